@@ -0,0 +1,197 @@
+/***************************************************************************
+ *   This file is part of the Inanna library.                              *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#ifndef __INANNA_ADAPTIVE_H__
+#define __INANNA_ADAPTIVE_H__
+
+#include "inanna/backprop.h"
+
+///////////////////////////////////////////////////////////////////////////////
+//|   | o       o ----                  |    -----           o               //
+//|\ /|     _     |   )  ___   |   ___  | _    |        ___      _    ___    //
+//| V | | |/ \  | |---   ___| -+- |   \ |/ |   |   |/\  ___| | |/ \  /   ) |/\//
+//| | | | |   | | |   ) (   |  |  |     |  |   |   |   (   | | |   | |---  | //
+//|   | | |   | | |___   \__|   \  \__/ |  |   |   |    \__| | |   |  \__  | //
+///////////////////////////////////////////////////////////////////////////////
+
+/** Baseclass for stochastic mini-batch training with per-weight
+ *  adaptive learning rates.
+ *
+ *  The patterns are gone through in a random order on each training
+ *  cycle, and the weights are updated after each mini-batch with the
+ *  mean gradient of the batch. The per-weight state of the inheritors
+ *  is kept in flat vectors indexed like @ref
+ *  BackpropTrainer::mWeightDeltas.
+ *
+ *  Parameters: "MiniBatchTrainer.eta" (learning rate, default 0.001),
+ *  "MiniBatchTrainer.batchSize" (patterns per update, default 32) and
+ *  "BackpropTrainer.decay" (weight decay multiplier, default 1.0).
+ *  The importance sampling parameters of @ref BackpropTrainer are
+ *  also supported; the mini-batches are then formed of the drawn
+ *  patterns.
+ *
+ *  Design Patterns: Template Method (@ref weightChange() gives the
+ *  update rule).
+ **/
+class MiniBatchTrainer : public BackpropTrainer {
+	decl_dynamic (MiniBatchTrainer);
+  public:
+	virtual Array<DynParameter>*	parameters	() const;
+	virtual void					init		(const StringMap& params);
+
+  protected:
+	virtual void					initTrain		(ANNetwork& network) const;
+	virtual double					trainOnce		(ANNetwork& network, const PatternSource& set) const;
+	virtual void					backpropagate	(ANNetwork& network, const PatternSource& set, int p) const;
+	virtual void					updateWeights	(ANNetwork& network) const;
+	virtual void					saveState		(CheckpointData& data) const;
+	virtual void					loadState		(CheckpointData& data);
+
+	/** Returns the change of a weight for its mean gradient over the
+	 *  mini-batch, updating the per-weight state of the method.
+	 *
+	 *  @param ji Index of the weight, as in mWeightDeltas.
+	 *  @param gradient Derivative of the error by the weight.
+	 **/
+	virtual double					weightChange	(int ji, double gradient) const {MUST_OVERLOAD; return 0.0;}
+
+  protected:
+	int		mBatchSize;		/**< Patterns in a mini-batch. */
+
+	/** Per-weight error gradient summed over the current mini-batch. */
+	mutable Vector			mGradient;
+
+	/** Patterns summed in mGradient. */
+	mutable int				mBatchPatterns;
+
+	/** Number of weight updates made so far. */
+	mutable int				mSteps;
+};
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//           _       |             -----           o                         //
+//          / \      |  ___          |        ___      _    ___              //
+//         /   \  ---|  ___| |/|/|   |   |/\  ___| | |/ \  /   ) |/\         //
+//         |---| (   | (   | | | |   |   |   (   | | |   | |---  |           //
+//         |   |  ---|  \__| | | |   |   |    \__| | |   |  \__  |           //
+///////////////////////////////////////////////////////////////////////////////
+
+/** Adam algorithm by Kingma and Ba, with bias-corrected estimates of
+ *  the first and second moments of the gradient.
+ *
+ *  Parameters (prefixed with "AdamTrainer."): beta1 (default 0.9),
+ *  beta2 (default 0.999) and epsilon (default 1E-8).
+ **/
+class AdamTrainer : public MiniBatchTrainer {
+	decl_dynamic (AdamTrainer);
+  public:
+	virtual Array<DynParameter>*	parameters	() const;
+	virtual void					init		(const StringMap& params);
+
+  protected:
+	virtual void					initTrain		(ANNetwork& network) const;
+	virtual void					updateWeights	(ANNetwork& network) const;
+	virtual double					weightChange	(int ji, double gradient) const;
+	virtual void					saveState		(CheckpointData& data) const;
+	virtual void					loadState		(CheckpointData& data);
+
+  protected:
+	double	mBeta1;		/**< Decay rate of the first moment. */
+	double	mBeta2;		/**< Decay rate of the second moment. */
+	double	mEpsilon;	/**< Small value to avoid division by zero. */
+
+	mutable Vector	mMoment1;		/**< Per-weight first moment estimate. */
+	mutable Vector	mMoment2;		/**< Per-weight second moment estimate. */
+	mutable double	mCorrection1;	/**< Bias correction of the first moment in this step. */
+	mutable double	mCorrection2;	/**< Bias correction of the second moment in this step. */
+};
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//   _       |        ___                | -----           o                 //
+//  / \      |  ___  /   \      ___      |   |        ___      _    ___      //
+// /   \  ---|  ___| |  __ |/\  ___|  ---|   |   |/\  ___| | |/ \  /   ) |/\ //
+// |---| (   | (   | |   | |   (   | (   |   |   |   (   | | |   | |---  |   //
+// |   |  ---|  \__| \___/ |    \__|  ---|   |   |    \__| | |   |  \__  |   //
+///////////////////////////////////////////////////////////////////////////////
+
+/** AdaGrad algorithm by Duchi et al. The learning rate of each weight
+ *  is divided by the root of the sum of its squared gradients.
+ *
+ *  Parameters: "AdaGradTrainer.epsilon" (default 1E-8).
+ **/
+class AdaGradTrainer : public MiniBatchTrainer {
+	decl_dynamic (AdaGradTrainer);
+  public:
+	virtual Array<DynParameter>*	parameters	() const;
+	virtual void					init		(const StringMap& params);
+
+  protected:
+	virtual void					initTrain		(ANNetwork& network) const;
+	virtual double					weightChange	(int ji, double gradient) const;
+	virtual void					saveState		(CheckpointData& data) const;
+	virtual void					loadState		(CheckpointData& data);
+
+  protected:
+	double			mEpsilon;	/**< Small value to avoid division by zero. */
+
+	/** Per-weight sum of squared gradients. */
+	mutable Vector	mSquares;
+};
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//  ----  |   |  ---- ----                -----           o                  //
+//  |   ) |\ /| (     |   )           --    |        ___      _    ___       //
+//  |---  | V |  ---  |---  |/\  __  |  )   |   |/\  ___| | |/ \  /   ) |/\  //
+//  | \   | | |     ) |     |   /  \ |--    |   |   (   | | |   | |---  |    //
+//  |  \  |   | ___/  |     |   \__/ |      |   |    \__| | |   |  \__  |    //
+///////////////////////////////////////////////////////////////////////////////
+
+/** RMSProp algorithm by Hinton. Like AdaGrad, but the squared
+ *  gradients are averaged with an exponential decay, so the learning
+ *  rates do not keep decreasing.
+ *
+ *  Parameters: "RMSPropTrainer.rho" (decay rate, default 0.9) and
+ *  "AdaGradTrainer.epsilon".
+ **/
+class RMSPropTrainer : public AdaGradTrainer {
+	decl_dynamic (RMSPropTrainer);
+  public:
+	virtual Array<DynParameter>*	parameters	() const;
+	virtual void					init		(const StringMap& params);
+
+  protected:
+	virtual double					weightChange	(int ji, double gradient) const;
+
+  protected:
+	double	mRho;	/**< Decay rate of the squared gradients. */
+};
+
+#endif
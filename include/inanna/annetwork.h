@@ -72,6 +72,18 @@ class NeuronContainer : public Array<Neuron> {
 	//void				makeNeurons		(int size) {make (size);}
 	void				add				    (Neuron* neuron);
 	void				removeUnit		(int i);
+
+	/** Creates many connections at once. The connection arrays of
+	 *  each unit are grown only once, which makes this much faster
+	 *  than repeated @ref ANNetwork::connect() calls for large
+	 *  networks.
+	 *
+	 *  @param count Number of connections.
+	 *  @param sources Source unit of each connection.
+	 *  @param targets Target unit of each connection.
+	 *  @param weights Weight of each connection.
+	 **/
+	void				connectBulk		(int count, const int* sources, const int* targets, const double* weights);
 	//void				writeXML		(OStream& out) const;
 	virtual void		empty			();
 
@@ -104,7 +116,7 @@ class ANNetwork : public NeuronContainer, virtual public Learner, public Attribu
 
 						ANNetwork		(const char* description=NULL);
 						ANNetwork		(int size);
-						ANNetwork		(const ANNetwork& orig) {copy (orig);}
+						ANNetwork		(const ANNetwork& orig);
 	virtual				~ANNetwork	();
 
 	void				makeUnits		(const char* topology);
@@ -120,6 +132,20 @@ class ANNetwork : public NeuronContainer, virtual public Learner, public Attribu
 	const Neuron*		getUnitPrototype	() const {return mUnitTemplate;}
 
 	virtual void		copyFreeNet		(const ANNetwork& orig, bool onlyWeights=false);
+
+	/** Returns the number of biases and connection weights. */
+	int					parameters		() const;
+
+	/** Copies the biases and connection weights to a flat vector,
+	 *  each unit's bias followed by the weights of its incoming
+	 *  connections. The vector is resized if necessary.
+	 **/
+	void				getWeights		(Vector& weights) const;
+
+	/** Sets the biases and connection weights from a vector in the
+	 *  order of @ref getWeights().
+	 **/
+	void				setWeights		(const Vector& weights);
 	virtual void		init			(double r=0.0);
 	void				reset			();
 	virtual void		update	 		();
@@ -28,6 +28,7 @@
 #include "annetwork.h"
 
 class ANNFileFormat; // Internal
+class MatrixEqualizer; // In equalization.h
 
 EXCEPTIONCLASS (invalid_filename);
 
@@ -106,4 +107,136 @@ class SNNS_ANNFormat : public ANNFileFormat {
 };
 
 
+
+//////////////////////////////////////////////////////////////////////////////////////
+//  ----  o                         _   |   | |   | -----                           //
+//  |   )     _    ___             / \  |\  | |\  | |                     ___   |   //
+//  |---  | |/ \   ___| |/\ \   | /   \ | \ | | \ | |---   __  |/\ |/|/|  ___| -+-  //
+//  |   ) | |   | (   | |    \  | |---| |  \| |  \| |     /  \ |   | | | (   |  |   //
+//  |___  | |   |  \__| |     \_/ |   | |   | |   | |     \__/ |   | | |  \__|   \  //
+//                          \_/                                                     //
+//////////////////////////////////////////////////////////////////////////////////////
+
+/** Versioned binary network file format.
+ *
+ *  The file has a fixed header with the dimensions of the network,
+ *  followed by the layering, the unit records and the connection
+ *  sources. The biases and the connection weights are stored in a
+ *  contiguous block of doubles that is aligned to @ref ALIGNMENT
+ *  bytes in the file, so that a memory mapped file can be used in
+ *  place by @ref MappedANNetwork.
+ *
+ *  The format can only be used with files, not with text streams.
+ *  The equalizer of the network can be stored if it is a
+ *  MatrixEqualizer with MinmaxEq planes.
+ **/
+class BinaryANNFormat : public ANNFileFormat {
+  public:
+	virtual void	load	(TextIStream& in, ANNetwork& net) const throw (stream_failure, invalid_format);
+	virtual void	save	(TextOStream& out, const ANNetwork& net) const throw (stream_failure);
+
+	static void		loadFile	(const String& filename, ANNetwork& net);
+	static void		saveFile	(const String& filename, const ANNetwork& net);
+
+	/** Returns 'true' if the file is a binary network file. */
+	static bool		isBinary	(const String& filename);
+
+	enum {VERSION=1, ALIGNMENT=64};
+};
+
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+//  |   |                           |   _   |   | |   |                           |    //
+//  |\ /|  ___   --   --   ___      |  / \  |\  | |\  |  ___   |                  |    //
+//  | V |  ___| |  ) |  ) /   )  ---| /   \ | \ | | \ | /   ) -+- \    /  __  |/\ | /  //
+//  | | | (   | |--  |--  |---  (   | |---| |  \| |  \| |---   |   \\//  /  \ |   |/   //
+//  |   |  \__| |    |     \__   ---| |   | |   | |   |  \__    \   VV   \__/ |   | \  //
+/////////////////////////////////////////////////////////////////////////////////////////
+
+/** Read-only view of a binary network file mapped to memory.
+ *
+ *  The weights are used directly from the mapped file, so opening a
+ *  network costs little more than validating the header, and the
+ *  pages are shared by all processes that map the same file. The
+ *  network must be a layered feedforward network; the first layer
+ *  is the input layer and the last one the output layer.
+ *
+ *  The object is immutable, so @ref evaluate() can be called from
+ *  several threads at the same time, as long as each thread gives its
+ *  own work buffer.
+ **/
+class MappedANNetwork {
+  public:
+	/** Maps the given binary network file.
+	 *
+	 *  @throws open_failure, invalid_format
+	 **/
+							MappedANNetwork	(const String& filename);
+
+	/** Maps the given binary network file. A string literal would
+	 *  otherwise convert to a network description as well.
+	 *
+	 *  @throws open_failure, invalid_format
+	 **/
+							MappedANNetwork	(const char* filename);
+
+	/** Makes an image of the current weights of the network in
+	 *  memory, without the equalizer. The image does not change when
+	 *  the network is trained further.
+	 *
+	 *  @throws invalid_format
+	 **/
+							MappedANNetwork	(const ANNetwork& net);
+							~MappedANNetwork	();
+
+	int						units			() const;
+	int						connections		() const;
+	int						inputs			() const;
+	int						outputs			() const;
+
+	/** Evaluates the network for one input vector.
+	 *
+	 *  @param input Values for the input units.
+	 *  @param output Buffer for the values of the output units.
+	 *  @param work Buffer of @ref units() values for the activations.
+	 **/
+	void					evaluate		(const double* input, double* output, double* work) const;
+
+	/** Evaluates the network for one input vector. Allocates the
+	 *  work buffer and the result vector.
+	 **/
+	Vector					evaluate		(const Vector& input) const;
+
+	/** Evaluates the network for a batch of input vectors. Each
+	 *  connection weight is loaded once for the whole batch, which is
+	 *  much faster than evaluating the vectors one at a time.
+	 *
+	 *  @param input The input vectors, one after another.
+	 *  @param output Buffer for the output vectors, one after another.
+	 *  @param count Number of vectors in the batch.
+	 *  @param work Buffer of count*@ref units() values for the activations.
+	 **/
+	void					evaluateBatch	(const double* input, double* output, int count, double* work) const;
+
+	/** Builds a normal network object from the mapped file. */
+	void					build			(ANNetwork& net) const;
+
+	/** Builds the stored equalizer, or returns NULL if the file has
+	 *  no equalizer. The caller takes the ownership.
+	 **/
+	MatrixEqualizer*		makeEqualizer	() const;
+
+  private:
+	const char*		mpData;		/**< The mapped file. */
+	long			mSize;		/**< Size of the mapped file. */
+	bool			mMapped;	/**< Is the data mapped, or allocated with new[]? */
+
+	void					map				(const String& filename);
+
+	MappedANNetwork (const MappedANNetwork& other) {FORBIDDEN}
+	void operator= (const MappedANNetwork& other) {FORBIDDEN}
+};
+
+
 #endif
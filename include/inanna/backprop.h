@@ -26,6 +26,7 @@
 #define __BACKPROPTRAINER_H__
 
 #include "trainer.h"
+#include "sampler.h"
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -37,12 +38,28 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 /** Error back propagation neural learning algorithm.
+ *
+ *  By default, the weights are updated once per cycle, with the
+ *  error signal of the last pattern of the cycle. With
+ *  "BackpropTrainer.onlineLearning", they are updated after each
+ *  pattern instead.
+ *
+ *  With "BackpropTrainer.importanceSampling", the patterns of each
+ *  cycle are drawn by their recent errors with an @ref
+ *  ImportanceSampler instead of going through them in order, and
+ *  their error signals are weighted by their importance weights.
+ *  As every drawn pattern is weighted separately, importance
+ *  sampling should be used with online learning.
+ *  "BackpropTrainer.samplingFloor" gives the share of uniform
+ *  sampling, from 0.0 to 1.0. It is 0.1 if not given.
  *
  *  Design Patterns: Template Method (various parts of the algorithm
  *  can be overloaded).
  **/
 class BackpropTrainer : public Trainer {
+	decl_dynamic (BackpropTrainer);
   public:
+									BackpropTrainer	();
 	virtual Array<DynParameter>*	parameters	() const;
 	virtual void					init		(const StringMap& params);
 	
@@ -52,12 +69,48 @@ class BackpropTrainer : public Trainer {
 	virtual double					trainPattern	(ANNetwork& network, const PatternSource& set, int p) const;
 	virtual void					backpropagate	(ANNetwork& network, const PatternSource& set, int p) const;
 	virtual void					updateWeights	(ANNetwork& network) const;
+	virtual void					saveState		(CheckpointData& data) const;
+	virtual void					loadState		(CheckpointData& data);
+
+	/** Reads the importance sampling parameters. */
+	void							initSampling	(const StringMap& params);
+
+	/** Puts the patterns of a training cycle to mOrder: drawn by
+	 *  importance if importance sampling is used, otherwise all the
+	 *  patterns in order or shuffled.
+	 **/
+	void							orderPatterns	(const PatternSource& set, bool shuffle) const;
+
+	/** Trains a pattern drawn by @ref orderPatterns(), weighting it
+	 *  by its importance if importance sampling is used.
+	 *
+	 *  @return Weighted MSE of the pattern.
+	 **/
+	double							trainDrawn		(ANNetwork& network, const PatternSource& set, int p) const;
 
   protected:
 	double	mEta;			/**< Learning speed. */
 	double	mMomentum;		/**< Momentum. */
 	double	mDecay;			/**< Weight decay multiplier. */
 	bool	mBatchLearning;	/**< Should batch learning be used? */
+	bool	mOnlineLearning;	/**< Update the weights after each pattern? */
+	bool	mImportanceSampling;	/**< Draw the patterns by their errors? */
+
+	/** Importance weight of the pattern being trained. Scales the
+	 *  error signals in @ref backpropagate().
+	 **/
+	mutable double	mPatternWeight;
+
+	/** Sampler of the patterns, if importance sampling is used. */
+	mutable ImportanceSampler	mSampler;
+
+	/** Order of the patterns in the current cycle. */
+	mutable PackArray<int>		mOrder;
+
+	/** Training set error of the current cycle, before the weights
+	 *  are updated. Available in @ref updateWeights().
+	 **/
+	mutable double	mCycleError;
 
 	/** Deltas for each weight in the network, in internal order.
 	 *
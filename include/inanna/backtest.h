@@ -0,0 +1,219 @@
+/***************************************************************************
+ *   This file is part of the Inanna library.                              *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __INANNA_BACKTEST_H__
+#define __INANNA_BACKTEST_H__
+
+#include <magic/mobject.h>
+#include <magic/mmap.h>
+#include <magic/mmatrix.h>
+
+// External predeclarations
+class PredictionStrategy;
+class PredictionTestResults;
+
+/** Results of one forecast origin in @ref WalkForwardBacktest.
+ **/
+struct BacktestStep {
+					BacktestStep	();
+					~BacktestStep	();
+
+	/** Index of the first predicted row in the data, i.e., the
+	 *  number of rows the strategy was trained with.
+	 **/
+	int				cutoff;
+
+	/** Month of the first predicted row. */
+	int				month;
+
+	/** Was the strategy trained from scratch at this step, instead
+	 *  of updated from the previous step?
+	 **/
+	bool			retrained;
+
+	/** Test results of the predicted months, or NULL if the step
+	 *  failed. Owned by the step.
+	 **/
+	PredictionTestResults*	results;
+
+	/** Wall-clock time used for training and testing. */
+	double			seconds;
+
+	/** Error message if the step failed, empty otherwise. */
+	String			error;
+};
+
+
+
+/////////////////////////////////////////////////////////////////////////////////////
+// ----              |                        ----                    |            //
+// |   )  ___   ___  |     |   ___   ____  |  |   )  ___   ____       |  |   ____  //
+// |---   ___| |   \ | /  -+- /   ) (     -+- |---  /   ) (     |   | | -+- (      //
+// |   ) (   | |     |/    |  |---   \__   |  | \   |---   \__  |   | |  |   \__   //
+// |___   \__|  \__/ | \    \  \__  ____)   \ |  \   \__  ____)  \__! |   \ ____)  //
+/////////////////////////////////////////////////////////////////////////////////////
+
+/** Aggregated results of a @ref WalkForwardBacktest run.
+ *
+ *  The aggregate statistics ignore any steps that failed.
+ **/
+class BacktestResults : public Object {
+  public:
+							BacktestResults		() {wallSeconds=0.0;}
+
+	/** Returns the number of forecast origins. */
+	int						size				() const {return steps.size();}
+
+	/** Returns the number of steps that failed with an error. */
+	int						failedSteps			() const;
+
+	/** Returns the number of steps that were trained from scratch. */
+	int						retrainedSteps		() const;
+
+	/** Returns the mean of the average absolute errors over the steps. */
+	double					meanError			() const;
+
+	/** Returns the mean of the RMSEs over the steps. */
+	double					meanRMSE			() const;
+
+	/** Returns the sum of the per-step times, i.e., the time the run
+	 *  would have taken sequentially.
+	 **/
+	double					stepSeconds			() const;
+
+	/** Results of the individual steps, in the order of the cutoffs. */
+	Array<BacktestStep>		steps;
+
+	/** Wall-clock time of the entire run. */
+	double					wallSeconds;
+};
+
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+// |   |       | |    -----                               | ----              |                        //
+// |   |  ___  | |    |                      ___          | |   )  ___   ___  |     |   ___   ____  |  //
+// | | |  ___| | | /  |---   __  |/\ \    /  ___| |/\  ---| |---   ___| |   \ | /  -+- /   ) (     -+- //
+// |\|/| (   | | |/   |     /  \ |    \\//  (   | |   (   | |   ) (   | |     |/    |  |---   \__   |  //
+// |   |  \__| | | \  |     \__/ |     VV    \__| |    ---| |___   \__|  \__/ | \    \  \__  ____)   \ //
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Rolling-origin evaluation of a @ref PredictionStrategy.
+ *
+ *  For each cutoff row, the strategy is trained with the rows before
+ *  the cutoff and tested with the following horizon months.
+ *
+ *  Training from scratch at every cutoff would be slow, so the
+ *  cutoffs are divided into chains of consecutive cutoffs. The
+ *  strategy is trained from scratch at the first cutoff of a chain,
+ *  and then only updated with the new rows at the following ones
+ *  with @ref PredictionStrategy::update(), which continues from the
+ *  previous weights for the neural strategies. The chains are
+ *  independent of each other and run concurrently in a @ref
+ *  ThreadPool, so the number of chains balances parallelism against
+ *  the amount of warm-starting.
+ *
+ *  The strategy is created dynamically by its class name and made
+ *  with the given parameters, so each chain has its own strategy.
+ *
+ *  Example:
+ *  @code
+ *  WalkForwardBacktest backtest ("SingleNeuralPrediction", params);
+ *  backtest.setCutoffs (48);
+ *  BacktestResults* results = backtest.run (data, 199501);
+ *  @endcode
+ **/
+class WalkForwardBacktest : public Object {
+  public:
+	/** Standard constructor.
+	 *
+	 *  @param strategyClass Class name of the @ref PredictionStrategy.
+	 *  @param params Parameters for @ref PredictionStrategy::make().
+	 **/
+							WalkForwardBacktest	(const String& strategyClass,
+												 const StringMap& params);
+
+	/** Sets the cutoff rows to test. The default is every row from 24
+	 *  to the last one that has a full horizon after it.
+	 *
+	 *  @param first First cutoff row.
+	 *  @param last Last cutoff row, or -1 for the last one that has a
+	 *  full horizon after it.
+	 *  @param step Number of rows between the cutoffs.
+	 **/
+	void					setCutoffs			(int first, int last=-1, int step=1) {
+								mFirstCutoff=first; mLastCutoff=last; mStep=step;
+							}
+
+	/** Sets the number of predicted months after each cutoff. The
+	 *  default is 12.
+	 **/
+	void					setHorizon			(int months) {mHorizon=months;}
+
+	/** Sets the number of worker threads, or 0 to use one thread per
+	 *  processor (the default).
+	 **/
+	void					setThreads			(int threads) {mThreads=threads;}
+
+	/** Sets the number of chains, or 0 to use one chain per thread
+	 *  (the default). One chain updates the strategy at every cutoff
+	 *  after the first one.
+	 **/
+	void					setChains			(int chains) {mChains=chains;}
+
+	/** Sets the number of steps in a chain after which the strategy
+	 *  is trained again from scratch, or 0 to never retrain (the
+	 *  default).
+	 **/
+	void					setRetrainInterval	(int steps) {mRetrainInterval=steps;}
+
+	/** Runs the backtest.
+	 *
+	 *  @param data Monthly data, one row per month, without the month
+	 *  column.
+	 *  @param startmonth Month of the first row, see @ref
+	 *  PredictionStrategy::train().
+	 *  @return Results of the run. The caller takes the ownership.
+	 **/
+	BacktestResults*		run					(const Matrix& data, int startmonth) const;
+
+  protected:
+	PredictionStrategy*		createStrategy		(bool singleThreaded) const;
+
+  protected:
+	String		mStrategyClass;		/**< Class name of the strategy. */
+	StringMap	mParams;			/**< Strategy parameters. */
+	int			mFirstCutoff;		/**< First cutoff row. */
+	int			mLastCutoff;		/**< Last cutoff row, or -1. */
+	int			mStep;				/**< Rows between the cutoffs. */
+	int			mHorizon;			/**< Predicted months. */
+	int			mThreads;			/**< Number of worker threads. */
+	int			mChains;			/**< Number of chains. */
+	int			mRetrainInterval;	/**< Steps between full retrainings. */
+
+  private:
+	void operator= (const WalkForwardBacktest& other) {FORBIDDEN}
+};
+
+#endif
@@ -0,0 +1,235 @@
+/***************************************************************************
+ *   This file is part of the Inanna library.                              *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __INANNA_CROSSVALIDATION_H__
+#define __INANNA_CROSSVALIDATION_H__
+
+#include <magic/mobject.h>
+#include <magic/mmap.h>
+#include "inanna/annetwork.h"
+#include "inanna/netstructure.h"
+
+// External predeclarations
+class PatternSource;
+class PatternSet;
+class Trainer;
+
+/** Results of training and testing one fold in @ref CrossValidator.
+ **/
+struct CrossValidationFold {
+					CrossValidationFold		();
+					~CrossValidationFold	();
+
+	/** Index of the fold. */
+	int				fold;
+
+	/** Number of patterns the network was trained with. */
+	int				trainPatterns;
+
+	/** Number of held-out patterns the network was tested with. */
+	int				testPatterns;
+
+	/** Training set MSE at the end of the training. */
+	double			trainMSE;
+
+	/** MSE on the held-out patterns. */
+	double			testMSE;
+
+	/** Classification results on the held-out patterns, or NULL if
+	 *  classification testing was not enabled. Owned by the fold.
+	 **/
+	ClassifResults*	classification;
+
+	/** Training error history, see @ref Trainer::trainingRecord(). */
+	Vector			trainingProfile;
+
+	/** Validation error history, see @ref Trainer::validationRecord(). */
+	Vector			validationProfile;
+
+	/** See @ref Trainer::cyclesTrained(). */
+	int				cyclesTrained;
+
+	/** See @ref Trainer::totalCycles(). */
+	int				totalCycles;
+
+	/** Wall-clock time used for training and testing the fold. */
+	double			seconds;
+
+	/** Trained weights of the fold network. The folds share the
+	 *  structure of the prototype, so the weights take memory only
+	 *  in proportion to the number of parameters.
+	 **/
+	NetworkWeights	weights;
+
+	/** Error message if the fold failed, empty otherwise. */
+	String			error;
+};
+
+
+
+//////////////////////////////////////////////////////////////////////////////////////////
+// ___                       |   |       | o     |           o            ----                    |//
+///   \           ____  ____ |   |  ___  |       |  ___               _   |   )  ___   ____       |      ____//
+//|     |/\  __  (     (     |   |  ___| | |  ---|  ___| -+- |  __  |/ \  |---  /   ) (     |   | | -+- (//
+//|     |   /  \  \__   \__   \ /  (   | | | (   | (   |  |  | /  \ |   | | \   |---   \__  |   | |  |   \__//
+//\___/ |   \__/ ____) ____)   V    \__| | |  ---|  \__|   \ | \__/ |   | |  \   \__  ____)  \__! |   \ ____)//
+//////////////////////////////////////////////////////////////////////////////////////////
+
+/** Aggregated results of a @ref CrossValidator run.
+ *
+ *  The aggregate statistics ignore any folds that failed.
+ **/
+class CrossValidationResults : public Object {
+  public:
+							CrossValidationResults	() {wallSeconds=0.0;}
+
+	/** Returns the number of folds. */
+	int						size				() const {return folds.size();}
+
+	/** Returns the number of folds that failed with an error. */
+	int						failedFolds			() const;
+
+	/** Returns the mean of the held-out MSEs over the folds. */
+	double					meanMSE				() const;
+
+	/** Returns the standard deviation of the held-out MSEs over the folds. */
+	double					stddevMSE			() const;
+
+	/** Returns the mean of the final training MSEs over the folds. */
+	double					meanTrainMSE		() const;
+
+	/** Returns the total number of classification failures over the
+	 *  folds, or -1 if classification testing was not enabled.
+	 **/
+	int						classifFailures		() const;
+
+	/** Returns the sum of the per-fold times, i.e., the time the run
+	 *  would have taken sequentially.
+	 **/
+	double					foldSeconds			() const;
+
+	/** Returns the cycle-wise average of the training profiles of the
+	 *  folds. A fold contributes to a cycle only if it was trained for
+	 *  that many cycles.
+	 **/
+	Vector					meanTrainingProfile	() const;
+
+	/** Results of the individual folds. */
+	Array<CrossValidationFold>	folds;
+
+	/** Wall-clock time of the entire run. */
+	double					wallSeconds;
+};
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//     ___                       |   |       | o     |                       //
+//    /   \           ____  ____ |   |  ___  |       |  ___                  //
+//    |     |/\  __  (     (     |   |  ___| | |  ---|  ___| -+-  __  |/\    //
+//    |     |   /  \  \__   \__   \ /  (   | | | (   | (   |  |  /  \ |      //
+//    \___/ |   \__/ ____) ____)   V    \__| | |  ---|  \__|   \ \__/ |      //
+///////////////////////////////////////////////////////////////////////////////
+
+/** Parallel k-fold cross-validation driver.
+ *
+ *  Splits a pattern source into k folds of consecutive patterns and
+ *  trains a copy of the prototype network for each fold with all the
+ *  other folds. The folds are trained and tested concurrently in a
+ *  @ref ThreadPool.
+ *
+ *  The trainer is created dynamically by its class name, and
+ *  initialized with the parameters given to the validator, so each
+ *  fold has its own trainer. The parameter map is the same as given
+ *  to @ref Trainer::init(); in addition, the keys "maxCycles",
+ *  "validationInterval" and "terminator" are used for controlling the
+ *  training, as in the prediction strategies.
+ *
+ *  Example:
+ *  @code
+ *  CrossValidator cv (prototype, "RPropTrainer", params);
+ *  cv.setFolds (10);
+ *  CrossValidationResults* results = cv.validate (set);
+ *  @endcode
+ **/
+class CrossValidator : public Object {
+  public:
+	/** Standard constructor.
+	 *
+	 *  @param prototype Network that is copied for each fold. The
+	 *  weights of the copies are initialized by the trainer.
+	 *  @param trainerClass Class name of the @ref Trainer to use.
+	 *  @param params Training parameters.
+	 **/
+							CrossValidator		(const ANNetwork& prototype,
+												 const String& trainerClass,
+												 const StringMap& params);
+							~CrossValidator		();
+
+	/** Sets the number of folds (k). The default is 10. */
+	void					setFolds			(int folds) {mFolds=folds;}
+
+	/** Sets the number of worker threads, or 0 to use one thread per
+	 *  processor (the default).
+	 **/
+	void					setThreads			(int threads) {mThreads=threads;}
+
+	/** Sets the ratio of the training patterns in each fold that is
+	 *  held out as an early-stopping validation set. The default is 0,
+	 *  i.e., no early stopping.
+	 **/
+	void					setValidationRatio	(double ratio) {mValidationRatio=ratio;}
+
+	/** Enables classification testing of the held-out patterns with
+	 *  @ref Learner::testClassify().
+	 **/
+	void					setClassification	(bool enable=true) {mClassify=enable;}
+
+	/** Trains and tests all the folds with the given patterns.
+	 *
+	 *  @return Results of the run. The caller takes the ownership.
+	 **/
+	CrossValidationResults*	validate			(const PatternSource& set) const;
+
+  protected:
+	Trainer*				createTrainer		() const;
+	void					makeFold			(const PatternSource& set, int fold,
+												 PatternSet& train, PatternSet& valid,
+												 PatternSet& test) const;
+
+  protected:
+	NetworkWeights	mPrototype;		/**< Structure of the prototype network. */
+	Equalizer*		mpEqualizer;	/**< Copy of the equalizer of the prototype, or NULL. */
+	String		mTrainerClass;		/**< Class name of the trainer. */
+	StringMap	mParams;			/**< Training parameters. */
+	int			mFolds;				/**< Number of folds (k). */
+	int			mThreads;			/**< Number of worker threads. */
+	double		mValidationRatio;	/**< Early-stopping validation ratio. */
+	bool		mClassify;			/**< Test classification? */
+
+  private:
+	void operator= (const CrossValidator& other) {FORBIDDEN}
+};
+
+#endif
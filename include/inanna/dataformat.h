@@ -45,12 +45,37 @@ class DataFormatLib {
 	 **/
 	static void		save	(const String& filename, const PatternSet& set);
 
+	/** Enables or disables the binary cache files for loading
+	 *  pattern sets from text files.
+	 *
+	 *  When enabled, a successful load of a file writes a binary
+	 *  sidecar file with the ".cache" suffix next to the source
+	 *  file. Later loads of the same file read the sidecar instead of
+	 *  parsing the text, if the source file has the same path, size
+	 *  and modification time (to the nanosecond, where the file system
+	 *  records it), and the requested numbers of inputs and
+	 *  outputs are the same.
+	 *
+	 *  Caching is disabled by default.
+	 **/
+	static void		setCaching	(bool enable=true) {sCaching=enable;}
+
+	/** Returns whether the binary cache files are used. */
+	static bool		caching		() {return sCaching;}
+
   protected:
 	/** Factory creates a data format handler according to
 	 *  filename. To make the factory more extensible, there would
 	 *  need to be some sort of dynamic registry of Factory Methods.
 	 **/
 	static DataFormat*	create		(const String& filename);
+
+	static bool			loadCache	(const String& filename, PatternSet& set);
+	static void			saveCache	(const String& filename, const PatternSet& set,
+									 int requestedInputs, int requestedOutputs);
+
+	/** Are the binary cache files used? */
+	static bool			sCaching;
 };
 
 //////////////////////////////////////////////////////////////////////////////
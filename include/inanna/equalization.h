@@ -30,12 +30,93 @@
 #include <magic/mmatrix.h>
 #include <magic/mpararr.h>
 #include <magic/mtextstream.h>
+#include "inanna/patternset.h"
+#include "inanna/matrixview.h"
 
 // XML format ios flag
 extern int xmlflag;
 
 
 
+//////////////////////////////////////////////////////////////////////////////
+//   ___                        o |        ---- |                    |      //
+//  |   |        ___    _    |    |  ___  (     |     ___   |   ___  | _    //
+//  |   | |   |  ___| |/ \  -+- | | /   )  ---  | /  /   ) -+- |   \ |/ |   //
+//  |  \| |   | (   | |   |  |  | | |---      ) |/   |---   |  |     |  |   //
+//  `___\  \__!  \__| |   |   \ | |  \__  ___/  | \   \__    \  \__/ |  |   //
+//////////////////////////////////////////////////////////////////////////////
+
+/** Mergeable streaming sketch of a value distribution.
+ *
+ *  The sketch is a merging t-digest: the values are summarized as a
+ *  sorted list of weighted centroids, which are dense at the tails of
+ *  the distribution and sparse in the middle. The memory use is
+ *  bounded by the compression parameter, regardless of the number of
+ *  values added. The rank error of the @ref cdf() and @ref quantile()
+ *  estimates is roughly inversely proportional to the compression.
+ *
+ *  Sketches built from different parts of the data, for example in
+ *  parallel workers, can be combined with @ref merge().
+ **/
+class QuantileSketch : public Object {
+  public:
+	/** Constructor.
+	 *
+	 *  @param compression Accuracy parameter. The sketch keeps at
+	 *  most about this many centroids.
+	 **/
+							QuantileSketch	(int compression=200);
+
+	/** Adds a value to the sketch. */
+	void					add				(double x, double weight=1.0);
+
+	/** Adds all defined values in the vector to the sketch. */
+	void					add				(const Vector& vec);
+
+	/** Adds the contents of another sketch to this one. */
+	void					merge			(const QuantileSketch& other);
+
+	/** Removes all values from the sketch. */
+	void					clear			();
+
+	/** Returns the total weight of the added values. */
+	double					count			() const {return mTotal;}
+
+	/** Returns the estimated fraction of values below x. */
+	double					cdf				(double x) const;
+
+	/** Returns the estimated value below which the given fraction of
+	 *  values are.
+	 **/
+	double					quantile		(double p) const;
+
+	/** Builds a piecewise-linear approximation of the cumulative
+	 *  distribution function as a table of knots. The values in both
+	 *  vectors are non-decreasing; the first knot is (min, 0) and the
+	 *  last one (max, 1).
+	 **/
+	void					makeKnots		(Vector& xs, Vector& ps) const;
+
+	/** Returns the number of centroids in the sketch. */
+	int						centroids		() const {flush (); return mCentroids;}
+
+  private:
+	void					flush			() const;
+
+	int				mCompression;	/**< Accuracy parameter. */
+	mutable Vector	mMeans;			/**< Centroid means, in increasing order. */
+	mutable Vector	mWeights;		/**< Centroid weights. */
+	mutable int		mCentroids;		/**< Number of centroids. */
+	mutable Vector	mBuffer;		/**< Values not yet merged to the centroids. */
+	mutable Vector	mBufWeights;	/**< Weights of the buffered values. */
+	mutable int		mBuffered;		/**< Number of values in the buffer. */
+	double			mTotal;			/**< Total weight. */
+	double			mMin;			/**< Smallest value added. */
+	double			mMax;			/**< Largest value added. */
+};
+
+
+
 //////////////////////////////////////////////////////////////////////////////
 //                 -----                  | o                               //
 //                 |                 ___  |   ___  ___                      //
@@ -64,6 +145,22 @@ class Equalizer : public Object {
 	virtual Equalizer*	clone			() const;  // MUST OVERLOAD
 	virtual void		handleMissing	(bool enable=true);
 
+	/** Completes any analysis that has been deferred to the first
+	 *  equalization, after which the const methods can be called
+	 *  from several threads at the same time.
+	 **/
+	virtual void		prepare			() {}
+
+	/** Strided versions of the above methods, for operating in place
+	 *  on n values that are stride elements apart, such as a column
+	 *  of a matrix. The default implementations copy the values
+	 *  through a temporary vector; simple equalizers overload them
+	 *  to avoid the copying.
+	 **/
+	virtual void		analyzeStrided		(const double* data, int n, int stride, bool additive=false);
+	virtual void		equalizeStrided		(double* data, int n, int stride) const;
+	virtual void		unequalizeStrided	(double* data, int n, int stride) const;
+
 	// Implementations
 	virtual	TextOStream&	operator>>	(TextOStream&) const;
 
@@ -83,17 +180,41 @@ class Equalizer : public Object {
 ///////////////////////////////////////////////////////////////////////////////
 
 /** Histogram equalization method (strategy).
+ *
+ *  In the default mode, the analysis builds a cumulative histogram
+ *  with the given precision. Additive analysis stores all the data
+ *  until the equalizer is used for the first time.
+ *
+ *  In the streaming mode, enabled by giving a sketch compression, the
+ *  analysis feeds the data to a @ref QuantileSketch, and the
+ *  distribution is finally represented as a compact piecewise-linear
+ *  knot table. The memory use is then bounded by the compression
+ *  regardless of the amount of analyzed data, and equalizers that
+ *  have analyzed different parts of the data can be combined with
+ *  @ref merge().
  **/
 class HistogramEq : public Equalizer {
 	decl_dynamic (HistogramEq);
   public:
-							HistogramEq	(int precision=100000, double floor=0.0, double ceiling=1.0);
+							HistogramEq	(int precision=100000, double floor=0.0, double ceiling=1.0,
+										 int sketchCompression=0);
 							HistogramEq (const HistogramEq& orig);
+							~HistogramEq ();
 	virtual HistogramEq*	clone		() const {return new HistogramEq (*this);}
 	
 	virtual void			analyze		(const Vector& vec, bool additive=false);
 	virtual void			equalize	(Vector& vec) const;
 	virtual void			unequalize	(Vector& vec) const;
+
+	/** Adds the data analyzed by another streaming mode equalizer to
+	 *  this one.
+	 **/
+	void					merge		(const HistogramEq& other);
+
+	virtual void			prepare		();
+
+	/** Returns 'true' if the equalizer is in the streaming mode. */
+	bool					isStreaming	() const {return mpSketch!=NULL;}
 	
 	/** Implementation of serialization. */
 	virtual	TextOStream&	operator>>	(TextOStream&) const;
@@ -109,6 +230,9 @@ class HistogramEq : public Equalizer {
 	double			mMax;		// Desired upper bound in the equalized data
 	Array<Vector>	mData;		// Accumulated additive analysis data
 	Vector			mHistogram;	// Histogram formed by analysis
+	QuantileSketch*	mpSketch;	// Distribution sketch in the streaming mode
+	Vector			mKnotX;		// CDF knot values in the streaming mode
+	Vector			mKnotP;		// CDF knot probabilities in the streaming mode
 };
 
 
@@ -127,7 +251,7 @@ class HistogramEq : public Equalizer {
 class GaussianEq : public Equalizer {
 	decl_dynamic (GaussianEq);
   public:
-						GaussianEq	(double avg=0.0, double stddev=0.0) {mAverage=0; mStdDev=0;}
+						GaussianEq	(double avg=0.0, double stddev=0.0) {mAverage=0; mStdDev=0; mCount=0;}
 						GaussianEq	(const GaussianEq& orig);
 	virtual GaussianEq*	clone		() const {return new GaussianEq (*this);}
 	
@@ -135,9 +259,14 @@ class GaussianEq : public Equalizer {
 	virtual void		equalize	(Vector& vec) const;
 	virtual void		unequalize	(Vector& vec) const;
 
+	virtual void		analyzeStrided		(const double* data, int n, int stride, bool additive=false);
+	virtual void		equalizeStrided		(double* data, int n, int stride) const;
+	virtual void		unequalizeStrided	(double* data, int n, int stride) const;
+
   private:
 	double	mAverage;
 	double	mStdDev;
+	double	mCount;		// Number of analyzed values, for additive analysis
 };
 
 
@@ -163,6 +292,10 @@ class MinmaxEq : public Equalizer {
 	virtual void		analyze		(const Vector& vec, bool additive=false);
 	virtual void		equalize	(Vector& vec) const;
 	virtual void		unequalize	(Vector& vec) const;
+
+	virtual void		analyzeStrided		(const double* data, int n, int stride, bool additive=false);
+	virtual void		equalizeStrided		(double* data, int n, int stride) const;
+	virtual void		unequalizeStrided	(double* data, int n, int stride) const;
 	
 	/** Implementation of serialization. */
 	virtual	TextOStream&	operator>>	(TextOStream& out) const;
@@ -194,10 +327,12 @@ class MatrixEqualizer : public Equalizer {
   public:
 
 						MatrixEqualizer		(Equalizer* prototype=NULL);
+						MatrixEqualizer		(const MatrixEqualizer& orig);
 
-	void				analyze				(const Matrix& mat, bool additive=false);
+	void				analyze				(const MatrixView& mat, bool additive=false);
 	void				equalize			(Matrix& mat) const;
 	void				unequalize			(Matrix& mat) const;
+	void				unequalizeColumn	(Vector& values, int col) const;
 
 	/** Returns equalizer for given matrix column (component
      *  plane). The equalizer may have analyzed data or it may have
@@ -207,6 +342,11 @@ class MatrixEqualizer : public Equalizer {
 
 	/** Returns number of columns (equalization planes). */
 	int					planes				() const {return mPlaneEqualizers.size();}
+
+	/** Adds an equalization plane for the next column. Takes the
+	 *  ownership of the equalizer.
+	 **/
+	void				addPlane			(Equalizer* plane) {mPlaneEqualizers.add (plane);}
 	
 	/** Implementation of serialization. */
 	virtual	TextOStream&	operator>>	(TextOStream& out) const;
@@ -215,12 +355,105 @@ class MatrixEqualizer : public Equalizer {
 	virtual	TextIStream&	operator<<	(TextIStream& in);
 
 	virtual void		handleMissing	(bool enable=true);
+
+	/** Prepares all the column plane equalizers. */
+	virtual void		prepare				();
+
+	/** Sets the number of threads used for processing the columns of
+	 *  a matrix in parallel. The default is 1, which processes the
+	 *  columns in the calling thread; 0 uses all processors.
+	 **/
+	void				setThreads			(int threads) {mThreads = threads;}
+
+	/** Implementation for @ref Equalizer. */
+	virtual MatrixEqualizer*	clone	() const {return new MatrixEqualizer (*this);}
 	
   private:
-	void				bothEqualize		(Matrix& mat, bool uneq) const;
+	/** Column operations. */
+	enum columnOps {ANALYZE=0, EQUALIZE=1, UNEQUALIZE=2};
+
+	void				forColumns			(const MatrixView& mat, int op) const;
+	void				processColumns		(const MatrixView& mat, int op, int begin, int end) const;
 
 	Array<Equalizer>	mPlaneEqualizers;	/**< Equalizers for each column plane for analyzed matrices. */
 	bool				mIsGlobal;			/**< Do we use global analysis mode? */
+	int					mThreads;			/**< Number of threads for column processing. */
+	friend class EqualizerColumnTask;
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//  -----                  | o                | ----                                 ----                             //
+//  |                 ___  |    ___  ___      | |   )  ___   |   |   ___        _   (                     ___   ___   //
+//  |---   __  |   |  ___| | |    / /   )  ---| |---   ___| -+- -+- /   ) |/\ |/ \   ---   __  |   | |/\ |   \ /   )  //
+//  |     /  \ |   | (   | | |   /  |---  (   | |     (   |  |   |  |---  |   |   |     ) /  \ |   | |   |     |---   //
+//  |____ \__|  \__!  \__| | |  /__  \__   ---| |      \__|   \   \  \__  |   |   | ___/  \__/  \__! |    \__/  \__   //
+//           |                                                                                                        //
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Pattern source decorator that equalizes the patterns of another
+ *  source on the fly, so that there is no need to keep both raw and
+ *  equalized copies of the data in memory.
+ *
+ *  By default, the input i of a pattern is equalized with the plane
+ *  i of a @ref MatrixEqualizer and the output j with the plane
+ *  inputs+j, as in a matrix with the inputs followed by the outputs.
+ *  A globally analyzed MatrixEqualizer, or any other equalizer, is
+ *  used for all the values. The mapping can be changed with @ref
+ *  mapInput() and @ref mapOutput().
+ *
+ *  The equalized patterns are optionally cached in blocks of
+ *  consecutive patterns, and each block is equalized one column at
+ *  a time. The cache is not thread-safe, so each thread must use its
+ *  own decorator object.
+ *
+ *  Design Patterns: Decorator.
+ **/
+class EqualizedPatternSource : public PatternSource {
+  public:
+	/** Constructor.
+	 *
+	 *  @param source The raw pattern source, which must exist as long
+	 *  as the decorator is used.
+	 *  @param eq The equalizer, which must exist as long as the
+	 *  decorator is used.
+	 *  @param blockSize Number of patterns in a cached block, or 0 to
+	 *  disable caching.
+	 *  @param cacheBlocks Number of blocks in the cache.
+	 **/
+					EqualizedPatternSource	(const PatternSource& source, const Equalizer& eq,
+											 int blockSize=64, int cacheBlocks=16);
+
+	/** Sets the equalization plane of an input variable. A negative
+	 *  plane leaves the variable unequalized.
+	 **/
+	void			mapInput		(int i, int plane);
+
+	/** Sets the equalization plane of an output variable. A negative
+	 *  plane leaves the variable unequalized.
+	 **/
+	void			mapOutput		(int j, int plane);
+
+	/** Returns the decorated raw pattern source. */
+	const PatternSource&	source	() const {return mSource;}
+
+	// Virtual method implementations
+	virtual void	print			(FILE* out = stdout) const;
+	virtual double	input			(int p, int i) const {return value (p, i);}
+	virtual double	output			(int p, int j) const {return value (p, inputs+j);}
+
+  private:
+	double			value			(int p, int col) const;
+	const Equalizer* planeEqualizer	(int plane) const;
+	void			loadBlock		(int block, int slot) const;
+
+	const PatternSource&		mSource;		/**< Raw pattern source. */
+	const Equalizer&			mEqualizer;		/**< Equalizer or matrix equalizer. */
+	PackArray<const Equalizer*>	mColumnEq;		/**< Equalizer of each input and output column, or NULL. */
+	int							mBlockSize;		/**< Patterns in a cache block. */
+	mutable PackArray<int>		mCachedBlock;	/**< Block in each cache slot, or -1. */
+	mutable Vector				mCache;			/**< Equalized patterns in the cache slots. */
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,127 @@
+/***************************************************************************
+ *   This file is part of the Inanna library.                              *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#ifndef __INANNA_LEVMAR_H__
+#define __INANNA_LEVMAR_H__
+
+#include <magic/mmatrix.h>
+#include "inanna/trainer.h"
+
+///////////////////////////////////////////////////////////////////////////////
+//               |     |   | -----           o                               //
+//               |     |\ /|   |        ___      _    ___                    //
+//               |     | V |   |   |/\  ___| | |/ \  /   ) |/\               //
+//               |     | | |   |   |   (   | | |   | |---  |                 //
+//               |____ |   |   |   |    \__| | |   |  \__  |                 //
+///////////////////////////////////////////////////////////////////////////////
+
+/** Levenberg-Marquardt training algorithm.
+ *
+ *  Each training cycle computes the Jacobian of the network outputs
+ *  with respect to all the weights and biases for each pattern, and
+ *  solves the damped normal equations (J'J + lambda*I)*dw = J'e with
+ *  a Cholesky factorization. If the step does not decrease the error,
+ *  it is rejected and lambda is increased until it does.
+ *
+ *  The method needs memory and time in proportion to the square of
+ *  the number of weights, so it is meant for small networks, up to
+ *  a few hundred weights. For those, it typically reaches the error
+ *  level of @ref RPropTrainer in a small fraction of the cycles.
+ *
+ *  Parameters (prefixed with "LevenbergMarquardtTrainer."):
+ *  lambda0 (initial damping, 0.001), lambdaFactor (multiplier for
+ *  adapting the damping, 10) and lambdaMax (damping at which the
+ *  training is considered converged, 1E10).
+ **/
+class LevenbergMarquardtTrainer : public Trainer {
+	decl_dynamic (LevenbergMarquardtTrainer);
+  public:
+	virtual Array<DynParameter>*	parameters	() const;
+	virtual void					init		(const StringMap& params);
+
+	/** Returns the current damping factor. */
+	double							lambda		() const {return mLambda;}
+
+  protected:
+	virtual void					initTrain		(ANNetwork& network) const;
+	virtual double					trainOnce		(ANNetwork& network, const PatternSource& set) const;
+	virtual void					saveState		(CheckpointData& data) const;
+	virtual void					loadState		(CheckpointData& data);
+
+	/** Feeds each pattern to the network and accumulates the
+	 *  approximate Hessian J'J and the gradient J'e.
+	 *
+	 *  @return Sum of squared errors with the current weights.
+	 **/
+	double							accumulate		(ANNetwork& network, const PatternSource& set) const;
+
+	/** Computes the derivatives of one output of the network with
+	 *  respect to the net input of each neuron, for the pattern that
+	 *  has been fed to the network.
+	 **/
+	void							sensitivities	(const ANNetwork& network, int output) const;
+
+	/** Returns the sum of squared errors of the network on the set. */
+	double							sumSquaredError	(ANNetwork& network, const PatternSource& set) const;
+
+	/** Solves the damped normal equations to mStep.
+	 *
+	 *  @return false if the damped matrix is not positive definite.
+	 **/
+	bool							solveStep		() const;
+
+  protected:
+	double	mLambda0;		/**< Initial damping. */
+	double	mLambdaFactor;	/**< Multiplier for increasing and decreasing the damping. */
+	double	mLambdaMax;		/**< Damping where the training has converged. */
+
+	/** Current damping. */
+	mutable double	mLambda;
+
+	/** Approximate Hessian J'J, in the weight order of
+	 *  ANNetwork::getWeights().
+	 **/
+	mutable Matrix	mHessian;
+
+	/** Cholesky factor of the damped Hessian. */
+	mutable Matrix	mFactor;
+
+	/** Gradient J'e. */
+	mutable Vector	mGradient;
+
+	/** Jacobian row of the current pattern and output. */
+	mutable Vector	mJacobian;
+
+	/** Derivatives of the current output by the net input of each neuron. */
+	mutable Vector	mSensitivity;
+
+	/** Weights before the step. */
+	mutable Vector	mWeights;
+
+	/** Weight change of the step. */
+	mutable Vector	mStep;
+};
+
+#endif
@@ -0,0 +1,147 @@
+/***************************************************************************
+ *   This file is part of the Inanna library.                              *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __INANNA_MATRIXVIEW_H__
+#define __INANNA_MATRIXVIEW_H__
+
+#include <magic/mmatrix.h>
+
+///////////////////////////////////////////////////////////////////////////////
+//              |   |               o     |   | o                            //
+//              |\ /|  ___   |            |   |    ___                       //
+//              | V |  ___| -+- |/\ | \ / |   | | /   ) \    /               //
+//              | | | (   |  |  |   |  X   \ /  | |---   \\//                //
+//              |   |  \__|   \ |   | / \   V   |  \__    VV                 //
+///////////////////////////////////////////////////////////////////////////////
+
+/** Non-owning view to a rectangular part of a @ref Matrix, optionally
+ *  taking only every n:th row.
+ *
+ *  Unlike Matrix::sub(), creating a view does not copy any values,
+ *  so views are cheap to create and pass by value. The viewed matrix
+ *  must exist as long as the view is used.
+ *
+ *  A view is implicitly created from a matrix, so functions that take
+ *  a view accept a whole matrix as well.
+ **/
+class MatrixView {
+  public:
+	/** Views the entire matrix. */
+					MatrixView		(const Matrix& matrix)
+							: mpMatrix (&matrix), mRow0 (0), mCol0 (0), mRowStep (1),
+							  rows (matrix.rows), cols (matrix.cols) {}
+
+	/** Views the given rows and columns of the matrix. The last row
+	 *  and column are included, and can be Matrix::end.
+	 *
+	 *  @param rowStep Distance of the viewed rows in the matrix, for
+	 *  example 12 for the same month of each year in monthly data.
+	 **/
+					MatrixView		(const Matrix& matrix, int row0, int row1,
+									 int col0, int col1, int rowStep=1)
+							: mpMatrix (&matrix), mRow0 (row0), mCol0 (col0), mRowStep (rowStep) {
+						if (row1 == Matrix::end)
+							row1 = matrix.rows-1;
+						if (col1 == Matrix::end)
+							col1 = matrix.cols-1;
+						rows = (row1-row0)/rowStep+1;
+						cols = col1-col0+1;
+					}
+
+	/** Returns a value in the view. */
+	double			get				(int row, int col) const {return mpMatrix->get (mRow0+row*mRowStep, mCol0+col);}
+
+	/** Returns the address of the first viewed value, for processing
+	 *  the columns in place, or NULL if the view is empty.
+	 **/
+	const double*	data			() const {return (rows>0 && cols>0)? &mpMatrix->get (mRow0, mCol0) : (const double*) NULL;}
+
+	/** Returns the distance between consecutive viewed rows in
+	 *  memory. The values of a row are contiguous.
+	 **/
+	int				stride			() const {
+		return (mpMatrix->rows > 1)? int (&mpMatrix->get (1,0) - &mpMatrix->get (0,0))*mRowStep : mRowStep;
+	}
+
+	/** Returns a view to a part of the view, as with the constructor. */
+	MatrixView		sub				(int row0, int row1, int col0, int col1, int rowStep=1) const {
+		if (row1 == Matrix::end)
+			row1 = rows-1;
+		if (col1 == Matrix::end)
+			col1 = cols-1;
+		return MatrixView (*mpMatrix, mRow0+row0*mRowStep, mRow0+row1*mRowStep,
+						   mCol0+col0, mCol0+col1, mRowStep*rowStep);
+	}
+
+  private:
+	const Matrix*	mpMatrix;		/**< The viewed matrix. */
+	int				mRow0;			/**< First viewed row in the matrix. */
+	int				mCol0;			/**< First viewed column in the matrix. */
+	int				mRowStep;		/**< Distance of the viewed rows. */
+
+  public:
+	/** Number of rows in the view. */
+	int				rows;
+
+	/** Number of columns in the view. */
+	int				cols;
+};
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//      ----               ___        |           |   | o                    //
+//      |   )             |  \   ___  |  |   ___  |   |    ___               //
+//      |---   __  \    / |   | /   ) | -+-  ___| |   | | /   ) \    /       //
+//      | \   /  \  \\//  |   | |---  |  |  (   |  \ /  | |---   \\//        //
+//      |  \  \__/   VV   |__/   \__  |   \  \__|   V   |  \__    VV         //
+///////////////////////////////////////////////////////////////////////////////
+
+/** Row deltas (differences between consecutive rows) of a matrix,
+ *  computed lazily when they are read, i.e., get(r,c) is
+ *  M[r+1,c]-M[r,c].
+ *
+ *  The view has one row less than the matrix. The viewed matrix must
+ *  exist as long as the view is used.
+ **/
+class RowDeltaView {
+  public:
+					RowDeltaView	(const MatrixView& matrix)
+							: mMatrix (matrix), rows (matrix.rows-1), cols (matrix.cols) {}
+
+	/** Returns the change of the column between the rows. */
+	double			get				(int row, int col) const {return mMatrix.get (row+1, col) - mMatrix.get (row, col);}
+
+  private:
+	MatrixView		mMatrix;		/**< The viewed matrix. */
+
+  public:
+	/** Number of rows in the view. */
+	int				rows;
+
+	/** Number of columns in the view. */
+	int				cols;
+};
+
+#endif
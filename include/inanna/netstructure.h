@@ -0,0 +1,173 @@
+/***************************************************************************
+ *   This file is part of the Inanna library.                              *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __INANNA_NETSTRUCTURE_H__
+#define __INANNA_NETSTRUCTURE_H__
+
+#include "inanna/annetwork.h"
+
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// |   |                           |     ----                                          //
+// |\  |  ___   |                  |    (      |             ___   |             ___   //
+// | \ | /   ) -+- \    /  __  |/\ | /   ---  -+- |/\ |   | |   \ -+- |   | |/\ /   )  //
+// |  \| |---   |   \\//  /  \ |   |/       )  |  |   |   | |      |  |   | |   |---   //
+// |   |  \__    \   VV   \__/ |   | \  ___/    \ |    \__!  \__/   \  \__! |    \__   //
+/////////////////////////////////////////////////////////////////////////////////////////
+
+/** Immutable description of the structure of a network: its units,
+ *  their connection graph and layering, but no weights.
+ *
+ *  Networks that differ only in their weights, such as the members
+ *  of an ensemble or the candidates of a parameter search, can share
+ *  one structure object through @ref NetworkWeights. The structure is
+ *  reference counted and never changes after it has been created,
+ *  so it can be shared between threads.
+ **/
+class NetworkStructure {
+  public:
+	/** Number of units. */
+	int						units				() const {return mUnits.size();}
+
+	/** Number of connections. */
+	int						connections			() const {return mSources.size();}
+
+	/** Number of biases and weights of a network with this structure. */
+	int						parameters			() const {return units() + connections();}
+
+	/** Returns whether the network has exactly this structure, so that
+	 *  weights can be copied between them.
+	 **/
+	bool					matches				(const ANNetwork& net) const;
+
+	/** Rebuilds the network to have this structure. The biases and
+	 *  weights are set to zero and the equalizer is not changed.
+	 **/
+	void					build				(ANNetwork& net) const;
+
+  private:
+	/** Attributes of a unit. */
+	struct Unit {
+		double	x, y, z;
+		int		type;
+		int		transferFunc;
+		bool	enabled;
+	};
+
+	/** Extracts the structure of the network. Created only by @ref
+	 *  NetworkWeights.
+	 **/
+							NetworkStructure	(const ANNetwork& net);
+							~NetworkStructure	() {}
+
+	/** Adds a reference. */
+	void					attach				() const {__sync_add_and_fetch (&mRefs, 1);}
+
+	/** Removes a reference and deletes the object with the last one. */
+	void					detach				() const {if (__sync_sub_and_fetch (&mRefs, 1) == 0) delete this;}
+
+	PackArray<int>		mLayers;		/**< Sizes of the layers, if layered. */
+	PackArray<Unit>		mUnits;			/**< Attributes of the units. */
+	PackArray<int>		mFirstIncoming;	/**< Index of the first incoming connection of each unit, plus end. */
+	PackArray<int>		mSources;		/**< Source unit of each connection. */
+	mutable int			mRefs;			/**< Reference count. */
+
+	NetworkStructure (const NetworkStructure& other) {FORBIDDEN}
+	void operator= (const NetworkStructure& other) {FORBIDDEN}
+
+	friend class NetworkWeights;
+};
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//  |   |                           |    |   |       o       |               //
+//  |\  |  ___   |                  |    |   |  ___          | _   |   ____  //
+//  | \ | /   ) -+- \    /  __  |/\ | /  | | | /   ) |  ___  |/ | -+- (      //
+//  |  \| |---   |   \\//  /  \ |   |/   |\|/| |---  | (   \ |  |  |   \__   //
+//  |   |  \__    \   VV   \__/ |   | \  |   |  \__  |  ---/ |  |   \ ____)  //
+//                                                       __/                 //
+///////////////////////////////////////////////////////////////////////////////
+
+/** The biases and weights of a network, as a value that shares the
+ *  network structure with its copies.
+ *
+ *  Copying the object copies only the weight vector, so many
+ *  replicas of a network can be stored with memory proportional to
+ *  the number of parameters. A replica is turned into an @ref
+ *  ANNetwork with @ref build(), or its weights written to an existing
+ *  network of the same structure with @ref set().
+ *
+ *  The weights are in the order of @ref ANNetwork::getWeights().
+ **/
+class NetworkWeights {
+  public:
+							NetworkWeights		() : mpStructure (NULL) {}
+
+	/** Takes the structure and the current weights of the network. */
+							NetworkWeights		(const ANNetwork& net);
+
+	/** Takes the weights of the network, sharing the structure of
+	 *  another weight object, which the network must match.
+	 **/
+							NetworkWeights		(const NetworkWeights& shape, const ANNetwork& net);
+
+							NetworkWeights		(const NetworkWeights& other);
+							~NetworkWeights		();
+	void					operator=			(const NetworkWeights& other);
+
+	/** Returns the shared structure. */
+	const NetworkStructure&	structure			() const {return *mpStructure;}
+
+	/** Returns whether the two weight objects share the structure. */
+	bool					sameStructure		(const NetworkWeights& other) const {return mpStructure == other.mpStructure;}
+
+	/** Number of parameters. */
+	int						size				() const {return mWeights.size();}
+
+	double					operator[]			(int i) const {return mWeights[i];}
+	double&					operator[]			(int i) {return mWeights[i];}
+
+	/** The weights as a vector. */
+	const Vector&			values				() const {return mWeights;}
+	Vector&					values				() {return mWeights;}
+
+	/** Reads the current weights from a network with the same
+	 *  structure. Allocates nothing.
+	 **/
+	void					get					(const ANNetwork& net) {net.getWeights (mWeights);}
+
+	/** Writes the weights to a network with the same structure. */
+	void					set					(ANNetwork& net) const {net.setWeights (mWeights);}
+
+	/** Rebuilds the network from the structure and sets the weights. */
+	void					build				(ANNetwork& net) const;
+
+  private:
+	const NetworkStructure*	mpStructure;	/**< Shared structure, or NULL. */
+	Vector					mWeights;		/**< Biases and weights. */
+};
+
+#endif
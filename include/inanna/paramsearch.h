@@ -0,0 +1,280 @@
+/***************************************************************************
+ *   This file is part of the Inanna library.                              *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#ifndef __INANNA_PARAMSEARCH_H__
+#define __INANNA_PARAMSEARCH_H__
+
+#include <magic/mobject.h>
+#include <magic/mmap.h>
+#include "inanna/annetwork.h"
+#include "inanna/netstructure.h"
+
+// External predeclarations
+class PatternSource;
+class Trainer;
+
+/** One sampled configuration in a @ref ParameterSearch.
+ **/
+struct SearchCandidate {
+					SearchCandidate		();
+
+	/** Index of the candidate in the order of sampling. */
+	int				index;
+
+	/** The sampled values, as "name=value" pairs separated with spaces. */
+	String			description;
+
+	/** Training parameters: the parameters of the search, with the
+	 *  sampled values set.
+	 **/
+	StringMap		params;
+
+	/** Lowest validation MSE reached so far; the candidates are ranked
+	 *  by this.
+	 **/
+	double			validationMSE;
+
+	/** Training set MSE at the end of the last training. */
+	double			trainMSE;
+
+	/** Total number of cycles trained. */
+	int				cycles;
+
+	/** Number of the last round (rung) of successive halving the
+	 *  candidate was trained in, starting from 0.
+	 **/
+	int				rounds;
+
+	/** Did the terminator of the trainer end the training before the
+	 *  budget of the round? Stopped candidates are not trained
+	 *  further. A training that ended because the validation error
+	 *  fell below the training error is not stopped.
+	 **/
+	bool			stopped;
+
+	/** Wall-clock time used for training the candidate. */
+	double			seconds;
+
+	/** Weights of the candidate network after its last round. The
+	 *  candidates with the same topology share the network structure.
+	 **/
+	NetworkWeights	weights;
+
+	/** Error message if the candidate failed, empty otherwise. */
+	String			error;
+};
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//    ----                       |    ----                    |              //
+//   (      ___   ___       ___  | _  |   )  ___   ____       |  |   ____    //
+//    ---  /   )  ___| |/\ |   \ |/ | |---  /   ) (     |   | | -+- (        //
+//       ) |---  (   | |   |     |  | | \   |---   \__  |   | |  |   \__     //
+//   ___/   \__   \__| |    \__/ |  | |  \   \__  ____)  \__! |   \ ____)    //
+///////////////////////////////////////////////////////////////////////////////
+
+/** Results of a @ref ParameterSearch run, ranked by the validation
+ *  error.
+ **/
+class SearchResults : public Object {
+  public:
+							SearchResults	() {wallSeconds=0.0;}
+
+	/** Returns the number of candidates. */
+	int						size			() const {return candidates.size();}
+
+	/** Returns the candidate at the given rank, 0 being the best. The
+	 *  failed candidates are ranked last.
+	 **/
+	const SearchCandidate&	ranked			(int rank) const {return candidates[ranking[rank]];}
+
+	/** Returns the best candidate. */
+	const SearchCandidate&	best			() const {return ranked (0);}
+
+	/** Returns the number of candidates that failed with an error. */
+	int						failedCandidates	() const;
+
+	/** Returns the total number of training cycles used by all the
+	 *  candidates.
+	 **/
+	int						totalCycles		() const;
+
+	/** Returns the sum of the per-candidate times, i.e., the time the
+	 *  search would have taken sequentially.
+	 **/
+	double					candidateSeconds	() const;
+
+	/** Prints the candidates as a ranked table. */
+	void					print			(FILE* out = stdout) const;
+
+	/** The candidates, in the order of sampling. */
+	Array<SearchCandidate>	candidates;
+
+	/** Indices of the candidates, best first. */
+	PackArray<int>			ranking;
+
+	/** Wall-clock time of the entire search. */
+	double					wallSeconds;
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////
+//  ----                                             ----                       |     //
+//  |   )  ___       ___         ___   |   ___      (      ___   ___       ___  | _   //
+//  |---   ___| |/\  ___| |/|/| /   ) -+- /   ) |/\  ---  /   )  ___| |/\ |   \ |/ |  //
+//  |     (   | |   (   | | | | |---   |  |---  |       ) |---  (   | |   |     |  |  //
+//  |      \__| |    \__| | | |  \__    \  \__  |   ___/   \__   \__| |    \__/ |  |  //
+////////////////////////////////////////////////////////////////////////////////////////
+
+/** Parallel random search of training parameters with successive
+ *  halving.
+ *
+ *  The candidate configurations are sampled randomly from the ranges
+ *  and choices given with @ref addRange() and @ref addChoices(). All
+ *  candidates are first trained for a small number of cycles, after
+ *  which only the best 1/reduction of them are trained further, for
+ *  reduction times more cycles, and so on until "maxCycles". The
+ *  candidates continue from their weights of the previous round. A
+ *  candidate whose training was ended by its terminator keeps its
+ *  result, but is not trained further. The candidates of each round
+ *  are trained concurrently in a @ref ThreadPool.
+ *
+ *  The candidates are sampled and their networks initialized in the
+ *  calling thread. Trainers that draw random numbers during the
+ *  training, to shuffle the patterns, draw importance samples or
+ *  select a validation subsample, hold the @ref RandomLock while
+ *  doing so. The search is therefore safe with several threads, but
+ *  such trainers make it reproducible only with one thread, as the
+ *  global generator is shared in the order the workers happen to
+ *  use it.
+ *
+ *  The candidates are compared by the lowest validation error in
+ *  their @ref Trainer::validationRecord(), so the terminator should
+ *  be one that restores the best weights, such as GL5. The trainer
+ *  is created dynamically by its class name. The parameter map is
+ *  the same as given to @ref Trainer::init(); in addition, the keys
+ *  "maxCycles", "validationInterval" and "terminator" are used for
+ *  controlling the training, and "hidden" gives the hidden layers of
+ *  the network, for example "-10-5-" (by default none). Any of these can also be
+ *  searched.
+ *
+ *  Example:
+ *  @code
+ *  ParameterSearch search ("RPropTrainer", params);
+ *  search.addRange ("RPropTrainer.delta0", 0.01, 1.0, true);
+ *  search.addChoices ("hidden", "-5- -10- -10-5-");
+ *  search.addChoices ("terminator", "GL2 GL5 UP3");
+ *  SearchResults* results = search.search (trainset, validationset);
+ *  results->print ();
+ *  @endcode
+ **/
+class ParameterSearch : public Object {
+  public:
+	/** Standard constructor.
+	 *
+	 *  @param trainerClass Class name of the @ref Trainer to use.
+	 *  @param params Training parameters that are not searched.
+	 **/
+							ParameterSearch		(const String& trainerClass,
+												 const StringMap& params);
+
+	/** Searches a real-valued parameter from the range [min,max].
+	 *
+	 *  @param logScale Sample uniformly on logarithmic scale, for
+	 *  parameters such as learning rates. Requires min>0.
+	 **/
+	void					addRange			(const String& name, double min, double max,
+												 bool logScale=false);
+
+	/** Searches an integer parameter from the range [min,max]. */
+	void					addIntRange			(const String& name, int min, int max);
+
+	/** Searches a parameter from alternative values separated with
+	 *  spaces, for example "GL2 GL5 UP3".
+	 **/
+	void					addChoices			(const String& name, const String& choices);
+
+	/** Sets the number of sampled candidates. The default is 27. */
+	void					setCandidates		(int candidates) {mCandidates=candidates;}
+
+	/** Sets the number of cycles in the first round, or 0 to divide
+	 *  "maxCycles" so that there are four rounds (the default).
+	 **/
+	void					setMinCycles		(int cycles) {mMinCycles=cycles;}
+
+	/** Sets the factor by which the candidates are reduced and the
+	 *  cycles increased after each round. The default is 3.
+	 **/
+	void					setReduction		(int reduction) {mReduction=reduction;}
+
+	/** Sets the number of worker threads, or 0 to use one thread per
+	 *  processor (the default).
+	 **/
+	void					setThreads			(int threads) {mThreads=threads;}
+
+	/** Samples the candidates, and trains and ranks them with the
+	 *  given patterns. The pattern sources are copied, so they only
+	 *  need to exist during the call.
+	 *
+	 *  @return Results of the search. The caller takes the ownership.
+	 *
+	 *  @throws invalid_format if the trainer class is unknown.
+	 **/
+	SearchResults*			search				(const PatternSource& trainset,
+												 const PatternSource& validationset) const;
+
+  protected:
+	/** A searched parameter. */
+	struct Dimension {
+		String	name;		/**< Parameter name. */
+		double	min;		/**< Lower limit of a range. */
+		double	max;		/**< Upper limit of a range. */
+		bool	logScale;	/**< Sample a range on logarithmic scale? */
+		bool	integer;	/**< Is the range integer-valued? */
+		String	choices;	/**< Alternative values, empty for a range. */
+	};
+
+	void					addDimension		(Dimension* dimension);
+	void					sample				(SearchCandidate& candidate) const;
+	Trainer*				createTrainer		(const StringMap& params) const;
+	void					rank				(const Array<SearchCandidate>& candidates,
+												 PackArray<int>& indices) const;
+
+  protected:
+	String				mTrainerClass;	/**< Class name of the trainer. */
+	StringMap			mParams;		/**< Fixed training parameters. */
+	Array<Dimension>	mDimensions;	/**< Searched parameters. */
+	int					mCandidates;	/**< Number of sampled candidates. */
+	int					mMinCycles;		/**< Cycles in the first round. */
+	int					mReduction;		/**< Reduction factor between rounds. */
+	int					mThreads;		/**< Number of worker threads. */
+
+  private:
+	void operator= (const ParameterSearch& other) {FORBIDDEN}
+};
+
+#endif
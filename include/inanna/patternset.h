@@ -31,6 +31,8 @@
 #include <magic/mattribute.h>
 #include <magic/mpararr.h>
 
+#include <inanna/matrixview.h>
+
 
 //////////////////////////////////////////////////////////////////////////////
 //                                                                          //
@@ -289,4 +291,61 @@ class ArrayTrainSet : public PatternSource {
 
  };
 
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// |                                 | |   | o           |             ----                                 ----                             //
+// |      ___               ___      | |   |     _       |             |   )  ___   |   |   ___        _   (                     ___   ___   //
+// |      ___|  ___   ___  /   )  ---| | | | | |/ \   ---|  __  \    / |---   ___| -+- -+- /   ) |/\ |/ \   ---   __  |   | |/\ |   \ /   )  //
+// |     (   | (   \ (   \ |---  (   | |\|/| | |   | (   | /  \  \\//  |     (   |  |   |  |---  |   |   |     ) /  \ |   | |   |     |---   //
+// |____  \__|  ---/  ---/  \__   ---| |   | | |   |  ---| \__/   VV   |      \__|   \   \  \__  |   |   | ___/  \__/  \__! |    \__/  \__   //
+//               __/   __/                                                                                                                   //
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Time-series patterns computed on the fly from a matrix of monthly
+ *  data, with one row per month.
+ *
+ *  Pattern p predicts the row p+lags from the lags rows before it.
+ *  The first 12 inputs are month indicator flags, which are 1 for
+ *  the months of the lagged rows. They are followed by the lagged
+ *  values of either all the variables, month by month, or of one
+ *  variable. The outputs are the values of either all the variables
+ *  or one variable at the predicted row.
+ *
+ *  Unlike a @ref PatternSet built with the same layout, the patterns
+ *  are not stored, so the memory use does not grow with the number
+ *  of lags. The source is read-only.
+ **/
+class LaggedWindowPatternSource : public PatternSource {
+  public:
+	/** Constructor.
+	 *
+	 *  @param data The monthly data, or a view to it. The viewed
+	 *  matrix must exist as long as the source is used.
+	 *  @param lags Number of months used as inputs for each pattern.
+	 *  @param firstMonth0 Zero-based month (0-11) of the first row.
+	 *  @param inputVariable Variable used as input, or -1 for all.
+	 *  @param outputVariable Variable used as output, or -1 for all.
+	 **/
+					LaggedWindowPatternSource	(const MatrixView& data, int lags, int firstMonth0,
+												 int inputVariable=-1, int outputVariable=-1);
+
+	// Virtual method implementations
+	virtual void	print			(FILE* out = stdout) const;
+	virtual double	input			(int p, int i) const;
+	virtual double	output			(int p, int j) const {
+		return mData.get (p+mLags, (mOutputVariable<0)? j : mOutputVariable);
+	}
+
+  private:
+	/** FORBIDDEN */
+	virtual void	make			(int patterns, int inputs, int outputs) {FORBIDDEN;}
+
+	MatrixView		mData;				/**< The monthly data. */
+	int				mLags;				/**< Months used as inputs. */
+	int				mFirstMonth0;		/**< Month of the first row. */
+	int				mInputVariable;		/**< Input variable, or -1 for all. */
+	int				mOutputVariable;	/**< Output variable, or -1 for all. */
+};
+
 #endif
@@ -31,10 +31,14 @@
 #include <magic/mclass.h>
 #include <magic/mpararr.h>
 #include <inanna/annetwork.h>
+#include <inanna/matrixview.h>
 
-class PatternSet;		// In patternset.h
+class PatternSource;	// In patternset.h
 class MatrixEqualizer;	// In equalization.h
+class EqualizedPatternSource;	// In equalization.h
 class TrainingObserver;	// In trainer.h
+class Trainer;			// In trainer.h
+class VariableTrainingTask;	// In prediction.cc
 
 
 
@@ -70,9 +74,6 @@ class MonthlyDataSet : public Matrix {
 				}
 			}
 
-	/** Returns a subset of the data set. */
-	Ref<MonthlyDataSet>	sub				(int row0, int row1, int col0, int col1) const;
-
 	/** Returns number of lag months for prediction. */
 	int					lag				() const {return mLag;}
 
@@ -150,17 +151,29 @@ class PredictionStrategy : public Object {
 	decl_dynamic (PredictionStrategy);
   public:
 						PredictionStrategy	() {FORBIDDEN}
-						PredictionStrategy	(const String& name) : mName (name) {}
+						PredictionStrategy	(const String& name) : mName (name) {mThreads=0;}
 
 	virtual void		make				(const StringMap& params);
-	virtual void		train				(const Matrix& traindata, int startmonth);
-	virtual Ref<Matrix>	predict				(const Matrix& testdata, int startmonth) const;
-	virtual PredictionTestResults*	test	(const Matrix& testdata, int startmonth) const;
+	virtual void		train				(const MatrixView& traindata, int startmonth);
+	virtual void		update				(const MatrixView& traindata, int startmonth, int newRows);
+	virtual Ref<Matrix>	predict				(const MatrixView& testdata, int startmonth) const;
+	virtual PredictionTestResults*	test	(const MatrixView& testdata, int startmonth) const;
 	virtual void		testCurve			(const Matrix& testdata, int startmonth, const String& filename) const;
 
 	/** Returns the name of the prediction method. */
 	const String&		name				() const {return mName;}
 	virtual int			inputMonths			() const {return mInputMonths;}
+
+	/** Returns the month (YYYYMM or YYMM) that is the given number
+	 *  of months after the given month.
+	 **/
+	static int			addMonths			(int month, int months);
+
+	/** Sets the number of threads the strategy may use for training
+	 *  and prediction, or 0 to use one thread per processor.
+	 *  Strategies that do not use threads ignore this.
+	 **/
+	void				setThreads			(int threads) {mThreads=threads;}
 	
   protected:
 	String	mName;
@@ -171,7 +184,13 @@ class PredictionStrategy : public Object {
 	 **/
 	int		mInputMonths;
 
-	static Ref<Matrix>	rowDeltas			(const Matrix& matrix);
+	/** Number of threads for training and prediction. */
+	int		mThreads;
+
+	/** Returns the number of threads to use for the given number of
+	 *  independent tasks.
+	 **/
+	int					threadsFor			(int tasks) const;
 };
 
 /*******************************************************************************
@@ -187,8 +206,8 @@ class PreviousYear : public PredictionStrategy {
   public:
 						PreviousYear			() : PredictionStrategy ("PreviousYear") {mInputMonths=0;}
 						PreviousYear			(const StringMap& params);
-	virtual void		train					(const Matrix& traindata, int startmonth);
-	virtual Ref<Matrix>	predict					(const Matrix& testdata, int startmonth) const;
+	virtual void		train					(const MatrixView& traindata, int startmonth);
+	virtual Ref<Matrix>	predict					(const MatrixView& testdata, int startmonth) const;
 	virtual int			inputMonths				() const {return 0;}
   protected:
 	Matrix			mData;
@@ -207,8 +226,8 @@ class PreviousYearsAvg : public PredictionStrategy {
   public:
 						PreviousYearsAvg		() : PredictionStrategy ("PreviousYearsAvg") {mInputMonths=0;}
 						PreviousYearsAvg		(const StringMap& params);
-	virtual void		train					(const Matrix& traindata, int startmonth);
-	virtual Ref<Matrix>	predict					(const Matrix& testdata, int startmonth) const;
+	virtual void		train					(const MatrixView& traindata, int startmonth);
+	virtual Ref<Matrix>	predict					(const MatrixView& testdata, int startmonth) const;
 	virtual int			inputMonths				() const {return 0;}
 
   protected:
@@ -229,8 +248,8 @@ class AverageDeltaPrediction : public PredictionStrategy {
   public:
 						AverageDeltaPrediction	() : PredictionStrategy ("AverageDelta") {mInputMonths=1;}
 						AverageDeltaPrediction	(const StringMap& params);
-	virtual void		train					(const Matrix& traindata, int startmonth);
-	virtual Ref<Matrix>	predict					(const Matrix& testdata, int startmonth) const;
+	virtual void		train					(const MatrixView& traindata, int startmonth);
+	virtual Ref<Matrix>	predict					(const MatrixView& testdata, int startmonth) const;
 	const Matrix&		deltas					() const {return mMonthAvg;}
 	virtual int			inputMonths				() const {return 1;}
   protected:
@@ -246,6 +265,10 @@ class AverageDeltaPrediction : public PredictionStrategy {
  * best ranking method to predict a particular month in a test set.
  *
  * This has proven to be a rather good prediction method for many cases.
+ *
+ * The component methods are independent, so they are trained and used for
+ * prediction in parallel. The number of threads is given with the parameter
+ * "CombinedPrediction.threads"; 0 or no value uses one thread per processor.
  ******************************************************************************/
 class CombinedPrediction : public PredictionStrategy {
 	decl_dynamic (CombinedPrediction);
@@ -253,8 +276,8 @@ class CombinedPrediction : public PredictionStrategy {
 						CombinedPrediction		() : PredictionStrategy ("CombinedPrediction") {}
 						CombinedPrediction		(const StringMap& params);
 	virtual void		make					(const StringMap& params);
-	virtual void		train					(const Matrix& traindata, int startmonth);
-	virtual Ref<Matrix>	predict					(const Matrix& testdata, int startmonth) const;
+	virtual void		train					(const MatrixView& traindata, int startmonth);
+	virtual Ref<Matrix>	predict					(const MatrixView& testdata, int startmonth) const;
 
   protected:
 	Array<PredictionStrategy>	mPredictors;
@@ -277,8 +300,8 @@ class ZeroDeltaPrediction : public PredictionStrategy {
   public:
 						ZeroDeltaPrediction		() : PredictionStrategy ("ZeroDelta") {mInputMonths=1;}
 						ZeroDeltaPrediction		(const StringMap& params);
-	virtual void		train					(const Matrix& traindata, int startmonth);
-	virtual Ref<Matrix>	predict					(const Matrix& testdata, int startmonth) const;
+	virtual void		train					(const MatrixView& traindata, int startmonth);
+	virtual Ref<Matrix>	predict					(const MatrixView& testdata, int startmonth) const;
 	virtual int			inputMonths				() const {return 1;}
   protected:
 };
@@ -304,9 +327,14 @@ class AbsoluteNeuralPrediction : public PredictionStrategy {
 						AbsoluteNeuralPrediction	(const char* name=NULL) : PredictionStrategy (name? name:"AbsoluteNeural")  {mpNetwork=NULL; rpObserver=NULL;}
 						~AbsoluteNeuralPrediction	();
 	virtual void		make						(const StringMap& params);
-	virtual void		train						(const Matrix& traindata, int startmonth);
-	virtual Ref<Matrix>	predict						(const Matrix& testdata, int startmonth) const;
+	virtual void		train						(const MatrixView& traindata, int startmonth);
+	virtual void		update						(const MatrixView& traindata, int startmonth, int newRows);
+	virtual Ref<Matrix>	predict						(const MatrixView& testdata, int startmonth) const;
 
+	/** Sets an observer for the training. Notice that @ref
+	 *  SingleNeuralPrediction calls it from several threads at the
+	 *  same time.
+	 **/
 	void				setObserver					(TrainingObserver* observer) {rpObserver=observer;}
 	virtual void		load						(TextIStream& in);
 	virtual void		save						(TextOStream& out) const;
@@ -326,11 +354,6 @@ class AbsoluteNeuralPrediction : public PredictionStrategy {
 	 **/
 	bool				mUseAllInputs;
 
-	/** Currently handled output variable. This value changes during
-	 *  the run.
-	 **/
-	int					mVariable;
-
 	/** Should global equalization be used? */
 	bool				mGlobalEqualization;
 
@@ -348,27 +371,102 @@ class AbsoluteNeuralPrediction : public PredictionStrategy {
 	TrainingObserver*	rpObserver;
 
   protected:
-	/** Builds pattern set from given dataset and starting month. */
-	PatternSet*			makeSet					(const Matrix& data, int startmonth) const;
+	/** Creates an unconnected network for the given data, with the
+	 *  hidden layers given in the parameters.
+	 **/
+	ANNetwork*			createNetwork			(const MatrixView& data) const;
+
+	/** Creates an equalizer analyzed from the given data. */
+	MatrixEqualizer*	createEqualizer			(const MatrixView& data) const;
+
+	/** Creates a trainer with the parameters of the strategy. The
+	 *  trainer class is given with "AbsoluteNeuralPrediction.trainer",
+	 *  by default RPropTrainer.
+	 *
+	 *  @throws invalid_format if the trainer class is unknown.
+	 **/
+	Trainer*			createTrainer			() const;
+
+	/** Builds pattern source from given dataset and starting month.
+	 *  The patterns are computed from the data on the fly, so the data
+	 *  must exist as long as the source is used. The data can be a
+	 *  @ref MatrixView to a part of a larger matrix.
+	 *
+	 *  @param variable The variable to use, if not all variables are
+	 *  used as inputs and outputs.
+	 **/
+	PatternSource*		makeSet					(const MatrixView& data, int startmonth, int variable=0) const;
+
+	/** Wraps a pattern source built with @ref makeSet() from raw data
+	 *  to a source that equalizes it on the fly with the equalizer
+	 *  of the network.
+	 **/
+	EqualizedPatternSource*	equalizeSet			(const PatternSource& set, int datacolumns,
+												 const ANNetwork& network, int variable=0) const;
+
+	/** Predicts the test data with the given network, which must
+	 *  have been trained for the variable. Does not touch the
+	 *  members of the strategy, so several networks can predict at
+	 *  the same time.
+	 **/
+	Ref<Matrix>			predictWith				(const ANNetwork& network, const MatrixView& testdata,
+												 int startmonth, int variable=0) const;
+
+	/** Returns the first row of the training data that @ref update()
+	 *  retrains with, so that the rows include the new rows and the
+	 *  input months before them, or the "updateWindow" last months
+	 *  if it is longer.
+	 **/
+	int					updateStart				(const MatrixView& traindata, int newRows) const;
+
+	/** Returns the number of cycles for retraining in @ref update(). */
+	int					updateCycles			() const;
 
   private:
 	int					inputVariables			(int datacolumns) const {return 12+mInputMonths*(mUseAllInputs? datacolumns : 1);}
 	int					outputVariables			(int datacolumns) const {return mUseAllOutputs? datacolumns : 1;}
 };
 
+/*******************************************************************************
+ *  Neural network prediction with a separate network for each
+ *  variable.
+ *
+ *  The networks are independent, so they are trained and used for
+ *  prediction in parallel. The number of threads is given with the
+ *  parameter "SingleNeuralPrediction.threads"; 0 or no value uses one
+ *  thread per processor.
+ ******************************************************************************/
 class SingleNeuralPrediction : public AbsoluteNeuralPrediction {
 	decl_dynamic (SingleNeuralPrediction);
   public:
 						SingleNeuralPrediction		() : AbsoluteNeuralPrediction ("SingleNeural")  {mpNetwork=NULL;}
 	virtual void		make						(const StringMap& params);
-	virtual void		train						(const Matrix& traindata, int startmonth);
-	virtual Ref<Matrix>	predict						(const Matrix& testdata, int startmonth) const;
+	virtual void		train						(const MatrixView& traindata, int startmonth);
+	virtual void		update						(const MatrixView& traindata, int startmonth, int newRows);
+	virtual Ref<Matrix>	predict						(const MatrixView& testdata, int startmonth) const;
 
 	virtual void		load						(TextIStream& in);
 	virtual void		save						(TextOStream& out) const;
 
+	/** Saves the network of each variable in a separate file named
+	 *  "<basename>.<variable>", by default in the binary format that
+	 *  can be mapped with @ref MappedANNetwork.
+	 **/
+	void				saveNetworks				(const String& basename, const char* fileformat="binary") const;
+
+	/** Loads the networks saved with @ref saveNetworks for the
+	 *  given number of variables. The file formats are recognized
+	 *  automatically.
+	 **/
+	void				loadNetworks				(const String& basename, int variables);
+
   protected:
 	Array<ANNetwork>	mNetworks;
+
+  private:
+	void				runTasks					(Array<VariableTrainingTask>& tasks) const;
+
+	friend class VariablePredictionTask;
 };
 
 /** Not in use currently.
@@ -379,8 +477,8 @@ class DeltaNeuralPrediction : public PredictionStrategy {
   public:
 						DeltaNeuralPrediction	() : PredictionStrategy ("DeltaNeural") {}
 						DeltaNeuralPrediction	(const StringMap& params);
-	virtual void		train					(const Matrix& traindata, int startmonth);
-	virtual Ref<Matrix>	predict					(const Matrix& testdata, int startmonth) const;
+	virtual void		train					(const MatrixView& traindata, int startmonth);
+	virtual Ref<Matrix>	predict					(const MatrixView& testdata, int startmonth) const;
   protected:
 };
 
@@ -388,8 +486,8 @@ class DeltaNeuralPrediction : public PredictionStrategy {
 class StochasticPrediction : public PredictionStrategy {
   public:
 	virtual void		make						(const StringMap& params);
-	virtual void		train						(const Matrix& traindata, int startmonth);
-	virtual Ref<Matrix>	predict						(const Matrix& testdata, int startmonth) const;
+	virtual void		train						(const MatrixView& traindata, int startmonth);
+	virtual Ref<Matrix>	predict						(const MatrixView& testdata, int startmonth) const;
 
   protected:
 	virtual Matrix	predictRun					();
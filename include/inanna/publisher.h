@@ -0,0 +1,155 @@
+/***************************************************************************
+ *   This file is part of the Inanna library.                              *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __INANNA_PUBLISHER_H__
+#define __INANNA_PUBLISHER_H__
+
+#include <pthread.h>
+#include "inanna/annfilef.h"
+
+// Internal predeclarations
+class NetworkReader;
+
+
+
+/////////////////////////////////////////////////////////////////////////////////////
+// |   |                           |    ----        |     | o       |              //
+// |\  |  ___   |                  |    |   )       |     |    ____ | _   ___      //
+// | \ | /   ) -+- \    /  __  |/\ | /  |---  |   | |---  | | (     |/ | /   ) |/\ //
+// |  \| |---   |   \\//  /  \ |   |/   |     |   | |   ) | |  \__  |  | |---  |   //
+// |   |  \__    \   VV   \__/ |   | \  |      \__! |__/  | | ____) |  |  \__  |   //
+/////////////////////////////////////////////////////////////////////////////////////
+
+/** Publishes immutable snapshots of the weights of a network that is
+ *  being trained, for readers in other threads.
+ *
+ *  The network being trained acts as the back buffer. Each call to
+ *  @ref publish() copies its current state to a new @ref
+ *  MappedANNetwork image and atomically replaces the current snapshot
+ *  with it. Readers (@ref NetworkReader) never take locks and never
+ *  wait for the publisher; they always evaluate one complete
+ *  snapshot.
+ *
+ *  Replaced snapshots are reclaimed with epoch-based reclamation: a
+ *  snapshot is deleted only after every reader that could have seen
+ *  it has finished its evaluation.
+ *
+ *  Publishing is typically done by a @ref Trainer, see @ref
+ *  Trainer::setPublisher().
+ **/
+class NetworkPublisher {
+  public:
+							NetworkPublisher	();
+
+	/** Deletes the snapshots. All readers must have been destroyed
+	 *  before the publisher.
+	 **/
+							~NetworkPublisher	();
+
+	/** Publishes the current weights of the network. Can be called
+	 *  from any thread; concurrent publishers are serialized.
+	 *
+	 *  @throws invalid_format if the network can't be represented as
+	 *  a @ref MappedANNetwork.
+	 **/
+	void					publish				(const ANNetwork& net);
+
+	/** Returns the number of snapshots published so far. */
+	int						version				() const {return mVersion;}
+
+	/** Maximum number of simultaneous readers. */
+	enum {MAX_READERS=64};
+
+  private:
+	/** Reader slot states; other values are reader epochs. */
+	enum {SLOT_FREE=0, SLOT_IDLE=1, FIRST_EPOCH=2};
+
+	/** Deletes the retired snapshots that no reader can see anymore. */
+	void					reclaim				();
+
+	MappedANNetwork* volatile	mpCurrent;		/**< Current snapshot, or NULL. */
+	volatile long				mEpoch;			/**< Current epoch. */
+	volatile int				mVersion;		/**< Number of snapshots published. */
+	volatile long				mReaderEpochs [MAX_READERS];	/**< State of each reader slot. */
+	PackArray<MappedANNetwork*>	mRetired;		/**< Replaced snapshots not yet deleted. */
+	PackArray<long>				mRetireEpochs;	/**< Epoch when each snapshot was replaced. */
+	int							mRetiredCount;	/**< Number of retired snapshots. */
+	pthread_mutex_t				mPublishLock;	/**< Serializes the publishers. */
+
+	NetworkPublisher (const NetworkPublisher& other) {FORBIDDEN}
+	void operator= (const NetworkPublisher& other) {FORBIDDEN}
+
+	friend class NetworkReader;
+};
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//  |   |                           |    ----                  |             //
+//  |\  |  ___   |                  |    |   )  ___   ___      |  ___        //
+//  | \ | /   ) -+- \    /  __  |/\ | /  |---  /   )  ___|  ---| /   ) |/\   //
+//  |  \| |---   |   \\//  /  \ |   |/   | \   |---  (   | (   | |---  |     //
+//  |   |  \__    \   VV   \__/ |   | \  |  \   \__   \__|  ---|  \__  |     //
+///////////////////////////////////////////////////////////////////////////////
+
+/** Evaluates the snapshots published by a @ref NetworkPublisher.
+ *
+ *  Each reading thread must have its own reader object. Evaluation
+ *  never blocks, even while a new snapshot is being published.
+ **/
+class NetworkReader {
+  public:
+	/** Registers a reader for the publisher.
+	 *
+	 *  @throws generic_exception if the publisher already has
+	 *  NetworkPublisher::MAX_READERS readers.
+	 **/
+							NetworkReader		(NetworkPublisher& publisher);
+							~NetworkReader		();
+
+	/** Evaluates the current snapshot.
+	 *
+	 *  @param input Values for the input units.
+	 *  @param output Buffer for the values of the output units.
+	 *
+	 *  @throws generic_exception if nothing has been published yet.
+	 **/
+	void					evaluate			(const double* input, double* output);
+
+	/** Evaluates the current snapshot and returns the output values.
+	 *
+	 *  @throws generic_exception if nothing has been published yet.
+	 **/
+	Vector					evaluate			(const Vector& input);
+
+  private:
+	NetworkPublisher&	mPublisher;
+	int					mSlot;		/**< Slot of the reader in the publisher. */
+	PackArray<double>	mWork;		/**< Work buffer for the activations. */
+
+	NetworkReader (const NetworkReader& other) : mPublisher (other.mPublisher) {FORBIDDEN}
+	void operator= (const NetworkReader& other) {FORBIDDEN}
+};
+
+#endif
@@ -37,11 +37,25 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 /** Resilient error backpropagation algorithm by Riedmiller.
+ *
+ *  The update follows the improved Rprop of Igel and Hsken. When the
+ *  gradient of a weight changes its sign, the step of the weight is
+ *  decreased and the weight is not changed on that cycle (iRprop-).
+ *  With weight backtracking (iRprop+), the previous change of the
+ *  weight is also reverted if the training error increased.
+ *
+ *  Parameters (prefixed with "RPropTrainer."): delta0 (initial
+ *  step), deltamax and deltamin (step bounds, default 50 and 1E-6),
+ *  etaPlus and etaMinus (step multipliers, default 1.2 and 0.5) and
+ *  backtracking (use iRprop+, default off). The defaults apply only
+ *  to missing parameters. A negative deltamin, an etaPlus below 1 or
+ *  an etaMinus outside [0,1] makes @ref init() throw invalid_format.
  *
  *  Design Patterns: Template Method (various parts of the algorithm
  *  can be overloaded).
  **/
 class RPropTrainer : public BackpropTrainer {
+	decl_dynamic (RPropTrainer);
   public:
 	virtual Array<DynParameter>*	parameters	() const;
 	virtual void					init		(const StringMap& params);
@@ -50,10 +64,19 @@ class RPropTrainer : public BackpropTrainer {
 	virtual void					initTrain		(ANNetwork& network) const;
 	virtual void					backpropagate	(ANNetwork& network, const PatternSource& set, int p) const;
 	virtual void					updateWeights	(ANNetwork& network) const;
+	virtual void					saveState		(CheckpointData& data) const;
+	virtual void					loadState		(CheckpointData& data);
 
   protected:
 	double	mDelta0;	/**< Initial per-weight delta. */
 	double	mDeltaMax;	/**< Maximum per-weight delta. */
+	double	mDeltaMin;	/**< Minimum per-weight delta. */
+	double	mEtaPlus;	/**< Delta multiplier when the gradient keeps its sign. */
+	double	mEtaMinus;	/**< Delta multiplier when the gradient changes its sign. */
+	bool	mBacktracking;	/**< Revert weight changes if the error increases (iRprop+)? */
+
+	/** Training set error of the previous cycle, for backtracking. */
+	mutable double	mPreviousError;
 
 	/** Per-weight deltas.
 	 *
@@ -0,0 +1,103 @@
+/***************************************************************************
+ *   This file is part of the Inanna library.                              *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#ifndef __INANNA_SAMPLER_H__
+#define __INANNA_SAMPLER_H__
+
+#include <magic/mmath.h>
+
+// Externals
+class CheckpointData;	// In trainer.h
+
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+//  ---                                                  ----                  |            //
+//   |         --            |   ___    _    ___   ___  (      ___         --  |  ___       //
+//   |  |/|/| |  )  __  |/\ -+-  ___| |/ \  |   \ /   )  ---   ___| |/|/| |  ) | /   ) |/\  //
+//   |  | | | |--  /  \ |    |  (   | |   | |     |---      ) (   | | | | |--  | |---  |    //
+//  --- | | | |    \__/ |     \  \__| |   |  \__/  \__  ___/   \__| | | | |    |  \__  |    //
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Draws training patterns with probabilities proportional to their
+ *  recent errors, so that a training cycle is not spent mostly on
+ *  patterns that the network already fits well.
+ *
+ *  The sampler keeps an estimate of the error of each pattern, which
+ *  is updated whenever the pattern is trained. A share of the
+ *  probability mass, the floor, is spread uniformly, so that every
+ *  pattern keeps getting its estimate refreshed. Each drawn pattern
+ *  has an importance weight, the inverse of its probability relative
+ *  to uniform sampling, which keeps the weighted gradient and error
+ *  sums unbiased estimates of those over the whole pattern set.
+ *
+ *  Until every pattern has an error estimate, the patterns are drawn
+ *  uniformly without replacement.
+ **/
+class ImportanceSampler {
+  public:
+							ImportanceSampler	() : mFloor (0.1), mKnown (0) {}
+
+	/** Sets the share of probability spread uniformly over the
+	 *  patterns, between 0 (purely by error) and 1 (uniform).
+	 **/
+	void					setFloor			(double floor) {mFloor = floor;}
+
+	/** Forgets the error estimates and prepares for the given number
+	 *  of patterns.
+	 **/
+	void					make				(int patterns);
+
+	/** Draws the patterns for one training cycle, as many as there
+	 *  are patterns, in random order and with replacement. The error
+	 *  estimates are reset if the number of patterns has changed.
+	 *
+	 *  @param order The drawn pattern indices are stored here.
+	 **/
+	void					draw				(int patterns, PackArray<int>& order);
+
+	/** Returns the importance weight of the pattern for the current
+	 *  draw. The mean weight over the draws is 1.
+	 **/
+	double					weight				(int p) const {return 1.0 / (mProbability.size() * mProbability[p]);}
+
+	/** Updates the error estimate of the pattern. */
+	void					update				(int p, double error);
+
+	/** Writes the error estimates to a training checkpoint. */
+	void					saveState			(CheckpointData& data) const;
+
+	/** Reads the state written by @ref saveState(). */
+	void					loadState			(CheckpointData& data);
+
+  protected:
+	double	mFloor;			/**< Uniformly spread share of probability. */
+	int		mKnown;			/**< Number of patterns with an error estimate. */
+	Vector	mError;			/**< Error estimate of each pattern, negative if unknown. */
+	Vector	mProbability;	/**< Probability of each pattern in the current draw. */
+	Vector	mCumulative;	/**< Cumulative probabilities for drawing. */
+};
+
+#endif
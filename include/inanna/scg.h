@@ -0,0 +1,92 @@
+/***************************************************************************
+ *   This file is part of the Inanna library.                              *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#ifndef __INANNA_SCG_H__
+#define __INANNA_SCG_H__
+
+#include "inanna/backprop.h"
+
+///////////////////////////////////////////////////////////////////////////////
+//             ----  ___   ___  -----           o                            //
+//            (     /   \ /   \   |        ___      _    ___                 //
+//             ---  |     |  __   |   |/\  ___| | |/ \  /   ) |/\            //
+//                ) |     |   |   |   |   (   | | |   | |---  |              //
+//            ___/  \___/ \___/   |   |    \__| | |   |  \__  |              //
+///////////////////////////////////////////////////////////////////////////////
+
+/** Scaled conjugate gradient training algorithm by Mller.
+ *
+ *  The weights are moved along conjugate directions, and the step
+ *  length is computed from a finite-difference estimate of the
+ *  curvature along the direction, scaled with a Levenberg-Marquardt
+ *  style damping that is adapted from how well the quadratic model
+ *  predicted the error. No line search or learning rate is needed,
+ *  and the memory use is linear in the number of weights.
+ *
+ *  The gradients are computed with @ref BackpropTrainer::backpropagate.
+ *  Each training cycle is one iteration of the algorithm, taking two
+ *  passes over the training set. The learning is always in batch.
+ *
+ *  Parameters (prefixed with "SCGTrainer."): sigma (relative step for
+ *  the curvature estimate, 1E-4) and lambda0 (initial damping, 1E-6).
+ **/
+class SCGTrainer : public BackpropTrainer {
+	decl_dynamic (SCGTrainer);
+  public:
+	virtual Array<DynParameter>*	parameters	() const;
+	virtual void					init		(const StringMap& params);
+
+  protected:
+	virtual void					initTrain		(ANNetwork& network) const;
+	virtual double					trainOnce		(ANNetwork& network, const PatternSource& set) const;
+	virtual void					saveState		(CheckpointData& data) const;
+	virtual void					loadState		(CheckpointData& data);
+
+	/** Computes the gradient of the error function E=SSE/2 with the
+	 *  given weights, in the order of ANNetwork::getWeights().
+	 *
+	 *  @return The error E with the weights.
+	 **/
+	double							errorGradient	(ANNetwork& network, const PatternSource& set,
+													 const Vector& weights, Vector& gradient) const;
+
+  protected:
+	double	mSigma;		/**< Relative step for the curvature estimate. */
+	double	mLambda0;	/**< Initial damping. */
+
+	mutable Vector	mWeights;		/**< Current weights. */
+	mutable Vector	mResidual;		/**< Negative gradient at the current weights. */
+	mutable Vector	mDirection;		/**< Current search direction. */
+	mutable Vector	mTrial;			/**< Weights of a trial step. */
+	mutable Vector	mTrialGradient;	/**< Gradient at the trial weights. */
+	mutable double	mErrorValue;	/**< Error E at the current weights. */
+	mutable double	mCurvature;		/**< Damped curvature along the direction (delta). */
+	mutable double	mLambda;		/**< Current damping. */
+	mutable double	mLambdaBar;		/**< Damping of the last rejected step. */
+	mutable bool	mSuccess;		/**< Was the last step accepted? */
+	mutable int		mIteration;		/**< Iterations so far, 0 before the first one. */
+};
+
+#endif
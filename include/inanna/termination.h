@@ -31,11 +31,13 @@
  **/
 
 #include "annetwork.h"
+#include "netstructure.h"
 
 // Externals
 class ANNetwork;
 class PatternSource;
 class Trainer;
+class CheckpointData;
 
 /** Abstract superclass for early stopping strategies for @ref AnyNetwork.
  *
@@ -102,6 +104,52 @@ class Terminator : public Object {
 	 **/
 	int				howManyTrained		() const {return mMinCycle;}
 
+	/** Makes the validations use a fixed random subsample of the
+	 *  validation patterns. A subsample error that looks like a new
+	 *  minimum is confirmed with all the patterns, so the minimum
+	 *  error and the saved network state are always measured with
+	 *  the full validation set. So is an error at or above @ref
+	 *  abortLimit(), so that the training is never stopped on a
+	 *  subsample estimate alone, and an error below the training
+	 *  error if the trainer compares them. Terminators whose abort
+	 *  limit is the minimum, such as UP and FT, accept no estimate
+	 *  and always validate with all the patterns.
+	 *
+	 *  @param patterns Size of the subsample, or 0 to always use all
+	 *  the patterns (the default).
+	 *
+	 *  @param fullInterval Use all the patterns on every
+	 *  fullInterval'th validation, or 0 only for confirming minimums
+	 *  and errors above the abort limit.
+	 **/
+	void			setSampling			(int patterns, int fullInterval=10) {mSampleSize=patterns; mFullInterval=fullInterval;}
+
+	/** Makes the validations stop accumulating the error as soon as
+	 *  it is clear that the terminator will make the same decision
+	 *  as with the exact error; see @ref abortLimit(). The
+	 *  validation error of an aborted validation is a lower bound of
+	 *  the exact error.
+	 **/
+	void			setEarlyAbort		(bool abort=true) {mEarlyAbort=abort;}
+
+	/** Tells whether the trainer stops when the validation error
+	 *  falls below the training error, which makes also such errors
+	 *  affect the decisions. This is the default.
+	 **/
+	void			setTrainingBound	(bool bound=true) {mTrainingBound=bound;}
+
+	/** Returns the number of validation patterns evaluated so far. */
+	int				evaluatedPatterns	() const {return mEvaluated;}
+
+	/** Writes the state of the terminator to a training checkpoint.
+	 *  Inheritors with their own state must overload this and @ref
+	 *  loadState(), and call the parent implementations first.
+	 **/
+	virtual void	saveState			(CheckpointData& data) const;
+
+	/** Reads the state written by @ref saveState(). */
+	virtual void	loadState			(CheckpointData& data);
+
   protected:
 	/** Smalled validation error so far. */
 	double	mMinValidError;
@@ -118,9 +166,46 @@ class Terminator : public Object {
 	/** Validation interval. */
 	int		mStripLength;
 
+	/** Size of the validation subsample, 0 for none. */
+	int		mSampleSize;
+
+	/** Interval of validations with the full validation set. */
+	int		mFullInterval;
+
+	/** Number of validations made with subsampling enabled. */
+	int		mSampledValidations;
+
+	/** Indices of the subsampled validation patterns, in ascending
+	 *  order. Drawn on the first validation.
+	 **/
+	PackArray<int>	mSample;
+
+	/** Abort validations early? */
+	bool	mEarlyAbort;
+
+	/** Must a validation error below the training error be exact? */
+	bool	mTrainingBound;
+
+	/** Number of validation patterns evaluated. */
+	int		mEvaluated;
+
 	/** */
 	virtual bool	check				(const ANNetwork& net, int cyclesTrained) = 0;
 
+	/** Returns the validation error above which the exact value does
+	 *  not affect the decisions of the terminator. By default, any
+	 *  error above the lowest one so far is just not a new minimum.
+	 **/
+	virtual double	abortLimit			() const {return mMinValidError;}
+
+	/** Calculates the validation MSE with the given patterns, or with
+	 *  all the patterns if the sample is NULL. Stops accumulating
+	 *  the error when it exceeds the limit, if the limit is
+	 *  non-negative.
+	 **/
+	double			measure				(const ANNetwork& net, const PackArray<int>* sample,
+										 double limit);
+
 };
 
 /** Terminator factory. Manufactures a terminator according to the
@@ -152,6 +237,8 @@ class TerminatorT800 : virtual public Terminator {
 										 int hits, int striplen);
 
 	bool			check				(const ANNetwork& net, int cyclesTrained);
+	virtual void	saveState			(CheckpointData& data) const;
+	virtual void	loadState			(CheckpointData& data);
 
   protected:
 	/** Number of successive increases in the validation error. */
@@ -188,6 +275,8 @@ class SavingTerminator : virtual public Terminator {
 	 *  as parameter.
 	 **/
 	bool			restore				(ANNetwork& net);
+	virtual void	saveState			(CheckpointData& data) const;
+	virtual void	loadState			(CheckpointData& data);
 
   protected:
 
@@ -198,9 +287,9 @@ class SavingTerminator : virtual public Terminator {
   private:
 	/** The best network state (lowest validation error) so far. We
 	 *  save the state as an ordered weight vector (including the
-	 *  biases).
+	 *  biases), without the structure of the network.
 	 **/
-	Vector		mBestWeights;
+	NetworkWeights	mBestWeights;
 };
 
 // Methods by Lutz Prechelt (prechelt@ira.uka.de). See his article
@@ -236,6 +325,9 @@ class GLTerminator : public SavingTerminator {
 	/** Generalization loss threshold for stopping.
 	 **/
 	double	mThreshold;
+
+	/** Any error that exceeds the threshold stops the training. */
+	virtual double	abortLimit			() const;
 };
 
 /** Another @ref Terminator used in the examples of Prechelt's
@@ -251,6 +343,8 @@ class PRTerminator : public GLTerminator {
 										 int striplen, const String& pars);
 	
 	bool			check				(const ANNetwork& net, int cyclesTrained);
+	virtual void	saveState			(CheckpointData& data) const;
+	virtual void	loadState			(CheckpointData& data);
 
   private:
 	int		mStrips;
@@ -273,6 +367,9 @@ class PQTerminator : public SavingTerminator {
 										 double threshold, int striplen);
 	
 	bool			check				(const ANNetwork& net, int cyclesTrained);
+
+  protected:
+	virtual double	abortLimit			() const;
 };
 
 /** A @ref Terminator that stops traning when the generalization error
@@ -286,6 +383,8 @@ class UPTerminator : public SavingTerminator, public TerminatorT800 {
 										 int maxraises, int striplen);
 
 	bool			check				(const ANNetwork& net, int cyclesTrained);
+	virtual void	saveState			(CheckpointData& data) const;
+	virtual void	loadState			(CheckpointData& data);
 };
 
 
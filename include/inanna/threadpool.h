@@ -0,0 +1,184 @@
+/***************************************************************************
+ *   This file is part of the Inanna library.                              *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __INANNA_THREADPOOL_H__
+#define __INANNA_THREADPOOL_H__
+
+#include <pthread.h>
+#include <magic/mobject.h>
+#include <magic/mpararr.h>
+
+// Internal predeclarations
+class ThreadPool;
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//          ----- |                        | -----             |             //
+//            |   | _       ___   ___      |   |    ___   ____ |             //
+//            |   |/ | |/\ /   )  ___|  ---|   |    ___| (     | /           //
+//            |   |  | |   |---  (   | (   |   |   (   |  \__  |/            //
+//            |   |  | |    \__   \__|  ---|   |    \__| ____) | \           //
+///////////////////////////////////////////////////////////////////////////////
+
+/** A unit of work executed by a @ref ThreadPool.
+ *
+ *  The task should keep all its mutable state in itself. Networks,
+ *  trainers and pattern sets are not thread-safe, so tasks that run
+ *  concurrently must not share them, except for read-only access to
+ *  objects that are not modified by anyone during the execution.
+ *
+ *  Design Patterns: Command.
+ **/
+class ThreadTask {
+  public:
+							ThreadTask		() {}
+	virtual					~ThreadTask		() {}
+
+	/** Executes the task. Called in a worker thread of the pool. */
+	virtual void			run				()=0;
+
+	/** Returns 'true' if the @ref run() method threw an exception. */
+	bool					failed			() const {return !mError.isEmpty();}
+
+	/** Returns the message of the exception thrown by @ref run(),
+	 *  or an empty string if the task succeeded.
+	 **/
+	const String&			error			() const {return mError;}
+
+  private:
+	/** Error message of a failed task. */
+	String	mError;
+
+	friend class ThreadPool;
+};
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//            ----- |                        | ----            |             //
+//              |   | _       ___   ___      | |   )           |             //
+//              |   |/ | |/\ /   )  ___|  ---| |---   __   __  |             //
+//              |   |  | |   |---  (   | (   | |     /  \ /  \ |             //
+//              |   |  | |    \__   \__|  ---| |     \__/ \__/ |             //
+///////////////////////////////////////////////////////////////////////////////
+
+/** A fixed-size pool of worker threads that execute @ref ThreadTask
+ *  objects.
+ *
+ *  Tasks are executed in the order they are submitted. The pool does
+ *  not take the ownership of the tasks; they must exist at least
+ *  until @ref wait() returns.
+ *
+ *  The pool is intended for coarse-grained parallelism, such as
+ *  training several networks at once, not for parallelizing the
+ *  inner loops of a single training run.
+ **/
+class ThreadPool {
+  public:
+	/** Creates a pool with the given number of worker threads.
+	 *
+	 *  @param threads Number of worker threads, or 0 to use the
+	 *  number of available processors.
+	 **/
+							ThreadPool		(int threads=0);
+
+	/** Waits for the pending tasks and stops the worker threads. */
+							~ThreadPool		();
+
+	/** Queues a task for execution. Does not take the ownership. */
+	void					submit			(ThreadTask* task);
+
+	/** Blocks until all submitted tasks have been executed. */
+	void					wait			();
+
+	/** Returns the number of worker threads in the pool. */
+	int						threads			() const {return mThreads.size();}
+
+	/** Returns the number of processors available in the system. */
+	static int				processors		();
+
+  private:
+	/** Entry point of the worker threads. */
+	static void*			workerMain		(void* pool);
+
+	/** Main loop of a worker thread. */
+	void					work			();
+
+	/** Orders the first count workers to quit and joins them. */
+	void					stopWorkers		(int count);
+
+	PackArray<pthread_t>	mThreads;	/**< Worker threads. */
+	PackArray<ThreadTask*>	mQueue;		/**< Submitted tasks. */
+	int						mQueued;	/**< Number of tasks in the queue. */
+	int						mNext;		/**< Index of the next task to execute. */
+	int						mRunning;	/**< Number of tasks being executed. */
+	bool					mShutdown;	/**< Are the workers being stopped? */
+	pthread_mutex_t			mLock;		/**< Protects the queue and the counters. */
+	pthread_cond_t			mWorkReady;	/**< Signaled when tasks are submitted. */
+	pthread_cond_t			mWorkDone;	/**< Signaled when a task finishes. */
+
+	ThreadPool (const ThreadPool& other) {FORBIDDEN}
+	void operator= (const ThreadPool& other) {FORBIDDEN}
+};
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//        ----                  |              |                |            //
+//        |   )  ___            |              |                |            //
+//        |---   ___| |/ \   ---|  __  |/|/|   |      __   ___  | /          //
+//        | \   (   | |   | (   | /  \ | | |   |     /  \ |   \ |/           //
+//        |  \   \__| |   |  ---| \__/ | | |   |____ \__/  \__/ | \          //
+///////////////////////////////////////////////////////////////////////////////
+
+/** Holds a process-wide lock on the global random number generator
+ *  for its lifetime.
+ *
+ *  The generator is not thread-safe. Code that may run in a worker
+ *  thread concurrently with other tasks, such as a prediction
+ *  strategy trained in a backtest chain, must hold the lock while it
+ *  initializes networks randomly.
+ *
+ *  Example:
+ *  @code
+ *  {
+ *      RandomLock lock;
+ *      network.init (0.5);
+ *  }
+ *  @endcode
+ **/
+class RandomLock {
+  public:
+							RandomLock		() {pthread_mutex_lock (&sLock);}
+							~RandomLock		() {pthread_mutex_unlock (&sLock);}
+
+  private:
+	static pthread_mutex_t	sLock;		/**< Lock of the random number generator. */
+
+	RandomLock (const RandomLock& other) {FORBIDDEN}
+	void operator= (const RandomLock& other) {FORBIDDEN}
+};
+
+#endif
@@ -31,6 +31,69 @@
 // Local predeclarations
 class Trainer;
 class TrainingObserver;
+class Terminator;
+class NetworkPublisher;
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//   ___  |                |              o            ___                   //
+//  /   \ | _   ___   ___  |     --           _    |  |  \   ___   |   ___   //
+//  |     |/ | /   ) |   \ | /  |  )  __  | |/ \  -+- |   |  ___| -+-  ___|  //
+//  |     |  | |---  |     |/   |--  /  \ | |   |  |  |   | (   |  |  (   |  //
+//  \___/ |  |  \__   \__/ | \  |    \__/ | |   |   \ |__/   \__|   \  \__|  //
+///////////////////////////////////////////////////////////////////////////////
+
+/** Serialized state of a training run, for checkpoint files.
+ *
+ *  The network, the trainer and its terminator write their state as
+ *  a plain sequence of values, which is read back in the same order
+ *  when resuming the training.
+ **/
+class CheckpointData {
+  public:
+							CheckpointData	() : mSize (0), mReadPos (0) {}
+
+	/** Appends a value. */
+	void					put				(double value);
+
+	/** Appends a vector, including its size. */
+	void					put				(const Vector& values);
+
+	/** Reads the next value.
+	 *
+	 *  @throws invalid_format if there are no more values.
+	 **/
+	double					get				();
+
+	/** Reads the next vector, written with @ref put(const Vector&).
+	 *
+	 *  @throws invalid_format
+	 **/
+	void					get				(Vector& values);
+
+	/** Removes all values. */
+	void					clear			() {mSize = mReadPos = 0;}
+
+	/** Writes the values to a binary file. The file is written under
+	 *  a temporary name, synced and then renamed, so an interrupted
+	 *  write never destroys an earlier checkpoint.
+	 *
+	 *  @throws open_failure
+	 **/
+	void					writeFile		(const String& filename) const;
+
+	/** Reads the values from a file written with @ref writeFile().
+	 *
+	 *  @throws open_failure, invalid_format
+	 **/
+	void					readFile		(const String& filename);
+
+  private:
+	PackArray<double>	mValues;	/**< Storage, may be larger than mSize. */
+	int					mSize;		/**< Number of values stored. */
+	int					mReadPos;	/**< Index of the next value to get. */
+};
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -49,8 +112,10 @@ class TrainingObserver;
  *  Design Patterns: Strategy.
  **/
 class Trainer : public Object, public IParameterized {
+	decl_dynamic (Trainer);
   public:
 							Trainer			();
+	virtual					~Trainer		();
 
 	/** Initialize the algorithm with the given parameters.
 	 **/
@@ -69,6 +134,44 @@ class Trainer : public Object, public IParameterized {
 											 int                  cycles,
 											 const PatternSource* pValidationSet=NULL,
 											 int                  validationInterval=0);
+
+	/** Trains the network like the other train() method, but writes
+	 *  a checkpoint file every checkpointInterval cycles. If the
+	 *  checkpoint file exists, the training is resumed from it,
+	 *  including the state of the training algorithm and the
+	 *  terminator.
+	 *
+	 *  The checkpoints are written in a background thread, so the
+	 *  training is stalled only for the time of copying the state.
+	 *
+	 *  @throws open_failure, invalid_format if writing or reading a
+	 *  checkpoint fails.
+	 **/
+	double					train			(ANNetwork&           network,
+											 const PatternSource& trainset,
+											 int                  cycles,
+											 const PatternSource* pValidationSet,
+											 int                  validationInterval,
+											 const String&        checkpointFile,
+											 int                  checkpointInterval);
+
+	/** Writes the network weights and the complete training state
+	 *  to a checkpoint file. If called during training, for example
+	 *  by a @ref TrainingObserver, the state of the terminator is
+	 *  included.
+	 *
+	 *  @throws open_failure
+	 **/
+	void					saveCheckpoint	(const String& filename, const ANNetwork& network) const;
+
+	/** Restores the network weights and the training state from a
+	 *  checkpoint file. The network must have the same structure as
+	 *  when the checkpoint was written. The training can then be
+	 *  continued with the checkpointing train() method.
+	 *
+	 *  @throws open_failure, invalid_format
+	 **/
+	void					loadCheckpoint	(const String& filename, ANNetwork& network);
 	
 	/** Sets the termination method by name (UP2, GL5, etc).
 	 *
@@ -77,6 +180,20 @@ class Trainer : public Object, public IParameterized {
 	 **/
 	void					setTerminator	(const String& name) {mTerminatorName=name;}
 
+	/** Makes the terminator validate with a fixed random subsample
+	 *  of the validation patterns, using all of them every
+	 *  fullInterval'th time and to confirm new minimums. See @ref
+	 *  Terminator::setSampling().
+	 **/
+	void					setValidationSampling	(int patterns, int fullInterval=10) {mValidationSample=patterns; mFullValidationInterval=fullInterval;}
+
+	/** Makes the terminator stop a validation as soon as its result
+	 *  can not affect the decisions anymore. The validation record
+	 *  then contains lower bounds for the aborted validations. See
+	 *  @ref Terminator::setEarlyAbort().
+	 **/
+	void					setValidationAbort	(bool abort=true) {mValidationAbort=abort;}
+
 	// Informative methods
 	
 	/** Returns the number of training cycles the network has been
@@ -95,6 +212,17 @@ class Trainer : public Object, public IParameterized {
 	 **/
 	int						totalCycles		() const {return mTotalTrained;}
 
+	/** Reasons for the end of a training. */
+	enum stopReasons {BUDGET_USED=0, TERMINATED=1, VALIDATION_BELOW_TRAINING=2,
+					  OBSERVER_STOPPED=3, CHECKPOINT_FAILED=4};
+
+	/** Returns why the last training ended: the cycles were used up,
+	 *  the @ref Terminator decided to stop, the validation error fell
+	 *  below the training error, the @ref TrainingObserver stopped
+	 *  the training, or a checkpoint could not be written.
+	 **/
+	stopReasons				stopReason		() const {return mStopReason;}
+
 	/** Returns the percentual error growth between lowest validation
 	 *  error and the validation error at the end of the training.
 	 **/
@@ -120,6 +248,19 @@ class Trainer : public Object, public IParameterized {
 	/** Sets the observer object for the trainer, to track the the training progress.
 	 **/
 	void					setObserver		(TrainingObserver* observer) {pTrainingObserver=observer;}
+
+	/** Sets a publisher that receives a snapshot of the weights
+	 *  every interval training cycles and at the end of the
+	 *  training, so that the network can be used by other threads
+	 *  while it is being trained. NULL disables publishing.
+	 **/
+	void					setPublisher	(NetworkPublisher* publisher, int interval=1) {mpPublisher=publisher; mPublishInterval=interval;}
+
+	/** Makes the training continue from the current weights of the
+	 *  network instead of initializing them randomly. Used for
+	 *  retraining a network incrementally with new data.
+	 **/
+	void					setWarmStart	(bool warm=true) {mWarmStart=warm;}
 	
   protected:
 
@@ -129,6 +270,25 @@ class Trainer : public Object, public IParameterized {
 	/** Trains the pattern set once. */
 	virtual double			trainOnce		(ANNetwork& network, const PatternSource& set) const {MUST_OVERLOAD; return 0.0;}
 
+	/** Writes the internal state of the training algorithm for a
+	 *  checkpoint. Inheritors that keep state between training
+	 *  cycles must overload this and @ref loadState(), and call the
+	 *  parent implementations first.
+	 **/
+	virtual void			saveState		(CheckpointData& data) const {}
+
+	/** Reads the state written by @ref saveState(). Called after
+	 *  @ref initTrain().
+	 **/
+	virtual void			loadState		(CheckpointData& data) {}
+
+  private:
+	double					runTraining		(ANNetwork& network, const PatternSource& trainset,
+											 int cycles, const PatternSource* pValidationSet,
+											 int validationInterval, const String& checkpointFile,
+											 int checkpointInterval, bool resume);
+	void					captureState	(CheckpointData& data, const ANNetwork& network) const;
+
   protected:
 
 	/** Name of the current termination method. */
@@ -174,6 +334,38 @@ class Trainer : public Object, public IParameterized {
 	/** Observer object that gets called after every cycle.
 	 */
 	TrainingObserver*	pTrainingObserver;
+
+	/** Number of validations made in the current training. */
+	int		mValidations;
+
+	/** Terminator of the current training, or NULL. */
+	Terminator*			mpTerminator;
+
+	/** Terminator state read by @ref loadCheckpoint(), waiting for
+	 *  the resumed training to build its terminator.
+	 **/
+	CheckpointData*		mpResumeState;
+
+	/** Publisher for the weight snapshots, or NULL. */
+	NetworkPublisher*	mpPublisher;
+
+	/** Training cycles between published snapshots. */
+	int					mPublishInterval;
+
+	/** Keep the weights at the start of the training? */
+	bool				mWarmStart;
+
+	/** Size of the validation subsample, 0 for none. */
+	int					mValidationSample;
+
+	/** Interval of validations with the full validation set. */
+	int					mFullValidationInterval;
+
+	/** Abort validations early? */
+	bool				mValidationAbort;
+
+	/** Why the last training ended. */
+	stopReasons			mStopReason;
 	
 	friend class Terminator;
 };
@@ -45,13 +45,17 @@ include $(SRCDIR)/build/magicdef.mk
 sources =	annetwork.cc backprop.cc dataformat.cc equalization.cc \
 		neuron.cc rprop.cc topology.cc annfilef.cc connection.cc \
 		dataformats.cc learning.cc patternset.cc termination.cc \
-		trainer.cc prediction.cc
+		trainer.cc prediction.cc threadpool.cc crossvalidation.cc \
+		publisher.cc netstructure.cc backtest.cc levmar.cc scg.cc adaptive.cc \
+		paramsearch.cc sampler.cc
 
 
 headers =	annetwork.h backprop.h dataformats.h learning.h rprop.h tools.h \
 		annfilef.h connection.h equalization.h neuron.h termination.h \
 		topology.h annfilefs.h dataformat.h initializer.h patternset.h \
-		tfunc.h trainer.h prediction.h
+		tfunc.h trainer.h prediction.h threadpool.h crossvalidation.h \
+		publisher.h netstructure.h backtest.h matrixview.h \
+		levmar.h scg.h adaptive.h paramsearch.h sampler.h
 
 headersubdir = inanna
 
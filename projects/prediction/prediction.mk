@@ -53,6 +53,7 @@ datafiles = company_1_90-95.tsv company_1_90-99.tsv company_2_74-80.tsv
 configfiles = neuroprediction.cfg
 
 EXTRA_INCLUDE_DIRS += -I$(SRCDIR)/libinanna/include
+EXTRA_LIBS += -lpthread
 
 ################################################################################
 # Compile
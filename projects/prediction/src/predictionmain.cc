@@ -11,12 +11,20 @@
  *                                                                         *
  ***************************************************************************/
 
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <dirent.h>
 #include <magic/mapplic.h>
 #include <magic/mtextstream.h>
 
 #include <inanna/patternset.h>
+#include <inanna/dataformat.h>
 #include <inanna/trainer.h>
 #include <inanna/prediction.h>
+#include <inanna/threadpool.h>
 
 class ReportObserver : public TrainingObserver {
   public:
@@ -32,8 +40,8 @@ class ReportObserver : public TrainingObserver {
 void predict (
 	PredictionStrategy*           strategy,
 	Matrix&                       alldata,
-	Matrix&                       traindata,
-	Matrix&                       testdata,
+	const MatrixView&             traindata,
+	const MatrixView&             testdata,
 	int                           runs,
 	Array<PredictionTestResults>& allResults,
 	Matrix&                       prediction)
@@ -133,20 +141,246 @@ void report (
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-//                            |   |       o                                  //
-//                            |\ /|  ___      _                              //
-//                            | V |  ___| | |/ \                             //
-//                            | | | (   | | |   |                            //
-//                            |   |  \__| | |   |                            //
+//                        ----                  |                            //
+//                        |   )  ___   |   ___  | _                          //
+//                        |---   ___| -+- |   \ |/ |                         //
+//                        |   ) (   |  |  |     |  |                         //
+//                        |___   \__|   \  \__/ |  |                         //
 ///////////////////////////////////////////////////////////////////////////////
 
-Main ()
+/*******************************************************************************
+ * Forecasts one series of a batch: loads the data file, trains the
+ * strategy with all but the last 12 months and predicts them.
+ *
+ * The strategy is made in the main thread, as the parameter map is not
+ * safe to use concurrently; everything else is done in the task. Each
+ * run initializes the networks randomly again, which the strategies
+ * do while holding the @ref RandomLock, so the series can be trained
+ * concurrently.
+ ******************************************************************************/
+class SeriesTask : public ThreadTask {
+  public:
+					SeriesTask		(const String& filename, PredictionStrategy* strategy, int runs)
+							: mFilename (filename), mpStrategy (strategy), mRuns (runs) {mAverageError=0.0;}
+					~SeriesTask		() {delete mpStrategy;}
+	virtual void	run				();
+
+	String				mFilename;
+	PredictionStrategy*	mpStrategy;		/**< Deleted after the prediction. */
+	int					mRuns;
+	Matrix				mActual;		/**< Predicted months, with the month column. */
+	Matrix				mPrediction;	/**< Prediction averaged over the runs. */
+	double				mAverageError;	/**< Average absolute error of the prediction. */
+};
+
+void SeriesTask::run ()
 {
-	// assertmode = ASSERT_CRASH;
-	sout.autoFlush ();
+	PatternSet loaded (mFilename, 10, 0);
+	Ref<Matrix> alldataRef = loaded.getMatrix ();
+	Matrix& alldata = alldataRef.object();
 
-	readConfig ("neuroprediction.cfg");
+	int inputMonths = mpStrategy->inputMonths ();
+	if (alldata.rows < 13+inputMonths)
+		throw invalid_format (strformat ("Series '%s' has only %d months", (CONSTR) mFilename, alldata.rows));
+
+	MatrixView traindata (alldata, 0, alldata.rows-13, 1, Matrix::end);
+	MatrixView testdata (alldata, alldata.rows-12-inputMonths, Matrix::end, 1, Matrix::end);
+	int startmonth = int (alldata.get(0,0)+0.01);
+	int testmonth = int (alldata.get(alldata.rows-12-inputMonths,0)+0.1);
+
+	mPrediction.make (12, testdata.cols);
+	for (int r=0; r<mPrediction.rows; r++)
+		for (int c=0; c<mPrediction.cols; c++)
+			mPrediction.get(r,c) = 0.0;
+
+	for (int i=0; i<mRuns; i++) {
+		mpStrategy->train (traindata, startmonth);
+		mPrediction += mpStrategy->predict (testdata, testmonth);
+	}
+	mPrediction /= mRuns;
+
+	// The trained strategy is not needed any more
+	delete mpStrategy;
+	mpStrategy = NULL;
+
+	mActual = alldata.sub (alldata.rows-12, Matrix::end, 0, Matrix::end);
+	for (int r=0; r<mPrediction.rows; r++)
+		for (int c=0; c<mPrediction.cols; c++)
+			mAverageError += fabs (mActual.get(r,c+1) - mPrediction.get(r,c));
+	mAverageError /= mPrediction.rows*mPrediction.cols;
+}
+
+/*******************************************************************************
+ * Lists the series files of a batch. The source is either a directory,
+ * whose .tsv files are used, or a manifest file with one file name per
+ * line. Relative names in a manifest are relative to the manifest.
+ ******************************************************************************/
+void listSeries (const String& source, Array<String>& files)
+{
+	struct stat st;
+	if (stat (source, &st))
+		throw open_failure (strformat ("Could not find batch source '%s'.", (CONSTR) source));
+
+	if (S_ISDIR (st.st_mode)) {
+		struct dirent** entries;
+		int n = scandir (source, &entries, NULL, alphasort);
+		if (n<0)
+			throw open_failure (strformat ("Could not read batch directory '%s'.", (CONSTR) source));
+		for (int i=0; i<n; i++) {
+			String name = entries[i]->d_name;
+			if (name.length()>4 && name.right(4)==".tsv")
+				files.add (new String (source + "/" + name));
+			free (entries[i]);
+		}
+		free (entries);
+		return;
+	}
+
+	FILE* in = fopen (source, "r");
+	if (!in)
+		throw open_failure (strformat ("Could not open batch manifest '%s'.", (CONSTR) source));
+
+	const char* slash = strrchr ((CONSTR) source, '/');
+	String dir = slash? source.left (slash-(CONSTR) source+1) : String ("");
+
+	char line[4096];
+	while (fgets (line, sizeof(line), in)) {
+		// Strip the trailing whitespace and skip empty and comment lines
+		int len = strlen (line);
+		while (len>0 && isspace (line[len-1]))
+			line[--len] = '\0';
+		if (len==0 || line[0]=='#')
+			continue;
+		files.add (new String ((line[0]=='/')? String (line) : dir + line));
+	}
+	fclose (in);
+}
+
+/** Returns the current wall-clock time in seconds. */
+static double wallClock ()
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+/** Orders series tasks by decreasing file size. */
+struct SeriesOrder {
+	int		task;
+	off_t	size;
+};
+
+static int largestFirst (const void* a, const void* b)
+{
+	off_t sa = ((const SeriesOrder*) a)->size;
+	off_t sb = ((const SeriesOrder*) b)->size;
+	return (sa<sb)? 1 : (sa>sb)? -1 : 0;
+}
+
+/*******************************************************************************
+ * Forecasts every series given with the "batch" parameter with the same
+ * configuration, and writes the predictions of all the series in one
+ * output file given with "batchOutput". The file has a row for each
+ * predicted month and variable of each series.
+ *
+ * The series are forecast concurrently in "batchThreads" threads, or in
+ * one thread per processor. The workers take the next series from a
+ * shared queue as they finish the previous one, and the largest series
+ * are queued first, so that no long series is left running alone at
+ * the end. The "cacheData" parameter enables the binary caches of the
+ * series files as in a single forecast.
+ ******************************************************************************/
+void predictBatch (const StringMap& params)
+{
+	double start = wallClock ();
+
+	Array<String> files;
+	listSeries (params["batch"], files);
+	if (files.size()==0)
+		throw open_failure (strformat ("No series found in '%s'.", (CONSTR) params["batch"]));
+
+	int threads = params["batchThreads"].toInt();
+	if (threads<=0)
+		threads = ThreadPool::processors ();
+	if (threads>files.size())
+		threads = files.size();
+
+	int runs = params["runs"].toInt();
+	if (runs<1)
+		runs = 1;
 
+	// The setting is global, so it is made before the workers start
+	DataFormatLib::setCaching (params["cacheData"].toInt());
+
+	// Create a strategy for each series
+	PredictionStrategyLib& audStr = PredictionStrategyLib::instance();
+	Array<SeriesTask> tasks;
+	SeriesOrder* order = new SeriesOrder [files.size()];
+	for (int i=0; i<files.size(); i++) {
+		PredictionStrategy* strategy = audStr.create (params["strategy"].toInt());
+		strategy->make (params);
+
+		// The series are the unit of parallelism
+		strategy->setThreads (1);
+
+		tasks.add (new SeriesTask (files[i], strategy, runs));
+
+		struct stat st;
+		order[i].task = i;
+		order[i].size = stat (files[i], &st)? 0 : st.st_size;
+	}
+	qsort (order, files.size(), sizeof(SeriesOrder), largestFirst);
+
+	sout.printf ("Forecasting %d series with %s in %d threads...\n",
+				 files.size(), (CONSTR) tasks[0].mpStrategy->name(), threads);
+	ThreadPool pool (threads);
+	for (int i=0; i<files.size(); i++)
+		pool.submit (tasks.getp (order[i].task));
+	pool.wait ();
+	delete [] order;
+
+	// Write the predictions of all series in one file
+	String resultfile = params["batchOutput"].isEmpty()? String ("results/batch.tsv") : params["batchOutput"];
+	FILE* out = fopen (resultfile, "w");
+	if (!out)
+		throw open_failure (strformat ("Could not open output file '%s' for writing.", (CONSTR) resultfile));
+	fprintf (out, "series\tmonth\tvariable\tpredicted\tactual\n");
+
+	int    failed = 0;
+	double errorSum = 0.0;
+	for (int i=0; i<tasks.size(); i++) {
+		const SeriesTask& task = tasks[i];
+		if (task.failed ()) {
+			fprintf (stderr, "Series '%s' failed: %s\n", (CONSTR) task.mFilename, (CONSTR) task.error ());
+			failed++;
+			continue;
+		}
+		errorSum += task.mAverageError;
+
+		const char* slash = strrchr ((CONSTR) task.mFilename, '/');
+		const char* name = slash? slash+1 : (CONSTR) task.mFilename;
+		for (int r=0; r<task.mPrediction.rows; r++)
+			for (int c=0; c<task.mPrediction.cols; c++)
+				fprintf (out, "%s\t%d\t%d\t%f\t%f\n", name, int (task.mActual.get(r,0)+0.1),
+						 c, task.mPrediction.get(r,c), task.mActual.get(r,c+1));
+	}
+	fclose (out);
+
+	double seconds = wallClock () - start;
+	int succeeded = files.size()-failed;
+	printf ("Forecasted %d series (%d failed) in %.1f seconds, %.1f series/minute.\n",
+			succeeded, failed, seconds, (seconds>0.0)? 60.0*succeeded/seconds : 0.0);
+	if (succeeded>0)
+		printf ("Average error over the series: %f\n", errorSum/succeeded);
+	printf ("Written to '%s'.\n", (CONSTR) resultfile);
+}
+
+/*******************************************************************************
+ * Trains and tests the strategy with the single series given with the
+ * "datafile" parameter, and reports the results.
+ ******************************************************************************/
+void predictSingle ()
+{
 	//////////////////////////////////////////////////////////////////////
 	// PREPARE STRATEGY
 
@@ -167,7 +401,8 @@ Main ()
 	//////////////////////////////////////////////////////////////////////
 	// PREPARE DATA
 
-	// Load a data file
+	// Load a data file, using a binary cache of the parsed file if enabled
+	DataFormatLib::setCaching (paramMap()["cacheData"].toInt());
 	PatternSet loaded (dataDir() + paramMap()["datafile"], 10, 0);
 	fprintf (stderr, "Loaded %d samples of length %d\n", loaded.patterns, loaded.inputs+loaded.outputs);
 
@@ -177,9 +412,9 @@ Main ()
 
 	sout << "Loaded=" << loaded << "\n";
 
-	// Split it into training and test set
-	Matrix traindata = alldata.sub (0,alldata.rows-13, 1, Matrix::end);
-	Matrix testdata = alldata.sub (alldata.rows-12-strategy->inputMonths(), Matrix::end, 1, Matrix::end);
+	// Split it into training and test set, without copying
+	MatrixView traindata (alldata, 0, alldata.rows-13, 1, Matrix::end);
+	MatrixView testdata (alldata, alldata.rows-12-strategy->inputMonths(), Matrix::end, 1, Matrix::end);
 	
 	fprintf (stderr, "Train data: %d patterns with %d values\n", traindata.rows, traindata.cols);
 	fprintf (stderr, "Test  data: %d patterns with %d values\n", testdata.rows, testdata.cols);
@@ -204,5 +439,27 @@ Main ()
 	delete strategy;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+//                            |   |       o                                  //
+//                            |\ /|  ___      _                              //
+//                            | V |  ___| | |/ \                             //
+//                            | | | (   | | |   |                            //
+//                            |   |  \__| | |   |                            //
+///////////////////////////////////////////////////////////////////////////////
+
+Main ()
+{
+	// assertmode = ASSERT_CRASH;
+	sout.autoFlush ();
+
+	readConfig ("neuroprediction.cfg");
+
+	// A batch of series is forecast with the same configuration
+	if (paramMap()["batch"].isEmpty())
+		predictSingle ();
+	else
+		predictBatch (paramMap());
+}
+
 // http://www.neci.nj.nec.com/homepages/lawrence/papers/finance-tr96/latex.html
 // http://www.nodes.de/PredTimeSeries.htm
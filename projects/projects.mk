@@ -41,7 +41,7 @@ include $(SRCDIR)/build/magicdef.mk
 ################################################################################
 # Recursively compile some subprojects
 ################################################################################
-makemodules = prediction
+makemodules = prediction server
 
 # Disabled: equalizer
 
@@ -0,0 +1,750 @@
+/***************************************************************************
+ *   This is a network inference server for Inanna.                        *
+ *                                                                         *
+ *   Copyright (C) 1998-2004 Marko Grnroos <magi@iki.fi>                  *
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+
+#include <magic/mapplic.h>
+#include <magic/mtextstream.h>
+
+#include <inanna/annetwork.h>
+#include <inanna/annfilef.h>
+#include <inanna/equalization.h>
+#include <inanna/threadpool.h>
+
+class InferenceServer;
+
+/*******************************************************************************
+ * The protocol. Every message begins with a MessageHeader in the
+ * native byte order, followed by a payload of the given length. See
+ * README.md for the requests and responses.
+ ******************************************************************************/
+struct MessageHeader {
+	uint32_t	magic;		/**< REQUEST_MAGIC or RESPONSE_MAGIC. */
+	int32_t		code;		/**< Request type or response status. */
+	int32_t		model;		/**< Index of the model. */
+	uint32_t	length;		/**< Length of the payload in bytes. */
+};
+
+enum magics		{REQUEST_MAGIC=0x51524e49 /* "INRQ" */, RESPONSE_MAGIC=0x53524e49 /* "INRS" */};
+enum requests	{LOOKUP=1, EVALUATE=2, METRICS=3};
+enum statuses	{STATUS_OK=0, STATUS_BAD_REQUEST=1, STATUS_NO_MODEL=2, STATUS_FAILED=3};
+enum {MAX_PAYLOAD=64*1024*1024};
+
+/** Returns the current time in microseconds. */
+static double now ()
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec*1E6 + tv.tv_usec;
+}
+
+static bool readFully (int fd, void* buffer, size_t length)
+{
+	char* pos = (char*) buffer;
+	while (length > 0) {
+		ssize_t got = read (fd, pos, length);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			return false;
+		pos += got;
+		length -= got;
+	}
+	return true;
+}
+
+static bool writeFully (int fd, const void* buffer, size_t length)
+{
+	const char* pos = (const char*) buffer;
+	while (length > 0) {
+		ssize_t written = write (fd, pos, length);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return false;
+		pos += written;
+		length -= written;
+	}
+	return true;
+}
+
+static bool respond (int fd, int status, int model, const void* payload, size_t length)
+{
+	MessageHeader header;
+	header.magic  = RESPONSE_MAGIC;
+	header.code   = status;
+	header.model  = model;
+	header.length = length;
+	return writeFully (fd, &header, sizeof (header)) && writeFully (fd, payload, length);
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//               |   | o                                                     //
+//               |   |    ____  |                  ___                       //
+//               |---| | (     -+-  __   ___  |/\  ___| |/|/|                //
+//               |   | |  \__   |  /  \ (   \ |   (   | | | |                //
+//               |   | | ____)   \ \__/  ---/ |    \__| | | |                //
+//                                        __/                                //
+///////////////////////////////////////////////////////////////////////////////
+
+/** Histogram with buckets of doubling size, printed in the text
+ *  format of Prometheus.
+ **/
+class Histogram {
+  public:
+					Histogram	();
+
+	void			add			(double value);
+	void			print		(String& out, const char* name) const;
+
+	enum {BUCKETS=24};
+
+  private:
+	long	mBuckets [BUCKETS];	/**< Bucket i counts the values up to 2^i. */
+	long	mCount;
+	double	mSum;
+};
+
+Histogram::Histogram () : mCount (0), mSum (0.0)
+{
+	for (int b=0; b<BUCKETS; b++)
+		mBuckets[b] = 0;
+}
+
+void Histogram::add (double value)
+{
+	int b = 0;
+	for (double limit=1.0; b<BUCKETS-1 && value>limit; limit*=2)
+		b++;
+	mBuckets[b]++;
+	mCount++;
+	mSum += value;
+}
+
+void Histogram::print (String& out, const char* name) const
+{
+	long cumulative = 0;
+	double limit = 1.0;
+	for (int b=0; b<BUCKETS; b++, limit*=2) {
+		cumulative += mBuckets[b];
+		if (b < BUCKETS-1)
+			out += format ("%s_bucket{le=\"%.0f\"} %ld\n", name, limit, cumulative);
+		else
+			out += format ("%s_bucket{le=\"+Inf\"} %ld\n", name, cumulative);
+	}
+	out += format ("%s_sum %.0f\n%s_count %ld\n", name, mSum, name, mCount);
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//             ----                  |    -----             |                //
+//             |   )  ___   |   ___  | _    |    ___   ____ |                //
+//             |---   ___| -+- |   \ |/ |   |    ___| (     | /              //
+//             |   ) (   |  |  |     |  |   |   (   |  \__  |/               //
+//             |___   \__|   \  \__/ |  |   |    \__| ____) | \              //
+///////////////////////////////////////////////////////////////////////////////
+
+/** A request for evaluating one or more input vectors, waiting in
+ *  the queue of the server.
+ **/
+struct PendingRequest {
+	int					model;
+	int					rows;		/**< Number of input vectors. */
+	const double*		input;
+	double*				output;
+	double				arrival;	/**< Time of arrival in microseconds. */
+	bool				done;
+	bool				failed;		/**< Did the evaluation fail? */
+	pthread_cond_t*		pDone;		/**< Signaled when the request is done. */
+	PendingRequest*		next;
+};
+
+/** Evaluates a batch of requests for the same model in a worker
+ *  thread.
+ **/
+class BatchTask : public ThreadTask {
+  public:
+							BatchTask		(InferenceServer& server) : mServer (server), mCount (0), mRows (0) {}
+
+	/** Adds a request to the batch. */
+	void					add				(PendingRequest* request);
+
+	/** Evaluates the batch and completes the requests. */
+	virtual void			run				();
+
+	int						rows			() const {return mRows;}
+
+  private:
+	InferenceServer&			mServer;
+	int							mModel;
+	PackArray<PendingRequest*>	mRequests;
+	int							mCount;		/**< Number of requests in the batch. */
+	int							mRows;		/**< Number of input vectors in the batch. */
+	PackArray<double>			mInput;
+	PackArray<double>			mOutput;
+	PackArray<double>			mWork;
+
+	friend class InferenceServer;
+};
+
+
+
+/////////////////////////////////////////////////////////////////////////////////////
+// ---                                              ----                           //
+//  |    _    __  ___       ___    _          ___  (      ___             ___      //
+//  |  |/ \  /   /   ) |/\ /   ) |/ \  |   \ /   )  ---  /   ) |/\ |   | /   ) |/\ //
+//  |  |   | +-- |---  |   |---  |   | |     |---      ) |---  |    \ /  |---  |   //
+// _|_ |   | |    \__  |    \__  |   |  \__/  \__  ___/   \__  |     V    \__  |   //
+//           |                                                                     //
+/////////////////////////////////////////////////////////////////////////////////////
+
+/** Serves networks over a local socket.
+ *
+ *  Every client connection has its own thread, which puts the
+ *  evaluation requests into a queue and waits for them. A batcher
+ *  thread collects the queued requests for the same model into
+ *  batches, waiting at most the latency budget for a batch to fill
+ *  up, and gives them to a pool of workers. While all the workers
+ *  are busy, the requests pile up into larger batches.
+ **/
+class InferenceServer {
+  public:
+	/** Takes the settings from the parameters "workers", "maxBatch"
+	 *  and "batchDelay".
+	 **/
+							InferenceServer	(const StringMap& params);
+
+	/** Loads a network file, in the binary format or any other
+	 *  format known by @ref ANNFileFormatLib. The equalizer of the
+	 *  network, if any, is applied to the inputs and outputs, so it
+	 *  must have one plane for all the columns or a plane for each
+	 *  input followed by each output.
+	 *
+	 *  @throws open_failure, invalid_format
+	 **/
+	void					loadModel		(const String& name, const String& filename);
+
+	/** Listens to the Unix domain socket, or to the TCP port on the
+	 *  loopback interface if the socket name is empty. Never returns.
+	 *
+	 *  @throws open_failure
+	 **/
+	void					run				(const String& socketName, int port);
+
+  private:
+	int						findModel		(const String& name) const;
+	int						openListener	(const String& socketName, int port) const;
+	void					serveClient		(int fd);
+	void					evaluate		(PendingRequest& request);
+	void					batchLoop		();
+	void					finishBatch		(BatchTask& task);
+	String					metrics			();
+
+	static void*			batcherMain		(void* server);
+	static void*			clientMain		(void* client);
+
+	Array<String>					mNames;			/**< Names of the models. */
+	PackArray<MappedANNetwork*>		mModels;
+	PackArray<MatrixEqualizer*>		mEqualizers;	/**< Equalizers of the models, or NULL. */
+	int								mMaxBatch;		/**< Maximum number of input vectors in a batch. */
+	double							mBatchDelay;	/**< Latency budget for filling a batch, in microseconds. */
+	ThreadPool						mPool;
+
+	pthread_mutex_t					mLock;			/**< Protects everything below. */
+	pthread_cond_t					mChanged;		/**< Signaled for new requests and free tasks. */
+	PendingRequest*					mpHead;			/**< Oldest queued request. */
+	PendingRequest*					mpTail;			/**< Newest queued request. */
+	PackArray<int>					mQueuedRows;	/**< Queued input vectors for each model. */
+	int								mQueueLength;	/**< Number of queued requests. */
+	int								mQueueRows;		/**< Number of queued input vectors. */
+	PackArray<BatchTask*>			mFreeTasks;		/**< Tasks not being executed. */
+	int								mFree;			/**< Number of free tasks. */
+
+	// Metrics
+	long							mRequests;
+	long							mBatches;
+	long							mErrors;
+	long							mFailures;		/**< Requests whose evaluation failed. */
+	int								mMaxQueueRows;
+	Histogram						mLatency;		/**< From arrival to response, in microseconds. */
+	Histogram						mBatchSizes;	/**< Input vectors in each batch. */
+	Histogram						mQueueDepths;	/**< Queued input vectors at each arrival. */
+	friend class BatchTask;
+};
+
+/** Arguments of a client thread. */
+struct ClientThread {
+	InferenceServer*	server;
+	int					fd;
+};
+
+void BatchTask::add (PendingRequest* request)
+{
+	if (mCount == mRequests.size())
+		mRequests.resize ((mCount>0)? 2*mCount : 16);
+	mRequests[mCount++] = request;
+	mRows += request->rows;
+}
+
+/** Returns the equalizer plane of the given input or output column. */
+static const Equalizer& columnEqualizer (const MatrixEqualizer& equalizer, int column)
+{
+	return equalizer.getPlane ((equalizer.planes() == 1)? 0 : column);
+}
+
+void BatchTask::run ()
+{
+	// The waiting clients must be released even if the evaluation
+	// fails, so the failure is reported in the requests
+	bool failed = false;
+	try {
+		const MappedANNetwork& net = *mServer.mModels[mModel];
+		const MatrixEqualizer* equalizer = mServer.mEqualizers[mModel];
+		int ins = net.inputs ();
+		int outs = net.outputs ();
+		if (mInput.size() < mRows*ins)
+			mInput.resize (mRows*ins);
+		if (mOutput.size() < mRows*outs)
+			mOutput.resize (mRows*outs);
+		if (mWork.size() < mRows*net.units())
+			mWork.resize (mRows*net.units());
+
+		for (int r=0, row=0; r<mCount; row+=mRequests[r++]->rows)
+			memcpy (&mInput[row*ins], mRequests[r]->input, mRequests[r]->rows*ins*sizeof(double));
+		if (equalizer)
+			for (int i=0; i<ins; i++)
+				columnEqualizer (*equalizer, i).equalizeStrided (&mInput[i], mRows, ins);
+
+		net.evaluateBatch (&mInput[0], &mOutput[0], mRows, &mWork[0]);
+
+		if (equalizer)
+			for (int j=0; j<outs; j++)
+				columnEqualizer (*equalizer, ins+j).unequalizeStrided (&mOutput[j], mRows, outs);
+		for (int r=0, row=0; r<mCount; row+=mRequests[r++]->rows)
+			memcpy (mRequests[r]->output, &mOutput[row*outs], mRequests[r]->rows*outs*sizeof(double));
+	} catch (...) {
+		failed = true;
+	}
+
+	for (int r=0; r<mCount; r++)
+		mRequests[r]->failed = failed;
+	mServer.finishBatch (*this);
+}
+
+InferenceServer::InferenceServer (const StringMap& params)
+		: mPool (params["workers"].toInt())
+{
+	mMaxBatch   = params["maxBatch"].toInt ();
+	mBatchDelay = params["batchDelay"].toDouble ();
+	if (mMaxBatch < 1)
+		mMaxBatch = 1;
+
+	pthread_mutex_init (&mLock, NULL);
+	pthread_cond_init (&mChanged, NULL);
+	mpHead = mpTail = NULL;
+	mQueueLength = mQueueRows = mMaxQueueRows = 0;
+	mRequests = mBatches = mErrors = mFailures = 0;
+
+	// One task for each worker, so a batch is formed only when a
+	// worker is free to take it
+	mFreeTasks.make (mPool.threads ());
+	for (mFree=0; mFree<mFreeTasks.size(); mFree++)
+		mFreeTasks[mFree] = new BatchTask (*this);
+}
+
+void InferenceServer::loadModel (const String& name, const String& filename)
+{
+	MappedANNetwork* model;
+	MatrixEqualizer* equalizer = NULL;
+	if (BinaryANNFormat::isBinary (filename)) {
+		model = new MappedANNetwork (filename);
+		equalizer = model->makeEqualizer ();
+	} else {
+		ANNetwork net;
+		ANNFileFormatLib::load (filename, net);
+		model = new MappedANNetwork (net);
+		if (const Equalizer* eq = net.getEqualizer()) {
+			const MatrixEqualizer* meq = dynamic_cast<const MatrixEqualizer*> (eq);
+			equalizer = meq? meq->clone () : NULL;
+			if (!equalizer) {
+				delete model;
+				throw invalid_format (format (i18n("Model '%s' has an equalizer that is not a MatrixEqualizer"),
+											  (CONSTR) name));
+			}
+		}
+	}
+
+	int columns = model->inputs() + model->outputs();
+	if (equalizer && equalizer->planes() != 1 && equalizer->planes() != columns) {
+		int planes = equalizer->planes ();
+		delete equalizer;
+		delete model;
+		throw invalid_format (format (i18n("Model '%s' has %d equalization planes, expected 1 or %d"),
+									  (CONSTR) name, planes, columns));
+	}
+	if (equalizer)
+		equalizer->prepare ();
+
+	mNames.add (new String (name));
+	mModels.resize (mModels.size()+1);
+	mModels[mModels.size()-1] = model;
+	mEqualizers.resize (mModels.size());
+	mEqualizers[mModels.size()-1] = equalizer;
+	mQueuedRows.resize (mModels.size());
+	mQueuedRows[mModels.size()-1] = 0;
+
+	fprintf (stderr, "Loaded model '%s' from %s: %d inputs, %d outputs, %d connections%s\n",
+			 (CONSTR) name, (CONSTR) filename, model->inputs(), model->outputs(), model->connections(),
+			 equalizer? ", equalized" : "");
+}
+
+int InferenceServer::findModel (const String& name) const
+{
+	for (int i=0; i<mNames.size(); i++)
+		if (mNames[i] == name)
+			return i;
+	return -1;
+}
+
+int InferenceServer::openListener (const String& socketName, int port) const
+{
+	int fd;
+	if (!socketName.isEmpty()) {
+		struct sockaddr_un address;
+		memset (&address, 0, sizeof (address));
+		address.sun_family = AF_UNIX;
+		if (socketName.length() >= int (sizeof (address.sun_path)))
+			throw open_failure (format (i18n("Socket name '%s' is too long"), (CONSTR) socketName));
+		strcpy (address.sun_path, socketName);
+		unlink (socketName);
+
+		fd = socket (AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0 || bind (fd, (struct sockaddr*) &address, sizeof (address)) < 0)
+			throw open_failure (format (i18n("Could not bind to socket '%s': %s"),
+										(CONSTR) socketName, strerror (errno)));
+	} else {
+		struct sockaddr_in address;
+		memset (&address, 0, sizeof (address));
+		address.sin_family      = AF_INET;
+		address.sin_port        = htons (port);
+		address.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+		fd = socket (AF_INET, SOCK_STREAM, 0);
+		int reuse = 1;
+		if (fd >= 0)
+			setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof (reuse));
+		if (fd < 0 || bind (fd, (struct sockaddr*) &address, sizeof (address)) < 0)
+			throw open_failure (format (i18n("Could not bind to port %d: %s"), port, strerror (errno)));
+	}
+
+	if (listen (fd, 64) < 0)
+		throw open_failure (format (i18n("Could not listen: %s"), strerror (errno)));
+	return fd;
+}
+
+void InferenceServer::run (const String& socketName, int port)
+{
+	int listener = openListener (socketName, port);
+	signal (SIGPIPE, SIG_IGN);
+
+	pthread_t batcher;
+	pthread_create (&batcher, NULL, batcherMain, this);
+	fprintf (stderr, "Serving %d models with %d workers\n", mModels.size(), mPool.threads());
+
+	while (true) {
+		int fd = accept (listener, NULL, NULL);
+		if (fd < 0) {
+			if (errno != EINTR)
+				perror ("accept");
+			continue;
+		}
+		if (socketName.isEmpty()) {
+			int nodelay = 1;
+			setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof (nodelay));
+		}
+
+		ClientThread* client = new ClientThread;
+		client->server = this;
+		client->fd     = fd;
+		pthread_t thread;
+		if (pthread_create (&thread, NULL, clientMain, client) != 0) {
+			close (fd);
+			delete client;
+			continue;
+		}
+		pthread_detach (thread);
+	}
+}
+
+/*static*/ void* InferenceServer::clientMain (void* arg)
+{
+	ClientThread* client = (ClientThread*) arg;
+	client->server->serveClient (client->fd);
+	close (client->fd);
+	delete client;
+	return NULL;
+}
+
+/*******************************************************************************
+ * Reads and answers the requests of one client until the connection
+ * is closed or the client violates the protocol.
+ ******************************************************************************/
+void InferenceServer::serveClient (int fd)
+{
+	pthread_cond_t done;
+	pthread_cond_init (&done, NULL);
+	PackArray<double> payload;
+	PackArray<double> output;
+
+	MessageHeader header;
+	while (readFully (fd, &header, sizeof (header))) {
+		if (header.magic != REQUEST_MAGIC || header.length > MAX_PAYLOAD)
+			break;
+
+		// Read the payload to a buffer aligned for doubles, with room
+		// for terminating a name
+		int words = header.length/sizeof(double) + 1;
+		if (payload.size() < words)
+			payload.resize (words);
+		char* bytes = (char*) &payload[0];
+		if (!readFully (fd, bytes, header.length))
+			break;
+		bytes[header.length] = '\0';
+
+		bool ok = true;
+		if (header.code == LOOKUP) {
+			int model = findModel (bytes);
+			if (model < 0)
+				ok = respond (fd, STATUS_NO_MODEL, -1, NULL, 0);
+			else {
+				int32_t shape[2] = {mModels[model]->inputs(), mModels[model]->outputs()};
+				ok = respond (fd, STATUS_OK, model, shape, sizeof (shape));
+			}
+		} else if (header.code == EVALUATE) {
+			int model = header.model;
+			size_t rowSize = (model>=0 && model<mModels.size())? mModels[model]->inputs()*sizeof(double) : 0;
+			if (rowSize == 0 || header.length == 0 || header.length % rowSize != 0) {
+				pthread_mutex_lock (&mLock);
+				mErrors++;
+				pthread_mutex_unlock (&mLock);
+				ok = respond (fd, (rowSize==0)? STATUS_NO_MODEL : STATUS_BAD_REQUEST, model, NULL, 0);
+			} else {
+				PendingRequest request;
+				request.model = model;
+				request.rows  = header.length / rowSize;
+				request.input = &payload[0];
+				request.pDone = &done;
+				int outs = mModels[model]->outputs ();
+				if (output.size() < request.rows*outs)
+					output.resize (request.rows*outs);
+				request.output = &output[0];
+
+				evaluate (request);
+				if (request.failed)
+					ok = respond (fd, STATUS_FAILED, model, NULL, 0);
+				else
+					ok = respond (fd, STATUS_OK, model, &output[0], request.rows*outs*sizeof(double));
+			}
+		} else if (header.code == METRICS) {
+			String text = metrics ();
+			ok = respond (fd, STATUS_OK, -1, (CONSTR) text, text.length());
+		} else
+			ok = respond (fd, STATUS_BAD_REQUEST, -1, NULL, 0);
+
+		if (!ok)
+			break;
+	}
+
+	pthread_cond_destroy (&done);
+}
+
+/*******************************************************************************
+ * Queues the request and waits until a worker has evaluated it.
+ ******************************************************************************/
+void InferenceServer::evaluate (PendingRequest& request)
+{
+	pthread_mutex_lock (&mLock);
+	request.arrival = now ();
+	request.done    = false;
+	request.failed  = false;
+	request.next    = NULL;
+	if (mpTail)
+		mpTail->next = &request;
+	else
+		mpHead = &request;
+	mpTail = &request;
+
+	mQueuedRows[request.model] += request.rows;
+	mQueueLength++;
+	mQueueRows += request.rows;
+	if (mQueueRows > mMaxQueueRows)
+		mMaxQueueRows = mQueueRows;
+	mQueueDepths.add (mQueueRows);
+	mRequests++;
+	pthread_cond_signal (&mChanged);
+
+	while (!request.done)
+		pthread_cond_wait (request.pDone, &mLock);
+	pthread_mutex_unlock (&mLock);
+}
+
+/*static*/ void* InferenceServer::batcherMain (void* server)
+{
+	static_cast<InferenceServer*> (server)->batchLoop ();
+	return NULL;
+}
+
+/*******************************************************************************
+ * Forms the batches. A batch is formed for the model of the oldest
+ * request, when a worker is free and either there are enough
+ * requests for a full batch or the oldest request has waited for
+ * its latency budget. Only this thread removes requests from the
+ * queue.
+ ******************************************************************************/
+void InferenceServer::batchLoop ()
+{
+	pthread_mutex_lock (&mLock);
+	while (true) {
+		if (!mpHead || mFree == 0) {
+			pthread_cond_wait (&mChanged, &mLock);
+			continue;
+		}
+
+		// Give the batch time to fill up
+		double deadline = mpHead->arrival + mBatchDelay;
+		if (mQueuedRows[mpHead->model] < mMaxBatch && now() < deadline) {
+			struct timespec until;
+			until.tv_sec  = time_t (deadline/1E6);
+			until.tv_nsec = long ((deadline - until.tv_sec*1E6)*1000);
+			pthread_cond_timedwait (&mChanged, &mLock, &until);
+			continue;
+		}
+
+		// Take the requests for the same model, oldest first. The
+		// oldest request is always taken, even if it is larger than
+		// a full batch.
+		BatchTask* task = mFreeTasks[--mFree];
+		task->mModel = mpHead->model;
+		task->mCount = task->mRows = 0;
+		PendingRequest* previous = NULL;
+		for (PendingRequest* request=mpHead, *next; request; request=next) {
+			next = request->next;
+			if (request->model == task->mModel &&
+				(task->mRows == 0 || task->mRows + request->rows <= mMaxBatch)) {
+				if (previous)
+					previous->next = next;
+				else
+					mpHead = next;
+				if (mpTail == request)
+					mpTail = previous;
+
+				task->add (request);
+				mQueuedRows[request->model] -= request->rows;
+				mQueueRows -= request->rows;
+				mQueueLength--;
+			} else
+				previous = request;
+		}
+
+		mBatches++;
+		mBatchSizes.add (task->rows ());
+		mPool.submit (task);
+	}
+}
+
+/*******************************************************************************
+ * Called by the worker when a batch has been evaluated.
+ ******************************************************************************/
+void InferenceServer::finishBatch (BatchTask& task)
+{
+	pthread_mutex_lock (&mLock);
+	double finished = now ();
+	for (int r=0; r<task.mCount; r++) {
+		PendingRequest* request = task.mRequests[r];
+		mLatency.add (finished - request->arrival);
+		if (request->failed)
+			mFailures++;
+		request->done = true;
+		pthread_cond_signal (request->pDone);
+	}
+
+	mFreeTasks[mFree++] = &task;
+	pthread_cond_signal (&mChanged);
+	pthread_mutex_unlock (&mLock);
+}
+
+String InferenceServer::metrics ()
+{
+	pthread_mutex_lock (&mLock);
+	String result;
+	result += format ("inanna_requests_total %ld\n", mRequests);
+	result += format ("inanna_bad_requests_total %ld\n", mErrors);
+	result += format ("inanna_failed_requests_total %ld\n", mFailures);
+	result += format ("inanna_batches_total %ld\n", mBatches);
+	result += format ("inanna_queue_requests %d\n", mQueueLength);
+	result += format ("inanna_queue_depth %d\n", mQueueRows);
+	result += format ("inanna_queue_depth_max %d\n", mMaxQueueRows);
+	result += format ("inanna_busy_workers %d\n", mFreeTasks.size()-mFree);
+	mLatency.print (result, "inanna_latency_us");
+	mBatchSizes.print (result, "inanna_batch_size");
+	mQueueDepths.print (result, "inanna_queue_depth_on_arrival");
+	pthread_mutex_unlock (&mLock);
+	return result;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//                            |   |       o                                  //
+//                            |\ /|  ___      _                              //
+//                            | V |  ___| | |/ \                             //
+//                            | | | (   | | |   |                            //
+//                            |   |  \__| | |   |                            //
+///////////////////////////////////////////////////////////////////////////////
+
+Main ()
+{
+	readConfig ("inannaserver.cfg");
+
+	InferenceServer server (paramMap());
+
+	// The models are given as "name:file" pairs separated by spaces
+	Array<String> models;
+	paramMap()["models"].split (models, ' ');
+	for (int i=0; i<models.size(); i++) {
+		if (models[i].isEmpty())
+			continue;
+		Array<String> parts;
+		models[i].split (parts, ':');
+		if (parts.size() != 2)
+			throw invalid_format (format (i18n("Invalid model definition '%s', expected name:file"),
+										  (CONSTR) models[i]));
+		server.loadModel (parts[0], parts[1]);
+	}
+
+	server.run (paramMap()["socket"], paramMap()["port"].toInt());
+}
@@ -0,0 +1,365 @@
+/***************************************************************************
+ *   This file is part of the Inanna library.                              *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include <magic/mclass.h>
+#include "inanna/adaptive.h"
+#include "inanna/patternset.h"
+
+impl_dynamic (MiniBatchTrainer, {BackpropTrainer});
+impl_dynamic (AdamTrainer, {MiniBatchTrainer});
+impl_dynamic (AdaGradTrainer, {MiniBatchTrainer});
+impl_dynamic (RMSPropTrainer, {AdaGradTrainer});
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//|   | o       o ----                  |    -----           o               //
+//|\ /|     _     |   )  ___   |   ___  | _    |        ___      _    ___    //
+//| V | | |/ \  | |---   ___| -+- |   \ |/ |   |   |/\  ___| | |/ \  /   ) |/\//
+//| | | | |   | | |   ) (   |  |  |     |  |   |   |   (   | | |   | |---  | //
+//|   | | |   | | |___   \__|   \  \__/ |  |   |   |    \__| | |   |  \__  | //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/*virtual*/ void MiniBatchTrainer::init (const StringMap& params)
+{
+	Trainer::init (params);
+
+	INITPARAMS(params, 
+			   mEta			= params["MiniBatchTrainer.eta"].toDouble();
+			   mBatchSize	= params["MiniBatchTrainer.batchSize"].toInt();
+			   mDecay		= params["BackpropTrainer.decay"].toDouble();
+		);
+
+	// Defaults for missing parameters
+	if (mEta <= 0.0)
+		mEta = 0.001;
+	if (mBatchSize <= 0)
+		mBatchSize = 32;
+	if (mDecay <= 0.0)
+		mDecay = 1.0;
+	mMomentum = 0.0;
+	mBatchLearning = false;
+	initSampling (params);
+}
+
+/*virtual*/ Array<DynParameter>* MiniBatchTrainer::parameters () const
+{
+	Array<DynParameter>* result = new Array<DynParameter>;
+	result->add (new DoubleParameter	("eta", i18n("Learning rate"), 15, 0.0, 1.0, 0.001));
+	result->add (new IntParameter		("batchSize", i18n("Patterns in a mini-batch"), 1, 100000, 32));
+	result->add (new DoubleParameter	("decay", i18n("Weight decay multiplier"), 15, 0.5, 1.0, 1.0));
+	result->add (new IntParameter		("maxCycles", i18n("Max training cycles"), 1, 100000, 100));
+	result->add (new BoolParameter		("importanceSampling", i18n("Draw patterns by their errors")));
+	result->add (new DoubleParameter	("samplingFloor", i18n("Share of uniform sampling"), 15, 0.0, 1.0, 0.1));
+
+	return result;
+}
+
+/** Implementation for BackpropTrainer. Initializes training. */
+/*virtual*/ void MiniBatchTrainer::initTrain (ANNetwork& network) const
+{
+	BackpropTrainer::initTrain (network);
+
+	mGradient.make (mWeightDeltas.size());
+	for (int i=0; i<mGradient.size(); i++)
+		mGradient[i] = 0.0;
+	mBatchPatterns = 0;
+	mSteps = 0;
+}
+
+/*******************************************************************************
+ * Implementation for Trainer. Goes through the patterns in a random
+ * order and updates the weights after every mini-batch; the last
+ * batch of the cycle may be smaller.
+ ******************************************************************************/
+/*virtual*/ double MiniBatchTrainer::trainOnce (ANNetwork& network, const PatternSource& set) const
+{
+	// Shuffle the patterns, or draw them by importance
+	orderPatterns (set, true);
+
+	double sse=0.0;
+	for (int p=0; p<set.patterns; p++) {
+		sse += trainDrawn (network, set, mOrder[p]);
+		if (mBatchPatterns >= mBatchSize || p == set.patterns-1)
+			updateWeights (network);
+	}
+
+	mCycleError = sse/set.patterns;
+	return mCycleError; // Return MSE
+}
+
+/*******************************************************************************
+ * Implementation for BackpropTrainer. Sums the error gradients of the
+ * weights, as in RPropTrainer. Units without incoming connections are
+ * not transferred, so their bias has no gradient.
+ ******************************************************************************/
+/*virtual*/ void MiniBatchTrainer::backpropagate (ANNetwork& network,
+												  const PatternSource& set,
+												  int p) const
+{
+	BackpropTrainer::backpropagate (network, set, p);
+
+	for (int j=network.size()-1, ji=0; j>=0; j--) {
+		if (network[j].incomings() == 0) {
+			ji++;
+			continue;
+		}
+		for (int i=-1; i<network[j].incomings(); i++, ji++)
+			if (i==-1) // Bias
+				mGradient[ji] -= mError[j];
+			else // Weight
+				mGradient[ji] -= mError[j] * network[j].incoming(i).source().activation();
+	}
+	mBatchPatterns++;
+}
+
+/** Updates weights with the mean gradient of the mini-batch. */
+/*virtual*/ void MiniBatchTrainer::updateWeights (ANNetwork& network) const
+{
+	if (mBatchPatterns == 0)
+		return;
+	mSteps++;
+
+	for (int j=network.size()-1, ji=0; j>=0; j--) {
+		for (int i=-1; i<network[j].incomings(); i++, ji++) {
+			Connection& conn = (i==-1)? network[j].getBiasObj() : network[j].incoming(i);
+
+			// Mean gradient with weight decay
+			double gradient_ji = mGradient[ji]/mBatchPatterns + (1-mDecay)*conn.weight();
+			mWeightDeltas[ji] = weightChange (ji, gradient_ji);
+
+			if (i==-1)
+				network[j].setBias (network[j].bias() + mWeightDeltas[ji]);
+			else
+				conn.setWeight (conn.weight() + mWeightDeltas[ji]);
+			mGradient[ji] = 0.0;
+		}
+	}
+	mBatchPatterns = 0;
+}
+
+/*******************************************************************************
+ * Implementation for Trainer. A checkpoint is made between training
+ * cycles, when the mini-batch gradient is always empty.
+ ******************************************************************************/
+/*virtual*/ void MiniBatchTrainer::saveState (CheckpointData& data) const
+{
+	BackpropTrainer::saveState (data);
+	data.put (mSteps);
+}
+
+/*virtual*/ void MiniBatchTrainer::loadState (CheckpointData& data)
+{
+	BackpropTrainer::loadState (data);
+	mSteps = int (data.get ());
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//           _       |             -----           o                         //
+//          / \      |  ___          |        ___      _    ___              //
+//         /   \  ---|  ___| |/|/|   |   |/\  ___| | |/ \  /   ) |/\         //
+//         |---| (   | (   | | | |   |   |   (   | | |   | |---  |           //
+//         |   |  ---|  \__| | | |   |   |    \__| | |   |  \__  |           //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/*virtual*/ void AdamTrainer::init (const StringMap& params)
+{
+	MiniBatchTrainer::init (params);
+
+	INITPARAMS(params, 
+			   mBeta1	= params["AdamTrainer.beta1"].toDouble();
+			   mBeta2	= params["AdamTrainer.beta2"].toDouble();
+			   mEpsilon	= params["AdamTrainer.epsilon"].toDouble();
+		);
+
+	if (mBeta1 <= 0.0 || mBeta1 >= 1.0)
+		mBeta1 = 0.9;
+	if (mBeta2 <= 0.0 || mBeta2 >= 1.0)
+		mBeta2 = 0.999;
+	if (mEpsilon <= 0.0)
+		mEpsilon = 1E-8;
+}
+
+/*virtual*/ Array<DynParameter>* AdamTrainer::parameters () const
+{
+	Array<DynParameter>* result = MiniBatchTrainer::parameters ();
+	result->add (new DoubleParameter	("beta1", i18n("First moment decay rate"), 15, 0.0, 1.0, 0.9));
+	result->add (new DoubleParameter	("beta2", i18n("Second moment decay rate"), 15, 0.0, 1.0, 0.999));
+	result->add (new DoubleParameter	("epsilon", i18n("Denominator offset"), 15, 0.0, 1.0, 1E-8));
+
+	return result;
+}
+
+/*virtual*/ void AdamTrainer::initTrain (ANNetwork& network) const
+{
+	MiniBatchTrainer::initTrain (network);
+
+	mMoment1.make (mWeightDeltas.size());
+	mMoment2.make (mWeightDeltas.size());
+	for (int i=0; i<mMoment1.size(); i++)
+		mMoment1[i] = mMoment2[i] = 0.0;
+}
+
+/** Computes the bias corrections of the step, before updating the weights. */
+/*virtual*/ void AdamTrainer::updateWeights (ANNetwork& network) const
+{
+	mCorrection1 = 1.0 - pow (mBeta1, mSteps+1);
+	mCorrection2 = 1.0 - pow (mBeta2, mSteps+1);
+	MiniBatchTrainer::updateWeights (network);
+}
+
+/*virtual*/ double AdamTrainer::weightChange (int ji, double gradient) const
+{
+	mMoment1[ji] = mBeta1*mMoment1[ji] + (1.0-mBeta1)*gradient;
+	mMoment2[ji] = mBeta2*mMoment2[ji] + (1.0-mBeta2)*gradient*gradient;
+	return -mEta * (mMoment1[ji]/mCorrection1) / (sqrt (mMoment2[ji]/mCorrection2) + mEpsilon);
+}
+
+/*virtual*/ void AdamTrainer::saveState (CheckpointData& data) const
+{
+	MiniBatchTrainer::saveState (data);
+	data.put (mMoment1);
+	data.put (mMoment2);
+}
+
+/*virtual*/ void AdamTrainer::loadState (CheckpointData& data)
+{
+	MiniBatchTrainer::loadState (data);
+	Vector moment1, moment2;
+	data.get (moment1);
+	data.get (moment2);
+	if (moment1.size() != mMoment1.size() || moment2.size() != mMoment2.size())
+		throw invalid_format (i18n("Checkpoint has wrong number of moment values"));
+	for (int i=0; i<moment1.size(); i++) {
+		mMoment1[i] = moment1[i];
+		mMoment2[i] = moment2[i];
+	}
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//   _       |        ___                | -----           o                 //
+//  / \      |  ___  /   \      ___      |   |        ___      _    ___      //
+// /   \  ---|  ___| |  __ |/\  ___|  ---|   |   |/\  ___| | |/ \  /   ) |/\ //
+// |---| (   | (   | |   | |   (   | (   |   |   |   (   | | |   | |---  |   //
+// |   |  ---|  \__| \___/ |    \__|  ---|   |   |    \__| | |   |  \__  |   //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/*virtual*/ void AdaGradTrainer::init (const StringMap& params)
+{
+	MiniBatchTrainer::init (params);
+
+	INITPARAMS(params, 
+			   mEpsilon	= params["AdaGradTrainer.epsilon"].toDouble();
+		);
+
+	if (mEpsilon <= 0.0)
+		mEpsilon = 1E-8;
+}
+
+/*virtual*/ Array<DynParameter>* AdaGradTrainer::parameters () const
+{
+	Array<DynParameter>* result = MiniBatchTrainer::parameters ();
+	result->add (new DoubleParameter	("epsilon", i18n("Denominator offset"), 15, 0.0, 1.0, 1E-8));
+
+	return result;
+}
+
+/*virtual*/ void AdaGradTrainer::initTrain (ANNetwork& network) const
+{
+	MiniBatchTrainer::initTrain (network);
+
+	mSquares.make (mWeightDeltas.size());
+	for (int i=0; i<mSquares.size(); i++)
+		mSquares[i] = 0.0;
+}
+
+/*virtual*/ double AdaGradTrainer::weightChange (int ji, double gradient) const
+{
+	mSquares[ji] += gradient*gradient;
+	return -mEta * gradient / (sqrt (mSquares[ji]) + mEpsilon);
+}
+
+/*virtual*/ void AdaGradTrainer::saveState (CheckpointData& data) const
+{
+	MiniBatchTrainer::saveState (data);
+	data.put (mSquares);
+}
+
+/*virtual*/ void AdaGradTrainer::loadState (CheckpointData& data)
+{
+	MiniBatchTrainer::loadState (data);
+	Vector squares;
+	data.get (squares);
+	if (squares.size() != mSquares.size())
+		throw invalid_format (i18n("Checkpoint has wrong number of squared gradients"));
+	for (int i=0; i<squares.size(); i++)
+		mSquares[i] = squares[i];
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//  ----  |   |  ---- ----                -----           o                  //
+//  |   ) |\ /| (     |   )           --    |        ___      _    ___       //
+//  |---  | V |  ---  |---  |/\  __  |  )   |   |/\  ___| | |/ \  /   ) |/\  //
+//  | \   | | |     ) |     |   /  \ |--    |   |   (   | | |   | |---  |    //
+//  |  \  |   | ___/  |     |   \__/ |      |   |    \__| | |   |  \__  |    //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/*virtual*/ void RMSPropTrainer::init (const StringMap& params)
+{
+	AdaGradTrainer::init (params);
+
+	INITPARAMS(params, 
+			   mRho	= params["RMSPropTrainer.rho"].toDouble();
+		);
+
+	if (mRho <= 0.0 || mRho >= 1.0)
+		mRho = 0.9;
+}
+
+/*virtual*/ Array<DynParameter>* RMSPropTrainer::parameters () const
+{
+	Array<DynParameter>* result = AdaGradTrainer::parameters ();
+	result->add (new DoubleParameter	("rho", i18n("Squared gradient decay rate"), 15, 0.0, 1.0, 0.9));
+
+	return result;
+}
+
+/*virtual*/ double RMSPropTrainer::weightChange (int ji, double gradient) const
+{
+	mSquares[ji] = mRho*mSquares[ji] + (1.0-mRho)*gradient*gradient;
+	return -mEta * gradient / (sqrt (mSquares[ji]) + mEpsilon);
+}
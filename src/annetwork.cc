@@ -81,6 +81,46 @@ void NeuronContainer::removeUnit (int unitID) {
 		mUnits[i].setId (i);
 }
 
+/*******************************************************************************
+ * Creates many connections at once.
+ *
+ * The new connections are first counted for each unit, so that the
+ * connection arrays need to be resized only once.
+ ******************************************************************************/
+void NeuronContainer::connectBulk (int count, const int* sources, const int* targets,
+								   const double* weights)
+{
+	// Count the new connections of each unit
+	PackArray<int> inpos (mUnits.size()), outpos (mUnits.size());
+	for (int i=0; i<mUnits.size(); i++)
+		inpos[i] = outpos[i] = 0;
+	for (int c=0; c<count; c++) {
+		ASSERTWITH (sources[c]>=0 && sources[c]<mUnits.size() && targets[c]>=0 && targets[c]<mUnits.size(),
+					format ("Invalid connection from(i)=%d, to(j)=%d", sources[c], targets[c]));
+		inpos[targets[c]]++;
+		outpos[sources[c]]++;
+	}
+
+	// Grow the arrays, leaving the positions of the first new
+	// connections in the counters
+	for (int i=0; i<mUnits.size(); i++) {
+		BiNode& unit = mUnits[i];
+		int incomings = unit.mIncoming.size(), outgoings = unit.mOutgoing.size();
+		if (inpos[i] > 0)
+			unit.mIncoming.resize (incomings + inpos[i]);
+		if (outpos[i] > 0)
+			unit.mOutgoing.resize (outgoings + outpos[i]);
+		inpos[i] = incomings;
+		outpos[i] = outgoings;
+	}
+
+	for (int c=0; c<count; c++) {
+		Connection* conn = new Connection (&mUnits[sources[c]], &mUnits[targets[c]], weights[c]);
+		static_cast<BiNode&>(mUnits[targets[c]]).mIncoming.put (conn, inpos[targets[c]]++);
+		static_cast<BiNode&>(mUnits[sources[c]]).mOutgoing.put (conn, outpos[sources[c]]++);
+	}
+}
+
 /*******************************************************************************
  * Deletes all the neurons in the network.
  ******************************************************************************/
@@ -149,6 +189,19 @@ ANNetwork::ANNetwork (int size)
 	make (size);
 }
 
+/*******************************************************************************
+* Constructs a deep copy of another network.
+*******************************************************************************/
+ANNetwork::ANNetwork (const ANNetwork& orig) : NeuronContainer ()
+{
+	mUnitTemplate = NULL;
+	mInitializer  = NULL;
+	mTopology     = NULL;
+	mpEqualizer   = NULL;
+
+	copy (orig);
+}
+
 ANNetwork::~ANNetwork	()
 {
 	delete mUnitTemplate;
@@ -194,7 +247,8 @@ void ANNetwork::make (int size)
  ******************************************************************************/
 void ANNetwork::empty ()
 {
-	mTopology->empty ();
+	if (mTopology)
+		mTopology->empty ();
 	NeuronContainer::empty ();
 }
 
@@ -286,14 +340,87 @@ void ANNetwork::connectFull ()
  ******************************************************************************/
 void ANNetwork::copyFreeNet (const ANNetwork& other, bool onlyWeights)
 {
-	ANNLayering& mLayering = dynamic_cast<ANNLayering&>(*mTopology);
 	if (onlyWeights) {
-		ASSERTWITH (false, "onlyWeights-copy not implemented for ANNetwork");
+		// The topologies must be identical, so we just copy the
+		// weights and biases in the internal order.
+		ASSERTWITH (size()==other.size(), "Weight copy requires identical network topologies");
+		for (int j=0; j<mUnits.size(); j++) {
+			ASSERTWITH (mUnits[j].incomings()==other[j].incomings(),
+						"Weight copy requires identical network topologies");
+			for (int i=0; i<mUnits[j].incomings(); i++)
+				mUnits[j].incoming(i).setWeight (other[j].incoming(i).weight());
+			mUnits[j].setBias (other[j].bias());
+		}
 	} else {
 		// Full reconstructive copy
-		mLayering = dynamic_cast<ANNLayering&>(*other.mTopology);
-		failtrace (copyClone (mUnits, other.mUnits));
+		NeuronContainer::empty ();
+		delete mTopology;
+		mTopology = NULL;
+		if (const ANNLayering* layering = dynamic_cast<const ANNLayering*>(other.mTopology)) {
+			LayeredTopology* topology = new LayeredTopology ();
+			*static_cast<ANNLayering*>(topology) = *layering;
+			mTopology = topology;
+		}
+
+		delete mUnitTemplate;
 		mUnitTemplate = other.mUnitTemplate? other.mUnitTemplate->clone () : (Neuron*)NULL;
+
+		// Create the units. Connections are not copied by the neuron
+		// copy operator, so they are recreated separately below.
+		for (int i=0; i<other.size(); i++) {
+			const Neuron& orig = other[i];
+			Neuron* unit = mUnitTemplate? mUnitTemplate->clone () : new Neuron ();
+			unit->Object3D::copy (orig);
+			unit->mActivation   = orig.mActivation;
+			unit->mType         = orig.mType;
+			unit->mTransferFunc = orig.mTransferFunc;
+			unit->mExists       = orig.mExists;
+			unit->setBias (orig.bias());
+			add (unit);
+		}
+
+		// Connect the units
+		for (int j=0; j<other.size(); j++)
+			for (int i=0; i<other[j].incomings(); i++) {
+				const Connection& conn = other[j].incoming(i);
+				connect (conn.source().id(), j)->setWeight (conn.weight());
+			}
+
+		setEqualizer (other.mpEqualizer? other.mpEqualizer->clone () : (Equalizer*)NULL);
+	}
+}
+
+int ANNetwork::parameters () const
+{
+	int result = mUnits.size();
+	for (int j=0; j<mUnits.size(); j++)
+		result += mUnits[j].incomings();
+	return result;
+}
+
+void ANNetwork::getWeights (Vector& weights) const
+{
+	int count = parameters ();
+	if (weights.size() != count)
+		weights.make (count);
+
+	for (int j=0, ji=0; j<mUnits.size(); j++) {
+		const Neuron& unit = mUnits[j];
+		weights[ji++] = unit.bias ();
+		for (int i=0; i<unit.incomings(); i++)
+			weights[ji++] = unit.incoming(i).weight ();
+	}
+}
+
+void ANNetwork::setWeights (const Vector& weights)
+{
+	ASSERTWITH (weights.size() == parameters(), "Weight vector does not match the network");
+
+	for (int j=0, ji=0; j<mUnits.size(); j++) {
+		Neuron& unit = mUnits[j];
+		unit.setBias (weights[ji++]);
+		for (int i=0; i<unit.incomings(); i++)
+			unit.incoming(i).setWeight (weights[ji++]);
 	}
 }
 
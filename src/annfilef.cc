@@ -23,6 +23,15 @@
  ***************************************************************************/
 
 #include "fstream"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <magic/mobject.h>
 #include <magic/mregexp.h>
@@ -52,6 +61,12 @@ void ANNFileFormatLib::load (const String& filename,
 {
 	ASSERTWITH (!isempty(filename), "Filename required (was empty)");
 
+	// Binary files are recognized by their contents
+	if (filename != "-" && BinaryANNFormat::isBinary (filename)) {
+		BinaryANNFormat::loadFile (filename, set);
+		return;
+	}
+
 	// Open the file
 	TextIStream* in = &stin;
 	if (filename != "-") {
@@ -60,7 +75,7 @@ void ANNFileFormatLib::load (const String& filename,
 			throw file_not_found (format ("Network file '%s' not found", (CONSTR) filename));
 	}
 
-	// TODO: Support other filetypes than SNNS
+	// TODO: Support other text filetypes than SNNS
 	load (*in, set, "SNNS");
 
 	if (in != &stin)
@@ -99,6 +114,12 @@ void ANNFileFormatLib::save (
 	const char*      fileformat)	/**< File format. */
 	throw (invalid_filename, invalid_format, assertion_failed, stream_failure, open_failure)
 {
+	// The binary format is written directly to the file
+	if (fileformat && String (fileformat) == "binary" && filename != "-") {
+		BinaryANNFormat::saveFile (filename, net);
+		return;
+	}
+
 	// Default to standard output stream
 	TextOStream* out = &sout;
 
@@ -165,8 +186,10 @@ ANNFileFormat* ANNFileFormatLib::create (const String& fileformat) throw (invali
 	// Parse the contents according to the file name extension
 	if (fileformat == "SNNS")
 		return new SNNS_ANNFormat ();
+	else if (fileformat == "binary")
+		return new BinaryANNFormat ();
 	else
-		throw invalid_format (i18n("Only SNNS (.net) file format supported currently"));
+		throw invalid_format (i18n("Only SNNS (.net) and binary network file formats supported currently"));
 }
 
 
@@ -179,112 +202,198 @@ ANNFileFormat* ANNFileFormatLib::create (const String& fileformat) throw (invali
 // |   | |   | |   | |     | |  \__  |     \__/ |   | | |  \__|   \  //
 ///////////////////////////////////////////////////////////////////////
 
+/** Skips spaces and tabs. */
+static inline const char* skipBlanks (const char* p)
+{
+	while (*p==' ' || *p=='\t')
+		p++;
+	return p;
+}
+
+/** Returns the beginning of the next '|' separated field, or NULL if
+ *  there are no more fields on the line.
+ **/
+static inline const char* nextField (const char* p)
+{
+	p = strchr (p, '|');
+	return p? p+1 : NULL;
+}
+
+/** Parses a number that must begin the string, after optional blanks.
+ *
+ *  @throws invalid_format
+ **/
+static inline double parseNumber (const char*& p, const String& line)
+{
+	char* end;
+	double result = strtod (p, &end);
+	if (end == p)
+		throw invalid_format (format (i18n("Invalid number in SNNS network line:\n%s"), (CONSTR) line));
+	p = end;
+	return result;
+}
+
+/** Unit attributes read from the unit definition section. */
+struct SNNSUnit {
+	double	activation, bias;
+	double	x, y, z;
+};
+
+/*******************************************************************************
+ * Reads a network in SNNS format.
+ *
+ * The lines are scanned in place without splitting them to strings.
+ * Units and connections are collected to arrays that are reserved
+ * according to the counts in the file header, and the network is
+ * built and connected at once at the end.
+ ******************************************************************************/
 void SNNS_ANNFormat::load (TextIStream& in, ANNetwork& net) const
 	throw (stream_failure, invalid_format)
 {
-	String str_units        ("units : ");
-	String str_lfunc		("learning function : ");
-	String str_ufunc		("update function   : ");
-	String str_unitdefault	("unit default section");
-	String str_unitdefin	("unit definition section");
-	String str_conndefin	("connection definition section");
-	String re_unitline		("^ +[0-9]+");
-	String str_equalization	("Equalization:");
-	String str_EON			("# end-of-network");
+	static const char str_units[]		= "no. of units :";
+	static const char str_conns[]		= "no. of connections :";
+	static const char str_lfunc[]		= "learning function :";
+	static const char str_unitdefault[]	= "unit default section";
+	static const char str_unitdefin[]	= "unit definition section";
+	static const char str_conndefin[]	= "connection definition section";
+	static const char str_equalization[]= "# Equalization:";
+	static const char str_EON[]			= "# end-of-network";
 
 	net.empty ();
 
+	PackArray<SNNSUnit> units;
+	PackArray<char> unitTypes;
+	PackArray<int> sources, targets;
+	PackArray<double> weights;
+	int unitCount=0, connCount=0;
+
 	String linebuf;
-	//Array<String> linesubs;
 	int state = 0;
-	int inputs=0, hiddens=0, outputs=0;
 	while (in.readLine (linebuf)) {
-		linebuf = linebuf.stripWhiteSpace ();
+		const char* line = skipBlanks (linebuf);
 
 		// Stop reading on End-Of-Network
-		if (linebuf.left (str_EON.length()) == str_EON)
+		if (!strncmp (line, str_EON, sizeof (str_EON)-1))
 			break;
 
 		switch (state) {
 		  case 0:
-			  // Network size
-			  if (linebuf.left (str_units.length()) == str_units)
-				  net.make (linebuf.mid(str_units.length()).toInt());
-			  
+			  // Network size, for reserving the arrays
+			  if (!strncmp (line, str_units, sizeof (str_units)-1)) {
+				  int count = atoi (line + sizeof (str_units)-1);
+				  if (count>0) {
+					  units.make (count);
+					  unitTypes.make (count);
+				  }
+			  }
+			  if (!strncmp (line, str_conns, sizeof (str_conns)-1)) {
+				  int count = atoi (line + sizeof (str_conns)-1);
+				  if (count>0) {
+					  sources.make (count);
+					  targets.make (count);
+					  weights.make (count);
+				  }
+			  }
+
 			  // Learning function
-			  if (linebuf.left (str_lfunc.length()) == str_lfunc) {
-				  if (linebuf.mid(str_lfunc.length()) != "Rprop")
+			  if (!strncmp (line, str_lfunc, sizeof (str_lfunc)-1)) {
+				  String lfunc = String (skipBlanks (line + sizeof (str_lfunc)-1)).stripWhiteSpace ();
+				  if (lfunc != "Rprop")
 					  throw invalid_format (strformat("SNNS learning function '%s' not supported",
-													  (CONSTR) linebuf.mid (str_lfunc.length())));
+													  (CONSTR) lfunc));
 			  }
-			  if (linebuf.left (str_unitdefault.length()) == str_unitdefault)
+			  if (!strncmp (line, str_unitdefault, sizeof (str_unitdefault)-1))
 				  state = 1;
 			  break;
-			  
+
 		  case 1: // Reading unit default section
-			  if (linebuf.left (str_unitdefin.length()) == str_unitdefin)
+			  if (!strncmp (line, str_unitdefin, sizeof (str_unitdefin)-1))
 				  state = 2;
 			  break;
-			  
+
 		  case 2: // Reading unit definition section
 			  // It's a unit definition line if it begins with a value
-			  if (linebuf.length() > 0 && isdigit(linebuf[0])) {
-				  // Extract unit fields
-				  Array<String> unitfields;
-				  linebuf.split (unitfields, '|');
-				  for (int i=0; i<unitfields.size(); i++)
-					  unitfields[i] = unitfields[i].stripWhiteSpace();
-				  int unitid = unitfields[0].toInt()-1;
+			  if (isdigit (line[0])) {
+				  // Fields: no | typeName | unitName | act | bias | st | position | ...
+				  const char* p = line;
+				  int unitid = int (parseNumber (p, linebuf)) - 1;
+				  for (int f=0; f<3 && p; f++)
+					  p = nextField (p);
+				  if (!p || unitid<0)
+					  throw invalid_format (format (i18n("Invalid SNNS unit definition line:\n%s"), (CONSTR) linebuf));
+
+				  // Units are normally listed in order, but grow if needed
+				  if (unitid >= units.size()) {
+					  int newsize = (unitid >= 2*units.size())? unitid+1 : 2*units.size();
+					  units.resize (newsize);
+					  unitTypes.resize (newsize);
+				  }
+				  if (unitid >= unitCount) {
+					  for (int i=unitCount; i<unitid; i++)
+						  unitTypes[i] = 0;
+					  unitCount = unitid+1;
+				  }
+				  SNNSUnit& unit = units[unitid];
 
 				  // Read activation and bias
-				  net[unitid].setActivation (unitfields[3].toFloat());
-				  net[unitid].setBias (unitfields[4].toFloat());
+				  unit.activation = parseNumber (p, linebuf);
+				  p = nextField (p);
+				  unit.bias = p? parseNumber (p, linebuf) : 0.0;
 
 				  // Read unit type
-				  if (unitfields[5].stripWhiteSpace()=="i")
-					  inputs++;
-				  else if (unitfields[5].stripWhiteSpace()=="h")
-					  hiddens++;
-				  else if (unitfields[5].stripWhiteSpace()=="o")
-					  outputs++;
-
-				  // Extract unit coordinates
-				  Array<String> coords;
-				  unitfields[6].split (coords, ',');
-				  ASSERTWITH (coords.size()==3, "ANNetwork SNNS file must have 3-dimensional coordinates for units");
-				  net[unitid].moveTo (coords[0].stripWhiteSpace().toFloat(),
-									  coords[1].stripWhiteSpace().toFloat(),
-									  coords[2].stripWhiteSpace().toFloat());
+				  p = p? nextField (p) : NULL;
+				  unitTypes[unitid] = p? *skipBlanks (p) : 'h';
+
+				  // Read unit coordinates
+				  p = p? nextField (p) : NULL;
+				  ASSERTWITH (p, "ANNetwork SNNS file must have 3-dimensional coordinates for units");
+				  unit.x = parseNumber (p, linebuf);
+				  ASSERTWITH (*p==',', "ANNetwork SNNS file must have 3-dimensional coordinates for units");
+				  p++;
+				  unit.y = parseNumber (p, linebuf);
+				  ASSERTWITH (*p==',', "ANNetwork SNNS file must have 3-dimensional coordinates for units");
+				  p++;
+				  unit.z = parseNumber (p, linebuf);
 			  }
-			  
-			  if (linebuf.left (str_conndefin.length()) == str_conndefin)
+
+			  if (!strncmp (line, str_conndefin, sizeof (str_conndefin)-1))
 				  state = 3;
 			  break;
-			  
+
 		  case 3: // Reading connection definition section
 			  // It's a connection definition line if it begins with a value
-			  if (linebuf.length() > 0 && isdigit(linebuf[0])) {
-				  // Extract connection fields
-				  Array<String> unitfields;
-				  linebuf.split (unitfields, '|');
-				  int targetid = unitfields[0].stripWhiteSpace().toInt()-1;
+			  if (isdigit (line[0])) {
+				  // Fields: target | site | source:weight,source:weight,...
+				  const char* p = line;
+				  int targetid = int (parseNumber (p, linebuf)) - 1;
+				  p = nextField (p);
+				  p = p? nextField (p) : NULL;
+				  if (!p)
+					  throw invalid_format (format (i18n("Invalid SNNS connection definition line:\n%s"), (CONSTR) linebuf));
 
 				  // Extract connections to this target unit
-				  Array<String> conns;
-				  unitfields[2].split (conns, ',');
-				  for (int i=0; i<conns.size(); i++) {
-					  Array<String> connpair;
-					  conns[i].split (connpair, ':');
+				  for (p = skipBlanks (p); *p && *p!='\r' && *p!='\n'; p = skipBlanks (p)) {
+					  if (connCount == sources.size()) {
+						  int newsize = (connCount>0)? 2*connCount : 1024;
+						  sources.resize (newsize);
+						  targets.resize (newsize);
+						  weights.resize (newsize);
+					  }
+					  sources[connCount] = int (parseNumber (p, linebuf)) - 1;
+					  p = skipBlanks (p);
+					  if (*p++ != ':')
+						  throw invalid_format (format (i18n("Invalid SNNS connection definition line:\n%s"), (CONSTR) linebuf));
+					  weights[connCount] = parseNumber (p, linebuf);
+					  targets[connCount] = targetid;
+					  connCount++;
 
-					  // Make connection
-					  Connection* newconn = net.connect (connpair[0].stripWhiteSpace().toInt()-1, targetid);
-
-					  // Set conenction weight
-					  newconn->setWeight (connpair[1].stripWhiteSpace().toFloat());
+					  p = skipBlanks (p);
+					  if (*p == ',')
+						  p++;
 				  }
 			  }
-			  
-			  if (linebuf.left (str_equalization.length()) == str_equalization && !net.getEqualizer()) {
+
+			  if (!strncmp (line, str_equalization, sizeof (str_equalization)-1) && !net.getEqualizer()) {
 				  // Read the '# ' in the beginning of the next row
 				  in >> linebuf;
 
@@ -295,79 +404,700 @@ void SNNS_ANNFormat::load (TextIStream& in, ANNetwork& net) const
 		};
 	}
 
-	// Make topology handler according to parameters acquired
-	const_cast<ANNLayering&>(dynamic_cast<const ANNLayering&>(net.getTopology())).make (format ("%d-%d-%d", inputs, hiddens, outputs));
+	// Make the units, with a layering if the unit types give one
+	int inputs=0, hiddens=0, outputs=0;
+	for (int i=0; i<unitCount; i++)
+		switch (unitTypes[i]) {
+		  case 'i': inputs++; break;
+		  case 'h': hiddens++; break;
+		  case 'o': outputs++; break;
+		  default:
+			  throw invalid_format (format (i18n("SNNS unit %d is not defined or has unknown type"), i+1));
+		};
+	if (inputs>0 && outputs>0)
+		net.make ((hiddens>0)? format ("%d-%d-%d", inputs, hiddens, outputs) : format ("%d-%d", inputs, outputs));
+	else
+		net.make (unitCount);
+
+	for (int i=0; i<unitCount; i++) {
+		net[i].setActivation (units[i].activation);
+		net[i].setBias (units[i].bias);
+		net[i].moveTo (units[i].x, units[i].y, units[i].z);
+	}
+
+	for (int c=0; c<connCount; c++)
+		if (sources[c]<0 || sources[c]>=unitCount || targets[c]<0 || targets[c]>=unitCount)
+			throw invalid_format (format (i18n("SNNS connection from unit %d to unit %d refers to an undefined unit"),
+										  sources[c]+1, targets[c]+1));
+	if (connCount > 0)
+		net.connectBulk (connCount, &sources[0], &targets[0], &weights[0]);
+}
+
+/** Collects formatted text to a buffer and writes it to a stream in
+ *  large pieces.
+ **/
+class TextWriteBuffer {
+  public:
+					TextWriteBuffer		(TextOStream& out) : mOut (out), mLength (0) {}
+					~TextWriteBuffer	() {flush ();}
+
+	/** Appends a formatted item. The formatted item must be shorter
+	 *  than @ref MAXITEM characters.
+	 **/
+	void			printf				(const char* fmt, ...);
+
+	/** Appends a string. */
+	void			write				(const char* str);
+
+	/** Writes the buffered text to the stream. */
+	void			flush				();
+
+  private:
+	enum {SIZE=65536, MAXITEM=256};
+
+	TextOStream&	mOut;
+	char			mBuffer [SIZE];
+	int				mLength;
+};
+
+void TextWriteBuffer::printf (const char* fmt, ...)
+{
+	if (mLength + MAXITEM >= SIZE)
+		flush ();
+
+	va_list args;
+	va_start (args, fmt);
+	int length = vsnprintf (mBuffer+mLength, SIZE-mLength, fmt, args);
+	va_end (args);
+	if (length > 0)
+		mLength += (length < SIZE-mLength)? length : SIZE-mLength-1;
+}
+
+void TextWriteBuffer::write (const char* str)
+{
+	for (int length = strlen (str); length > 0; ) {
+		if (mLength == SIZE-1)
+			flush ();
+		int piece = (length < SIZE-1-mLength)? length : SIZE-1-mLength;
+		memcpy (mBuffer+mLength, str, piece);
+		mLength += piece;
+		str += piece;
+		length -= piece;
+	}
+}
+
+void TextWriteBuffer::flush ()
+{
+	if (mLength > 0) {
+		mBuffer[mLength] = '\0';
+		mOut << mBuffer;
+		mLength = 0;
+	}
 }
 
+/*******************************************************************************
+ * Writes a network in SNNS format.
+ *
+ * The text is formatted to a buffer that is written to the stream in
+ * large pieces.
+ ******************************************************************************/
 void SNNS_ANNFormat::save (TextOStream& out,
 						   const ANNetwork& net) const
 	throw (stream_failure)
 {
+	int connections = 0;
+	for (int i=0; i<net.size(); i++)
+		connections += net[i].incomings();
+
+	TextWriteBuffer buffer (out);
+
 	// SNNS Version
-	out << "SNNS network definition file V1.4-3D\n";
-	out	<< "generated at <time>\n\n"
-		<< "network name : Network\n"
-		<< "source files :\n"
-		<< "no. of units : " << net.size() << "\n"
-		<< "no. of connections : 0\n"
-		<< "no. of unit types : 0\n"
-		<< "no. of site types : 0\n\n\n"
-		<< "learning function : Rprop\n"
-		<< "update function   : Topological_Order\n\n\n"
-		<< "unit default section :\n\n"
-		<< "act      | bias     | st | subnet | layer | act func     | out func\n"
-		<< "---------|----------|----|--------|-------|--------------|-------------\n"
-		<< " 0.00000 |  0.00000 | h  |      0 |     1 | Act_Logistic | Out_Identity\n"
-		<< "---------|----------|----|--------|-------|--------------|-------------\n\n\n";
+	buffer.write ("SNNS network definition file V1.4-3D\n"
+				  "generated at <time>\n\n"
+				  "network name : Network\n"
+				  "source files :\n");
+	buffer.printf ("no. of units : %d\n"
+				   "no. of connections : %d\n", net.size(), connections);
+	buffer.write ("no. of unit types : 0\n"
+				  "no. of site types : 0\n\n\n"
+				  "learning function : Rprop\n"
+				  "update function   : Topological_Order\n\n\n"
+				  "unit default section :\n\n"
+				  "act      | bias     | st | subnet | layer | act func     | out func\n"
+				  "---------|----------|----|--------|-------|--------------|-------------\n"
+				  " 0.00000 |  0.00000 | h  |      0 |     1 | Act_Logistic | Out_Identity\n"
+				  "---------|----------|----|--------|-------|--------------|-------------\n\n\n");
 
 	// List units
-	out << "unit definition section :\n\n"
-		<< "no. | typeName | unitName | act      | bias     | st | position | act func             | out func | sites\n"
-		<< "----|----------|----------|----------|----------|----|----------|----------------------|----------|-------\n";
+	buffer.write ("unit definition section :\n\n"
+				  "no. | typeName | unitName | act      | bias     | st | position | act func             | out func | sites\n"
+				  "----|----------|----------|----------|----------|----|----------|----------------------|----------|-------\n");
 
 	// Go through all units
+	const ANNLayering* layering = dynamic_cast<const ANNLayering*> (&net.getTopology());
 	for (int i=0; i<net.size(); i++) {
 		// Determine unit status
 		char st='h'; // Hidden
 
 		// The layering object tells the unit type (input/output/hidden)
-		if (const ANNLayering* layering = dynamic_cast<const ANNLayering*> (&net.getTopology()))
-			if (layering->layers() > 1)
-				if (i < (*layering)[0])
-					st = 'i';
-				else if (i >= net.size()-(*layering)[-1])
-					st = 'o';
+		if (layering && layering->layers() > 1) {
+			if (i < (*layering)[0])
+				st = 'i';
+			else if (i >= net.size()-(*layering)[-1])
+				st = 'o';
+		}
 
 		// Print unit line
-		out << strformat ("%3d |          | unit     | % 3.5f | % 3.5f | %c  | %2g,%2g,%2g |||\n",
-						  i+1, net[i].activation(), net[i].bias(), st,
-						  net[i].getPlace().x, net[i].getPlace().y, net[i].getPlace().z);
+		buffer.printf ("%3d |          | unit     | % 3.5f | % 3.5f | %c  | %2g,%2g,%2g |||\n",
+					   i+1, net[i].activation(), net[i].bias(), st,
+					   net[i].getPlace().x, net[i].getPlace().y, net[i].getPlace().z);
 	}
-	out << "----|----------|----------|----------|----------|----|----------|----------------------|----------|-------\n";
+	buffer.write ("----|----------|----------|----------|----------|----|----------|----------------------|----------|-------\n");
 
 	// List connections
-	out << "\n\nconnection definition section :\n\n"
-		<< "target | site | source:weight\n"
-		<< "-------|------|---------------------------------------------------------------------------------------------------------------------\n";
+	buffer.write ("\n\nconnection definition section :\n\n"
+				  "target | site | source:weight\n"
+				  "-------|------|---------------------------------------------------------------------------------------------------------------------\n");
 	for (int i=0; i<net.size(); i++)
 		if (net[i].incomings()>0) {
-			out << strformat ("%6d |      |", i+1); // Target neuron ID
-			for (int j=0; j<net[i].incomings(); j++) {
-				if (j>0)
-					out << ',';
-				out << strformat ("%3d:% .5f",
-								  net[i].incoming(j).source().id()+1, // Source neuron ID
-								  net[i].incoming(j).weight()); // Connection weight
-			}
-			out << '\n';
+			buffer.printf ("%6d |      |", i+1); // Target neuron ID
+			for (int j=0; j<net[i].incomings(); j++)
+				buffer.printf ((j>0)? ",%3d:% .5f" : "%3d:% .5f",
+							   net[i].incoming(j).source().id()+1, // Source neuron ID
+							   net[i].incoming(j).weight()); // Connection weight
+			buffer.write ("\n");
 		}
-	out << "-------|------|---------------------------------------------------------------------------------------------------------------------\n";
+	buffer.write ("-------|------|---------------------------------------------------------------------------------------------------------------------\n");
 
 	// Store equalization object
 	if (const Equalizer* eq = net.getEqualizer()) {
-		out << "\n# Equalization:\n"
-			<< "# " << (*eq) << "\n";
+		buffer.write ("\n# Equalization:\n# ");
+		buffer.flush ();
+		out << (*eq) << "\n";
 	}
 
-	out << "# end-of-network\n";
+	buffer.write ("# end-of-network\n");
+}
+
+
+
+//////////////////////////////////////////////////////////////////////////////////////
+//  ----  o                         _   |   | |   | -----                           //
+//  |   )     _    ___             / \  |\  | |\  | |                     ___   |   //
+//  |---  | |/ \   ___| |/\ \   | /   \ | \ | | \ | |---   __  |/\ |/|/|  ___| -+-  //
+//  |   ) | |   | (   | |    \  | |---| |  \| |  \| |     /  \ |   | | | (   |  |   //
+//  |___  | |   |  \__| |     \_/ |   | |   | |   | |     \__/ |   | | |  \__|   \  //
+//                          \_/                                                     //
+//////////////////////////////////////////////////////////////////////////////////////
+
+/** Header of a binary network file.
+ *
+ *  The file is in native byte order; a file written on a machine
+ *  with a different byte order is rejected by the byteOrder field.
+ *  All section offsets are from the beginning of the file.
+ **/
+struct BinaryNetHeader {
+	char	magic[8];			/**< BINARY_NET_MAGIC */
+	int		byteOrder;			/**< BINARY_NET_BYTEORDER */
+	int		version;			/**< BinaryANNFormat::VERSION */
+	int		units;				/**< Number of units. */
+	int		connections;		/**< Number of connections. */
+	int		layers;				/**< Number of layers in the layering. */
+	int		equalizerPlanes;	/**< Number of MinmaxEq planes, or 0 if none. */
+	int		layerOffset;		/**< int[layers] layer sizes. */
+	int		unitOffset;			/**< BinaryNetUnit[units] */
+	int		sourceOffset;		/**< int[connections] connection source units. */
+	int		weightOffset;		/**< double[units] biases, double[connections] weights. */
+	int		equalizerOffset;	/**< double[4*equalizerPlanes] MinmaxEq parameters. */
+	int		fileSize;			/**< Total size of the file. */
+};
+
+/** Unit record of a binary network file. The incoming connections of
+ *  each unit are stored consecutively, in the order of the units.
+ **/
+struct BinaryNetUnit {
+	double	activation;
+	double	x, y, z;			/**< Coordinates of the unit. */
+	int		type;				/**< Neuron::unitTypes */
+	int		transferFunc;		/**< Neuron::tfuncs */
+	int		enabled;
+	int		firstConnection;	/**< Index of the first incoming connection. */
+	int		incomings;			/**< Number of incoming connections. */
+	int		reserved;
+};
+
+#define BINARY_NET_MAGIC		"INNBNET1"
+#define BINARY_NET_BYTEORDER	0x01020304
+
+/** Rounds a file offset up to the given alignment. */
+static inline int alignOffset (int offset, int alignment)
+{
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+/** Checks that a section of count items of the given size starts
+ *  after the header, at the given alignment, and ends within the file.
+ **/
+static inline bool validSection (int offset, int count, int itemSize, int alignment, long size)
+{
+	return offset >= int (sizeof (BinaryNetHeader)) && offset % alignment == 0 &&
+		offset + double (count) * itemSize <= size;
+}
+
+/*******************************************************************************
+ * Checks that a memory image of a file is a valid binary network.
+ *
+ * @throws invalid_format
+ ******************************************************************************/
+static const BinaryNetHeader& validateBinaryNet (const char* data, long size, const String& filename)
+{
+	const BinaryNetHeader& header = *reinterpret_cast<const BinaryNetHeader*>(data);
+	if (size < long (sizeof (BinaryNetHeader)) || memcmp (header.magic, BINARY_NET_MAGIC, sizeof (header.magic)))
+		throw invalid_format (format (i18n("File '%s' is not a binary network file"), (CONSTR) filename));
+	if (header.byteOrder != BINARY_NET_BYTEORDER)
+		throw invalid_format (format (i18n("Binary network file '%s' has wrong byte order"), (CONSTR) filename));
+	if (header.version != BinaryANNFormat::VERSION)
+		throw invalid_format (format (i18n("Binary network file '%s' has unsupported version %d"),
+									  (CONSTR) filename, header.version));
+
+	bool valid = header.units >= 0 && header.connections >= 0 &&
+		header.layers >= 0 && header.equalizerPlanes >= 0 &&
+		header.fileSize == size &&
+		validSection (header.layerOffset, header.layers, sizeof (int), sizeof (int), size) &&
+		validSection (header.unitOffset, header.units, sizeof (BinaryNetUnit), sizeof (double), size) &&
+		validSection (header.sourceOffset, header.connections, sizeof (int), sizeof (int), size) &&
+		validSection (header.weightOffset, header.units + header.connections, sizeof (double),
+					  BinaryANNFormat::ALIGNMENT, size) &&
+		validSection (header.equalizerOffset, 4 * header.equalizerPlanes, sizeof (double),
+					  sizeof (double), size);
+	if (!valid)
+		throw invalid_format (format (i18n("Binary network file '%s' is corrupted"), (CONSTR) filename));
+
+	// The layering must cover all the units
+	const int* layers = reinterpret_cast<const int*> (data + header.layerOffset);
+	int layered = 0;
+	for (int l=0; l<header.layers; l++)
+		layered += layers[l];
+	if (header.layers > 0 && layered != header.units)
+		throw invalid_format (format (i18n("Binary network file '%s' is corrupted"), (CONSTR) filename));
+
+	// Check the connection structure, so that evaluation can trust it
+	const BinaryNetUnit* units = reinterpret_cast<const BinaryNetUnit*> (data + header.unitOffset);
+	const int* sources = reinterpret_cast<const int*> (data + header.sourceOffset);
+	for (int i=0, c=0; i<header.units; i++) {
+		if (units[i].firstConnection != c || units[i].incomings < 0 ||
+			c + units[i].incomings > header.connections)
+			throw invalid_format (format (i18n("Binary network file '%s' is corrupted"), (CONSTR) filename));
+		for (int end=c+units[i].incomings; c<end; c++)
+			if (sources[c] < 0 || sources[c] >= header.units)
+				throw invalid_format (format (i18n("Binary network file '%s' is corrupted"), (CONSTR) filename));
+	}
+	return header;
+}
+
+/*******************************************************************************
+ * The binary format can not be read from text streams.
+ ******************************************************************************/
+void BinaryANNFormat::load (TextIStream& in, ANNetwork& net) const
+	throw (stream_failure, invalid_format)
+{
+	throw invalid_format (i18n("Binary network format can only be loaded from a file"));
+}
+
+/*******************************************************************************
+ * The binary format can not be written to text streams.
+ ******************************************************************************/
+void BinaryANNFormat::save (TextOStream& out, const ANNetwork& net) const
+	throw (stream_failure)
+{
+	throw stream_failure (i18n("Binary network format can only be saved to a file"));
+}
+
+bool BinaryANNFormat::isBinary (const String& filename)
+{
+	FILE* in = fopen (filename, "rb");
+	if (!in)
+		return false;
+
+	char magic[8];
+	bool result = fread (magic, 1, sizeof (magic), in) == sizeof (magic) &&
+		!memcmp (magic, BINARY_NET_MAGIC, sizeof (magic));
+	fclose (in);
+	return result;
+}
+
+/*******************************************************************************
+ * Loads a network from a binary network file.
+ *
+ * @throws open_failure, invalid_format
+ ******************************************************************************/
+void BinaryANNFormat::loadFile (const String& filename, ANNetwork& net)
+{
+	MappedANNetwork image (filename);
+	image.build (net);
+}
+
+/*******************************************************************************
+ * Builds the binary image of a network. The size of the image is in
+ * the fileSize field of its header.
+ *
+ * @param withEqualizer Should the equalizer of the network be stored?
+ *
+ * @throws invalid_format
+ ******************************************************************************/
+static char* buildBinaryNet (const ANNetwork& net, bool withEqualizer)
+{
+	// Only equalizers that can be represented exactly are supported
+	const MatrixEqualizer* equalizer = NULL;
+	if (withEqualizer && net.getEqualizer()) {
+		equalizer = dynamic_cast<const MatrixEqualizer*> (net.getEqualizer());
+		for (int i=0; equalizer && i<equalizer->planes(); i++)
+			if (!dynamic_cast<const MinmaxEq*> (&equalizer->getPlane (i)))
+				equalizer = NULL;
+		if (!equalizer)
+			throw invalid_format (i18n("Binary network format can only store a MatrixEqualizer with MinmaxEq planes"));
+	}
+
+	const ANNLayering* layering = dynamic_cast<const ANNLayering*> (&net.getTopology());
+
+	int connections = 0;
+	for (int i=0; i<net.size(); i++)
+		connections += net[i].incomings();
+
+	// Lay out the sections
+	BinaryNetHeader header;
+	memset (&header, 0, sizeof (header));
+	memcpy (header.magic, BINARY_NET_MAGIC, sizeof (header.magic));
+	header.byteOrder       = BINARY_NET_BYTEORDER;
+	header.version         = BinaryANNFormat::VERSION;
+	header.units           = net.size ();
+	header.connections     = connections;
+	header.layers          = layering? layering->layers() : 0;
+	header.equalizerPlanes = equalizer? equalizer->planes() : 0;
+	header.layerOffset     = alignOffset (sizeof (BinaryNetHeader), sizeof (double));
+	header.unitOffset      = alignOffset (header.layerOffset + header.layers*sizeof (int), sizeof (double));
+	header.sourceOffset    = header.unitOffset + header.units*sizeof (BinaryNetUnit);
+	header.weightOffset    = alignOffset (header.sourceOffset + connections*sizeof (int), BinaryANNFormat::ALIGNMENT);
+	header.equalizerOffset = header.weightOffset + (header.units+connections)*sizeof (double);
+	header.fileSize        = header.equalizerOffset + header.equalizerPlanes*4*sizeof (double);
+
+	// Build the file image
+	char* image = new char [header.fileSize];
+	memset (image, 0, header.fileSize);
+	memcpy (image, &header, sizeof (header));
+
+	int* layers = reinterpret_cast<int*> (image + header.layerOffset);
+	for (int l=0; l<header.layers; l++)
+		layers[l] = (*layering)[l];
+
+	BinaryNetUnit* units = reinterpret_cast<BinaryNetUnit*> (image + header.unitOffset);
+	int* sources = reinterpret_cast<int*> (image + header.sourceOffset);
+	double* biases = reinterpret_cast<double*> (image + header.weightOffset);
+	double* weights = biases + header.units;
+	for (int i=0, c=0; i<net.size(); i++) {
+		const Neuron& unit = net[i];
+		units[i].activation      = unit.activation ();
+		units[i].x               = unit.getPlace().x;
+		units[i].y               = unit.getPlace().y;
+		units[i].z               = unit.getPlace().z;
+		units[i].type            = unit.getType ();
+		units[i].transferFunc    = unit.transferFunc ();
+		units[i].enabled         = unit.isEnabled ();
+		units[i].firstConnection = c;
+		units[i].incomings       = unit.incomings ();
+		biases[i]                = unit.bias ();
+		for (int j=0; j<unit.incomings(); j++, c++) {
+			sources[c] = unit.incoming(j).source().id();
+			weights[c] = unit.incoming(j).weight();
+		}
+	}
+
+	double* eqparams = reinterpret_cast<double*> (image + header.equalizerOffset);
+	for (int p=0; p<header.equalizerPlanes; p++) {
+		const MinmaxEq& plane = dynamic_cast<const MinmaxEq&> (equalizer->getPlane (p));
+		eqparams[4*p]   = plane.mDataMin;
+		eqparams[4*p+1] = plane.mDataMax;
+		eqparams[4*p+2] = plane.mTrgMin;
+		eqparams[4*p+3] = plane.mTrgMax;
+	}
+
+	return image;
+}
+
+/*******************************************************************************
+ * Saves a network to a binary network file.
+ *
+ * The file is first written under a temporary name and then renamed,
+ * so that a concurrent reader never sees a partially written file.
+ *
+ * @throws invalid_format, open_failure
+ ******************************************************************************/
+void BinaryANNFormat::saveFile (const String& filename, const ANNetwork& net)
+{
+	char* image = buildBinaryNet (net, true);
+	const BinaryNetHeader& header = *reinterpret_cast<const BinaryNetHeader*> (image);
+
+	// Write it with a single write
+	String tmpname = filename + format (".%d.tmp", int (getpid ()));
+	FILE* out = fopen (tmpname, "wb");
+	bool ok = out && fwrite (image, 1, header.fileSize, out) == size_t (header.fileSize);
+	if (out && fclose (out))
+		ok = false;
+	delete [] image;
+	if (!ok || rename (tmpname, filename)) {
+		unlink (tmpname);
+		throw open_failure (format (i18n("Network file '%s' couldn't be written"), (CONSTR) filename));
+	}
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+//  |   |                           |   _   |   | |   |                           |    //
+//  |\ /|  ___   --   --   ___      |  / \  |\  | |\  |  ___   |                  |    //
+//  | V |  ___| |  ) |  ) /   )  ---| /   \ | \ | | \ | /   ) -+- \    /  __  |/\ | /  //
+//  | | | (   | |--  |--  |---  (   | |---| |  \| |  \| |---   |   \\//  /  \ |   |/   //
+//  |   |  \__| |    |     \__   ---| |   | |   | |   |  \__    \   VV   \__/ |   | \  //
+/////////////////////////////////////////////////////////////////////////////////////////
+
+/** Returns the header of the mapped file. */
+static inline const BinaryNetHeader& mappedHeader (const char* data)
+{
+	return *reinterpret_cast<const BinaryNetHeader*> (data);
+}
+
+/*******************************************************************************
+ * Maps the given binary network file to memory and validates it.
+ *
+ * @throws open_failure, invalid_format
+ ******************************************************************************/
+MappedANNetwork::MappedANNetwork (const String& filename)
+{
+	map (filename);
+}
+
+MappedANNetwork::MappedANNetwork (const char* filename)
+{
+	map (filename);
+}
+
+void MappedANNetwork::map (const String& filename)
+{
+	int fd = open (filename, O_RDONLY);
+	if (fd < 0)
+		throw open_failure (format (i18n("Network file '%s' couldn't be opened"), (CONSTR) filename));
+
+	struct stat st;
+	void* data = MAP_FAILED;
+	if (!fstat (fd, &st) && st.st_size > 0)
+		data = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close (fd); // The mapping stays valid
+	if (data == MAP_FAILED)
+		throw open_failure (format (i18n("Network file '%s' couldn't be mapped"), (CONSTR) filename));
+
+	mpData = static_cast<const char*> (data);
+	mSize = st.st_size;
+	mMapped = true;
+	try {
+		validateBinaryNet (mpData, mSize, filename);
+	} catch (...) {
+		munmap (const_cast<char*> (mpData), mSize);
+		throw;
+	}
+}
+
+/*******************************************************************************
+ * Makes an in-memory image of the current weights of the network.
+ * The equalizer of the network is not included.
+ ******************************************************************************/
+MappedANNetwork::MappedANNetwork (const ANNetwork& net)
+{
+	mpData = buildBinaryNet (net, false);
+	mSize = mappedHeader(mpData).fileSize;
+	mMapped = false;
+}
+
+MappedANNetwork::~MappedANNetwork ()
+{
+	if (mMapped)
+		munmap (const_cast<char*> (mpData), mSize);
+	else
+		delete [] mpData;
+}
+
+int MappedANNetwork::units () const
+{
+	return mappedHeader(mpData).units;
+}
+
+int MappedANNetwork::connections () const
+{
+	return mappedHeader(mpData).connections;
+}
+
+int MappedANNetwork::inputs () const
+{
+	const BinaryNetHeader& header = mappedHeader (mpData);
+	return (header.layers > 0)? reinterpret_cast<const int*> (mpData + header.layerOffset)[0] : 0;
+}
+
+int MappedANNetwork::outputs () const
+{
+	const BinaryNetHeader& header = mappedHeader (mpData);
+	return (header.layers > 0)? reinterpret_cast<const int*> (mpData + header.layerOffset)[header.layers-1] : 0;
+}
+
+/*******************************************************************************
+ * Evaluates the network in the same way as @ref ANNetwork::update():
+ * the units are updated in their order, and units without incoming
+ * connections keep their stored activation.
+ ******************************************************************************/
+void MappedANNetwork::evaluate (const double* input, double* output, double* work) const
+{
+	const BinaryNetHeader& header = mappedHeader (mpData);
+	const BinaryNetUnit* units = reinterpret_cast<const BinaryNetUnit*> (mpData + header.unitOffset);
+	const int* sources = reinterpret_cast<const int*> (mpData + header.sourceOffset);
+	const double* biases = reinterpret_cast<const double*> (mpData + header.weightOffset);
+	const double* weights = biases + header.units;
+
+	int ins = inputs ();
+	for (int i=0; i<header.units; i++)
+		work[i] = (i < ins)? input[i] : units[i].activation;
+
+	for (int i=0; i<header.units; i++) {
+		const BinaryNetUnit& unit = units[i];
+		if (unit.incomings == 0)
+			continue;
+		if (!unit.enabled) {
+			work[i] = 0.0;
+			continue;
+		}
+		double sum = biases[i];
+		for (int c=unit.firstConnection, end=c+unit.incomings; c<end; c++)
+			sum += weights[c]*work[sources[c]];
+		work[i] = (unit.transferFunc == Neuron::LOGISTIC_TF)? sigmoid (sum) : sum;
+	}
+
+	int outs = outputs ();
+	for (int j=0; j<outs; j++)
+		output[j] = work[header.units-outs+j];
+}
+
+Vector MappedANNetwork::evaluate (const Vector& input) const
+{
+	ASSERTWITH (input.size() == inputs(), "Wrong number of inputs for network");
+	double* work = new double [units()];
+	Vector result (outputs());
+	evaluate (&input[0], &result[0], work);
+	delete [] work;
+	return result;
+}
+
+/*******************************************************************************
+ * The activations are stored unit by unit, with the values of the
+ * whole batch side by side, so the inner loops run over contiguous
+ * memory.
+ ******************************************************************************/
+void MappedANNetwork::evaluateBatch (const double* input, double* output, int count, double* work) const
+{
+	const BinaryNetHeader& header = mappedHeader (mpData);
+	const BinaryNetUnit* units = reinterpret_cast<const BinaryNetUnit*> (mpData + header.unitOffset);
+	const int* sources = reinterpret_cast<const int*> (mpData + header.sourceOffset);
+	const double* biases = reinterpret_cast<const double*> (mpData + header.weightOffset);
+	const double* weights = biases + header.units;
+
+	int ins = inputs ();
+	for (int i=0; i<header.units; i++) {
+		double* act = work + i*count;
+		for (int p=0; p<count; p++)
+			act[p] = (i < ins)? input[p*ins+i] : units[i].activation;
+	}
+
+	for (int i=0; i<header.units; i++) {
+		const BinaryNetUnit& unit = units[i];
+		if (unit.incomings == 0)
+			continue;
+
+		double* act = work + i*count;
+		if (!unit.enabled) {
+			for (int p=0; p<count; p++)
+				act[p] = 0.0;
+			continue;
+		}
+
+		for (int p=0; p<count; p++)
+			act[p] = biases[i];
+		for (int c=unit.firstConnection, end=c+unit.incomings; c<end; c++) {
+			const double weight = weights[c];
+			const double* source = work + sources[c]*count;
+			for (int p=0; p<count; p++)
+				act[p] += weight*source[p];
+		}
+		if (unit.transferFunc == Neuron::LOGISTIC_TF)
+			for (int p=0; p<count; p++)
+				act[p] = sigmoid (act[p]);
+	}
+
+	int outs = outputs ();
+	for (int j=0; j<outs; j++) {
+		const double* act = work + (header.units-outs+j)*count;
+		for (int p=0; p<count; p++)
+			output[p*outs+j] = act[p];
+	}
+}
+
+/*******************************************************************************
+ * Builds a normal network object from the mapped file, replacing the
+ * previous contents of the network.
+ ******************************************************************************/
+void MappedANNetwork::build (ANNetwork& net) const
+{
+	const BinaryNetHeader& header = mappedHeader (mpData);
+	const int* layers = reinterpret_cast<const int*> (mpData + header.layerOffset);
+	const BinaryNetUnit* units = reinterpret_cast<const BinaryNetUnit*> (mpData + header.unitOffset);
+	const int* sources = reinterpret_cast<const int*> (mpData + header.sourceOffset);
+	const double* biases = reinterpret_cast<const double*> (mpData + header.weightOffset);
+	const double* weights = biases + header.units;
+
+	// Create the units, with the stored layering if there is one
+	net.empty ();
+	if (header.layers > 0) {
+		String description;
+		for (int l=0; l<header.layers; l++)
+			description += format ((l>0)? "-%d" : "%d", layers[l]);
+		net.make (description);
+	} else
+		for (int i=0; i<header.units; i++)
+			net.add (net.getUnitPrototype()? net.getUnitPrototype()->clone() : new Neuron ());
+
+	for (int i=0; i<header.units; i++) {
+		Neuron& unit = net[i];
+		unit.setActivation (units[i].activation);
+		unit.moveTo (units[i].x, units[i].y, units[i].z);
+		unit.setType (units[i].type);
+		unit.setTFunc (units[i].transferFunc);
+		unit.enable (units[i].enabled);
+		unit.setBias (biases[i]);
+		for (int c=units[i].firstConnection; c<units[i].firstConnection+units[i].incomings; c++)
+			net.connect (sources[c], i)->setWeight (weights[c]);
+	}
+
+	net.setEqualizer (makeEqualizer ());
+}
+
+MatrixEqualizer* MappedANNetwork::makeEqualizer () const
+{
+	const BinaryNetHeader& header = mappedHeader (mpData);
+	if (header.equalizerPlanes == 0)
+		return NULL;
+
+	const double* params = reinterpret_cast<const double*> (mpData + header.equalizerOffset);
+	MatrixEqualizer* result = new MatrixEqualizer ();
+	for (int p=0; p<header.equalizerPlanes; p++) {
+		MinmaxEq* plane = new MinmaxEq (params[4*p+2], params[4*p+3]);
+		plane->mDataMin = params[4*p];
+		plane->mDataMax = params[4*p+1];
+		result->addPlane (plane);
+	}
+	return result;
 }
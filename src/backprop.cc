@@ -22,8 +22,12 @@
  *                                                                         *
  ***************************************************************************/
 
+#include <magic/mclass.h>
 #include "inanna/backprop.h"
 #include "inanna/patternset.h"
+#include "inanna/threadpool.h"
+
+impl_dynamic (BackpropTrainer, {Trainer});
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -34,6 +38,12 @@
 // |___   \__|  \__/ | \ |    |   \__/ |      |   |    \__| | |   |  \__  |   //
 ////////////////////////////////////////////////////////////////////////////////
 
+BackpropTrainer::BackpropTrainer () {
+	mOnlineLearning     = false;
+	mImportanceSampling = false;
+	mPatternWeight      = 1.0;
+}
+
 /*virtual*/ void BackpropTrainer::init (const StringMap& params) {
 	Trainer::init (params);
 	INITPARAMS(params, 
@@ -41,7 +51,24 @@
 			   mMomentum		= params["BackpropTrainer.momentum"].toDouble();
 			   mDecay			= params["BackpropTrainer.decay"].toDouble();
 			   mBatchLearning	= params["BackpropTrainer.batchLearning"].toInt();
+			   mOnlineLearning	= params["BackpropTrainer.onlineLearning"].toInt();
+		);
+	initSampling (params);
+}
+
+void BackpropTrainer::initSampling (const StringMap& params) {
+	double floor = 0.0;
+	INITPARAMS(params, 
+			   mImportanceSampling	= params["BackpropTrainer.importanceSampling"].toInt();
+			   floor				= params["BackpropTrainer.samplingFloor"].toDouble();
 		);
+
+	// Some uniform sampling refreshes the estimates by default
+	if (params["BackpropTrainer.samplingFloor"].isEmpty())
+		floor = 0.1;
+	if (floor < 0.0 || floor > 1.0)
+		throw invalid_format (format (i18n("BackpropTrainer.samplingFloor must be between 0.0 and 1.0, got %g"), floor));
+	mSampler.setFloor (floor);
 }
 
 /*virtual*/ Array<DynParameter>* BackpropTrainer::parameters () const {
@@ -50,6 +77,9 @@
 	result->add (new DoubleParameter	("momentum", i18n("Weight momentum"), 15, 0.0, 1.0, 0.9));
 	result->add (new DoubleParameter	("decay", i18n("Weight decay multiplier"), 15, 0.5, 1.0, 1.0));
 	result->add (new BoolParameter		("batchLearning", i18n("Update weights in batch")));
+	result->add (new BoolParameter		("onlineLearning", i18n("Update weights after each pattern")));
+	result->add (new BoolParameter		("importanceSampling", i18n("Draw patterns by their errors")));
+	result->add (new DoubleParameter	("samplingFloor", i18n("Share of uniform sampling"), 15, 0.0, 1.0, 0.1));
 
 	return result;
 }
@@ -86,12 +116,17 @@
 			mWeightDeltas[i] = 0.0;
 	*/
 	
-	// Train each pattern once
+	// Train each pattern once, or as many drawn patterns
+	orderPatterns (set, false);
 	double sse=0.0;
-	for (int p=0; p<set.patterns; p++)
-		sse += trainPattern (network, set, p);
+	for (int n=0; n<mOrder.size(); n++) {
+		sse += trainDrawn (network, set, mOrder[n]);
+		if (mOnlineLearning)
+			updateWeights (network);
+	}
 
-	if (true || mBatchLearning)
+	mCycleError = sse/set.patterns;
+	if (!mOnlineLearning && (true || mBatchLearning))
 		updateWeights (network);
 
 	// Actualize weight adjustments
@@ -101,7 +136,7 @@
 			for (int c=0; c<network[n].incomings(); c++, oc++)
 				network[n].incoming(c).setWeight (mWeightDeltas[oc]);
 	*/
-	return sse/set.patterns; // Return MSE
+	return mCycleError; // Return MSE
 }
 
 /*******************************************************************************
@@ -127,6 +162,44 @@
 	return sse / set.outputs; // Return MSE
 }
 
+void BackpropTrainer::orderPatterns (const PatternSource& set, bool shuffle) const
+{
+	if (mImportanceSampling) {
+		mSampler.draw (set.patterns, mOrder);
+		return;
+	}
+
+	mOrder.make (set.patterns);
+	for (int p=0; p<set.patterns; p++)
+		mOrder[p] = p;
+	if (shuffle) {
+		RandomLock lock;
+		for (int p=set.patterns-1; p>0; p--) {
+			int other = rnd (p+1);
+			int tmp = mOrder[p];
+			mOrder[p] = mOrder[other];
+			mOrder[other] = tmp;
+		}
+	}
+}
+
+/*******************************************************************************
+ * Trains a pattern with its importance weight. The error estimate of
+ * the sampler is the unweighted error, measured before the weights
+ * are updated with the pattern.
+ ******************************************************************************/
+double BackpropTrainer::trainDrawn (ANNetwork& network, const PatternSource& set, int p) const
+{
+	if (!mImportanceSampling)
+		return trainPattern (network, set, p);
+
+	mPatternWeight = mSampler.weight (p);
+	double mse = trainPattern (network, set, p);
+	mSampler.update (p, mse);
+	mPatternWeight = 1.0;
+	return mse * mSampler.weight (p);
+}
+
 /*******************************************************************************
  * Propagates an error signal backwards in the network. Does not
  * modify the network in any way, but stores the per-neuron error in
@@ -151,7 +224,7 @@ void BackpropTrainer::backpropagate (register ANNetwork& network,
 		// Calculate error at a neuron
 		if (j >= outLayerBase) { // Output neuron
 			delta_j = (set.output(p,j-outLayerBase) - neuron_j->activation())
-				* neuron_j->activation() * (1.0 - neuron_j->activation());
+				* neuron_j->activation() * (1.0 - neuron_j->activation()) * mPatternWeight;
 		}
 		else { // A hidden or input neuron
 			sum_k=0.0;
@@ -186,3 +259,28 @@ void BackpropTrainer::updateWeights (register ANNetwork& network) const {
 		}
 	}
 }
+
+/*******************************************************************************
+ * Implementation for Trainer. The momentum needs the previous weight
+ * changes.
+ ******************************************************************************/
+/*virtual*/ void BackpropTrainer::saveState (CheckpointData& data) const
+{
+	Trainer::saveState (data);
+	data.put (mWeightDeltas);
+	if (mImportanceSampling)
+		mSampler.saveState (data);
+}
+
+/*virtual*/ void BackpropTrainer::loadState (CheckpointData& data)
+{
+	Trainer::loadState (data);
+	Vector deltas;
+	data.get (deltas);
+	if (deltas.size() != mWeightDeltas.size())
+		throw invalid_format (i18n("Checkpoint has wrong number of weight deltas"));
+	for (int i=0; i<deltas.size(); i++)
+		mWeightDeltas[i] = deltas[i];
+	if (mImportanceSampling)
+		mSampler.loadState (data);
+}
@@ -0,0 +1,284 @@
+/***************************************************************************
+ *   This file is part of the Inanna library.                              *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <sys/time.h>
+#include <magic/mclass.h>
+#include "inanna/backtest.h"
+#include "inanna/prediction.h"
+#include "inanna/threadpool.h"
+
+/** Returns the current wall-clock time in seconds. */
+static double wallClock ()
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+BacktestStep::BacktestStep ()
+{
+	cutoff    = 0;
+	month     = 0;
+	retrained = false;
+	results   = NULL;
+	seconds   = 0.0;
+}
+
+BacktestStep::~BacktestStep ()
+{
+	delete results;
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////////////
+// ----              |                        ----                    |            //
+// |   )  ___   ___  |     |   ___   ____  |  |   )  ___   ____       |  |   ____  //
+// |---   ___| |   \ | /  -+- /   ) (     -+- |---  /   ) (     |   | | -+- (      //
+// |   ) (   | |     |/    |  |---   \__   |  | \   |---   \__  |   | |  |   \__   //
+// |___   \__|  \__/ | \    \  \__  ____)   \ |  \   \__  ____)  \__! |   \ ____)  //
+/////////////////////////////////////////////////////////////////////////////////////
+
+int BacktestResults::failedSteps () const
+{
+	int failed=0;
+	for (int i=0; i<steps.size(); i++)
+		if (!steps[i].error.isEmpty())
+			failed++;
+	return failed;
+}
+
+int BacktestResults::retrainedSteps () const
+{
+	int retrained=0;
+	for (int i=0; i<steps.size(); i++)
+		if (steps[i].error.isEmpty() && steps[i].retrained)
+			retrained++;
+	return retrained;
+}
+
+double BacktestResults::meanError () const
+{
+	double sum=0.0;
+	int    n=0;
+	for (int i=0; i<steps.size(); i++)
+		if (steps[i].error.isEmpty()) {
+			sum += steps[i].results->averageError;
+			n++;
+		}
+	return (n>0)? sum/n : 0.0;
+}
+
+double BacktestResults::meanRMSE () const
+{
+	double sum=0.0;
+	int    n=0;
+	for (int i=0; i<steps.size(); i++)
+		if (steps[i].error.isEmpty()) {
+			sum += steps[i].results->RMSE;
+			n++;
+		}
+	return (n>0)? sum/n : 0.0;
+}
+
+double BacktestResults::stepSeconds () const
+{
+	double sum=0.0;
+	for (int i=0; i<steps.size(); i++)
+		sum += steps[i].seconds;
+	return sum;
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+// |   |       | |    -----                               | ----              |                        //
+// |   |  ___  | |    |                      ___          | |   )  ___   ___  |     |   ___   ____  |  //
+// | | |  ___| | | /  |---   __  |/\ \    /  ___| |/\  ---| |---   ___| |   \ | /  -+- /   ) (     -+- //
+// |\|/| (   | | |/   |     /  \ |    \\//  (   | |   (   | |   ) (   | |     |/    |  |---   \__   |  //
+// |   |  \__| | | \  |     \__/ |     VV    \__| |    ---| |___   \__|  \__/ | \    \  \__  ____)   \ //
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Runs one chain of consecutive cutoffs with its own strategy. The
+ *  steps of different chains do not overlap, so the chains can be run
+ *  concurrently. The strategies hold a @ref RandomLock while they
+ *  initialize their networks.
+ **/
+class BacktestChainTask : public ThreadTask {
+  public:
+					BacktestChainTask		(const Matrix& data, int startmonth,
+											 Array<BacktestStep>& steps)
+							: mData (data), mStartMonth (startmonth), mSteps (steps) {
+						mpStrategy = NULL;
+					}
+					~BacktestChainTask		() {delete mpStrategy;}
+
+	virtual void	run						();
+
+	PredictionStrategy*	mpStrategy;		/**< Strategy of the chain. */
+	int					mFirst;			/**< First step of the chain. */
+	int					mEnd;			/**< Step after the last one of the chain. */
+	int					mHorizon;		/**< Predicted months. */
+	int					mRetrainInterval;	/**< Steps between full retrainings. */
+
+  private:
+	const Matrix&			mData;
+	int						mStartMonth;
+	Array<BacktestStep>&	mSteps;
+};
+
+/*******************************************************************************
+ * A failed step makes the next step train from scratch, as the state
+ * of the strategy is then unknown.
+ ******************************************************************************/
+void BacktestChainTask::run ()
+{
+	int inputMonths = mpStrategy->inputMonths ();
+	int previous    = -1;
+	for (int s=mFirst; s<mEnd; s++) {
+		BacktestStep& step  = mSteps[s];
+		double        start = wallClock ();
+		try {
+			int cutoff = step.cutoff;
+			int last   = cutoff+mHorizon-1;
+			if (last >= mData.rows)
+				last = mData.rows-1;
+
+			MatrixView traindata (mData, 0, cutoff-1, 0, Matrix::end);
+			MatrixView testdata  (mData, cutoff-inputMonths, last, 0, Matrix::end);
+
+			step.retrained = previous<0 ||
+				(mRetrainInterval>0 && (s-mFirst)%mRetrainInterval==0);
+			if (step.retrained)
+				mpStrategy->train (traindata, mStartMonth);
+			else
+				mpStrategy->update (traindata, mStartMonth, cutoff-previous);
+
+			step.results = mpStrategy->test (testdata,
+											 PredictionStrategy::addMonths (mStartMonth,
+																			cutoff-inputMonths));
+			previous = cutoff;
+		} catch (Exception& e) {
+			step.error = e.what ();
+			if (step.error.isEmpty())
+				step.error = i18n("Unknown error");
+			previous = -1;
+		}
+		step.seconds = wallClock () - start;
+	}
+}
+
+WalkForwardBacktest::WalkForwardBacktest (const String& strategyClass,
+										  const StringMap& params)
+		: mStrategyClass (strategyClass), mParams (params)
+{
+	mFirstCutoff     = 24;
+	mLastCutoff      = -1;
+	mStep            = 1;
+	mHorizon         = 12;
+	mThreads         = 0;
+	mChains          = 0;
+	mRetrainInterval = 0;
+}
+
+/*******************************************************************************
+ * Creates and makes a strategy for one chain. If several chains are
+ * run concurrently, strategies that use threads of their own are made
+ * to use just one, so that the chains do not oversubscribe the
+ * processors.
+ ******************************************************************************/
+PredictionStrategy* WalkForwardBacktest::createStrategy (bool singleThreaded) const
+{
+	PredictionStrategy* strategy = dynamic_cast<PredictionStrategy*> (dyncreate (mStrategyClass));
+	if (!strategy)
+		throw invalid_format (i18n("Unknown prediction strategy class '%1'").arg (mStrategyClass));
+
+	strategy->make (mParams);
+	if (singleThreaded)
+		strategy->setThreads (1);
+	return strategy;
+}
+
+BacktestResults* WalkForwardBacktest::run (const Matrix& data, int startmonth) const
+{
+	int last = (mLastCutoff<0)? data.rows-mHorizon : mLastCutoff;
+	if (last > data.rows-1)
+		last = data.rows-1;
+	ASSERTWITH (mStep>0 && mHorizon>0, "Backtest requires a positive step and horizon");
+	ASSERTWITH (mFirstCutoff>0 && mFirstCutoff<=last, "Backtest requires at least one cutoff in the data");
+
+	double start = wallClock ();
+
+	int cutoffs = (last-mFirstCutoff)/mStep+1;
+	int threads = (mThreads>0)? mThreads : ThreadPool::processors ();
+	int chains  = (mChains>0)? mChains : threads;
+	if (chains > cutoffs)
+		chains = cutoffs;
+	if (threads > chains)
+		threads = chains;
+
+	BacktestResults* results = new BacktestResults ();
+	results->steps.make (cutoffs);
+
+	// Prepare the tasks in this thread, as the parameter map and the
+	// class registry are not safe to access concurrently.
+	Array<BacktestChainTask> tasks;
+	try {
+		for (int s=0; s<cutoffs; s++) {
+			results->steps[s].cutoff = mFirstCutoff + s*mStep;
+			results->steps[s].month  = PredictionStrategy::addMonths (startmonth, results->steps[s].cutoff);
+		}
+
+		for (int k=0; k<chains; k++) {
+			BacktestChainTask* task = new BacktestChainTask (data, startmonth, results->steps);
+			tasks.add (task);
+			task->mpStrategy       = createStrategy (chains>1);
+			task->mFirst           = int ((double (k)*cutoffs)/chains);
+			task->mEnd             = int ((double (k+1)*cutoffs)/chains);
+			task->mHorizon         = mHorizon;
+			task->mRetrainInterval = mRetrainInterval;
+		}
+
+		ASSERTWITH (mFirstCutoff > tasks[0].mpStrategy->inputMonths(),
+					"Backtest requires more training rows than input months");
+	} catch (...) {
+		delete results;
+		throw;
+	}
+
+	ThreadPool pool (threads);
+	for (int k=0; k<tasks.size(); k++)
+		pool.submit (tasks.getp(k));
+	pool.wait ();
+
+	// The steps catch their own errors, so this is something else
+	for (int k=0; k<tasks.size(); k++)
+		if (tasks[k].failed ())
+			for (int s=tasks[k].mFirst; s<tasks[k].mEnd; s++)
+				if (!results->steps[s].results && results->steps[s].error.isEmpty())
+					results->steps[s].error = tasks[k].error ();
+
+	results->wallSeconds = wallClock () - start;
+	return results;
+}
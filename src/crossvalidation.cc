@@ -0,0 +1,349 @@
+/***************************************************************************
+ *   This file is part of the Inanna library.                              *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <sys/time.h>
+#include <magic/mclass.h>
+#include "inanna/crossvalidation.h"
+#include "inanna/patternset.h"
+#include "inanna/trainer.h"
+#include "inanna/threadpool.h"
+#include "inanna/equalization.h"
+
+/** Returns the current wall-clock time in seconds. */
+static double wallClock ()
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+CrossValidationFold::CrossValidationFold ()
+{
+	fold           = 0;
+	trainPatterns  = 0;
+	testPatterns   = 0;
+	trainMSE       = 0.0;
+	testMSE        = 0.0;
+	classification = NULL;
+	cyclesTrained  = 0;
+	totalCycles    = 0;
+	seconds        = 0.0;
+}
+
+CrossValidationFold::~CrossValidationFold ()
+{
+	delete classification;
+}
+
+
+
+//////////////////////////////////////////////////////////////////////////////////////////
+// ___                       |   |       | o     |           o            ----                    |//
+///   \           ____  ____ |   |  ___  |       |  ___               _   |   )  ___   ____       |      ____//
+//|     |/\  __  (     (     |   |  ___| | |  ---|  ___| -+- |  __  |/ \  |---  /   ) (     |   | | -+- (//
+//|     |   /  \  \__   \__   \ /  (   | | | (   | (   |  |  | /  \ |   | | \   |---   \__  |   | |  |   \__//
+//\___/ |   \__/ ____) ____)   V    \__| | |  ---|  \__|   \ | \__/ |   | |  \   \__  ____)  \__! |   \ ____)//
+//////////////////////////////////////////////////////////////////////////////////////////
+
+int CrossValidationResults::failedFolds () const
+{
+	int failed=0;
+	for (int i=0; i<folds.size(); i++)
+		if (!folds[i].error.isEmpty())
+			failed++;
+	return failed;
+}
+
+double CrossValidationResults::meanMSE () const
+{
+	double sum=0.0;
+	int    n=0;
+	for (int i=0; i<folds.size(); i++)
+		if (folds[i].error.isEmpty()) {
+			sum += folds[i].testMSE;
+			n++;
+		}
+	return (n>0)? sum/n : 0.0;
+}
+
+double CrossValidationResults::stddevMSE () const
+{
+	double mean = meanMSE ();
+	double sum  = 0.0;
+	int    n    = 0;
+	for (int i=0; i<folds.size(); i++)
+		if (folds[i].error.isEmpty()) {
+			sum += sqr (folds[i].testMSE - mean);
+			n++;
+		}
+	return (n>1)? sqrt (sum/(n-1)) : 0.0;
+}
+
+double CrossValidationResults::meanTrainMSE () const
+{
+	double sum=0.0;
+	int    n=0;
+	for (int i=0; i<folds.size(); i++)
+		if (folds[i].error.isEmpty()) {
+			sum += folds[i].trainMSE;
+			n++;
+		}
+	return (n>0)? sum/n : 0.0;
+}
+
+int CrossValidationResults::classifFailures () const
+{
+	int failures = -1;
+	for (int i=0; i<folds.size(); i++)
+		if (folds[i].error.isEmpty() && folds[i].classification)
+			failures = ((failures<0)? 0 : failures) + folds[i].classification->failures;
+	return failures;
+}
+
+double CrossValidationResults::foldSeconds () const
+{
+	double sum=0.0;
+	for (int i=0; i<folds.size(); i++)
+		sum += folds[i].seconds;
+	return sum;
+}
+
+Vector CrossValidationResults::meanTrainingProfile () const
+{
+	// Find the longest profile
+	int cycles=0;
+	for (int i=0; i<folds.size(); i++)
+		if (folds[i].error.isEmpty() && folds[i].trainingProfile.size() > cycles)
+			cycles = folds[i].trainingProfile.size();
+
+	Vector result (cycles);
+	PackArray<int> counts (cycles);
+	for (int c=0; c<cycles; c++) {
+		result[c] = 0.0;
+		counts[c] = 0;
+	}
+
+	for (int i=0; i<folds.size(); i++)
+		if (folds[i].error.isEmpty())
+			for (int c=0; c<folds[i].trainingProfile.size(); c++) {
+				result[c] += folds[i].trainingProfile[c];
+				counts[c]++;
+			}
+
+	for (int c=0; c<cycles; c++)
+		result[c] /= counts[c];
+
+	return result;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//     ___                       |   |       | o     |                       //
+//    /   \           ____  ____ |   |  ___  |       |  ___                  //
+//    |     |/\  __  (     (     |   |  ___| | |  ---|  ___| -+-  __  |/\    //
+//    |     |   /  \  \__   \__   \ /  (   | | | (   | (   |  |  /  \ |      //
+//    \___/ |   \__/ ____) ____)   V    \__| | |  ---|  \__|   \ \__/ |      //
+///////////////////////////////////////////////////////////////////////////////
+
+/** Trains and tests one fold. Everything the task modifies is owned
+ *  by the task, so the folds can be run concurrently.
+ **/
+class CrossValidationTask : public ThreadTask {
+  public:
+					CrossValidationTask		(CrossValidationFold& result) : mResult (result) {
+						mpNetwork = NULL;
+						mpTrainer = NULL;
+						mpShape   = NULL;
+					}
+					~CrossValidationTask	() {
+						delete mpNetwork;
+						delete mpTrainer;
+					}
+
+	virtual void	run						();
+
+	ANNetwork*		mpNetwork;		/**< Network built from the prototype structure. */
+	const NetworkWeights* mpShape;	/**< Structure of the prototype. */
+	Trainer*		mpTrainer;		/**< Trainer for the network. */
+	PatternSet		mTrainSet;		/**< Patterns in the other folds. */
+	PatternSet		mValidSet;		/**< Held-out part of the training patterns. */
+	PatternSet		mTestSet;		/**< Patterns in the fold. */
+	int				mCycles;		/**< Maximum number of training cycles. */
+	int				mInterval;		/**< Validation interval. */
+	bool			mClassify;		/**< Test classification? */
+
+  private:
+	CrossValidationFold&	mResult;
+};
+
+void CrossValidationTask::run ()
+{
+	double start = wallClock ();
+
+	bool validate = mValidSet.patterns>0 && mInterval>0;
+	mResult.trainMSE = mpTrainer->train (*mpNetwork, mTrainSet, mCycles,
+										 validate? &mValidSet : (PatternSource*)NULL,
+										 mInterval);
+	mResult.testMSE = mpNetwork->test (mTestSet);
+	if (mClassify)
+		mResult.classification = mpNetwork->testClassify (mTestSet);
+
+	mResult.trainingProfile   = mpTrainer->trainingRecord ();
+	mResult.validationProfile = mpTrainer->validationRecord ();
+	mResult.cyclesTrained     = mpTrainer->cyclesTrained ();
+	mResult.totalCycles       = mpTrainer->totalCycles ();
+	mResult.weights           = NetworkWeights (*mpShape, *mpNetwork);
+	mResult.seconds           = wallClock () - start;
+}
+
+CrossValidator::CrossValidator (const ANNetwork& prototype,
+								const String& trainerClass,
+								const StringMap& params)
+		: mTrainerClass (trainerClass), mParams (params)
+{
+	mPrototype       = NetworkWeights (prototype);
+	mpEqualizer      = prototype.getEqualizer()? prototype.getEqualizer()->clone () : (Equalizer*)NULL;
+	mFolds           = 10;
+	mThreads         = 0;
+	mValidationRatio = 0.0;
+	mClassify        = false;
+}
+
+CrossValidator::~CrossValidator ()
+{
+	delete mpEqualizer;
+}
+
+/*******************************************************************************
+ * Creates and initializes a trainer object for one fold.
+ ******************************************************************************/
+Trainer* CrossValidator::createTrainer () const
+{
+	Trainer* trainer = dynamic_cast<Trainer*> (dyncreate (mTrainerClass));
+	if (!trainer)
+		throw invalid_format (i18n("Unknown trainer class '%1'").arg (mTrainerClass));
+
+	trainer->init (mParams);
+	if (!mParams["terminator"].isEmpty())
+		trainer->setTerminator (mParams["terminator"]);
+	return trainer;
+}
+
+/*******************************************************************************
+ * Copies the patterns of the given fold to the test set and the other
+ * patterns to the training and validation sets.
+ ******************************************************************************/
+void CrossValidator::makeFold (const PatternSource& set, int fold,
+							   PatternSet& train, PatternSet& valid,
+							   PatternSet& test) const
+{
+	int start = int ((double (fold)*set.patterns)/mFolds);
+	int end   = int ((double (fold+1)*set.patterns)/mFolds);
+	int rest  = set.patterns - (end-start);
+	int vsize = int (rest*mValidationRatio);
+
+	test.make (end-start, set.inputs, set.outputs);
+	train.make (rest-vsize, set.inputs, set.outputs);
+	valid.make (vsize, set.inputs, set.outputs);
+
+	// The validation patterns are taken from the end of the
+	// training patterns.
+	for (int p=0, tp=0; p<set.patterns; p++) {
+		PatternSet* target;
+		int         tgtp;
+		if (p>=start && p<end) {
+			target = &test;
+			tgtp   = p-start;
+		} else if (tp < rest-vsize) {
+			target = &train;
+			tgtp   = tp++;
+		} else {
+			target = &valid;
+			tgtp   = (tp++) - (rest-vsize);
+		}
+
+		for (int i=0; i<set.inputs; i++)
+			target->set_input (tgtp, i, set.input (p, i));
+		for (int j=0; j<set.outputs; j++)
+			target->set_output (tgtp, j, set.output (p, j));
+	}
+}
+
+CrossValidationResults* CrossValidator::validate (const PatternSource& set) const
+{
+	ASSERTWITH (mFolds>=2, "Cross-validation requires at least two folds");
+	ASSERTWITH (set.patterns>=mFolds, "Cross-validation requires at least one pattern per fold");
+
+	double start = wallClock ();
+
+	CrossValidationResults* results = new CrossValidationResults ();
+	results->folds.make (mFolds);
+
+	// Prepare the tasks in this thread, as the pattern source, the
+	// prototype, the class registry and the random number generator
+	// are not safe to access concurrently.
+	Array<CrossValidationTask> tasks;
+	try {
+		for (int f=0; f<mFolds; f++) {
+			CrossValidationFold& fold = results->folds[f];
+			CrossValidationTask* task = new CrossValidationTask (fold);
+			tasks.add (task);
+
+			makeFold (set, f, task->mTrainSet, task->mValidSet, task->mTestSet);
+			task->mpNetwork = new ANNetwork;
+			mPrototype.structure().build (*task->mpNetwork);
+			if (mpEqualizer)
+				task->mpNetwork->setEqualizer (mpEqualizer->clone ());
+			task->mpNetwork->init (0.5);
+			task->mpShape   = &mPrototype;
+			task->mpTrainer = createTrainer ();
+			task->mpTrainer->setWarmStart ();
+			task->mCycles   = mParams["maxCycles"].toInt();
+			task->mInterval = mParams["validationInterval"].toInt();
+			task->mClassify = mClassify;
+
+			fold.fold          = f;
+			fold.trainPatterns = task->mTrainSet.patterns;
+			fold.testPatterns  = task->mTestSet.patterns;
+		}
+	} catch (...) {
+		delete results;
+		throw;
+	}
+
+	// Run the folds; there is no use for more threads than folds
+	int threads = (mThreads>0)? mThreads : ThreadPool::processors ();
+	ThreadPool pool ((threads<mFolds)? threads : mFolds);
+	for (int f=0; f<tasks.size(); f++)
+		pool.submit (tasks.getp(f));
+	pool.wait ();
+
+	for (int f=0; f<tasks.size(); f++)
+		if (tasks[f].failed ())
+			results->folds[f].error = tasks[f].error ();
+
+	results->wallSeconds = wallClock () - start;
+	return results;
+}
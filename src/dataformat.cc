@@ -23,6 +23,9 @@
  ***************************************************************************/
 
 #include <fstream>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <magic/mobject.h>
 #include <magic/mtextstream.h>
 #include "inanna/dataformat.h"
@@ -47,6 +50,14 @@ void DataFormatLib::load (const String& filename, PatternSet& set)
 {
 	ASSERTWITH (!isempty(filename), "Filename required (was empty)");
 
+	// The requested dimensions are a part of the cache key
+	int  requestedInputs  = set.inputs;
+	int  requestedOutputs = set.outputs;
+	bool cacheable        = sCaching && filename != "-" && !filename.isEmpty() &&
+		!(filename.length()>3 && filename.right(3)==".dt"); // Proben1 header attributes are not cached
+	if (cacheable && loadCache (filename, set))
+		return;
+
 	// Open the file
 	TextIStream* in = &stin;
 	if (filename != "-" && !filename.isEmpty()) {
@@ -66,6 +77,9 @@ void DataFormatLib::load (const String& filename, PatternSet& set)
 
 	if (in != &stin)
 		delete in;
+
+	if (cacheable)
+		saveCache (filename, set, requestedInputs, requestedOutputs);
 }
 
 /*******************************************************************************
@@ -119,3 +133,213 @@ DataFormat* DataFormatLib::create (const String& filename) {
 	else
 		return new RawDataFormat ();
 }
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+//     ----                                 ___              |              //
+//     |   )  ___   |   |   ___        _   /   \  ___   ___  | _   ___      //
+//     |---   ___| -+- -+- /   ) |/\ |/ \  |      ___| |   \ |/ | /   )     //
+//     |     (   |  |   |  |---  |   |   | |     (   | |     |  | |---      //
+//     |      \__|   \   \  \__  |   |   | \___/  \__|  \__/ |  |  \__      //
+//////////////////////////////////////////////////////////////////////////////
+
+bool DataFormatLib::sCaching = false;
+
+/** Header of a binary pattern cache file.
+ *
+ *  The header is followed by the source path (pathLength bytes), the
+ *  input and output values as doubles in pattern order, and, if
+ *  hasComments is set, the row comments as length-prefixed,
+ *  null-terminated strings.
+ *  The file is in native byte order; a cache written on a machine
+ *  with different byte order is rejected by the byteOrder field.
+ **/
+struct PatternCacheHeader {
+	char	magic[8];			/**< PATTERN_CACHE_MAGIC */
+	int		byteOrder;			/**< PATTERN_CACHE_BYTEORDER */
+	int		requestedInputs;	/**< Inputs requested when loading the source. */
+	int		requestedOutputs;	/**< Outputs requested when loading the source. */
+	int		pathLength;			/**< Length of the source path. */
+	double	sourceSize;			/**< Size of the source file. */
+	double	sourceMTime;		/**< Modification time of the source file, seconds. */
+	double	sourceMTimeNsec;	/**< Nanoseconds of the modification time. */
+	int		patterns;			/**< Dimensions of the cached set. */
+	int		inputs;
+	int		outputs;
+	int		hasComments;		/**< Are row comments stored? */
+};
+
+#define PATTERN_CACHE_MAGIC		"INNPCCH2"
+#define PATTERN_CACHE_BYTEORDER	0x01020304
+
+/** Returns the name of the cache file for a source file. */
+static String cacheFileName (const String& filename)
+{
+	return filename + ".cache";
+}
+
+/** Fills the cache key fields of the header for the given source file.
+ *
+ *  @return 'false' if the source file could not be examined.
+ **/
+static bool makeCacheKey (const String& filename, PatternCacheHeader& header,
+						  int requestedInputs, int requestedOutputs)
+{
+	struct stat st;
+	if (stat (filename, &st))
+		return false;
+
+	memset (&header, 0, sizeof (header));
+	memcpy (header.magic, PATTERN_CACHE_MAGIC, sizeof (header.magic));
+	header.byteOrder        = PATTERN_CACHE_BYTEORDER;
+	header.requestedInputs  = requestedInputs;
+	header.requestedOutputs = requestedOutputs;
+	header.pathLength       = filename.length ();
+	header.sourceSize       = double (st.st_size);
+	header.sourceMTime      = double (st.st_mtime);
+	header.sourceMTimeNsec  = double (st.st_mtim.tv_nsec);
+	return true;
+}
+
+/*******************************************************************************
+ * Tries to load the pattern set from the cache file of the given
+ * source file.
+ *
+ * @return 'true' if the cache was valid and the set was loaded,
+ * 'false' if the source file must be parsed.
+ ******************************************************************************/
+bool DataFormatLib::loadCache (const String& filename, PatternSet& set)
+{
+	PatternCacheHeader key;
+	if (!makeCacheKey (filename, key, set.inputs, set.outputs))
+		return false;
+
+	FILE* in = fopen (cacheFileName (filename), "rb");
+	if (!in)
+		return false;
+
+	// Read the entire cache file with one read
+	struct stat st;
+	char* buffer = NULL;
+	long  size   = 0;
+	if (!fstat (fileno (in), &st) && st.st_size >= long (sizeof (PatternCacheHeader))) {
+		size   = st.st_size;
+		buffer = new char [size];
+		if (fread (buffer, 1, size, in) != size_t (size))
+			size = 0;
+	}
+	fclose (in);
+	if (size==0) {
+		delete [] buffer;
+		return false;
+	}
+
+	// Validate the key and the size of the data
+	const PatternCacheHeader& header = *reinterpret_cast<const PatternCacheHeader*>(buffer);
+	long dataOffset = sizeof (PatternCacheHeader) + key.pathLength;
+	bool valid = !memcmp (header.magic, key.magic, sizeof (key.magic)) &&
+		header.byteOrder == key.byteOrder &&
+		header.requestedInputs == key.requestedInputs &&
+		header.requestedOutputs == key.requestedOutputs &&
+		header.pathLength == key.pathLength &&
+		header.sourceSize == key.sourceSize &&
+		header.sourceMTime == key.sourceMTime &&
+		header.sourceMTimeNsec == key.sourceMTimeNsec &&
+		header.patterns>=0 && header.inputs>=0 && header.outputs>=0 &&
+		dataOffset + double (header.patterns) * (header.inputs + header.outputs) * sizeof (double) <= size &&
+		!memcmp (buffer + sizeof (PatternCacheHeader), (CONSTR) filename, key.pathLength);
+	if (!valid) {
+		delete [] buffer;
+		return false;
+	}
+
+	// Copy the values to the set. The data is not necessarily
+	// aligned for doubles, so copy it value by value.
+	set.make (header.patterns, header.inputs, header.outputs);
+	const char* data = buffer + dataOffset;
+	double value;
+	for (int p=0; p<set.patterns; p++) {
+		for (int i=0; i<set.inputs; i++, data+=sizeof (double)) {
+			memcpy (&value, data, sizeof (double));
+			set.set_input (p, i, value);
+		}
+		for (int j=0; j<set.outputs; j++, data+=sizeof (double)) {
+			memcpy (&value, data, sizeof (double));
+			set.set_output (p, j, value);
+		}
+	}
+
+	// Row comments
+	if (header.hasComments) {
+		const char* end = buffer + size;
+		Array<String>* comments = new Array<String> (set.patterns);
+		for (int p=0; p<set.patterns; p++) {
+			int length;
+			if (data + int (sizeof (int)) > end)
+				break;
+			memcpy (&length, data, sizeof (int));
+			data += sizeof (int);
+			if (length<1 || data + length > end || data[length-1])
+				break;
+			(*comments)[p] = String (data);
+			data += length;
+		}
+		set.setAttribute ("comments", comments);
+	}
+
+	delete [] buffer;
+	return true;
+}
+
+/*******************************************************************************
+ * Writes the cache file for the given source file.
+ *
+ * The cache is written to a temporary file that is then renamed, so
+ * concurrent jobs never see a partially written cache. Failures are
+ * ignored, as the cache is only an optimization.
+ ******************************************************************************/
+void DataFormatLib::saveCache (const String& filename, const PatternSet& set,
+							   int requestedInputs, int requestedOutputs)
+{
+	PatternCacheHeader header;
+	if (!makeCacheKey (filename, header, requestedInputs, requestedOutputs))
+		return;
+	header.patterns    = set.patterns;
+	header.inputs      = set.inputs;
+	header.outputs     = set.outputs;
+	header.hasComments = !isnull (set.getAttribute ("comments"));
+
+	String cachename = cacheFileName (filename);
+	String tmpname   = strformat ("%s.%d", (CONSTR) cachename, int (getpid ()));
+	FILE* out = fopen (tmpname, "wb");
+	if (!out)
+		return;
+
+	bool ok = fwrite (&header, sizeof (header), 1, out) == 1 &&
+		fwrite ((CONSTR) filename, 1, header.pathLength, out) == size_t (header.pathLength);
+
+	// Write the values one pattern at a time
+	int    rowsize = set.inputs + set.outputs;
+	double* row    = new double [rowsize>0? rowsize : 1];
+	for (int p=0; ok && p<set.patterns; p++) {
+		for (int i=0; i<set.inputs; i++)
+			row[i] = set.input (p, i);
+		for (int j=0; j<set.outputs; j++)
+			row[set.inputs+j] = set.output (p, j);
+		ok = fwrite (row, sizeof (double), rowsize, out) == size_t (rowsize);
+	}
+	delete [] row;
+
+	if (ok && header.hasComments) {
+		const Array<String>& comments = dynamic_cast<const Array<String>&> (set.getAttribute ("comments"));
+		for (int p=0; ok && p<set.patterns; p++) {
+			int length = comments[p].length () + 1; // Including the terminating null
+			ok = fwrite (&length, sizeof (int), 1, out) == 1 &&
+				fwrite ((CONSTR) comments[p], 1, length, out) == size_t (length);
+		}
+	}
+
+	if (fclose (out) || !ok || rename (tmpname, cachename))
+		unlink (tmpname);
+}
@@ -22,10 +22,14 @@
  *                                                                         *
  ***************************************************************************/
 
+#include <stdlib.h>
+#include <math.h>
 #include "inanna/equalization.h"
+#include "inanna/threadpool.h"
 #include "magic/mclass.h"
 
 impl_dynamic (Equalizer, {Object});
+impl_dynamic (QuantileSketch, {Object});
 impl_dynamic (HistogramEq, {Equalizer});
 impl_dynamic (GaussianEq, {Equalizer});
 impl_dynamic (MinmaxEq, {Equalizer});
@@ -92,6 +96,43 @@ void Equalizer::unequalize (Vector& vec) const
  *
  * @warning Must be overloaded by any inheritor.
  ******************************************************************************/
+/*******************************************************************************
+ * Analyzes strided data by copying it to a vector.
+ ******************************************************************************/
+void Equalizer::analyzeStrided (const double* data, int n, int stride, bool additive)
+{
+	Vector vec (n);
+	for (int i=0; i<n; i++)
+		vec[i] = data[i*stride];
+	analyze (vec, additive);
+}
+
+/*******************************************************************************
+ * Equalizes strided data by copying it through a vector.
+ ******************************************************************************/
+void Equalizer::equalizeStrided (double* data, int n, int stride) const
+{
+	Vector vec (n);
+	for (int i=0; i<n; i++)
+		vec[i] = data[i*stride];
+	equalize (vec);
+	for (int i=0; i<n; i++)
+		data[i*stride] = vec[i];
+}
+
+/*******************************************************************************
+ * Unequalizes strided data by copying it through a vector.
+ ******************************************************************************/
+void Equalizer::unequalizeStrided (double* data, int n, int stride) const
+{
+	Vector vec (n);
+	for (int i=0; i<n; i++)
+		vec[i] = data[i*stride];
+	unequalize (vec);
+	for (int i=0; i<n; i++)
+		data[i*stride] = vec[i];
+}
+
 Equalizer* Equalizer::clone () const
 {
 	MUST_OVERLOAD;
@@ -120,6 +161,258 @@ TextOStream& Equalizer::operator>> (TextOStream&) const
 }
 
 
+
+//////////////////////////////////////////////////////////////////////////////
+//   ___                        o |        ---- |                    |      //
+//  |   |        ___    _    |    |  ___  (     |     ___   |   ___  | _    //
+//  |   | |   |  ___| |/ \  -+- | | /   )  ---  | /  /   ) -+- |   \ |/ |   //
+//  |  \| |   | (   | |   |  |  | | |---      ) |/   |---   |  |     |  |   //
+//  `___\  \__!  \__| |   |   \ | |  \__  ___/  | \   \__    \  \__/ |  |   //
+//////////////////////////////////////////////////////////////////////////////
+
+/** A weighted centroid, used when sorting the sketch contents. */
+struct SketchCentroid {
+	double	mean;
+	double	weight;
+};
+
+static int compareCentroids (const void* a, const void* b)
+{
+	double am = ((const SketchCentroid*) a)->mean;
+	double bm = ((const SketchCentroid*) b)->mean;
+	return (am < bm)? -1 : (am > bm)? 1 : 0;
+}
+
+/*******************************************************************************
+ * The scale function of the sketch. The centroids are merged so that
+ * each of them spans at most one unit of the scale, which keeps the
+ * centroids small near the tails of the distribution.
+ ******************************************************************************/
+static inline double sketchScale (double q, int compression)
+{
+	if (q <= 0.0)
+		q = 0.0;
+	if (q >= 1.0)
+		q = 1.0;
+	return compression/(2*M_PI) * asin (2*q-1);
+}
+
+QuantileSketch::QuantileSketch (int compression)
+{
+	ASSERTWITH (compression > 0, "Quantile sketch compression must be positive.");
+	mCompression	= compression;
+	mCentroids		= 0;
+	mBuffered		= 0;
+	mTotal			= 0.0;
+	mMin			= 0.0;
+	mMax			= 0.0;
+
+	// Two adjacent merged centroids always span more than one unit of
+	// the scale, whose whole range is compression/2, so this is enough.
+	mMeans.make (compression+2);
+	mWeights.make (compression+2);
+	mBuffer.make (5*compression);
+	mBufWeights.make (5*compression);
+}
+
+void QuantileSketch::add (double x, double weight)
+{
+	if (is_undef (x) || weight <= 0.0)
+		return;
+
+	if (mTotal == 0.0)
+		mMin = mMax = x;
+	else {
+		if (x < mMin)
+			mMin = x;
+		if (x > mMax)
+			mMax = x;
+	}
+	mTotal += weight;
+
+	if (mBuffered == mBuffer.size())
+		flush ();
+	mBuffer[mBuffered]		= x;
+	mBufWeights[mBuffered]	= weight;
+	mBuffered++;
+}
+
+void QuantileSketch::add (const Vector& vec)
+{
+	for (int i=0; i<vec.size(); i++)
+		add (vec[i]);
+}
+
+/*******************************************************************************
+ * Adds the contents of another sketch to this one. The result is
+ * about as accurate as if all the values had been added directly to
+ * this sketch.
+ ******************************************************************************/
+void QuantileSketch::merge (const QuantileSketch& other)
+{
+	other.flush ();
+	for (int i=0; i<other.mCentroids; i++)
+		add (other.mMeans[i], other.mWeights[i]);
+
+	// The centroid means are never outside the actual extremes, which
+	// must be taken from the other sketch.
+	if (other.mTotal > 0.0) {
+		if (other.mMin < mMin)
+			mMin = other.mMin;
+		if (other.mMax > mMax)
+			mMax = other.mMax;
+	}
+}
+
+void QuantileSketch::clear ()
+{
+	mCentroids	= 0;
+	mBuffered	= 0;
+	mTotal		= 0.0;
+	mMin		= 0.0;
+	mMax		= 0.0;
+}
+
+/*******************************************************************************
+ * Merges the buffered values to the centroids.
+ *
+ * The old centroids and the buffered values are sorted together, and
+ * adjacent items are then merged as long as the merged centroid stays
+ * within one unit of the scale function.
+ ******************************************************************************/
+void QuantileSketch::flush () const
+{
+	if (mBuffered == 0)
+		return;
+
+	// Collect and sort all items
+	int items = mCentroids + mBuffered;
+	SketchCentroid* sorted = new SketchCentroid [items];
+	for (int i=0; i<mCentroids; i++) {
+		sorted[i].mean		= mMeans[i];
+		sorted[i].weight	= mWeights[i];
+	}
+	for (int i=0; i<mBuffered; i++) {
+		sorted[mCentroids+i].mean	= mBuffer[i];
+		sorted[mCentroids+i].weight	= mBufWeights[i];
+	}
+	qsort (sorted, items, sizeof (SketchCentroid), compareCentroids);
+
+	double total = 0.0;
+	for (int i=0; i<items; i++)
+		total += sorted[i].weight;
+
+	// Merge the sorted items from left to right
+	int		merged		= 0;
+	double	cumulative	= 0.0;
+	double	curMean		= sorted[0].mean;
+	double	curWeight	= sorted[0].weight;
+	double	kLeft		= sketchScale (0.0, mCompression);
+	for (int i=1; i<items; i++) {
+		double q = (cumulative+curWeight+sorted[i].weight)/total;
+		if (sketchScale (q, mCompression) - kLeft <= 1.0) {
+			curWeight += sorted[i].weight;
+			curMean += (sorted[i].mean-curMean)*sorted[i].weight/curWeight;
+		} else {
+			mMeans[merged]		= curMean;
+			mWeights[merged]	= curWeight;
+			merged++;
+			cumulative	+= curWeight;
+			kLeft		= sketchScale (cumulative/total, mCompression);
+			curMean		= sorted[i].mean;
+			curWeight	= sorted[i].weight;
+		}
+	}
+	mMeans[merged]		= curMean;
+	mWeights[merged]	= curWeight;
+	mCentroids			= merged+1;
+	mBuffered			= 0;
+
+	delete [] sorted;
+}
+
+/*******************************************************************************
+ * Returns the estimated fraction of values below x.
+ *
+ * The cumulative distribution is interpolated linearly between the
+ * centroids, each of which is taken to have half of its weight below
+ * its mean.
+ ******************************************************************************/
+double QuantileSketch::cdf (double x) const
+{
+	flush ();
+	if (mTotal == 0.0)
+		return 0.0;
+	if (x < mMin)
+		return 0.0;
+	if (x >= mMax)
+		return 1.0;
+
+	double prevX = mMin;
+	double prevP = 0.0;
+	double cumulative = 0.0;
+	for (int i=0; i<mCentroids; i++) {
+		double p = (cumulative+mWeights[i]/2)/mTotal;
+		if (x < mMeans[i])
+			return (mMeans[i] > prevX)? prevP+(p-prevP)*(x-prevX)/(mMeans[i]-prevX) : p;
+		prevX = mMeans[i];
+		prevP = p;
+		cumulative += mWeights[i];
+	}
+	return prevP+(1.0-prevP)*(x-prevX)/(mMax-prevX);
+}
+
+/*******************************************************************************
+ * Returns the estimated p-quantile of the values. This is the inverse
+ * of @ref cdf().
+ ******************************************************************************/
+double QuantileSketch::quantile (double p) const
+{
+	flush ();
+	ASSERTWITH (mTotal > 0.0, "Quantile sketch is empty.");
+	if (p <= 0.0)
+		return mMin;
+	if (p >= 1.0)
+		return mMax;
+
+	double prevX = mMin;
+	double prevP = 0.0;
+	double cumulative = 0.0;
+	for (int i=0; i<mCentroids; i++) {
+		double cp = (cumulative+mWeights[i]/2)/mTotal;
+		if (p < cp)
+			return prevX+(mMeans[i]-prevX)*(p-prevP)/(cp-prevP);
+		prevX = mMeans[i];
+		prevP = cp;
+		cumulative += mWeights[i];
+	}
+	return prevX+(mMax-prevX)*(p-prevP)/(1.0-prevP);
+}
+
+void QuantileSketch::makeKnots (Vector& xs, Vector& ps) const
+{
+	flush ();
+	if (mTotal == 0.0) {
+		xs.make (0);
+		ps.make (0);
+		return;
+	}
+	
+	xs.make (mCentroids+2);
+	ps.make (mCentroids+2);
+	xs[0] = mMin;
+	ps[0] = 0.0;
+	double cumulative = 0.0;
+	for (int i=0; i<mCentroids; i++) {
+		xs[i+1] = mMeans[i];
+		ps[i+1] = (cumulative+mWeights[i]/2)/mTotal;
+		cumulative += mWeights[i];
+	}
+	xs[mCentroids+1] = mMax;
+	ps[mCentroids+1] = 1.0;
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //          |   | o                                      -----               //
 //          |   |    ____  |                  ___        |                   //
@@ -129,8 +422,76 @@ TextOStream& Equalizer::operator>> (TextOStream&) const
 //                                  __/                           |          //
 ///////////////////////////////////////////////////////////////////////////////
 
-HistogramEq::HistogramEq (int precision, double floor, double ceiling) {
-	mHistogram.make (precision);
+static void copyVector (Vector& trg, const Vector& src)
+{
+	trg.make (src.size());
+	for (int i=0; i<src.size(); i++)
+		trg[i] = src[i];
+}
+
+/*******************************************************************************
+ * Maps a value through a piecewise-linear function given as a knot
+ * table with non-decreasing knot coordinates. Values outside the
+ * table are limited to its ends.
+ ******************************************************************************/
+static double interpolateKnots (const Vector& from, const Vector& to, double v)
+{
+	int n = from.size();
+	if (v <= from[0])
+		return to[0];
+	if (v >= from[n-1])
+		return to[n-1];
+
+	// Binary search for the segment with from[lo] <= v < from[hi]
+	int lo = 0, hi = n-1;
+	while (hi-lo > 1) {
+		int mid = (lo+hi)/2;
+		if (from[mid] <= v)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return to[lo] + (to[hi]-to[lo])*(v-from[lo])/(from[hi]-from[lo]);
+}
+
+/*******************************************************************************
+ * Finds the fractional histogram slot where a cumulative histogram
+ * reaches the given level. This is the inverse of the lookup made in
+ * equalization.
+ ******************************************************************************/
+static double inverseCumulative (const Vector& hist, double level)
+{
+	int n = hist.size();
+	if (level <= hist[0])
+		return 0.0;
+	if (level >= hist[n-1])
+		return n-1;
+
+	// Binary search for the slot with hist[lo] <= level < hist[hi]
+	int lo = 0, hi = n-1;
+	while (hi-lo > 1) {
+		int mid = (lo+hi)/2;
+		if (hist[mid] <= level)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo + (level-hist[lo])/(hist[hi]-hist[lo]);
+}
+
+/*******************************************************************************
+ * Constructor.
+ *
+ * @param precision Number of slots in the cumulative histogram.
+ * @param floor Lower bound of the equalized values.
+ * @param ceiling Upper bound of the equalized values.
+ * @param sketchCompression If positive, the equalizer works in the
+ * streaming mode, using a @ref QuantileSketch with the given
+ * compression instead of the histogram.
+ ******************************************************************************/
+HistogramEq::HistogramEq (int precision, double floor, double ceiling, int sketchCompression) {
+	mpSketch = (sketchCompression > 0)? new QuantileSketch (sketchCompression) : NULL;
+	mHistogram.make (mpSketch? 0 : precision);
 	mMin = floor;
 	mMax = ceiling;
 	mLowBound = 1E30;
@@ -138,11 +499,21 @@ HistogramEq::HistogramEq (int precision, double floor, double ceiling) {
 }
 
 HistogramEq::HistogramEq (const HistogramEq& orig) : Equalizer (orig) {
-	mHistogram.make (orig.mHistogram.size());
+	copyVector (mHistogram, orig.mHistogram);
 	mMin = orig.mMin;
 	mMax = orig.mMax;
 	mLowBound = orig.mLowBound;
 	mUpBound = orig.mUpBound;
+	for (int i=0; i<orig.mData.size(); i++)
+		mData.add (new Vector (orig.mData[i]));
+	mpSketch = orig.mpSketch? new QuantileSketch (*orig.mpSketch) : NULL;
+	copyVector (mKnotX, orig.mKnotX);
+	copyVector (mKnotP, orig.mKnotP);
+}
+
+HistogramEq::~HistogramEq ()
+{
+	delete mpSketch;
 }
 
 int HistogramEq::determineDomain (float x, int precision, float lowBound, float upBound) {
@@ -164,7 +535,15 @@ int HistogramEq::determineDomain (float x, int precision, float lowBound, float
 
 void HistogramEq::analyze (const Vector& vec, bool additive)
 {
-	if (additive) {
+	if (mpSketch) {
+		// In the streaming mode, the data is summarized in the sketch
+		// immediately and the knot table is rebuilt when needed.
+		if (!additive)
+			mpSketch->clear ();
+		mpSketch->add (vec);
+		mKnotX.make (0);
+		mKnotP.make (0);
+	} else if (additive) {
 		// It is not possible to directly implement additive analysis with
 		// histogram equalization. Therefore, we have to store all data
 		// and perform the actual equalization later, when the equalize()
@@ -177,8 +556,40 @@ void HistogramEq::analyze (const Vector& vec, bool additive)
 	}
 }
 
+/*******************************************************************************
+ * Adds the data analyzed by another equalizer to this one. Both
+ * equalizers must be in the streaming mode.
+ ******************************************************************************/
+void HistogramEq::merge (const HistogramEq& other)
+{
+	ASSERTWITH (mpSketch && other.mpSketch, "Only streaming mode histogram equalizers can be merged.");
+	mpSketch->merge (*other.mpSketch);
+	mKnotX.make (0);
+	mKnotP.make (0);
+}
+
+/*******************************************************************************
+ * Builds the equalization tables from the additively analyzed data
+ * or the sketch, if they have not been built yet.
+ ******************************************************************************/
+/*virtual*/ void HistogramEq::prepare ()
+{
+	if ((mpSketch && mKnotX.size()==0) || mData.size()>0)
+		finalize ();
+}
+
 void HistogramEq::finalize ()
 {
+	// In the streaming mode, build the knot table from the sketch
+	if (mpSketch) {
+		mpSketch->makeKnots (mKnotX, mKnotP);
+		if (mKnotX.size() > 0) {
+			mLowBound = mKnotX[0];
+			mUpBound = mKnotX[mKnotX.size()-1];
+		}
+		return;
+	}
+	
 	// Calculate the total number of values in stored data.
 	int totlen=0;
 	for (int i=0; i<mData.size(); i++)
@@ -236,6 +647,19 @@ void HistogramEq::analyze2 (const Vector& vec)
 }
 
 /*virtual*/ void HistogramEq::equalize (Vector& vec) const {
+	if (mpSketch) {
+		if (mKnotX.size() == 0)
+			const_cast<HistogramEq&>(*this).finalize ();
+		ASSERTWITH (mKnotX.size(), "Histogram equalizer has not analyzed any data.");
+
+		for (int i=0; i<vec.size(); i++)
+			if (!is_undef (vec[i]))
+				vec[i] = mMin+(mMax-mMin) * interpolateKnots (mKnotX, mKnotP, vec[i]);
+			else if (mHandleMissing)
+				vec[i] = (mMax+mMin)/2;
+		return;
+	}
+	
 	// If additive analysis has been used, the analysis must be
 	// finalized.
 	if (mData.size()>0)
@@ -251,36 +675,37 @@ void HistogramEq::analyze2 (const Vector& vec)
 }
 
 /*virtual*/ void HistogramEq::unequalize (Vector& vec) const {
+	if (mpSketch) {
+		if (mKnotX.size() == 0)
+			const_cast<HistogramEq&>(*this).finalize ();
+		ASSERTWITH (mKnotX.size(), "Histogram equalizer has not analyzed any data.");
+
+		// The knot table is monotonic, so the inverse is found by
+		// swapping the coordinates.
+		for (int i=0; i<vec.size(); i++)
+			if (!is_undef (vec[i]))
+				vec[i] = interpolateKnots (mKnotP, mKnotX, (vec[i]-mMin)/(mMax-mMin));
+			else if (mHandleMissing)
+				vec[i] = interpolateKnots (mKnotP, mKnotX, 0.5);
+		return;
+	}
+	
 	// If additive analysis has been used, the analysis must be
 	// finalized.
 	if (mData.size()>0)
 		const_cast<HistogramEq&>(*this).finalize();
 	ASSERTWITH (mHistogram.size(), "Histogram equalizer has not analyzed any data.");
 	
-	// Unequalize each value in the vector
+	// The cumulative histogram is monotonic, so the slot of each value
+	// can be found with a binary search. The values are interpolated
+	// between the slots and limited to the analyzed bounds.
+	double slotWidth = (mUpBound-mLowBound)/(mHistogram.size()>1? mHistogram.size()-1 : 1);
+	double invRange = 1.0/(mMax-mMin);
 	for (int i=0; i<vec.size(); i++) {
-		if (!is_undef (vec[i])) {
-			// Find reverse function by iterating through the
-			// histogram and finding the slot. NOTE: This solution is
-			// VERY slow! A binary search would be faster.
-			double searchvalue01 = (vec[i]-mMin)/(mMax-mMin);
-			bool found=false;
-			for (int j=0; j<mHistogram.size()-1; j++)
-				if ((mHistogram[j]+mHistogram[j+1])/2 > searchvalue01) {
-					// Calculate the updated value. Note that we would
-					// get more accurate results by interpolating
-					// between current and previous slot.
-					vec[i] = mLowBound+mHistogram[j]*(mUpBound-mLowBound);
-					found = true;
-					break;
-				}
-			// If the value was not found from the histogram, it must
-			// be greater than the upper bound. Since we can't
-			// calculate beyond the bounds, limit to the upper bound.
-			if (!found)
-				vec[i] = mUpBound;
-		} else if (mHandleMissing)
-			vec[i] = mLowBound+mHistogram[mHistogram.size()/2]*(mUpBound-mLowBound);
+		if (!is_undef (vec[i]))
+			vec[i] = mLowBound + slotWidth*inverseCumulative (mHistogram, (vec[i]-mMin)*invRange);
+		else if (mHandleMissing)
+			vec[i] = mLowBound + slotWidth*inverseCumulative (mHistogram, 0.5);
 	}
 }
 
@@ -289,8 +714,10 @@ TextOStream& HistogramEq::operator>> (TextOStream& out) const
 	out << "<HistogramEq lowBound=" << mLowBound
 		<< " upBound=" << mUpBound
 		<< " min=" << mMin
-		<< " max=" << mMax
-		<< ">";
+		<< " max=" << mMax;
+	if (mpSketch)
+		out << " knots=" << mKnotX.size();
+	out << ">";
 	out << "</HistogramEq>";
 
 	return out;
@@ -308,42 +735,76 @@ TextOStream& HistogramEq::operator>> (TextOStream& out) const
 
 GaussianEq::GaussianEq (const GaussianEq& orig)
 		: Equalizer(orig),
-		  mAverage (orig.mAverage), mStdDev (orig.mStdDev) {	
+		  mAverage (orig.mAverage), mStdDev (orig.mStdDev), mCount (orig.mCount) {	
 }
 
 /*virtual*/ void GaussianEq::analyze (const Vector& vec, bool additive) {
-	// Calculate average
-	float sum=0.0;
-	int actualPatterns=0; // There may be missing values
-	for (int i=0; i<vec.size(); i++)
-		if (!is_undef (vec[i])) {
-			sum += vec[i];
-			actualPatterns++;
-		}
-	mAverage = sum/actualPatterns;
-
-	// Calculate stddev
-	sum=0.0;
-	for (int i=0; i<vec.size(); i++)
-		if (!is_undef (vec[i]))
-			sum += sqr (vec[i]-mAverage);
-	mStdDev = sqrt (sum / actualPatterns);
+	if (vec.size() > 0)
+		analyzeStrided (&vec[0], vec.size(), 1, additive);
 }
 
 /*virtual*/ void GaussianEq::equalize (Vector& vec) const {
-	for (int i=0; i<vec.size(); i++)
-		if (!is_undef (vec[i]))
-			vec[i] = (vec[i] - mAverage)/mStdDev;
-		else if (mHandleMissing)
-			vec[i] = 0.0;
+	if (vec.size() > 0)
+		equalizeStrided (&vec[0], vec.size(), 1);
 }
 
 /*virtual*/ void GaussianEq::unequalize (Vector& vec) const {
-	for (int i=0; i<vec.size(); i++)
-		if (!is_undef (vec[i]))
-			vec[i] = (vec[i] - mAverage)/mStdDev;
+	if (vec.size() > 0)
+		unequalizeStrided (&vec[0], vec.size(), 1);
+}
+
+/*******************************************************************************
+ * Calculates the average and the standard deviation in a single pass
+ * with the Welford method. In additive analysis, the statistics are
+ * combined with those of the previously analyzed data.
+ ******************************************************************************/
+/*virtual*/ void GaussianEq::analyzeStrided (const double* data, int n, int stride, bool additive) {
+	double count = 0.0;
+	double mean = 0.0;
+	double m2 = 0.0;	// Sum of squared deviations from the mean
+	for (int i=0; i<n; i++) {
+		double x = data[i*stride];
+		if (is_undef (x))
+			continue; // There may be missing values
+		count += 1.0;
+		double delta = x-mean;
+		mean += delta/count;
+		m2 += delta*(x-mean);
+	}
+
+	if (additive && mCount > 0.0) {
+		double total = mCount+count;
+		double delta = mean-mAverage;
+		m2 += sqr (mStdDev)*mCount + sqr (delta)*mCount*count/total;
+		mean = mAverage + delta*count/total;
+		count = total;
+	}
+
+	mCount = count;
+	mAverage = mean;
+	mStdDev = (count > 0.0)? sqrt (m2/count) : 0.0;
+}
+
+/*virtual*/ void GaussianEq::equalizeStrided (double* data, int n, int stride) const {
+	double scale = 1.0/mStdDev;
+	double offset = -mAverage*scale;
+	for (int i=0; i<n; i++) {
+		double& x = data[i*stride];
+		if (!is_undef (x))
+			x = x*scale + offset;
 		else if (mHandleMissing)
-			vec[i] = mAverage;
+			x = 0.0;
+	}
+}
+
+/*virtual*/ void GaussianEq::unequalizeStrided (double* data, int n, int stride) const {
+	for (int i=0; i<n; i++) {
+		double& x = data[i*stride];
+		if (!is_undef (x))
+			x = x*mStdDev + mAverage;
+		else if (mHandleMissing)
+			x = mAverage;
+	}
 }
 
 
@@ -378,26 +839,67 @@ MinmaxEq::MinmaxEq (const MinmaxEq& orig)
 
 void MinmaxEq::analyze (const Vector& vec, bool additive)
 {
-	mDataMin = additive? min<double>(mDataMin,min (vec)) : min (vec);
-	mDataMax = additive? max<double>(mDataMax,max (vec)) : max (vec);
+	if (vec.size() > 0)
+		analyzeStrided (&vec[0], vec.size(), 1, additive);
 }
 
 void MinmaxEq::equalize (Vector& vec) const
 {
-	for (int i=0; i<vec.size(); i++)
-		if (!is_undef (vec[i]))
-			vec[i] = mTrgMin + (vec[i] - mDataMin)/(mDataMax-mDataMin)*(mTrgMax-mTrgMin);
-		else if (mHandleMissing)
-			vec[i] = (mTrgMax+mTrgMin)/2; // Use the center value for default
+	if (vec.size() > 0)
+		equalizeStrided (&vec[0], vec.size(), 1);
 }
 
 void MinmaxEq::unequalize (Vector& vec) const
 {
-	for (int i=0; i<vec.size(); i++)
-		if (!is_undef (vec[i]))
-			vec[i] = (vec[i]-mTrgMin)/(mTrgMax-mTrgMin)*(mDataMax-mDataMin)+mDataMin;
+	if (vec.size() > 0)
+		unequalizeStrided (&vec[0], vec.size(), 1);
+}
+
+void MinmaxEq::analyzeStrided (const double* data, int n, int stride, bool additive)
+{
+	// Find both bounds in the same pass, skipping missing values
+	double lo = additive? mDataMin : 1E30;
+	double hi = additive? mDataMax : -1E30;
+	for (int i=0; i<n; i++) {
+		double x = data[i*stride];
+		if (is_undef (x))
+			continue;
+		if (x < lo)
+			lo = x;
+		if (x > hi)
+			hi = x;
+	}
+	mDataMin = lo;
+	mDataMax = hi;
+}
+
+void MinmaxEq::equalizeStrided (double* data, int n, int stride) const
+{
+	// The mapping is linear, so it reduces to one multiply-add
+	double scale = (mTrgMax-mTrgMin)/(mDataMax-mDataMin);
+	double offset = mTrgMin - mDataMin*scale;
+	double center = (mTrgMax+mTrgMin)/2; // Use the center value for default
+	for (int i=0; i<n; i++) {
+		double& x = data[i*stride];
+		if (!is_undef (x))
+			x = x*scale + offset;
 		else if (mHandleMissing)
-			vec[i] = (mDataMax+mDataMin)/2; // Use the center value for default
+			x = center;
+	}
+}
+
+void MinmaxEq::unequalizeStrided (double* data, int n, int stride) const
+{
+	double scale = (mDataMax-mDataMin)/(mTrgMax-mTrgMin);
+	double offset = mDataMin - mTrgMin*scale;
+	double center = (mDataMax+mDataMin)/2; // Use the center value for default
+	for (int i=0; i<n; i++) {
+		double& x = data[i*stride];
+		if (!is_undef (x))
+			x = x*scale + offset;
+		else if (mHandleMissing)
+			x = center;
+	}
 }
 
 TextOStream& MinmaxEq::operator>> (TextOStream& out) const
@@ -437,20 +939,34 @@ TextIStream& MinmaxEq::operator<< (TextIStream& in)
  ******************************************************************************/
 MatrixEqualizer::MatrixEqualizer (Equalizer* templ)
 {
+	mIsGlobal = false;
+	mThreads = 1;
+
 	// Put the template as the first item in the equalizer set
 	if (templ)
 		mPlaneEqualizers.add (templ);
 }
 
 /*******************************************************************************
- * Analyzes a matrix for equalization.
+ * Copy constructor. Makes deep copies of the column plane equalizers.
+ ******************************************************************************/
+MatrixEqualizer::MatrixEqualizer (const MatrixEqualizer& orig) : Equalizer (orig)
+{
+	mIsGlobal = orig.mIsGlobal;
+	mThreads = orig.mThreads;
+	for (int i=0; i<orig.mPlaneEqualizers.size(); i++)
+		mPlaneEqualizers.add (orig.mPlaneEqualizers.getp(i)->clone ());
+}
+
+/*******************************************************************************
+ * Analyzes a matrix, or a part of one, for equalization.
  *
  * If the optional additive-parameter is true, the analysis is made
  * for all columns at the same time, i.e., they share their value
  * space. This may be useful if the relative values of different
  * columns are significant.
  ******************************************************************************/
-void MatrixEqualizer::analyze (const Matrix& mat, bool global)
+void MatrixEqualizer::analyze (const MatrixView& mat, bool global)
 {
 	ASSERTWITH (mPlaneEqualizers.size() > 0, "No equalizer template defined for matrix equalizer.");
 
@@ -462,49 +978,110 @@ void MatrixEqualizer::analyze (const Matrix& mat, bool global)
 
 	mIsGlobal = global;
 
-	// Analyze each component column
-	for (int i=0; i<mat.cols; i++) {
-		if (i>0 && !global)
-			mPlaneEqualizers.put (mPlaneEqualizers.getp(0)->clone(), i);
+	// In global mode, all the columns are analyzed into the same
+	// equalizer, which must be done serially.
+	if (global) {
+		processColumns (mat, ANALYZE, 0, mat.cols);
+		return;
+	}
 
-		// Copy matrix column to a vector
-		Vector plane (mat.rows); // Component plane
-		for (int j=0; j<plane.size(); j++)
-			plane[j] = mat.get (j,i);
+	// Make the column equalizers before the analysis, so that the
+	// columns can be analyzed in parallel
+	for (int i=1; i<mat.cols; i++)
+		mPlaneEqualizers.put (mPlaneEqualizers.getp(0)->clone(), i);
 
-		// Analyze the column vector
-		mPlaneEqualizers.getp(global? 0:i)->analyze (plane, global);
-	}
+	forColumns (mat, ANALYZE);
+}
+
+/*virtual*/ void MatrixEqualizer::prepare ()
+{
+	for (int i=0; i<mPlaneEqualizers.size(); i++)
+		mPlaneEqualizers.getp(i)->prepare ();
 }
 
 /*******************************************************************************
- * Internal function for doing both equalization and unequalization.
+ * Applies a column operation in place to the matrix columns in the
+ * range [begin,end). Only the analysis may be given a view to a
+ * constant matrix.
  ******************************************************************************/
-void MatrixEqualizer::bothEqualize (Matrix& mat, bool uneq) const
+void MatrixEqualizer::processColumns (const MatrixView& mat, int op, int begin, int end) const
 {
-	for (int i=0; i<mat.cols; i++) {
-		Vector plane (mat.rows);
+	if (mat.rows == 0)
+		return;
+
+	int stride = mat.stride ();
+	for (int i=begin; i<end; i++) {
+		// If there is only one equalizer, but the matrix has more
+		// columns, we can assume that the planes have been analyzed
+		// with global data.
+		Equalizer* eq = mPlaneEqualizers.getp((mIsGlobal || mPlaneEqualizers.size()==1)? 0:i);
+		double* column = const_cast<double*> (mat.data ()) + i;
+		switch (op) {
+		  case ANALYZE:    eq->analyzeStrided (column, mat.rows, stride, mIsGlobal); break;
+		  case EQUALIZE:   eq->equalizeStrided (column, mat.rows, stride); break;
+		  case UNEQUALIZE: eq->unequalizeStrided (column, mat.rows, stride); break;
+		}
+	}
+}
+
+/*******************************************************************************
+ * Executes the column operations for a block of matrix columns in a
+ * worker thread.
+ ******************************************************************************/
+class EqualizerColumnTask : public ThreadTask {
+  public:
+					EqualizerColumnTask	(const MatrixEqualizer& eq, const MatrixView& mat, int op, int begin, int end)
+							: mEq (eq), mMat (mat), mOp (op), mBegin (begin), mEnd (end) {}
 
-		// Copy the column (component plane) vector from the matrix
-		for (int j=0; j<plane.size(); j++)
-			plane[j] = mat.get (j,i);
+	virtual void	run		() {mEq.processColumns (mMat, mOp, mBegin, mEnd);}
 
-		// Apply the column equalizer. If there is only one equalizer,
-		// but the matrix has more columns, we can assume that the
-		// planes have been analyzed with global data.
-		const Equalizer* eq = mPlaneEqualizers.getp(mIsGlobal? 0:i);
-		if (uneq)
-			eq->unequalize (plane);
-		else
-			eq->equalize (plane);
-
-		//for (int q=0; q<plane.size(); q++)
-		//	sout << plane[q] << " ";
-		//sout << "\n";
-		// Copy the equalized column (component plane) vector back to the matrix
-		for (int j=0; j<plane.size(); j++)
-			mat.get (j,i) = plane[j];
+  private:
+	const MatrixEqualizer&	mEq;
+	MatrixView				mMat;
+	int						mOp;
+	int						mBegin;
+	int						mEnd;
+};
+
+/*******************************************************************************
+ * Applies a column operation to all columns of the matrix, in
+ * parallel if multiple threads have been enabled.
+ *
+ * The columns are divided into contiguous blocks, a few per thread,
+ * which balances the load without making the tasks too small.
+ ******************************************************************************/
+void MatrixEqualizer::forColumns (const MatrixView& mat, int op) const
+{
+	int threads = (mThreads>0)? mThreads : ThreadPool::processors ();
+	if (threads > mat.cols)
+		threads = mat.cols;
+	if (threads <= 1) {
+		processColumns (mat, op, 0, mat.cols);
+		return;
 	}
+
+	// The plane equalizers may finalize their analysis lazily on the
+	// first equalization, and in the global mode they are shared by
+	// all the columns, so the finalization must be done before the
+	// columns are dispatched to the workers.
+	if (op != ANALYZE)
+		for (int i=0; i<mPlaneEqualizers.size(); i++)
+			mPlaneEqualizers.getp(i)->prepare ();
+
+	int blocks = (4*threads < mat.cols)? 4*threads : mat.cols;
+	Array<EqualizerColumnTask> tasks;
+	for (int b=0; b<blocks; b++)
+		tasks.add (new EqualizerColumnTask (*this, mat, op,
+											b*mat.cols/blocks, (b+1)*mat.cols/blocks));
+
+	ThreadPool pool (threads);
+	for (int b=0; b<blocks; b++)
+		pool.submit (tasks.getp(b));
+	pool.wait ();
+
+	for (int b=0; b<blocks; b++)
+		if (tasks[b].failed ())
+			throw generic_exception (tasks[b].error ());
 }
 
 /*******************************************************************************
@@ -513,7 +1090,7 @@ void MatrixEqualizer::bothEqualize (Matrix& mat, bool uneq) const
  ******************************************************************************/
 void MatrixEqualizer::equalize (Matrix& mat) const
 {
-	bothEqualize (mat, false);
+	forColumns (mat, EQUALIZE);
 }
 
 /*******************************************************************************
@@ -522,7 +1099,19 @@ void MatrixEqualizer::equalize (Matrix& mat) const
  ******************************************************************************/
 void MatrixEqualizer::unequalize (Matrix& mat) const
 {
-	bothEqualize (mat, true);
+	forColumns (mat, UNEQUALIZE);
+}
+
+/*******************************************************************************
+ * Reverses the equalization of a batch of values that belong to the
+ * given matrix column, such as the predictions for one output
+ * variable, without building a matrix around them.
+ ******************************************************************************/
+void MatrixEqualizer::unequalizeColumn (Vector& values, int col) const
+{
+	ASSERTWITH (mIsGlobal || (col >= 0 && col < mPlaneEqualizers.size()),
+				"Column index out of range in unequalization.");
+	mPlaneEqualizers.getp(mIsGlobal? 0:col)->unequalize (values);
 }
 
 TextOStream& MatrixEqualizer::operator>> (TextOStream& out) const
@@ -579,3 +1168,137 @@ void MatrixEqualizer::handleMissing (bool enable)
 	for (int i=0; i < mPlaneEqualizers.size(); i++)
 		mPlaneEqualizers[i].handleMissing (enable);
 }
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//  -----                  | o                | ----                                 ----                             //
+//  |                 ___  |    ___  ___      | |   )  ___   |   |   ___        _   (                     ___   ___   //
+//  |---   __  |   |  ___| | |    / /   )  ---| |---   ___| -+- -+- /   ) |/\ |/ \   ---   __  |   | |/\ |   \ /   )  //
+//  |     /  \ |   | (   | | |   /  |---  (   | |     (   |  |   |  |---  |   |   |     ) /  \ |   | |   |     |---   //
+//  |____ \__|  \__!  \__| | |  /__  \__   ---| |      \__|   \   \  \__  |   |   | ___/  \__/  \__! |    \__/  \__   //
+//           |                                                                                                        //
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*******************************************************************************
+ * Constructs a decorator that equalizes the given pattern source with
+ * the given equalizer.
+ ******************************************************************************/
+EqualizedPatternSource::EqualizedPatternSource (const PatternSource& source, const Equalizer& eq,
+												int blockSize, int cacheBlocks)
+		: mSource (source), mEqualizer (eq)
+{
+	patterns = source.patterns;
+	inputs   = source.inputs;
+	outputs  = source.outputs;
+	setName (source.name());
+
+	// Default mapping: inputs followed by outputs
+	mColumnEq.make (inputs+outputs);
+	for (int c=0; c<inputs+outputs; c++)
+		mColumnEq[c] = planeEqualizer (c);
+
+	mBlockSize = (blockSize > 0 && cacheBlocks > 0)? blockSize : 0;
+	if (mBlockSize > 0) {
+		mCachedBlock.make (cacheBlocks);
+		for (int i=0; i<cacheBlocks; i++)
+			mCachedBlock[i] = -1;
+		mCache.make (cacheBlocks*mBlockSize*(inputs+outputs));
+	}
+}
+
+/*******************************************************************************
+ * Returns the equalizer for the given equalization plane, or NULL if
+ * the plane does not exist.
+ ******************************************************************************/
+const Equalizer* EqualizedPatternSource::planeEqualizer (int plane) const
+{
+	if (plane < 0)
+		return NULL;
+
+	const MatrixEqualizer* meq = dynamic_cast<const MatrixEqualizer*> (&mEqualizer);
+	if (!meq)
+		return &mEqualizer;
+	if (meq->planes() == 1)
+		return &meq->getPlane (0);
+	return (plane < meq->planes())? &meq->getPlane (plane) : NULL;
+}
+
+void EqualizedPatternSource::mapInput (int i, int plane)
+{
+	ASSERTWITH (i >= 0 && i < inputs, "Input index out of range.");
+	mColumnEq[i] = planeEqualizer (plane);
+	for (int s=0; s<mCachedBlock.size(); s++)
+		mCachedBlock[s] = -1;
+}
+
+void EqualizedPatternSource::mapOutput (int j, int plane)
+{
+	ASSERTWITH (j >= 0 && j < outputs, "Output index out of range.");
+	mColumnEq[inputs+j] = planeEqualizer (plane);
+	for (int s=0; s<mCachedBlock.size(); s++)
+		mCachedBlock[s] = -1;
+}
+
+/*******************************************************************************
+ * Reads a block of patterns from the source to a cache slot and
+ * equalizes it column by column.
+ ******************************************************************************/
+void EqualizedPatternSource::loadBlock (int block, int slot) const
+{
+	int width = inputs+outputs;
+	int first = block*mBlockSize;
+	int rows = (first+mBlockSize <= patterns)? mBlockSize : patterns-first;
+	double* data = &mCache[slot*mBlockSize*width];
+
+	for (int r=0; r<rows; r++) {
+		for (int i=0; i<inputs; i++)
+			data[r*width+i] = mSource.input (first+r, i);
+		for (int j=0; j<outputs; j++)
+			data[r*width+inputs+j] = mSource.output (first+r, j);
+	}
+
+	for (int c=0; c<width; c++)
+		if (mColumnEq[c])
+			mColumnEq[c]->equalizeStrided (data+c, rows, width);
+
+	mCachedBlock[slot] = block;
+}
+
+/*******************************************************************************
+ * Returns the equalized value in the given pattern and column, where
+ * the outputs follow the inputs.
+ ******************************************************************************/
+double EqualizedPatternSource::value (int p, int col) const
+{
+	// Without the cache, equalize each value separately
+	if (mBlockSize == 0) {
+		double x = (col < inputs)? mSource.input (p, col) : mSource.output (p, col-inputs);
+		if (mColumnEq[col])
+			mColumnEq[col]->equalizeStrided (&x, 1, 1);
+		return x;
+	}
+
+	int block = p/mBlockSize;
+	int slot = block % mCachedBlock.size();
+	if (mCachedBlock[slot] != block)
+		loadBlock (block, slot);
+	return mCache[(slot*mBlockSize + p-block*mBlockSize)*(inputs+outputs) + col];
+}
+
+void EqualizedPatternSource::print (FILE* out) const
+{
+	if (!out)
+		out=stdout;
+
+	for (int p=0; p<patterns; p++) {
+		fprintf (out, "# Input pattern %d:\n", p);
+		for (int i=0; i<inputs; i++)
+			fprintf (out, "%f ", input (p, i));
+		fprintf (out, "\n");
+		fprintf (out, "# Output pattern %d:\n", p);
+		for (int j=0; j<outputs; j++)
+			fprintf (out, "%f ", output (p, j));
+		fprintf (out, "\n");
+	}
+}
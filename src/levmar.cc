@@ -0,0 +1,279 @@
+/***************************************************************************
+ *   This file is part of the Inanna library.                              *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include <magic/mclass.h>
+#include "inanna/levmar.h"
+#include "inanna/patternset.h"
+
+impl_dynamic (LevenbergMarquardtTrainer, {Trainer});
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//               |     |   | -----           o                               //
+//               |     |\ /|   |        ___      _    ___                    //
+//               |     | V |   |   |/\  ___| | |/ \  /   ) |/\               //
+//               |     | | |   |   |   (   | | |   | |---  |                 //
+//               |____ |   |   |   |    \__| | |   |  \__  |                 //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/*virtual*/ void LevenbergMarquardtTrainer::init (const StringMap& params)
+{
+	Trainer::init (params);
+
+	INITPARAMS(params, 
+			   mLambda0			= params["LevenbergMarquardtTrainer.lambda0"].toDouble();
+			   mLambdaFactor	= params["LevenbergMarquardtTrainer.lambdaFactor"].toDouble();
+			   mLambdaMax		= params["LevenbergMarquardtTrainer.lambdaMax"].toDouble();
+		);
+
+	// Defaults for missing parameters
+	if (mLambda0 <= 0.0)
+		mLambda0 = 0.001;
+	if (mLambdaFactor <= 1.0)
+		mLambdaFactor = 10.0;
+	if (mLambdaMax <= mLambda0)
+		mLambdaMax = 1E10;
+	mLambda = mLambda0;
+}
+
+/*virtual*/ Array<DynParameter>* LevenbergMarquardtTrainer::parameters () const
+{
+	Array<DynParameter>* result = new Array<DynParameter>;
+	result->add (new DoubleParameter	("lambda0", i18n("Initial damping"), 15, 0.0, 1E10, 0.001));
+	result->add (new DoubleParameter	("lambdaFactor", i18n("Damping multiplier"), 15, 1.0, 1000.0, 10.0));
+	result->add (new DoubleParameter	("lambdaMax", i18n("Maximum damping"), 15, 0.0, 1E20, 1E10));
+	result->add (new IntParameter		("maxCycles", i18n("Max training cycles"), 1, 100000, 100));
+
+	return result;
+}
+
+/*******************************************************************************
+ * Implementation for Trainer. Allocates the normal equations for the
+ * weights of the network.
+ ******************************************************************************/
+/*virtual*/ void LevenbergMarquardtTrainer::initTrain (ANNetwork& network) const
+{
+	Trainer::initTrain (network);
+
+	int weights = network.parameters ();
+	mHessian.make (weights, weights);
+	mFactor.make (weights, weights);
+	mGradient.make (weights);
+	mJacobian.make (weights);
+	mStep.make (weights);
+	mSensitivity.make (network.size());
+	mLambda = mLambda0;
+}
+
+/*******************************************************************************
+ * Implementation for Trainer. Takes one Levenberg-Marquardt step. The
+ * damping is increased until the step decreases the error; if it
+ * grows over the maximum, the weights are left as they were, as the
+ * error is then at a minimum.
+ ******************************************************************************/
+/*virtual*/ double LevenbergMarquardtTrainer::trainOnce (ANNetwork& network, const PatternSource& set) const
+{
+	double sse = accumulate (network, set);
+	network.getWeights (mWeights);
+
+	Vector trial (mWeights.size());
+	while (true) {
+		if (solveStep ()) {
+			for (int i=0; i<trial.size(); i++)
+				trial[i] = mWeights[i] + mStep[i];
+			network.setWeights (trial);
+
+			double trialSse = sumSquaredError (network, set);
+			if (trialSse < sse) {
+				// Accept the step and move towards Gauss-Newton
+				sse = trialSse;
+				mLambda /= mLambdaFactor;
+				if (mLambda < 1E-20)
+					mLambda = 1E-20;
+				break;
+			}
+		}
+
+		// Reject the step and move towards gradient descent
+		mLambda *= mLambdaFactor;
+		if (mLambda > mLambdaMax) {
+			network.setWeights (mWeights);
+			mLambda = mLambdaMax;
+			break;
+		}
+	}
+
+	return sse / (set.patterns*set.outputs); // Return MSE
+}
+
+/*******************************************************************************
+ * The Jacobian is computed one output at a time, by propagating the
+ * derivative of the output backwards. Only the upper triangle of the
+ * Hessian is accumulated, and the zero derivatives (of weights that
+ * do not affect the output) are skipped.
+ ******************************************************************************/
+double LevenbergMarquardtTrainer::accumulate (ANNetwork& network, const PatternSource& set) const
+{
+	int weights = mGradient.size ();
+	for (int a=0; a<weights; a++) {
+		mGradient[a] = 0.0;
+		for (int b=a; b<weights; b++)
+			mHessian.get (a, b) = 0.0;
+	}
+
+	int outLayerBase = network.size() - set.outputs;
+	double sse = 0.0;
+	for (int p=0; p<set.patterns; p++) {
+		// Feed the pattern to the network
+		for (int inp=0; inp<set.inputs; inp++)
+			network[inp].setActivation (set.input (p, inp));
+		network.update ();
+
+		for (int outp=0; outp<set.outputs; outp++) {
+			double error = set.output (p, outp) - network[outLayerBase+outp].activation();
+			sse += error*error;
+
+			// Jacobian row in the order of ANNetwork::getWeights()
+			sensitivities (network, outLayerBase+outp);
+			for (int j=0, ji=0; j<network.size(); j++) {
+				const Neuron& neuron_j = network[j];
+				mJacobian[ji++] = mSensitivity[j];
+				for (int i=0; i<neuron_j.incomings(); i++)
+					mJacobian[ji++] = mSensitivity[j] * neuron_j.incoming(i).source().activation();
+			}
+
+			for (int a=0; a<weights; a++) {
+				double ja = mJacobian[a];
+				if (ja == 0.0)
+					continue;
+				mGradient[a] += ja * error;
+				for (int b=a; b<weights; b++)
+					mHessian.get (a, b) += ja * mJacobian[b];
+			}
+		}
+	}
+
+	return sse;
+}
+
+void LevenbergMarquardtTrainer::sensitivities (const ANNetwork& network, int output) const
+{
+	// Iterate backwards; the other output units have no outgoing
+	// connections, so their sensitivity is zero
+	for (int j=network.size()-1; j>=0; j--) {
+		const Neuron& neuron_j = network[j];
+
+		// Derivative by the activation of the neuron
+		double sum_k = 0.0;
+		if (j == output)
+			sum_k = 1.0;
+		else
+			for (int k=0; k<neuron_j.outgoings(); k++)
+				sum_k += mSensitivity[neuron_j.outgoing(k).target().id()] * neuron_j.outgoing(k).weight();
+
+		// Derivative of the transfer function, as in Neuron::transfer()
+		if (!neuron_j.isEnabled() || neuron_j.incomings()==0)
+			sum_k = 0.0;
+		else if (neuron_j.transferFunc() == Neuron::LOGISTIC_TF)
+			sum_k *= neuron_j.activation() * (1.0 - neuron_j.activation());
+
+		mSensitivity[j] = sum_k;
+	}
+}
+
+double LevenbergMarquardtTrainer::sumSquaredError (ANNetwork& network, const PatternSource& set) const
+{
+	int outLayerBase = network.size() - set.outputs;
+	double sse = 0.0;
+	for (int p=0; p<set.patterns; p++) {
+		for (int inp=0; inp<set.inputs; inp++)
+			network[inp].setActivation (set.input (p, inp));
+		network.update ();
+
+		for (int outp=0; outp<set.outputs; outp++)
+			sse += sqr (set.output (p, outp) - network[outLayerBase+outp].activation());
+	}
+	return sse;
+}
+
+/*******************************************************************************
+ * Factorizes J'J + lambda*I = LL' to the lower triangle of mFactor and
+ * solves the step from LL'*dw = J'e by forward and back substitution.
+ ******************************************************************************/
+bool LevenbergMarquardtTrainer::solveStep () const
+{
+	int n = mGradient.size ();
+	for (int j=0; j<n; j++) {
+		double sum = mHessian.get (j, j) + mLambda;
+		for (int k=0; k<j; k++)
+			sum -= mFactor.get (j, k) * mFactor.get (j, k);
+		if (sum <= 0.0)
+			return false;
+		double diag = sqrt (sum);
+		mFactor.get (j, j) = diag;
+
+		for (int i=j+1; i<n; i++) {
+			sum = mHessian.get (j, i); // Upper triangle
+			for (int k=0; k<j; k++)
+				sum -= mFactor.get (i, k) * mFactor.get (j, k);
+			mFactor.get (i, j) = sum / diag;
+		}
+	}
+
+	// Solve L*y = J'e
+	for (int i=0; i<n; i++) {
+		double sum = mGradient[i];
+		for (int k=0; k<i; k++)
+			sum -= mFactor.get (i, k) * mStep[k];
+		mStep[i] = sum / mFactor.get (i, i);
+	}
+
+	// Solve L'*dw = y
+	for (int i=n-1; i>=0; i--) {
+		double sum = mStep[i];
+		for (int k=i+1; k<n; k++)
+			sum -= mFactor.get (k, i) * mStep[k];
+		mStep[i] = sum / mFactor.get (i, i);
+	}
+
+	return true;
+}
+
+/*******************************************************************************
+ * Implementation for Trainer. The damping is the only state kept
+ * between the cycles.
+ ******************************************************************************/
+/*virtual*/ void LevenbergMarquardtTrainer::saveState (CheckpointData& data) const
+{
+	Trainer::saveState (data);
+	data.put (mLambda);
+}
+
+/*virtual*/ void LevenbergMarquardtTrainer::loadState (CheckpointData& data)
+{
+	Trainer::loadState (data);
+	mLambda = data.get ();
+}
@@ -0,0 +1,174 @@
+/***************************************************************************
+ *   This file is part of the Inanna library.                              *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "inanna/netstructure.h"
+#include "inanna/topology.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// |   |                           |     ----                                          //
+// |\  |  ___   |                  |    (      |             ___   |             ___   //
+// | \ | /   ) -+- \    /  __  |/\ | /   ---  -+- |/\ |   | |   \ -+- |   | |/\ /   )  //
+// |  \| |---   |   \\//  /  \ |   |/       )  |  |   |   | |      |  |   | |   |---   //
+// |   |  \__    \   VV   \__/ |   | \  ___/    \ |    \__!  \__/   \  \__! |    \__   //
+/////////////////////////////////////////////////////////////////////////////////////////
+
+NetworkStructure::NetworkStructure (const ANNetwork& net) : mRefs (0)
+{
+	if (const ANNLayering* layering = dynamic_cast<const ANNLayering*> (&net.getTopology ())) {
+		mLayers.make (layering->layers ());
+		for (int l=0; l<mLayers.size(); l++)
+			mLayers[l] = (*layering)[l];
+	}
+
+	mUnits.make (net.size ());
+	mFirstIncoming.make (net.size()+1);
+	int connections = 0;
+	for (int j=0; j<net.size(); j++) {
+		const Neuron& unit = net[j];
+		unit.getPlace (mUnits[j].x, mUnits[j].y, mUnits[j].z);
+		mUnits[j].type         = unit.getType ();
+		mUnits[j].transferFunc = unit.transferFunc ();
+		mUnits[j].enabled      = unit.isEnabled ();
+		mFirstIncoming[j]      = connections;
+		connections           += unit.incomings ();
+	}
+	mFirstIncoming[net.size()] = connections;
+
+	mSources.make (connections);
+	for (int j=0, c=0; j<net.size(); j++)
+		for (int i=0; i<net[j].incomings(); i++)
+			mSources[c++] = net[j].incoming(i).source().id();
+}
+
+bool NetworkStructure::matches (const ANNetwork& net) const
+{
+	if (net.size() != mUnits.size())
+		return false;
+
+	for (int j=0; j<net.size(); j++) {
+		const Neuron& unit = net[j];
+		if (unit.incomings() != mFirstIncoming[j+1]-mFirstIncoming[j])
+			return false;
+		for (int i=0; i<unit.incomings(); i++)
+			if (unit.incoming(i).source().id() != mSources[mFirstIncoming[j]+i])
+				return false;
+	}
+	return true;
+}
+
+void NetworkStructure::build (ANNetwork& net) const
+{
+	// Create the units, with the layering if there is one
+	net.empty ();
+	if (mLayers.size() > 0) {
+		String description;
+		for (int l=0; l<mLayers.size(); l++)
+			description += format ((l>0)? "-%d" : "%d", mLayers[l]);
+		net.make (description);
+	} else
+		for (int j=0; j<mUnits.size(); j++)
+			net.add (net.getUnitPrototype()? net.getUnitPrototype()->clone() : new Neuron ());
+
+	for (int j=0; j<mUnits.size(); j++) {
+		Neuron& unit = net[j];
+		unit.moveTo (mUnits[j].x, mUnits[j].y, mUnits[j].z);
+		unit.setType (mUnits[j].type);
+		unit.setTFunc (mUnits[j].transferFunc);
+		unit.enable (mUnits[j].enabled);
+		unit.setBias (0.0);
+	}
+
+	// Connect in one pass
+	PackArray<int> targets;
+	PackArray<double> weights;
+	targets.make (mSources.size());
+	weights.make (mSources.size());
+	for (int j=0; j<mUnits.size(); j++)
+		for (int c=mFirstIncoming[j]; c<mFirstIncoming[j+1]; c++) {
+			targets[c] = j;
+			weights[c] = 0.0;
+		}
+	if (mSources.size() > 0)
+		net.connectBulk (mSources.size(), &mSources[0], &targets[0], &weights[0]);
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//  |   |                           |    |   |       o       |               //
+//  |\  |  ___   |                  |    |   |  ___          | _   |   ____  //
+//  | \ | /   ) -+- \    /  __  |/\ | /  | | | /   ) |  ___  |/ | -+- (      //
+//  |  \| |---   |   \\//  /  \ |   |/   |\|/| |---  | (   \ |  |  |   \__   //
+//  |   |  \__    \   VV   \__/ |   | \  |   |  \__  |  ---/ |  |   \ ____)  //
+//                                                       __/                 //
+///////////////////////////////////////////////////////////////////////////////
+
+NetworkWeights::NetworkWeights (const ANNetwork& net)
+{
+	NetworkStructure* structure = new NetworkStructure (net);
+	structure->attach ();
+	mpStructure = structure;
+	net.getWeights (mWeights);
+}
+
+NetworkWeights::NetworkWeights (const NetworkWeights& shape, const ANNetwork& net)
+{
+	ASSERTWITH (shape.mpStructure && shape.mpStructure->matches (net),
+				"Network does not have the structure of the weights");
+	mpStructure = shape.mpStructure;
+	mpStructure->attach ();
+	net.getWeights (mWeights);
+}
+
+NetworkWeights::NetworkWeights (const NetworkWeights& other) : mpStructure (NULL)
+{
+	operator= (other);
+}
+
+NetworkWeights::~NetworkWeights ()
+{
+	if (mpStructure)
+		mpStructure->detach ();
+}
+
+void NetworkWeights::operator= (const NetworkWeights& other)
+{
+	if (other.mpStructure)
+		other.mpStructure->attach ();
+	if (mpStructure)
+		mpStructure->detach ();
+	mpStructure = other.mpStructure;
+
+	if (mWeights.size() != other.mWeights.size())
+		mWeights.make (other.mWeights.size());
+	for (int i=0; i<mWeights.size(); i++)
+		mWeights[i] = other.mWeights[i];
+}
+
+void NetworkWeights::build (ANNetwork& net) const
+{
+	ASSERTWITH (mpStructure, "Building a network from empty weights");
+	mpStructure->build (net);
+	net.setWeights (mWeights);
+}
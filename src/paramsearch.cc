@@ -0,0 +1,405 @@
+/***************************************************************************
+ *   This file is part of the Inanna library.                              *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include <sys/time.h>
+#include <math.h>
+#include <magic/mclass.h>
+#include "inanna/paramsearch.h"
+#include "inanna/patternset.h"
+#include "inanna/trainer.h"
+#include "inanna/threadpool.h"
+
+/** Returns the current wall-clock time in seconds. */
+static double wallClock ()
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+SearchCandidate::SearchCandidate ()
+{
+	index         = 0;
+	validationMSE = 0.0;
+	trainMSE      = 0.0;
+	cycles        = 0;
+	rounds        = 0;
+	stopped       = false;
+	seconds       = 0.0;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//    ----                       |    ----                    |              //
+//   (      ___   ___       ___  | _  |   )  ___   ____       |  |   ____    //
+//    ---  /   )  ___| |/\ |   \ |/ | |---  /   ) (     |   | | -+- (        //
+//       ) |---  (   | |   |     |  | | \   |---   \__  |   | |  |   \__     //
+//   ___/   \__   \__| |    \__/ |  | |  \   \__  ____)  \__! |   \ ____)    //
+///////////////////////////////////////////////////////////////////////////////
+
+int SearchResults::failedCandidates () const
+{
+	int failed=0;
+	for (int i=0; i<candidates.size(); i++)
+		if (!candidates[i].error.isEmpty())
+			failed++;
+	return failed;
+}
+
+int SearchResults::totalCycles () const
+{
+	int sum=0;
+	for (int i=0; i<candidates.size(); i++)
+		sum += candidates[i].cycles;
+	return sum;
+}
+
+double SearchResults::candidateSeconds () const
+{
+	double sum=0.0;
+	for (int i=0; i<candidates.size(); i++)
+		sum += candidates[i].seconds;
+	return sum;
+}
+
+void SearchResults::print (FILE* out) const
+{
+	fprintf (out, "rank\tvalidMSE\ttrainMSE\tcycles\trounds\tparameters\n");
+	for (int r=0; r<size(); r++) {
+		const SearchCandidate& candidate = ranked (r);
+		if (candidate.error.isEmpty())
+			fprintf (out, "%d\t%f\t%f\t%d\t%d%s\t%s\n", r+1,
+					 candidate.validationMSE, candidate.trainMSE, candidate.cycles,
+					 candidate.rounds+1, candidate.stopped? "*" : "",
+					 (CONSTR) candidate.description);
+		else
+			fprintf (out, "%d\tfailed: %s\t\t\t\t%s\n", r+1,
+					 (CONSTR) candidate.error, (CONSTR) candidate.description);
+	}
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////
+//  ----                                             ----                       |     //
+//  |   )  ___       ___         ___   |   ___      (      ___   ___       ___  | _   //
+//  |---   ___| |/\  ___| |/|/| /   ) -+- /   ) |/\  ---  /   )  ___| |/\ |   \ |/ |  //
+//  |     (   | |   (   | | | | |---   |  |---  |       ) |---  (   | |   |     |  |  //
+//  |      \__| |    \__| | | |  \__    \  \__  |   ___/   \__   \__| |    \__/ |  |  //
+////////////////////////////////////////////////////////////////////////////////////////
+
+/** Trains one candidate for one round. Everything the task modifies
+ *  is owned by the task, so the candidates can be trained
+ *  concurrently.
+ **/
+class SearchTask : public ThreadTask {
+  public:
+					SearchTask		(SearchCandidate& result) : mResult (result) {
+						mpNetwork = NULL;
+						mpTrainer = NULL;
+					}
+					~SearchTask		() {
+						delete mpNetwork;
+						delete mpTrainer;
+					}
+
+	virtual void	run				();
+
+	ANNetwork*				mpNetwork;		/**< Network of the candidate. */
+	NetworkWeights			mShape;			/**< Structure shared with the candidates of the same topology. */
+	Trainer*				mpTrainer;		/**< Trainer of the candidate. */
+	const PatternSet*		mpTrainSet;		/**< Shared training patterns. */
+	const PatternSet*		mpValidSet;		/**< Shared validation patterns. */
+	int						mCycles;		/**< Cycles to train in this round. */
+	int						mInterval;		/**< Validation interval. */
+
+  private:
+	SearchCandidate&		mResult;
+};
+
+/*******************************************************************************
+ * Continues the training of the candidate from its current weights.
+ * The network is initialized when the task is prepared.
+ ******************************************************************************/
+void SearchTask::run ()
+{
+	double start = wallClock ();
+
+	mResult.trainMSE = mpTrainer->train (*mpNetwork, *mpTrainSet, mCycles,
+										 mpValidSet, mInterval);
+
+	// Lowest validation error of the round
+	const Vector& record = mpTrainer->validationRecord ();
+	double best = (record.size() > 0)? record[0] : mpNetwork->test (*mpValidSet);
+	for (int i=1; i<record.size(); i++)
+		if (record[i] < best)
+			best = record[i];
+
+	if (mResult.cycles == 0 || best < mResult.validationMSE)
+		mResult.validationMSE = best;
+	mResult.cycles  += mpTrainer->totalCycles ();
+	mResult.stopped  = mpTrainer->stopReason () == Trainer::TERMINATED;
+	mResult.seconds += wallClock () - start;
+	mResult.weights = NetworkWeights (mShape, *mpNetwork);
+}
+
+ParameterSearch::ParameterSearch (const String& trainerClass, const StringMap& params)
+		: mTrainerClass (trainerClass), mParams (params)
+{
+	mCandidates = 27;
+	mMinCycles  = 0;
+	mReduction  = 3;
+	mThreads    = 0;
+}
+
+void ParameterSearch::addDimension (Dimension* dimension)
+{
+	dimension->logScale = dimension->logScale && dimension->choices.isEmpty();
+	mDimensions.add (dimension);
+}
+
+void ParameterSearch::addRange (const String& name, double min, double max, bool logScale)
+{
+	ASSERTWITH (min<=max && (!logScale || min>0.0), "Invalid parameter range");
+	Dimension* dimension = new Dimension;
+	dimension->name     = name;
+	dimension->min      = min;
+	dimension->max      = max;
+	dimension->logScale = logScale;
+	dimension->integer  = false;
+	addDimension (dimension);
+}
+
+void ParameterSearch::addIntRange (const String& name, int min, int max)
+{
+	addRange (name, min, max);
+	mDimensions[mDimensions.size()-1].integer = true;
+}
+
+void ParameterSearch::addChoices (const String& name, const String& choices)
+{
+	Dimension* dimension = new Dimension;
+	dimension->name     = name;
+	dimension->min      = 0.0;
+	dimension->max      = 0.0;
+	dimension->logScale = false;
+	dimension->integer  = false;
+	dimension->choices  = choices;
+	addDimension (dimension);
+}
+
+/*******************************************************************************
+ * Samples a value for each searched parameter. Uses the global random
+ * number generator, so this must be called in the main thread.
+ ******************************************************************************/
+void ParameterSearch::sample (SearchCandidate& candidate) const
+{
+	candidate.params = mParams;
+	for (int d=0; d<mDimensions.size(); d++) {
+		const Dimension& dimension = mDimensions[d];
+		String value;
+		if (!dimension.choices.isEmpty()) {
+			// Pick one of the non-empty alternatives
+			Array<String> items, choices;
+			dimension.choices.split (items, ' ');
+			for (int i=0; i<items.size(); i++)
+				if (!items[i].isEmpty())
+					choices.add (new String (items[i]));
+			ASSERTWITH (choices.size()>0, "No choices given for a searched parameter");
+			value = choices[rnd (choices.size())];
+		} else if (dimension.integer)
+			value = format ("%d", int (dimension.min) + rnd (int (dimension.max - dimension.min) + 1));
+		else if (dimension.logScale)
+			value = format ("%g", exp (log (dimension.min) + frnd()*(log (dimension.max) - log (dimension.min))));
+		else
+			value = format ("%g", dimension.min + frnd()*(dimension.max - dimension.min));
+
+		candidate.params.set (dimension.name, value);
+		if (d>0)
+			candidate.description += " ";
+		candidate.description += dimension.name + "=" + value;
+	}
+}
+
+/*******************************************************************************
+ * Creates and initializes a trainer object for one candidate.
+ ******************************************************************************/
+Trainer* ParameterSearch::createTrainer (const StringMap& params) const
+{
+	Trainer* trainer = dynamic_cast<Trainer*> (dyncreate (mTrainerClass));
+	if (!trainer)
+		throw invalid_format (i18n("Unknown trainer class '%1'").arg (mTrainerClass));
+
+	trainer->init (params);
+
+	// A validation record is needed for ranking, so validate even
+	// without early stopping
+	trainer->setTerminator (params["terminator"].isEmpty()? String ("dummy") : params["terminator"]);
+	return trainer;
+}
+
+/*******************************************************************************
+ * Sorts the given candidate indices by the validation error; failed
+ * candidates go last. The number of candidates is small, so an
+ * insertion sort is enough.
+ ******************************************************************************/
+void ParameterSearch::rank (const Array<SearchCandidate>& candidates, PackArray<int>& indices) const
+{
+	for (int i=1; i<indices.size(); i++) {
+		int current = indices[i];
+		const SearchCandidate& c = candidates[current];
+		int j = i-1;
+		for (; j>=0; j--) {
+			const SearchCandidate& other = candidates[indices[j]];
+			bool better = c.error.isEmpty() &&
+				(!other.error.isEmpty() || c.validationMSE < other.validationMSE);
+			if (!better)
+				break;
+			indices[j+1] = indices[j];
+		}
+		indices[j+1] = current;
+	}
+}
+
+SearchResults* ParameterSearch::search (const PatternSource& trainset,
+										const PatternSource& validationset) const
+{
+	ASSERTWITH (mCandidates>=1 && mReduction>=2, "Invalid search settings");
+	ASSERTWITH (validationset.patterns>0, "Parameter search requires validation patterns");
+
+	double start = wallClock ();
+	int maxCycles = mParams["maxCycles"].toInt();
+	int minCycles = mMinCycles;
+	if (minCycles <= 0)
+		minCycles = maxCycles / (mReduction*mReduction*mReduction);
+	if (minCycles <= 0)
+		minCycles = 1;
+	int interval = mParams["validationInterval"].toInt();
+	if (interval <= 0)
+		interval = 1;
+
+	// The pattern sources are not safe to access concurrently, so
+	// the tasks share read-only copies
+	PatternSet trainCopy, validCopy;
+	trainCopy.PatternSource::copy (trainset);
+	validCopy.PatternSource::copy (validationset);
+
+	SearchResults* results = new SearchResults ();
+	results->candidates.make (mCandidates);
+	results->ranking.make (mCandidates);
+
+	// Sample the candidates, initialize their networks and prepare
+	// their tasks in this thread, as the random number generator and
+	// the class registry are not safe to access concurrently.
+	Array<SearchTask> tasks;
+	Array<String> topologies;
+	try {
+		for (int c=0; c<mCandidates; c++) {
+			SearchCandidate& candidate = results->candidates[c];
+			candidate.index = c;
+			results->ranking[c] = c;
+			sample (candidate);
+
+			SearchTask* task = new SearchTask (candidate);
+			tasks.add (task);
+			String hidden = candidate.params["hidden"];
+			if (hidden.isEmpty())
+				hidden = "-";
+			String topology = format ("%d%s%d", trainset.inputs, (CONSTR) hidden, trainset.outputs);
+
+			// Build the network from the structure of an earlier
+			// candidate with the same topology, if there is one
+			int same = 0;
+			while (same<c && topologies[same] != topology)
+				same++;
+			topologies.add (new String (topology));
+			task->mpNetwork = new ANNetwork;
+			if (same < c) {
+				tasks[same].mShape.structure().build (*task->mpNetwork);
+				task->mShape = tasks[same].mShape;
+			} else {
+				task->mpNetwork->make (topology);
+				task->mpNetwork->connectFullFfw (false);
+				task->mShape = NetworkWeights (*task->mpNetwork);
+			}
+			task->mpNetwork->init (0.5);
+			task->mpTrainer = createTrainer (candidate.params);
+			task->mpTrainer->setWarmStart ();
+			task->mpTrainSet = &trainCopy;
+			task->mpValidSet = &validCopy;
+			task->mInterval  = interval;
+		}
+	} catch (...) {
+		delete results;
+		throw;
+	}
+
+	// Successive halving: train the remaining candidates up to the
+	// budget of the round, then keep the best of them
+	int threads = (mThreads>0)? mThreads : ThreadPool::processors ();
+	PackArray<int> remaining (mCandidates);
+	for (int c=0; c<mCandidates; c++)
+		remaining[c] = c;
+	int previousBudget = 0;
+	for (int round=0, budget=minCycles; remaining.size()>0; round++, budget*=mReduction) {
+		if (budget > maxCycles)
+			budget = maxCycles;
+
+		{
+			ThreadPool pool ((threads<remaining.size())? threads : remaining.size());
+			for (int i=0; i<remaining.size(); i++) {
+				tasks[remaining[i]].mCycles = budget - previousBudget;
+				results->candidates[remaining[i]].rounds = round;
+				pool.submit (tasks.getp (remaining[i]));
+			}
+			pool.wait ();
+		}
+
+		for (int i=0; i<remaining.size(); i++)
+			if (tasks[remaining[i]].failed ())
+				results->candidates[remaining[i]].error = tasks[remaining[i]].error ();
+		if (budget >= maxCycles)
+			break;
+
+		// Keep the best candidates that can still be improved
+		rank (results->candidates, remaining);
+		int keep = remaining.size()/mReduction;
+		if (keep < 1)
+			keep = 1;
+		PackArray<int> next;
+		for (int i=0; i<keep; i++) {
+			const SearchCandidate& candidate = results->candidates[remaining[i]];
+			if (candidate.error.isEmpty() && !candidate.stopped)
+				next.add (remaining[i]);
+		}
+		remaining = next;
+		previousBudget = budget;
+	}
+
+	rank (results->candidates, results->ranking);
+	results->wallSeconds = wallClock () - start;
+	return results;
+}
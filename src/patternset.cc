@@ -371,7 +371,7 @@ PatternSet::PatternSet (const Matrix& m, int mins, int mouts)
 		for (int c=0; c<mins; c++) 
 			set_input (r,c,m.get(r,c));
 		for (int c=0; c<mouts; c++)
-			set_output (r,c+mins,m.get(r,c+mins));
+			set_output (r,c,m.get(r,c+mins));
 	}
 }
 
@@ -877,3 +877,52 @@ void ArrayTrainSet::truncate (int newsize) {
 	data.resize (newsize);
 	patterns = data.size() - inputs - outputs;
 }
+
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// |                                 | |   | o           |             ----                                 ----                             //
+// |      ___               ___      | |   |     _       |             |   )  ___   |   |   ___        _   (                     ___   ___   //
+// |      ___|  ___   ___  /   )  ---| | | | | |/ \   ---|  __  \    / |---   ___| -+- -+- /   ) |/\ |/ \   ---   __  |   | |/\ |   \ /   )  //
+// |     (   | (   \ (   \ |---  (   | |\|/| | |   | (   | /  \  \\//  |     (   |  |   |  |---  |   |   |     ) /  \ |   | |   |     |---   //
+// |____  \__|  ---/  ---/  \__   ---| |   | | |   |  ---| \__/   VV   |      \__|   \   \  \__  |   |   | ___/  \__/  \__! |    \__/  \__   //
+//               __/   __/                                                                                                                   //
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+LaggedWindowPatternSource::LaggedWindowPatternSource (const MatrixView& data, int lags, int firstMonth0,
+													  int inputVariable, int outputVariable)
+		: mData (data), mLags (lags), mFirstMonth0 (firstMonth0),
+		  mInputVariable (inputVariable), mOutputVariable (outputVariable)
+{
+	ASSERT (lags>=0 && lags<data.rows);
+	PatternSource::make1 (data.rows-lags,
+						  12 + lags*((inputVariable<0)? data.cols : 1),
+						  (outputVariable<0)? data.cols : 1);
+}
+
+/*******************************************************************************
+ * The month flag m of pattern p is set if some of the lagged rows
+ * p..p+lags-1 falls on the month m.
+ ******************************************************************************/
+double LaggedWindowPatternSource::input (int p, int i) const
+{
+	if (i<12)
+		return (((i-mFirstMonth0-p)%12+12)%12 < mLags)? 1.0 : 0.0;
+
+	i -= 12;
+	if (mInputVariable<0)
+		return mData.get (p + i/mData.cols, i%mData.cols);
+	return mData.get (p+i, mInputVariable);
+}
+
+void LaggedWindowPatternSource::print (FILE* out) const
+{
+	for (int p=0; p<patterns; p++) {
+		for (int i=0; i<inputs; i++)
+			fprintf (out, "%f ", input (p, i));
+		fprintf (out, "-> ");
+		for (int j=0; j<outputs; j++)
+			fprintf (out, "%f ", output (p, j));
+		fprintf (out, "\n");
+	}
+}
@@ -32,6 +32,7 @@
 #include <inanna/equalization.h>
 #include <inanna/annfilef.h>
 #include <inanna/prediction.h>
+#include <inanna/threadpool.h>
 
 impl_dynamic (PredictionStrategy, {Object});
 impl_dynamic (ZeroDeltaPrediction, {PredictionStrategy});
@@ -44,19 +45,6 @@ impl_dynamic (SingleNeuralPrediction, {AbsoluteNeuralPrediction});
 impl_dynamic (DeltaNeuralPrediction, {PredictionStrategy});
 
 
-/*******************************************************************************
- *
- ******************************************************************************/
-Ref<MonthlyDataSet> MonthlyDataSet::sub (int row0, int row1, int col0, int col1) const
-{
-	Ref<MonthlyDataSet> result = new MonthlyDataSet (Matrix::sub (row0, row1, col0, col1));
-	result->mFirstMonth0 = (mFirstMonth0+row0)%12;
-	result->mFirstYear = mFirstYear+(mFirstMonth0+row0)/12;
-	result->mLag = mLag;
-	return result;
-}
-
-
 /////////////////////////////////////////////////////////////////////////////////////////////////////
 //   _             | o     o             -----                 ----                    |           //
 //  / \            |    |      _           |    ___   ____  |  |   )  ___   ____       |  |   ____ //
@@ -155,12 +143,30 @@ void PredictionStrategy::make (const StringMap& params)
  * interpreted as months, so it can have values like 199905 or 9905.
  ******************************************************************************/
 void PredictionStrategy::train (
-	const Matrix& traindata, /**< Data for training the method. */
+	const MatrixView& traindata, /**< Data for training the method. */
 	int           startmonth)
 {
 	MUST_OVERLOAD;
 }
 
+/*******************************************************************************
+ * Updates the trained method when new rows have been appended to the
+ * end of the training data since the previous training or update.
+ *
+ * The default implementation trains the method again with all the
+ * data. Strategies that can continue from their current state should
+ * overload this to make the update cheaper.
+ *
+ * @param startmonth See train().
+ ******************************************************************************/
+/*virtual*/ void PredictionStrategy::update (
+	const MatrixView& traindata, /**< All data for training the method. */
+	int           startmonth,
+	int           newRows)   /**< Number of rows added to the end of the data. */
+{
+	train (traindata, startmonth);
+}
+
 /*******************************************************************************
  * Tests the data and returns the monthly predictions in matrix.
  *
@@ -169,7 +175,7 @@ void PredictionStrategy::train (
  *  @param startmonth See train().
  ******************************************************************************/
 Ref<Matrix>	PredictionStrategy::predict (
-	const Matrix& testdata,
+	const MatrixView& testdata,
 	int           startmonth) const
 {
 	MUST_OVERLOAD;
@@ -191,7 +197,7 @@ Ref<Matrix>	PredictionStrategy::predict (
  *  @param startmonth See train().
  ******************************************************************************/
 /*virtual*/ PredictionTestResults* PredictionStrategy::test (
-	const Matrix& testdata,
+	const MatrixView& testdata,
 	int           startmonth) const
 {
 	// Let the strategy do the prediction
@@ -224,35 +230,25 @@ Ref<Matrix>	PredictionStrategy::predict (
 	return result;
 }
 
-/*******************************************************************************
- * Tests the data and plots the result as a curve with GnuPlot.
- *
- *  @param filename File where the EPS pictures should be printed.
- ******************************************************************************/
-void PredictionStrategy::testCurve (const Matrix& testdata, int startmonth, const String& filename) const
+int PredictionStrategy::threadsFor (int tasks) const
+{
+	int threads = (mThreads>0)? mThreads : ThreadPool::processors ();
+	return (threads<tasks)? threads : tasks;
+}
+
+int PredictionStrategy::addMonths (int month, int months)
 {
+	int month0 = (month/100)*12 + (month%100)-1 + months;
+	return (month0/12)*100 + month0%12 + 1;
 }
 
 /*******************************************************************************
- * Calculates row deltas (differences between rows) for a matrix.
- *
- * Row delta is the change in a column between two rows, that is,
- * Deltas[r,c] = M[r+1,c] - M[r,c].
+ * Tests the data and plots the result as a curve with GnuPlot.
  *
- * @return Reference object to the delta matrix with one row less than the
- * original matrix.
+ *  @param filename File where the EPS pictures should be printed.
  ******************************************************************************/
-Ref<Matrix> PredictionStrategy::rowDeltas (const Matrix& matrix)
+void PredictionStrategy::testCurve (const Matrix& testdata, int startmonth, const String& filename) const
 {
-	Ref<Matrix> result = new Matrix (matrix.rows-1, matrix.cols);
-	Matrix& deltas = result.object();
-
-	// Calculate row deltas
-	for (int r=0; r<deltas.rows; r++)
-		for (int c=0; c<deltas.cols; c++)
-			deltas.get(r,c) = matrix.get(r+1,c) - matrix.get(r,c);
-
-	return result;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -271,15 +267,14 @@ AverageDeltaPrediction::AverageDeltaPrediction (
 }
 
 /*virtual*/ void AverageDeltaPrediction::train (
-	const Matrix& traindata, /**< Data for training the method. */
+	const MatrixView& traindata, /**< Data for training the method. */
 	int           startmonth /**< Starting month of the data.   */)
 {
 	ASSERT ((int(fabs(traindata.get(0,0)-traindata.get(1,0)+0.001))%100) != 1);
 	//cout << "traindata " << traindata.rows << " rows, startmonth=" << startmonth << "\n";
 	
-	// Calculate deltas
-	Ref<Matrix> deltasRef = rowDeltas (traindata);
-	Matrix& deltas = deltasRef.object();
+	// Deltas are computed as they are read
+	RowDeltaView deltas (traindata);
 	
 	// Initialize average matrix
 	mMonthAvg.make (12, deltas.cols);
@@ -301,7 +296,7 @@ AverageDeltaPrediction::AverageDeltaPrediction (
 	}
 }
 
-/*virtual*/ Ref<Matrix> AverageDeltaPrediction::predict (const Matrix& testdata, int startmonth) const {
+/*virtual*/ Ref<Matrix> AverageDeltaPrediction::predict (const MatrixView& testdata, int startmonth) const {
 	Ref<Matrix> result = new Matrix (testdata.rows-inputMonths(), testdata.cols);
 	int startmonthi = startmonth%100;
 	for (int r=0; r<result->rows; r++) {
@@ -326,10 +321,10 @@ AverageDeltaPrediction::AverageDeltaPrediction (
 ZeroDeltaPrediction::ZeroDeltaPrediction (const StringMap& params) : PredictionStrategy ("ZeroDelta") {
 }
 
-/*virtual*/ void ZeroDeltaPrediction::train (const Matrix& traindata, int startmonth) {
+/*virtual*/ void ZeroDeltaPrediction::train (const MatrixView& traindata, int startmonth) {
 }
 
-/*virtual*/ Ref<Matrix> ZeroDeltaPrediction::predict (const Matrix& testdata, int startmonth) const {
+/*virtual*/ Ref<Matrix> ZeroDeltaPrediction::predict (const MatrixView& testdata, int startmonth) const {
 	Ref<Matrix> result = new Matrix (testdata.rows-1, testdata.cols);
 	for (int r=0; r<result->rows; r++)
 		for (int c=0; c<result->cols; c++)
@@ -347,6 +342,30 @@ ZeroDeltaPrediction::ZeroDeltaPrediction (const StringMap& params) : PredictionS
 // \___/ \__/ | | | |__/  | |   |  \__   ---| |     |    \__   ---| |  \__/   \ | \__/ |   | //
 ///////////////////////////////////////////////////////////////////////////////////////////////
 
+/** Trains one component of a combined prediction, if it is given as
+ *  the trainee, and predicts the data with it.
+ **/
+class ComponentTask : public ThreadTask {
+  public:
+					ComponentTask	(const PredictionStrategy& predictor, const MatrixView& data, int startmonth)
+							: mpTrainee (NULL), mPredictor (predictor),
+							  mData (data), mStartMonth (startmonth) {}
+	virtual void	run				();
+
+	PredictionStrategy*			mpTrainee;		/**< Same as the predictor, or NULL. */
+	const PredictionStrategy&	mPredictor;
+	MatrixView					mData;
+	int							mStartMonth;
+	Ref<Matrix>					mPrediction;
+};
+
+void ComponentTask::run ()
+{
+	if (mpTrainee)
+		mpTrainee->train (mData, mStartMonth);
+	mPrediction = mPredictor.predict (mData, mStartMonth);
+}
+
 CombinedPrediction::CombinedPrediction (const StringMap& params) : PredictionStrategy ("CombinedPrediction")
 {
 	make (params);
@@ -355,6 +374,7 @@ CombinedPrediction::CombinedPrediction (const StringMap& params) : PredictionStr
 void CombinedPrediction::make (const StringMap& params)
 {
 	PredictionStrategy::make (params);
+	mThreads = params["CombinedPrediction.threads"].toInt();
 	
 	// Create and initialize predictors
 	mPredictors.add (new ZeroDeltaPrediction (params));
@@ -376,13 +396,27 @@ int CombinedPrediction::determineInputMonths () const
 	return inputMonths;
 }
 
-/*virtual*/ void CombinedPrediction::train (const Matrix& traindata, int startmonth)
+/*virtual*/ void CombinedPrediction::train (const MatrixView& traindata, int startmonth)
 {
 	int firstMonth = (startmonth%100)-1; // Zero-based month number
 
-	// Train the predictors
-	for (int p=0; p<mPredictors.size(); p++)
-		mPredictors[p].train (traindata, startmonth);
+	// Use training data as test data
+	const MatrixView& testdata = traindata;
+
+	// Train the predictors and test the training data with them
+	Array<ComponentTask> tasks;
+	ThreadPool pool (threadsFor (mPredictors.size()));
+	for (int p=0; p<mPredictors.size(); p++) {
+		ComponentTask* task = new ComponentTask (mPredictors[p], testdata, startmonth);
+		task->mpTrainee = mPredictors.getp (p);
+		tasks.add (task);
+		pool.submit (task);
+	}
+	pool.wait ();
+	for (int p=0; p<tasks.size(); p++)
+		if (tasks[p].failed ())
+			throw generic_exception (format ("Training predictor %s failed: %s",
+											 (CONSTR) mPredictors[p].name(), (CONSTR) tasks[p].error ()));
 
 	////////////////////////////////////////////////////////////////////////////////
 	// Evaluate the capability of predictors for each month/variable pair
@@ -397,17 +431,11 @@ int CombinedPrediction::determineInputMonths () const
 	Matrix smallestError (12, traindata.cols);
 	smallestError = 1e30;
 
-	// Use training data as test data
-	const Matrix& testdata = traindata;
-	
-	// Test each predictor
+	// Compare the predictors in order, so that ties go to the first one
 	for (int p=0; p<mPredictors.size(); p++) {
 		//cout << "\nPredictor " << p << ":\n";
 		int predictorInputMonths = mPredictors[p].inputMonths();
-
-		// Test the training data with a predictor
-		Ref<Matrix> predictionRef = mPredictors[p].predict (testdata, startmonth);
-		Matrix& prediction = predictionRef.object();
+		Matrix& prediction = tasks[p].mPrediction.object();
 
 		// WARNING: Unused
 		// int firstResultMonth = (firstMonth+predictorInputMonths)%12;
@@ -448,20 +476,32 @@ int CombinedPrediction::determineInputMonths () const
 	//}
 }
 
-/*virtual*/ Ref<Matrix> CombinedPrediction::predict (const Matrix& testdata, int startmonth) const {
+/*virtual*/ Ref<Matrix> CombinedPrediction::predict (const MatrixView& testdata, int startmonth) const {
 	int firstMonth = (startmonth%100)-1; // Zero-based month
 	Ref<Matrix> result = new Matrix (testdata.rows-inputMonths(), testdata.cols);
 	
-	// Test each predictor
+	// Test each predictor with the input months it needs
+	Array<ComponentTask> tasks;
+	ThreadPool pool (threadsFor (mPredictors.size()));
 	for (int p=0; p<mPredictors.size(); p++) {
 		int predictorInputMonths = mPredictors[p].inputMonths();
+		int firstTestMonth = (firstMonth+inputMonths()-predictorInputMonths)%12;
+
+		// Skip the input months the predictor does not need
+		MatrixView testdata2 = testdata.sub (inputMonths()-predictorInputMonths, Matrix::end, 0, Matrix::end);
+		ComponentTask* task = new ComponentTask (mPredictors[p], testdata2, firstTestMonth+1);
+		tasks.add (task);
+		pool.submit (task);
+	}
+	pool.wait ();
 
-		Matrix testdata2 = testdata.sub (inputMonths()-predictorInputMonths, Matrix::end, 0, Matrix::end);
+	for (int p=0; p<mPredictors.size(); p++) {
+		if (tasks[p].failed ())
+			throw generic_exception (format ("Predicting with %s failed: %s",
+											 (CONSTR) mPredictors[p].name(), (CONSTR) tasks[p].error ()));
+		int predictorInputMonths = mPredictors[p].inputMonths();
 		int firstTestMonth = (firstMonth+inputMonths()-predictorInputMonths)%12;
-		
-		// Test the training data with a predictor
-		Ref<Matrix> predictionRef = mPredictors[p].predict (testdata2, firstTestMonth+1);
-		Matrix& prediction = predictionRef.object();
+		Matrix& prediction = tasks[p].mPrediction.object();
 
 		// Apply the predictor to those datapoints which it has been
 		// found to predict well
@@ -489,7 +529,7 @@ int CombinedPrediction::determineInputMonths () const
 PreviousYear::PreviousYear (const StringMap& params) : PredictionStrategy ("PreviousYear") {
 }
 
-/*virtual*/ void PreviousYear::train (const Matrix& traindata, int startmonth) {
+/*virtual*/ void PreviousYear::train (const MatrixView& traindata, int startmonth) {
 	ASSERT (traindata.rows >= 12);
 	ASSERT ((startmonth%100) == 1);
 	
@@ -500,7 +540,7 @@ PreviousYear::PreviousYear (const StringMap& params) : PredictionStrategy ("Prev
 			mData.get(r,c) = traindata.get (traindata.rows-12+r,c);
 }
 
-/*virtual*/ Ref<Matrix> PreviousYear::predict (const Matrix& testdata, int startmonth) const {
+/*virtual*/ Ref<Matrix> PreviousYear::predict (const MatrixView& testdata, int startmonth) const {
 	ASSERT (mData.rows>0);
 	ASSERT ((startmonth%100) == 1);
 
@@ -528,7 +568,7 @@ PreviousYear::PreviousYear (const StringMap& params) : PredictionStrategy ("Prev
 PreviousYearsAvg::PreviousYearsAvg (const StringMap& params) : PredictionStrategy ("PreviousYearsAvg") {
 }
 
-/*virtual*/ void PreviousYearsAvg::train (const Matrix& traindata, int startmonth) {
+/*virtual*/ void PreviousYearsAvg::train (const MatrixView& traindata, int startmonth) {
 	ASSERT (traindata.rows >= 24);
 	
 	// One year
@@ -544,7 +584,7 @@ PreviousYearsAvg::PreviousYearsAvg (const StringMap& params) : PredictionStrateg
 		}
 }
 
-/*virtual*/ Ref<Matrix> PreviousYearsAvg::predict (const Matrix& testdata, int startmonth) const {
+/*virtual*/ Ref<Matrix> PreviousYearsAvg::predict (const MatrixView& testdata, int startmonth) const {
 	ASSERT (mMonthlyAvg.rows>0);
 
 	int firstMonth = (startmonth%100)-1; // Zero-based month
@@ -584,80 +624,100 @@ void AbsoluteNeuralPrediction::make (const StringMap& params) {
 	PredictionStrategy::make (params);
 }
 
-PatternSet* AbsoluteNeuralPrediction::makeSet (const Matrix& data, int startmonth) const {
+ANNetwork* AbsoluteNeuralPrediction::createNetwork (const MatrixView& data) const {
+	ANNetwork* network = new ANNetwork;
+	network->make (format("%d%s%d", inputVariables(data.cols),
+						  (CONSTR) mHiddenTopology,
+						  outputVariables(data.cols)));
+	network->connectFullFfw (false);
+	return network;
+}
+
+MatrixEqualizer* AbsoluteNeuralPrediction::createEqualizer (const MatrixView& data) const {
+	MatrixEqualizer* mequalizer = new MatrixEqualizer (new MinmaxEq(0.0, 1.0)); // new HistogramEq (100000, 0.0, 1.0)
+
+	// The columns of the training data are analyzed with the threads
+	// of the strategy. The equalizer is later used for small batches
+	// of patterns, possibly in worker threads, so it then works
+	// serially.
+	mequalizer->setThreads (mThreads);
+	mequalizer->analyze (data, mGlobalEqualization);
+	mequalizer->setThreads (1);
+	return mequalizer;
+}
+
+Trainer* AbsoluteNeuralPrediction::createTrainer () const {
+	// Create trainer and set parameters
+	Trainer* trainer;
+	String trainerClass = mParams["AbsoluteNeuralPrediction.trainer"];
+	if (trainerClass.isEmpty() || trainerClass == "RPropTrainer")
+		trainer = new RPropTrainer;
+	else if (!(trainer = dynamic_cast<Trainer*> (dyncreate (trainerClass))))
+		throw invalid_format (i18n("Unknown trainer class '%1'").arg (trainerClass));
+	trainer->init (mParams);
+	trainer->setTerminator (mParams["terminator"]);
+
+	// Set observer to display current training cycle
+	if (rpObserver)
+		trainer->setObserver (rpObserver);
+
+	return trainer;
+}
+
+PatternSource* AbsoluteNeuralPrediction::makeSet (const MatrixView& data, int startmonth, int variable) const {
 	//TRACE2 ("Making pattern set from = %d rows, %d cols", data.rows, data.cols);
 	
-	int startmonthi = (startmonth % 100)-1;
-	int inputs = data.cols;
-	
 	// Input patterns have inputs for each month (12) + inputmonths*attributes.
-	PatternSet* result = new PatternSet (data.rows-inputMonths(),
-										 12+inputMonths()*(mUseAllInputs? inputs:1),
-										 mUseAllOutputs? inputs:1);
-
-	// Copy the monthly attributes to the pattern set
-	for (int p=0; p<result->patterns; p++) {
-		// Zero the input month indicator flags
-		for (int m=0; m<12; m++)
-			result->set_input (p, m, 0);
-
-		// Set input month indicators as 1
-		for (int im=0; im<mInputMonths; im++)
-			result->set_input (p, (startmonthi+p+im+12)%12, 1);
-				
-		// Copy input month values to inputs
-		if (mUseAllInputs)
-			for (int j=0; j<inputs; j++)
-				for (int prm=0; prm<mInputMonths; prm++)
-					result->set_input (p, 12+inputs*prm+j, data.get(p+prm, j));
-		else {
-			// Only one input variable
-			for (int prm=0; prm<mInputMonths; prm++)
-				result->set_input (p, 12+prm, data.get(p+prm, mVariable));
-		}
-		
-		// Copy current month values to outputs
-		if (mUseAllOutputs)
-			for (int j=0; j<inputs; j++)
-				result->set_output (p, j, data.get(p+mInputMonths, j));
-		else
-			// Only one output variable
-			result->set_output (p, 0, data.get(p+mInputMonths, mVariable));
-	}
+	return new LaggedWindowPatternSource (data, inputMonths(), (startmonth % 100)-1,
+										  mUseAllInputs? -1 : variable,
+										  mUseAllOutputs? -1 : variable);
+}
+
+EqualizedPatternSource* AbsoluteNeuralPrediction::equalizeSet (const PatternSource& set, int datacolumns,
+																const ANNetwork& network, int variable) const {
+	EqualizedPatternSource* result = new EqualizedPatternSource (set, *network.getEqualizer());
+
+	// The month indicator flags are not equalized
+	for (int m=0; m<12; m++)
+		result->mapInput (m, -1);
+
+	// The other inputs and the outputs come from the data columns as
+	// arranged in makeSet()
+	for (int i=12; i<set.inputs; i++)
+		result->mapInput (i, mUseAllInputs? (i-12)%datacolumns : variable);
+	for (int j=0; j<set.outputs; j++)
+		result->mapOutput (j, mUseAllOutputs? j : variable);
+
 	return result;
 }
 
-/*virtual*/ void AbsoluteNeuralPrediction::train (const Matrix& traindata, int startmonth) {
+/*virtual*/ void AbsoluteNeuralPrediction::train (const MatrixView& traindata, int startmonth) {
 	//TRACE2 ("Training data = %d rows, %d cols", traindata.rows, traindata.cols);
 	
 	////////////////////////////////////////////////////////////////////////////////
 	// Create network
 	
-	if (!mpNetwork) {
-		mpNetwork = new ANNetwork;
-		mpNetwork->make (format("%d%s%d", inputVariables(traindata.cols),
-								(CONSTR) mHiddenTopology,
-								outputVariables(traindata.cols)));
-		mpNetwork->connectFullFfw (false);
+	if (!mpNetwork)
+		mpNetwork = createNetwork (traindata);
+
+	// Initialize the network. The strategy may be trained in a worker
+	// thread, such as in a backtest chain, so the random number
+	// generator is locked.
+	{
+		RandomLock lock;
+		mpNetwork->init (0.5);
 	}
 
-	// Initialize the network
-	mpNetwork->init (0.5);
-
 	////////////////////////////////////////////////////////////////////////////////
 	// Prepare data
 
-	// Equalize data
-	Matrix equalized = traindata;
-	if (!mpNetwork->getEqualizer()) {
-		MatrixEqualizer* mequalizer = new MatrixEqualizer (new MinmaxEq(0.0, 1.0)); // new HistogramEq (100000, 0.0, 1.0)
-		mequalizer->analyze (traindata, mGlobalEqualization);
-		mpNetwork->setEqualizer (mequalizer);
-	}
-	dynamic_cast<MatrixEqualizer*>(mpNetwork->getEqualizer())->equalize (equalized);
+	// Analyze data for equalization
+	if (!mpNetwork->getEqualizer())
+		mpNetwork->setEqualizer (createEqualizer (traindata));
 
-	// Create pattern set
-	PatternSet* trainset = makeSet (equalized, startmonth);
+	// Create pattern set from the raw data and equalize it on the fly
+	PatternSource* rawset = makeSet (traindata, startmonth);
+	EqualizedPatternSource* trainset = equalizeSet (*rawset, traindata.cols, *mpNetwork);
 	//trainset->print ();
 	//fprintf (stderr, "Training data has %d patterns with %d inputs and %d outputs\n",
 	//trainset->patterns, trainset->inputs, trainset->outputs);
@@ -668,32 +728,78 @@ PatternSet* AbsoluteNeuralPrediction::makeSet (const Matrix& data, int startmont
 	////////////////////////////////////////////////////////////////////////////////
 	// Train
 
-	// Create trainer and set parameters
-	RPropTrainer trainer;
-	trainer.init (mParams);
-	trainer.setTerminator (mParams["terminator"]);
+	Trainer* trainer = createTrainer ();
+	trainer->setWarmStart ();
+	trainer->train (*mpNetwork, *trainset, mParams["maxCycles"].toInt(),
+					NULL, mParams["validationInterval"].toInt());
 
-	// Set observer to display current training cycle
-	if (rpObserver)
-		trainer.setObserver (rpObserver);
+	//fprintf (stderr, "Trained for %d cycles, MSE=%f\n", trainer.totalCycles(), trainmse);
+	delete trainer;
+	delete trainset;
+	delete rawset;
+}
 
-	// Train
-	trainer.train (*mpNetwork, *trainset, mParams["maxCycles"].toInt(),
-				   NULL, mParams["validationInterval"].toInt());
+/*******************************************************************************
+ * Continues the training of the current network and its equalizer
+ * with the most recent months only, instead of training from scratch.
+ * The network is trained with all the data if it has not been trained
+ * yet.
+ *
+ * The number of cycles is given with the parameter
+ * "AbsoluteNeuralPrediction.updateCycles" (by default, a tenth of
+ * "maxCycles"), and the number of recent months with
+ * "AbsoluteNeuralPrediction.updateWindow" (by default, only the new
+ * months). The equalizer is kept as it was analyzed at the full
+ * training, so that the scale of the trained weights stays valid.
+ ******************************************************************************/
+/*virtual*/ void AbsoluteNeuralPrediction::update (const MatrixView& traindata, int startmonth, int newRows) {
+	if (!mpNetwork || !mpNetwork->getEqualizer()) {
+		train (traindata, startmonth);
+		return;
+	}
 
-	//fprintf (stderr, "Trained for %d cycles, MSE=%f\n", trainer.totalCycles(), trainmse);
+	int first = updateStart (traindata, newRows);
+	MatrixView recent = traindata.sub (first, Matrix::end, 0, Matrix::end);
+
+	PatternSource* rawset = makeSet (recent, addMonths (startmonth, first));
+	EqualizedPatternSource* trainset = equalizeSet (*rawset, recent.cols, *mpNetwork);
+
+	Trainer* trainer = createTrainer ();
+	trainer->setWarmStart ();
+	trainer->train (*mpNetwork, *trainset, updateCycles (),
+					NULL, mParams["validationInterval"].toInt());
+
+	delete trainer;
 	delete trainset;
+	delete rawset;
+}
+
+int AbsoluteNeuralPrediction::updateStart (const MatrixView& traindata, int newRows) const {
+	int window = mParams["AbsoluteNeuralPrediction.updateWindow"].toInt();
+	if (window < newRows)
+		window = newRows;
+	int first = traindata.rows - window - inputMonths();
+	return (first>0)? first : 0;
+}
+
+int AbsoluteNeuralPrediction::updateCycles () const {
+	int cycles = mParams["AbsoluteNeuralPrediction.updateCycles"].toInt();
+	if (cycles <= 0)
+		cycles = mParams["maxCycles"].toInt()/10;
+	return (cycles>0)? cycles : 1;
+}
+
+/*virtual*/ Ref<Matrix> AbsoluteNeuralPrediction::predict (const MatrixView& testdata, int startmonth) const {
+	return predictWith (*mpNetwork, testdata, startmonth);
 }
 
-/*virtual*/ Ref<Matrix> AbsoluteNeuralPrediction::predict (const Matrix& testdata, int startmonth) const {
+Ref<Matrix> AbsoluteNeuralPrediction::predictWith (const ANNetwork& network, const MatrixView& testdata,
+												   int startmonth, int variable) const {
 	//TRACE2 ("Test data = %d rows, %d cols", testdata.rows, testdata.cols);
 	
-	// Equalize
-	Matrix equalized = testdata;
-	dynamic_cast<MatrixEqualizer*>(mpNetwork->getEqualizer())->equalize (equalized);
-	
-	// Create pattern set and use it
-	PatternSet* testset = makeSet (equalized, startmonth);
+	// Create pattern set and equalize it on the fly
+	PatternSource* rawset = makeSet (testdata, startmonth, variable);
+	EqualizedPatternSource* testset = equalizeSet (*rawset, testdata.cols, network, variable);
 
 	////////////////////////////////////////////////////////////////////////////////
 	// Test the network
@@ -703,14 +809,26 @@ PatternSet* AbsoluteNeuralPrediction::makeSet (const Matrix& data, int startmont
 
 	// Test one month at a time
 	for (int p=0; p<testset->patterns; p++) {
-		Vector v = mpNetwork->testPattern (*testset, p);
+		Vector v = network.testPattern (*testset, p);
 		for (int i=0; i<v.size(); i++)
 			result->get(p,i) = v[i];
 	}
 	delete testset;
-
-	// Unequalize the results to get money values again
-	dynamic_cast<MatrixEqualizer*>(mpNetwork->getEqualizer())->unequalize (result);
+	delete rawset;
+
+	// Unequalize the results to get money values again. A single
+	// output belongs to the column of the predicted variable.
+	const MatrixEqualizer* equalizer = dynamic_cast<const MatrixEqualizer*>(network.getEqualizer());
+	if (mUseAllOutputs)
+		equalizer->unequalize (result);
+	else {
+		Vector column (result->rows);
+		for (int p=0; p<result->rows; p++)
+			column[p] = result->get (p, 0);
+		equalizer->unequalizeColumn (column, variable);
+		for (int p=0; p<result->rows; p++)
+			result->get (p, 0) = column[p];
+	}
 
 	return result;
 }
@@ -737,52 +855,166 @@ void AbsoluteNeuralPrediction::save (TextOStream& out) const {
 //                    __/                                                    //
 ///////////////////////////////////////////////////////////////////////////////
 
+/** Trains the network of one variable. */
+class VariableTrainingTask : public ThreadTask {
+  public:
+					VariableTrainingTask	() : mpTrainer (NULL), mpRawSet (NULL), mpTrainSet (NULL) {}
+					~VariableTrainingTask	();
+	virtual void	run						();
+
+	ANNetwork*				mpNetwork;		/**< Not owned. */
+	Trainer*				mpTrainer;
+	PatternSource*			mpRawSet;
+	EqualizedPatternSource*	mpTrainSet;
+	int						mCycles;
+	int						mInterval;
+};
+
+VariableTrainingTask::~VariableTrainingTask () {
+	delete mpTrainer;
+	delete mpTrainSet;
+	delete mpRawSet;
+}
+
+void VariableTrainingTask::run () {
+	mpTrainer->train (*mpNetwork, *mpTrainSet, mCycles, NULL, mInterval);
+}
+
+/** Predicts one variable. */
+class VariablePredictionTask : public ThreadTask {
+  public:
+					VariablePredictionTask	(const SingleNeuralPrediction& strategy, const MatrixView& testdata,
+											 int startmonth, int variable)
+							: mStrategy (strategy), mTestData (testdata),
+							  mStartMonth (startmonth), mVariable (variable) {}
+	virtual void	run						();
+
+	const SingleNeuralPrediction&	mStrategy;
+	MatrixView						mTestData;
+	int								mStartMonth;
+	int								mVariable;
+	Ref<Matrix>						mResult;
+};
+
+void VariablePredictionTask::run () {
+	mResult = mStrategy.predictWith (mStrategy.mNetworks[mVariable], mTestData, mStartMonth, mVariable);
+}
+
 void SingleNeuralPrediction::make (const StringMap& params) {
 	AbsoluteNeuralPrediction::make (params);
+	mThreads = params["SingleNeuralPrediction.threads"].toInt();
 }
 
-/*virtual*/ void SingleNeuralPrediction::train (const Matrix& traindata, int startmonth) {
+/*******************************************************************************
+ * The networks, pattern sets and trainers are prepared in this
+ * thread, as the random initialization and the parameter map are not
+ * safe to use concurrently. The equalizer is analyzed only once and
+ * copied to each network.
+ ******************************************************************************/
+/*virtual*/ void SingleNeuralPrediction::train (const MatrixView& traindata, int startmonth) {
 	for (int v=0; v<mNetworks.size(); v++)
 		mNetworks.cut (v);
 	mNetworks.empty ();
 	mNetworks.make (traindata.cols);
 
-	// Train each variable separately
-	sout.autoFlush ();
+	MatrixEqualizer* equalizer = createEqualizer (traindata);
+	Array<VariableTrainingTask> tasks;
 	for (int v=0; v<traindata.cols; v++) {
-		sout.printf ("Training variable %d...\n", v);
-		mVariable = v;
-		AbsoluteNeuralPrediction::train (traindata, startmonth);
-		mNetworks.put (mpNetwork, v);
-		mpNetwork=NULL;
+		ANNetwork* network = createNetwork (traindata);
+		{
+			RandomLock lock;
+			network->init (0.5);
+		}
+		network->setEqualizer (equalizer->clone ());
+		mNetworks.put (network, v);
+
+		VariableTrainingTask* task = new VariableTrainingTask;
+		tasks.add (task);
+		task->mpNetwork  = network;
+		task->mpTrainer  = createTrainer ();
+		task->mpTrainer->setWarmStart ();
+		task->mpRawSet   = makeSet (traindata, startmonth, v);
+		task->mpTrainSet = equalizeSet (*task->mpRawSet, traindata.cols, *network, v);
+		task->mCycles    = mParams["maxCycles"].toInt();
+		task->mInterval  = mParams["validationInterval"].toInt();
 	}
-	sout.printf("\n");
+	delete equalizer;
+
+	runTasks (tasks);
 }
 
-/*virtual*/ Ref<Matrix> SingleNeuralPrediction::predict (const Matrix& testdata, int startmonth) const {
-	SingleNeuralPrediction* ncthis = const_cast<SingleNeuralPrediction*>(this);
+/*******************************************************************************
+ * Continues the training of each variable network with the recent
+ * months, as in @ref AbsoluteNeuralPrediction::update().
+ ******************************************************************************/
+/*virtual*/ void SingleNeuralPrediction::update (const MatrixView& traindata, int startmonth, int newRows) {
+	if (mNetworks.size() != traindata.cols) {
+		train (traindata, startmonth);
+		return;
+	}
 
-	Ref<Matrix> result = new Matrix ();
+	int first = updateStart (traindata, newRows);
+	MatrixView recent = traindata.sub (first, Matrix::end, 0, Matrix::end);
+
+	Array<VariableTrainingTask> tasks;
+	for (int v=0; v<recent.cols; v++) {
+		VariableTrainingTask* task = new VariableTrainingTask;
+		tasks.add (task);
+		task->mpNetwork  = mNetworks.getp (v);
+		task->mpTrainer  = createTrainer ();
+		task->mpTrainer->setWarmStart ();
+		task->mpRawSet   = makeSet (recent, addMonths (startmonth, first), v);
+		task->mpTrainSet = equalizeSet (*task->mpRawSet, recent.cols, mNetworks[v], v);
+		task->mCycles    = updateCycles ();
+		task->mInterval  = mParams["validationInterval"].toInt();
+	}
 
-	// For each variable
-	for (int v=0; v<testdata.cols; v++) {
-		ncthis->mVariable = v;
+	runTasks (tasks);
+}
+
+/** Trains each variable separately. */
+void SingleNeuralPrediction::runTasks (Array<VariableTrainingTask>& tasks) const {
+	int threads = threadsFor (tasks.size());
+	sout.autoFlush ();
+	sout.printf ("Training %d variables in %d threads...\n", tasks.size(), threads);
+	ThreadPool pool (threads);
+	for (int v=0; v<tasks.size(); v++)
+		pool.submit (tasks.getp(v));
+	pool.wait ();
+	sout.printf("\n");
 
-		// Use a small kludge to set the current network
-		ncthis->mpNetwork = const_cast<ANNetwork*>(&mNetworks[v]);
+	for (int v=0; v<tasks.size(); v++)
+		if (tasks[v].failed ())
+			throw generic_exception (format (i18n("Training variable %d failed: %s"),
+											 v, (CONSTR) tasks[v].error ()));
+}
+
+/*virtual*/ Ref<Matrix> SingleNeuralPrediction::predict (const MatrixView& testdata, int startmonth) const {
+	// Let the baseclass do the prediction for each variable
+	Array<VariablePredictionTask> tasks;
+	ThreadPool pool (threadsFor (testdata.cols));
+	for (int v=0; v<testdata.cols; v++) {
+		VariablePredictionTask* task = new VariablePredictionTask (*this, testdata, startmonth, v);
+		tasks.add (task);
+		pool.submit (task);
+	}
+	pool.wait ();
 
-		// Let the baseclass do the prediction for one variable
-		Ref<Matrix> oneVariable = AbsoluteNeuralPrediction::predict (testdata, startmonth);
+	Ref<Matrix> result = new Matrix ();
+	for (int v=0; v<tasks.size(); v++) {
+		if (tasks[v].failed ())
+			throw generic_exception (format ("Predicting variable %d failed: %s",
+											 v, (CONSTR) tasks[v].error ()));
+		const Matrix& oneVariable = tasks[v].mResult.object ();
 
 		// Create the result matrix when we get the number of rows.
 		if (result->rows==0)
-			result->make (oneVariable->rows, testdata.cols);
+			result->make (oneVariable.rows, testdata.cols);
 		
 		// Copy the one variable to the total result
 		for (int r=0; r<result->rows; r++)
-			result->get (r, v) = oneVariable->get (r, 0);
+			result->get (r, v) = oneVariable.get (r, 0);
 	}
-	ncthis->mpNetwork = NULL;
 
 	return result;
 }
@@ -809,6 +1041,19 @@ void SingleNeuralPrediction::save (TextOStream& out) const {
 		ANNFileFormatLib::save (out, mNetworks[i], "SNNS");
 }
 
+void SingleNeuralPrediction::saveNetworks (const String& basename, const char* fileformat) const {
+	for (int i=0; i<mNetworks.size(); i++)
+		ANNFileFormatLib::save (format ("%s.%d", (CONSTR) basename, i), mNetworks[i], fileformat);
+}
+
+void SingleNeuralPrediction::loadNetworks (const String& basename, int variables) {
+	mNetworks.make (variables);
+	for (int i=0; i<variables; i++) {
+		mNetworks.put (new ANNetwork(), i);
+		ANNFileFormatLib::load (format ("%s.%d", (CONSTR) basename, i), mNetworks[i]);
+	}
+}
+
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -823,11 +1068,11 @@ DeltaNeuralPrediction::DeltaNeuralPrediction (const StringMap& params) : Predict
 {
 }
 
-/*virtual*/ void DeltaNeuralPrediction::train (const Matrix& traindata, int startmonth)
+/*virtual*/ void DeltaNeuralPrediction::train (const MatrixView& traindata, int startmonth)
 {
 }
 
-/*virtual*/ Ref<Matrix> DeltaNeuralPrediction::predict (const Matrix& testdata, int startmonth) const
+/*virtual*/ Ref<Matrix> DeltaNeuralPrediction::predict (const MatrixView& testdata, int startmonth) const
 {
 	return Ref<Matrix> (NULL);
 }
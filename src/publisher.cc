@@ -0,0 +1,193 @@
+/***************************************************************************
+ *   This file is part of the Inanna library.                              *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "inanna/publisher.h"
+
+// The snapshot pointer, the epochs and the reader slots are shared
+// without locks. They are accessed through volatile members and
+// ordered with full memory barriers (__sync_synchronize).
+
+
+
+/////////////////////////////////////////////////////////////////////////////////////
+// |   |                           |    ----        |     | o       |              //
+// |\  |  ___   |                  |    |   )       |     |    ____ | _   ___      //
+// | \ | /   ) -+- \    /  __  |/\ | /  |---  |   | |---  | | (     |/ | /   ) |/\ //
+// |  \| |---   |   \\//  /  \ |   |/   |     |   | |   ) | |  \__  |  | |---  |   //
+// |   |  \__    \   VV   \__/ |   | \  |      \__! |__/  | | ____) |  |  \__  |   //
+/////////////////////////////////////////////////////////////////////////////////////
+
+NetworkPublisher::NetworkPublisher ()
+{
+	mpCurrent     = NULL;
+	mEpoch        = FIRST_EPOCH;
+	mVersion      = 0;
+	mRetiredCount = 0;
+	for (int i=0; i<MAX_READERS; i++)
+		mReaderEpochs[i] = SLOT_FREE;
+	pthread_mutex_init (&mPublishLock, NULL);
+}
+
+NetworkPublisher::~NetworkPublisher ()
+{
+	delete mpCurrent;
+	for (int i=0; i<mRetiredCount; i++)
+		delete mRetired[i];
+	pthread_mutex_destroy (&mPublishLock);
+}
+
+/*******************************************************************************
+ * Publishes a new snapshot.
+ *
+ * The snapshot is built before taking the lock. After the swap, the
+ * epoch is advanced; a reader that announced an epoch not later than
+ * the replacement epoch may still be using the old snapshot, while
+ * readers announcing later epochs are guaranteed to see the new one.
+ ******************************************************************************/
+void NetworkPublisher::publish (const ANNetwork& net)
+{
+	MappedANNetwork* snapshot = new MappedANNetwork (net);
+
+	pthread_mutex_lock (&mPublishLock);
+
+	MappedANNetwork* old = mpCurrent;
+	__sync_synchronize ();
+	mpCurrent = snapshot;
+	__sync_synchronize ();
+	long replaced = mEpoch;
+	mEpoch = replaced + 1;
+	mVersion++;
+	__sync_synchronize ();
+
+	if (old) {
+		if (mRetiredCount == mRetired.size()) {
+			mRetired.resize ((mRetiredCount>0)? 2*mRetiredCount : 8);
+			mRetireEpochs.resize (mRetired.size());
+		}
+		mRetired[mRetiredCount] = old;
+		mRetireEpochs[mRetiredCount++] = replaced;
+	}
+	reclaim ();
+
+	pthread_mutex_unlock (&mPublishLock);
+}
+
+/*******************************************************************************
+ * Deletes the retired snapshots that were replaced before the oldest
+ * epoch announced by an active reader.
+ ******************************************************************************/
+void NetworkPublisher::reclaim ()
+{
+	long oldest = mEpoch;
+	for (int i=0; i<MAX_READERS; i++) {
+		long epoch = mReaderEpochs[i];
+		if (epoch >= FIRST_EPOCH && epoch < oldest)
+			oldest = epoch;
+	}
+
+	int kept = 0;
+	for (int i=0; i<mRetiredCount; i++)
+		if (mRetireEpochs[i] < oldest)
+			delete mRetired[i];
+		else {
+			mRetired[kept] = mRetired[i];
+			mRetireEpochs[kept++] = mRetireEpochs[i];
+		}
+	mRetiredCount = kept;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//  |   |                           |    ----                  |             //
+//  |\  |  ___   |                  |    |   )  ___   ___      |  ___        //
+//  | \ | /   ) -+- \    /  __  |/\ | /  |---  /   )  ___|  ---| /   ) |/\   //
+//  |  \| |---   |   \\//  /  \ |   |/   | \   |---  (   | (   | |---  |     //
+//  |   |  \__    \   VV   \__/ |   | \  |  \   \__   \__|  ---|  \__  |     //
+///////////////////////////////////////////////////////////////////////////////
+
+NetworkReader::NetworkReader (NetworkPublisher& publisher) : mPublisher (publisher)
+{
+	// Claim a free slot
+	for (mSlot=0; mSlot<NetworkPublisher::MAX_READERS; mSlot++)
+		if (__sync_bool_compare_and_swap (&mPublisher.mReaderEpochs[mSlot],
+										  long (NetworkPublisher::SLOT_FREE),
+										  long (NetworkPublisher::SLOT_IDLE)))
+			return;
+
+	throw generic_exception (format (i18n("Too many readers for a network publisher (max %d)"),
+									 int (NetworkPublisher::MAX_READERS)));
+}
+
+NetworkReader::~NetworkReader ()
+{
+	__sync_synchronize ();
+	mPublisher.mReaderEpochs[mSlot] = NetworkPublisher::SLOT_FREE;
+}
+
+void NetworkReader::evaluate (const double* input, double* output)
+{
+	// Announce the epoch before looking at the snapshot
+	volatile long& slot = mPublisher.mReaderEpochs[mSlot];
+	slot = mPublisher.mEpoch;
+	__sync_synchronize ();
+
+	const MappedANNetwork* snapshot = mPublisher.mpCurrent;
+	if (snapshot) {
+		if (mWork.size() < snapshot->units())
+			mWork.resize (snapshot->units());
+		snapshot->evaluate (input, output, &mWork[0]);
+	}
+
+	__sync_synchronize ();
+	slot = NetworkPublisher::SLOT_IDLE;
+
+	if (!snapshot)
+		throw generic_exception (i18n("No network has been published yet"));
+}
+
+Vector NetworkReader::evaluate (const Vector& input)
+{
+	// Find the output size from the snapshot being evaluated
+	volatile long& slot = mPublisher.mReaderEpochs[mSlot];
+	slot = mPublisher.mEpoch;
+	__sync_synchronize ();
+
+	const MappedANNetwork* snapshot = mPublisher.mpCurrent;
+	Vector result;
+	if (snapshot) {
+		ASSERTWITH (input.size() == snapshot->inputs(), "Wrong number of inputs for network");
+		result.make (snapshot->outputs());
+		if (mWork.size() < snapshot->units())
+			mWork.resize (snapshot->units());
+		snapshot->evaluate (&input[0], &result[0], &mWork[0]);
+	}
+
+	__sync_synchronize ();
+	slot = NetworkPublisher::SLOT_IDLE;
+
+	if (!snapshot)
+		throw generic_exception (i18n("No network has been published yet"));
+	return result;
+}
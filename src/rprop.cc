@@ -22,9 +22,12 @@
  *                                                                         *
  ***************************************************************************/
 
+#include <magic/mclass.h>
 #include "inanna/rprop.h"
 #include "inanna/patternset.h"
 
+impl_dynamic (RPropTrainer, {BackpropTrainer});
+
 ///////////////////////////////////////////////////////////////////////////////
 //                                                                           //
 //        ----  ----                -----           o                        //
@@ -42,9 +45,28 @@
 	INITPARAMS(params, 
 			   mDelta0			= params["RPropTrainer.delta0"].toDouble();
 			   mDeltaMax		= params["RPropTrainer.deltamax"].toDouble();
+			   mDeltaMin		= params["RPropTrainer.deltamin"].toDouble();
+			   mEtaPlus			= params["RPropTrainer.etaPlus"].toDouble();
+			   mEtaMinus		= params["RPropTrainer.etaMinus"].toDouble();
+			   mBacktracking	= params["RPropTrainer.backtracking"].toInt();
 			   mDecay			= params["BackpropTrainer.decay"].toDouble();
 			   mBatchLearning	= params["BackpropTrainer.batchLearning"].toInt();
 		);
+
+	// Classic Rprop values for missing parameters
+	if (params["RPropTrainer.deltamin"].isEmpty())
+		mDeltaMin = 1E-6;
+	if (params["RPropTrainer.etaPlus"].isEmpty())
+		mEtaPlus = 1.2;
+	if (params["RPropTrainer.etaMinus"].isEmpty())
+		mEtaMinus = 0.5;
+
+	if (mDeltaMin < 0.0)
+		throw invalid_format (format (i18n("RPropTrainer.deltamin must not be negative, got %g"), mDeltaMin));
+	if (mEtaPlus < 1.0)
+		throw invalid_format (format (i18n("RPropTrainer.etaPlus must be at least 1.0, got %g"), mEtaPlus));
+	if (mEtaMinus < 0.0 || mEtaMinus > 1.0)
+		throw invalid_format (format (i18n("RPropTrainer.etaMinus must be between 0.0 and 1.0, got %g"), mEtaMinus));
 }
 
 /*virtual*/ Array<DynParameter>* RPropTrainer::parameters () const
@@ -52,6 +74,10 @@
 	Array<DynParameter>* result = new Array<DynParameter>;
 	result->add (new DoubleParameter	("delta0", i18n("Initial learning rate"), 15, 0.0, 100.0, 0.1));
 	result->add (new DoubleParameter	("deltamax", i18n("Maximum learning rate"), 15, 0.0, 100.0, 50.0));
+	result->add (new DoubleParameter	("deltamin", i18n("Minimum learning rate"), 15, 0.0, 1.0, 1E-6));
+	result->add (new DoubleParameter	("etaPlus", i18n("Learning rate increase"), 15, 1.0, 10.0, 1.2));
+	result->add (new DoubleParameter	("etaMinus", i18n("Learning rate decrease"), 15, 0.0, 1.0, 0.5));
+	result->add (new BoolParameter		("backtracking", i18n("Revert weights if error increases (iRprop+)")));
 	result->add (new DoubleParameter	("decay", i18n("Weight decay multiplier"), 15, 0.5, 1.0, 1.0));
 	result->add (new IntParameter		("maxCycles", i18n("Max training cycles"), 1, 100000, 100));
 	result->add (new BoolParameter		("batchLearning", i18n("Update weights in batch")));
@@ -73,6 +99,8 @@
 	mGradient.make (mWeightDeltas.size());
 	for (int i=0; i<mGradient.size(); i++)
 		mGradient[i] = 0.0;
+
+	mPreviousError = -1.0; // No previous cycle
 }
 
 inline double sign (double x) {return (x>=0)? 1:-1;}
@@ -107,9 +135,19 @@ inline double min (double x, double y) {return (x>y)? y:x;}
 
 Connection nullconn;
 
-/** Updates weights after backpropagation phase. */
+/*******************************************************************************
+ * Updates weights after backpropagation phase.
+ *
+ * A change of the gradient sign is detected from the sign of the
+ * previous weight change, which is zeroed after a sign change, so
+ * that the next cycle starts again as on the first cycle.
+ ******************************************************************************/
 /*virtual*/ void RPropTrainer::updateWeights (ANNetwork& network) const
 {
+	// iRprop+ reverts the changes only if the error got worse
+	bool revert = mBacktracking && mPreviousError >= 0.0 && mCycleError > mPreviousError;
+	mPreviousError = mCycleError;
+
 	for (int j=network.size()-1, ji=0; j>=0; j--) {
 		// Update weights for the neuron j
 		for (int i=-1; i<network[j].incomings(); i++, ji++) {
@@ -121,33 +159,64 @@ Connection nullconn;
 
 			// Calculate dw * dEdw
 			double direction = gradient_ji * mWeightDeltas[ji];
+			double change;
 
 			if (direction < 0.0) {			// Same direction as before: dw * dEdw < 0
-				delta *= 1.2;
+				delta *= mEtaPlus;
 				if (delta > mDeltaMax)
 					delta = mDeltaMax;
 				if (gradient_ji < 0.0)
 					mWeightDeltas[ji] =  delta;
 				else
 					mWeightDeltas[ji] = -delta;
+				change = mWeightDeltas[ji];
 			} else if (direction > 0.0) {	// Direction changed
+				delta *= mEtaMinus;
+				if (delta < mDeltaMin)
+					delta = mDeltaMin;
+				change = revert? -mWeightDeltas[ji] : 0.0;
 				mWeightDeltas[ji] = 0.0;
-				delta *= 0.5;
-				if (delta < 1E-6)
-					delta = 1E-6;
 			} else {						// RProp learning process has just started
 				if (gradient_ji<0.0)
 					mWeightDeltas[ji] = delta;
 				else
 					mWeightDeltas[ji] = -delta;
+				change = mWeightDeltas[ji];
 			}
 			
 			// Update weight or bias
 			if (i==-1)
-				network[j].setBias (network[j].bias() + mWeightDeltas[ji]);
+				network[j].setBias (network[j].bias() + change);
 			else
-				conn.setWeight (conn.weight() + mWeightDeltas[ji]);
+				conn.setWeight (conn.weight() + change);
 			mGradient[ji] = 0.0;
 		}
 	}
 }
+
+/*******************************************************************************
+ * Implementation for Trainer. Stores the per-weight update values
+ * and the gradients accumulated since the last update.
+ ******************************************************************************/
+/*virtual*/ void RPropTrainer::saveState (CheckpointData& data) const
+{
+	BackpropTrainer::saveState (data);
+	data.put (mDelta);
+	data.put (mGradient);
+	data.put (mPreviousError);
+}
+
+/*virtual*/ void RPropTrainer::loadState (CheckpointData& data)
+{
+	BackpropTrainer::loadState (data);
+	Vector delta, gradient;
+	data.get (delta);
+	data.get (gradient);
+	if (delta.size() != mDelta.size() || gradient.size() != mGradient.size())
+		throw invalid_format (i18n("Checkpoint has wrong number of update values"));
+	for (int i=0; i<delta.size(); i++) {
+		mDelta[i]    = delta[i];
+		mGradient[i] = gradient[i];
+	}
+	mPreviousError = data.get ();
+}
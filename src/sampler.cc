@@ -0,0 +1,128 @@
+/***************************************************************************
+ *   This file is part of the Inanna library.                              *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include <magic/mclass.h>
+#include "inanna/sampler.h"
+#include "inanna/trainer.h"
+#include "inanna/threadpool.h"
+
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+//  ---                                                  ----                  |            //
+//   |         --            |   ___    _    ___   ___  (      ___         --  |  ___       //
+//   |  |/|/| |  )  __  |/\ -+-  ___| |/ \  |   \ /   )  ---   ___| |/|/| |  ) | /   ) |/\  //
+//   |  | | | |--  /  \ |    |  (   | |   | |     |---      ) (   | | | | |--  | |---  |    //
+//  --- | | | |    \__/ |     \  \__| |   |  \__/  \__  ___/   \__| | | | |    |  \__  |    //
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+void ImportanceSampler::make (int patterns)
+{
+	mError.make (patterns);
+	mProbability.make (patterns);
+	mCumulative.make (patterns);
+	for (int p=0; p<patterns; p++) {
+		mError[p] = -1.0;
+		mProbability[p] = 1.0/patterns;
+	}
+	mKnown = 0;
+}
+
+/*******************************************************************************
+ * Draws the patterns by their cumulative probabilities with a binary
+ * search. The probabilities are fixed for the whole cycle, so the
+ * importance weights stay consistent with the draw.
+ ******************************************************************************/
+void ImportanceSampler::draw (int patterns, PackArray<int>& order)
+{
+	if (patterns != mError.size())
+		make (patterns);
+	order.make (patterns);
+
+	// The trainer may run in a worker thread
+	RandomLock lock;
+
+	// Shuffle all the patterns until each has an error estimate
+	if (mKnown < patterns) {
+		for (int p=0; p<patterns; p++) {
+			order[p] = p;
+			mProbability[p] = 1.0/patterns;
+		}
+		for (int p=patterns-1; p>0; p--) {
+			int other = rnd (p+1);
+			int tmp = order[p];
+			order[p] = order[other];
+			order[other] = tmp;
+		}
+		return;
+	}
+
+	double sum = 0.0;
+	for (int p=0; p<patterns; p++)
+		sum += mError[p];
+
+	double cumulative = 0.0;
+	for (int p=0; p<patterns; p++) {
+		mProbability[p] = mFloor/patterns;
+		mProbability[p] += (sum>0.0)? (1.0-mFloor)*mError[p]/sum : (1.0-mFloor)/patterns;
+		cumulative += mProbability[p];
+		mCumulative[p] = cumulative;
+	}
+
+	for (int n=0; n<patterns; n++) {
+		double x = frnd() * cumulative;
+		int low=0, high=patterns-1;
+		while (low < high) {
+			int middle = (low+high)/2;
+			if (mCumulative[middle] <= x)
+				low = middle+1;
+			else
+				high = middle;
+		}
+		order[n] = low;
+	}
+}
+
+void ImportanceSampler::update (int p, double error)
+{
+	if (mError[p] < 0.0)
+		mKnown++;
+	mError[p] = error;
+}
+
+void ImportanceSampler::saveState (CheckpointData& data) const
+{
+	data.put (mError);
+}
+
+void ImportanceSampler::loadState (CheckpointData& data)
+{
+	Vector errors;
+	data.get (errors);
+	make (errors.size());
+	for (int p=0; p<errors.size(); p++)
+		if (errors[p] >= 0.0)
+			update (p, errors[p]);
+}
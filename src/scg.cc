@@ -0,0 +1,262 @@
+/***************************************************************************
+ *   This file is part of the Inanna library.                              *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include <magic/mclass.h>
+#include "inanna/scg.h"
+#include "inanna/patternset.h"
+
+impl_dynamic (SCGTrainer, {BackpropTrainer});
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//             ----  ___   ___  -----           o                            //
+//            (     /   \ /   \   |        ___      _    ___                 //
+//             ---  |     |  __   |   |/\  ___| | |/ \  /   ) |/\            //
+//                ) |     |   |   |   |   (   | | |   | |---  |              //
+//            ___/  \___/ \___/   |   |    \__| | |   |  \__  |              //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/*virtual*/ void SCGTrainer::init (const StringMap& params)
+{
+	Trainer::init (params);
+
+	INITPARAMS(params, 
+			   mSigma	= params["SCGTrainer.sigma"].toDouble();
+			   mLambda0	= params["SCGTrainer.lambda0"].toDouble();
+		);
+
+	// Defaults for missing parameters
+	if (mSigma <= 0.0)
+		mSigma = 1E-4;
+	if (mLambda0 <= 0.0)
+		mLambda0 = 1E-6;
+	mDecay = 1.0;
+	mBatchLearning = true;
+}
+
+/*virtual*/ Array<DynParameter>* SCGTrainer::parameters () const
+{
+	Array<DynParameter>* result = new Array<DynParameter>;
+	result->add (new DoubleParameter	("sigma", i18n("Curvature estimation step"), 15, 0.0, 1.0, 1E-4));
+	result->add (new DoubleParameter	("lambda0", i18n("Initial damping"), 15, 0.0, 1.0, 1E-6));
+	result->add (new IntParameter		("maxCycles", i18n("Max training cycles"), 1, 100000, 100));
+
+	return result;
+}
+
+/** Implementation for BackpropTrainer. Initializes training. */
+/*virtual*/ void SCGTrainer::initTrain (ANNetwork& network) const
+{
+	BackpropTrainer::initTrain (network);
+
+	int weights = network.parameters ();
+	mResidual.make (weights);
+	mDirection.make (weights);
+	mTrial.make (weights);
+	mTrialGradient.make (weights);
+	mIteration = 0;
+}
+
+inline double dot (const Vector& a, const Vector& b) {
+	double sum = 0.0;
+	for (int i=0; i<a.size(); i++)
+		sum += a[i]*b[i];
+	return sum;
+}
+
+/*******************************************************************************
+ * Implementation for Trainer. Makes one iteration of the algorithm,
+ * following the numbering of the steps in Mller's paper. A rejected
+ * step leaves the weights as they were, but increases the damping for
+ * the next iteration.
+ ******************************************************************************/
+/*virtual*/ double SCGTrainer::trainOnce (ANNetwork& network, const PatternSource& set) const
+{
+	int weights = mResidual.size ();
+
+	// The network always has the current weights between the cycles
+	network.getWeights (mWeights);
+
+	// 1. Start from the steepest descent direction
+	if (mIteration == 0) {
+		mErrorValue = errorGradient (network, set, mWeights, mResidual);
+		for (int i=0; i<weights; i++)
+			mDirection[i] = mResidual[i] = -mResidual[i];
+		mLambda    = mLambda0;
+		mLambdaBar = 0.0;
+		mSuccess   = true;
+	}
+	mIteration++;
+
+	// Restart if the direction is not downhill any more
+	double mu = dot (mDirection, mResidual);
+	if (mu <= 0.0) {
+		for (int i=0; i<weights; i++)
+			mDirection[i] = mResidual[i];
+		mu = dot (mDirection, mResidual);
+		mSuccess = true;
+	}
+	double pp = dot (mDirection, mDirection);
+	if (pp == 0.0)
+		return 2.0*mErrorValue / (set.patterns*set.outputs); // At a minimum
+
+	// 2. Estimate the curvature along the direction
+	if (mSuccess) {
+		double sigma = mSigma / sqrt (pp);
+		for (int i=0; i<weights; i++)
+			mTrial[i] = mWeights[i] + sigma*mDirection[i];
+		errorGradient (network, set, mTrial, mTrialGradient);
+
+		// The gradient at the current weights is -mResidual
+		mCurvature = 0.0;
+		for (int i=0; i<weights; i++)
+			mCurvature += mDirection[i] * (mTrialGradient[i] + mResidual[i]) / sigma;
+	}
+
+	// 3. Scale the curvature
+	mCurvature += (mLambda - mLambdaBar)*pp;
+
+	// 4. Make the Hessian estimate positive definite
+	if (mCurvature <= 0.0) {
+		mLambdaBar = 2.0*(mLambda - mCurvature/pp);
+		mCurvature = -mCurvature + mLambda*pp;
+		mLambda    = mLambdaBar;
+	}
+
+	// 5. Step size
+	double alpha = mu / mCurvature;
+
+	// 6. Compare the error of the step with the quadratic model
+	for (int i=0; i<weights; i++)
+		mTrial[i] = mWeights[i] + alpha*mDirection[i];
+	double newError = errorGradient (network, set, mTrial, mTrialGradient);
+	double comparison = 2.0*mCurvature*(mErrorValue - newError)/(mu*mu);
+
+	// 7. Accept or reject the step
+	if (comparison >= 0.0) {
+		double rr = 0.0, rrOld = 0.0;
+		for (int i=0; i<weights; i++) {
+			mWeights[i] = mTrial[i];
+			rrOld += mTrialGradient[i] * mResidual[i];
+			mResidual[i] = -mTrialGradient[i];
+			rr += mResidual[i] * mResidual[i];
+		}
+		mErrorValue = newError;
+		mLambdaBar  = 0.0;
+		mSuccess    = true;
+
+		// New conjugate direction, restarting after every N iterations
+		double beta = (mIteration % weights == 0)? 0.0 : (rr + rrOld)/mu;
+		for (int i=0; i<weights; i++)
+			mDirection[i] = mResidual[i] + beta*mDirection[i];
+
+		if (comparison >= 0.75)
+			mLambda /= 4.0;
+	} else {
+		network.setWeights (mWeights);
+		mLambdaBar = mLambda;
+		mSuccess   = false;
+	}
+
+	// 8. Increase the damping if the quadratic model was poor
+	if (comparison < 0.25)
+		mLambda += mCurvature*(1.0-comparison)/pp;
+
+	return 2.0*mErrorValue / (set.patterns*set.outputs); // Return MSE
+}
+
+/*******************************************************************************
+ * BackpropTrainer::backpropagate() gives the error signals of the
+ * neurons; units without incoming connections are not transferred,
+ * so their bias has no gradient.
+ ******************************************************************************/
+double SCGTrainer::errorGradient (ANNetwork& network, const PatternSource& set,
+								  const Vector& weights, Vector& gradient) const
+{
+	network.setWeights (weights);
+	for (int i=0; i<gradient.size(); i++)
+		gradient[i] = 0.0;
+
+	double sse = 0.0;
+	for (int p=0; p<set.patterns; p++) {
+		sse += trainPattern (network, set, p) * set.outputs;
+
+		for (int j=0, ji=0; j<network.size(); j++) {
+			const Neuron& neuron_j = network[j];
+			if (neuron_j.incomings() == 0) {
+				ji++;
+				continue;
+			}
+			gradient[ji++] -= mError[j];
+			for (int i=0; i<neuron_j.incomings(); i++)
+				gradient[ji++] -= mError[j] * neuron_j.incoming(i).source().activation();
+		}
+	}
+	return sse/2.0;
+}
+
+/*******************************************************************************
+ * Implementation for Trainer. Stores the search state; the current
+ * weights are stored with the network.
+ ******************************************************************************/
+/*virtual*/ void SCGTrainer::saveState (CheckpointData& data) const
+{
+	BackpropTrainer::saveState (data);
+	data.put (mIteration);
+	if (mIteration == 0)
+		return;
+
+	data.put (mResidual);
+	data.put (mDirection);
+	data.put (mErrorValue);
+	data.put (mCurvature);
+	data.put (mLambda);
+	data.put (mLambdaBar);
+	data.put (mSuccess);
+}
+
+/*virtual*/ void SCGTrainer::loadState (CheckpointData& data)
+{
+	BackpropTrainer::loadState (data);
+	mIteration = int (data.get ());
+	if (mIteration == 0)
+		return;
+
+	Vector residual, direction;
+	data.get (residual);
+	data.get (direction);
+	if (residual.size() != mResidual.size() || direction.size() != mDirection.size())
+		throw invalid_format (i18n("Checkpoint has wrong number of search values"));
+	for (int i=0; i<residual.size(); i++) {
+		mResidual[i]  = residual[i];
+		mDirection[i] = direction[i];
+	}
+	mErrorValue = data.get ();
+	mCurvature  = data.get ();
+	mLambda     = data.get ();
+	mLambdaBar  = data.get ();
+	mSuccess    = data.get () != 0.0;
+}
@@ -26,6 +26,7 @@
 #include "inanna/annetwork.h"
 #include "inanna/patternset.h"
 #include "inanna/trainer.h"
+#include "inanna/threadpool.h"
 
 Terminator* buildTerminator (const String& modelName,
 							 const PatternSource& validationset,
@@ -74,6 +75,12 @@ Terminator::Terminator (const PatternSource& vset, int striplen)
 	mMinValidError = 666;
 	mLastValidError = 666;
 	mMinCycle = -1;
+	mSampleSize = 0;
+	mFullInterval = 10;
+	mSampledValidations = 0;
+	mEarlyAbort = false;
+	mTrainingBound = true;
+	mEvaluated = 0;
 }
 
 double Terminator::generalizationLoss (double last, double opt) const {
@@ -83,12 +90,89 @@ double Terminator::generalizationLoss (double last, double opt) const {
 		return 100*((last/opt)-1);
 }
 
+/*******************************************************************************
+ * Measures the validation error, using the subsample and the early
+ * abort if they are enabled, and lets the inheritor decide about the
+ * termination.
+ ******************************************************************************/
 bool Terminator::validate (const ANNetwork& net, Trainer& trainer, int cyclesTrained) {
-	mLastValidError = net.test (mValidationSet);
+	// The trainer compares the validation error to the training
+	// error, so the limit must not be below that either
+	double trainMSE = 0.0;
+	if (mTrainingBound) {
+		const Vector& record = trainer.trainingRecord ();
+		if (cyclesTrained>0 && cyclesTrained<=record.size())
+			trainMSE = record[cyclesTrained-1];
+	}
+	double limit = (trainMSE > abortLimit ())? trainMSE : abortLimit ();
+	double abort = mEarlyAbort? limit : -1.0;
+
+	mLastValidError = -1.0;
+	if (mSampleSize>0 && mSampleSize<mValidationSet.patterns) {
+		// Select the patterns with selection sampling, which keeps
+		// them in their original order
+		if (mSample.size() != mSampleSize) {
+			RandomLock lock;
+			mSample.make (mSampleSize);
+			for (int p=0, left=mSampleSize; left>0; p++)
+				if (rnd (mValidationSet.patterns - p) < left)
+					mSample[mSampleSize - (left--)] = p;
+		}
+
+		// Only a subsample error strictly between the minimum (or
+		// the training error) and the limit can not change the
+		// decision, and is accepted as such. Otherwise it is
+		// confirmed with all the patterns. If there is no such range,
+		// as with UP and FT, the subsample is not measured at all.
+		double lower = (trainMSE > mMinValidError)? trainMSE : mMinValidError;
+		bool full = mFullInterval>0 && !((++mSampledValidations) % mFullInterval);
+		if (!full && lower < limit) {
+			double estimate = measure (net, &mSample, abort);
+			if (estimate > lower && estimate < limit)
+				mLastValidError = estimate;
+		}
+	}
+	if (mLastValidError < 0.0)
+		mLastValidError = measure (net, NULL, abort);
+	
 	trainer.setGeneralizLoss (generalizationLoss());
 	return check (net, cyclesTrained);
 }
 
+double Terminator::measure (const ANNetwork& net, const PackArray<int>* sample, double limit) {
+	int patterns = sample? sample->size() : mValidationSet.patterns;
+	ASSERT (patterns>0);
+
+	// Sum of squared errors that guarantees the MSE to exceed the limit
+	double abortSum = (limit>=0.0)? limit * patterns * mValidationSet.outputs : -1.0;
+
+	double errorSum = 0.0;
+	for (int n=0; n<patterns; n++) {
+		int p = sample? (*sample)[n] : n;
+		Vector res = net.testPattern (mValidationSet, p);
+		for (int j=0; j<res.size(); j++)
+			errorSum += sqr (res[j] - mValidationSet.output (p, j));
+		mEvaluated++;
+
+		if (abortSum>=0.0 && errorSum>abortSum)
+			break;
+	}
+	
+	return errorSum / (patterns * mValidationSet.outputs);
+}
+
+void Terminator::saveState (CheckpointData& data) const {
+	data.put (mMinValidError);
+	data.put (mMinCycle);
+	data.put (mLastValidError);
+}
+
+void Terminator::loadState (CheckpointData& data) {
+	mMinValidError  = data.get ();
+	mMinCycle       = int (data.get ());
+	mLastValidError = data.get ();
+}
+
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -104,6 +188,7 @@ bool Terminator::validate (const ANNetwork& net, Trainer& trainer, int cyclesTra
 TerminatorT800::TerminatorT800 (const PatternSource& vset, int hits, int striplen)
 		: Terminator (vset, striplen), mMaxRaises (hits)
 {
+	mRaises = 0;
 }
 	
 bool TerminatorT800::check (const ANNetwork& net, int cyclesTrained) {
@@ -116,6 +201,16 @@ bool TerminatorT800::check (const ANNetwork& net, int cyclesTrained) {
 	return (mRaises>=mMaxRaises);
 }
 
+void TerminatorT800::saveState (CheckpointData& data) const {
+	Terminator::saveState (data);
+	data.put (mRaises);
+}
+
+void TerminatorT800::loadState (CheckpointData& data) {
+	Terminator::loadState (data);
+	mRaises = int (data.get ());
+}
+
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -137,40 +232,30 @@ SavingTerminator::~SavingTerminator () {
 }
 
 void SavingTerminator::save (const ANNetwork& network, int cyclesTrained) {
-	// On the first call, create storage for weights and biases
-	if (mBestWeights.size()==0) {
-		// Count the total number of connections in the entire network
-		int connections=0;
-		for (int i=0; i<network.size(); i++)
-			connections += network[i].incomings();
-		
-		mBestWeights.make (connections + network.size());
-	}
-
-	// Copy weights and biases to the storate
-	for (register int j=network.size()-1, ji=0; j>=0; j--)
-		for (register int i=-1; i<network[j].incomings(); i++, ji++)
-			if (i==-1) // Bias
-				mBestWeights[ji] = network[j].bias ();
-			else // Weight
-				mBestWeights[ji] = network[j].incoming(i).weight();
-	
+	// Copy weights and biases to the storage, which is created on
+	// the first call
+	mBestWeights.get (network);
 	mMinCycle = cyclesTrained;
 }
 
 bool SavingTerminator::restore (ANNetwork& network) {
 	// Restore weights and biases from the storage
 	if (mBestWeights.size()>0)
-		for (register int j=network.size()-1, ji=0; j>=0; j--)
-			for (register int i=-1; i<network[j].incomings(); i++, ji++)
-				if (i==-1) // Bias
-					network[j].setBias (mBestWeights[ji]);
-				else // Weight
-					network[j].incoming(i).setWeight (mBestWeights[ji]);
+		mBestWeights.set (network);
 
 	return true;
 }
 
+void SavingTerminator::saveState (CheckpointData& data) const {
+	Terminator::saveState (data);
+	data.put (mBestWeights.values ());
+}
+
+void SavingTerminator::loadState (CheckpointData& data) {
+	Terminator::loadState (data);
+	data.get (mBestWeights.values ());
+}
+
 
 
 //////////////////////////////////////////////////////////////////////////////
@@ -209,6 +294,10 @@ bool GLTerminator::check (
 	return generalizationLoss() >= mThreshold;
 }
 
+double GLTerminator::abortLimit () const {
+	return mMinValidError * (1.0 + mThreshold/100);
+}
+
 /*******************************************************************************
 *
 *******************************************************************************/
@@ -284,6 +373,22 @@ bool PRTerminator::check (const ANNetwork& net, int cyclesTrained)
 	return terminate;
 }
 
+void PRTerminator::saveState (CheckpointData& data) const {
+	GLTerminator::saveState (data);
+	data.put (mRaises);
+	data.put (mGLFulfilled);
+	data.put (mUPFulfilled);
+	data.put (mGLperPFulfilled);
+}
+
+void PRTerminator::loadState (CheckpointData& data) {
+	GLTerminator::loadState (data);
+	mRaises          = int (data.get ());
+	mGLFulfilled     = data.get () != 0.0;
+	mUPFulfilled     = data.get () != 0.0;
+	mGLperPFulfilled = data.get () != 0.0;
+}
+
 
 
 //////////////////////////////////////////////////////////////////////////////
@@ -312,6 +417,10 @@ bool PQTerminator::check (const ANNetwork& net, int cyclesTrained)
 	return GL>=mThreshold;
 }
 
+double PQTerminator::abortLimit () const {
+	return mMinValidError * (1.0 + mThreshold/100);
+}
+
 
 
 //////////////////////////////////////////////////////////////////////////////
@@ -345,3 +454,13 @@ bool UPTerminator::check (const ANNetwork& net, int cyclesTrained)
 	
 	return (mRaises>=mMaxRaises);
 }
+
+void UPTerminator::saveState (CheckpointData& data) const {
+	SavingTerminator::saveState (data);
+	data.put (mRaises);
+}
+
+void UPTerminator::loadState (CheckpointData& data) {
+	SavingTerminator::loadState (data);
+	mRaises = int (data.get ());
+}
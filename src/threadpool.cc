@@ -0,0 +1,157 @@
+/***************************************************************************
+ *   This file is part of the Inanna library.                              *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <unistd.h>
+#include "inanna/threadpool.h"
+
+pthread_mutex_t RandomLock::sLock = PTHREAD_MUTEX_INITIALIZER;
+
+///////////////////////////////////////////////////////////////////////////////
+//            ----- |                        | ----            |             //
+//              |   | _       ___   ___      | |   )           |             //
+//              |   |/ | |/\ /   )  ___|  ---| |---   __   __  |             //
+//              |   |  | |   |---  (   | (   | |     /  \ /  \ |             //
+//              |   |  | |    \__   \__|  ---| |     \__/ \__/ |             //
+///////////////////////////////////////////////////////////////////////////////
+
+ThreadPool::ThreadPool (int threads)
+{
+	if (threads<=0)
+		threads = processors ();
+
+	mQueued   = 0;
+	mNext     = 0;
+	mRunning  = 0;
+	mShutdown = false;
+	pthread_mutex_init (&mLock, NULL);
+	pthread_cond_init (&mWorkReady, NULL);
+	pthread_cond_init (&mWorkDone, NULL);
+
+	mThreads.make (threads);
+	for (int i=0; i<threads; i++)
+		if (pthread_create (&mThreads[i], NULL, workerMain, this)) {
+			// The destructor is not called, so the workers already
+			// started must be stopped before the pool goes away
+			stopWorkers (i);
+			pthread_cond_destroy (&mWorkDone);
+			pthread_cond_destroy (&mWorkReady);
+			pthread_mutex_destroy (&mLock);
+			throw runtime_error (format (i18n("Could not create worker thread %d"), i));
+		}
+}
+
+ThreadPool::~ThreadPool ()
+{
+	wait ();
+	stopWorkers (mThreads.size());
+
+	pthread_cond_destroy (&mWorkDone);
+	pthread_cond_destroy (&mWorkReady);
+	pthread_mutex_destroy (&mLock);
+}
+
+void ThreadPool::submit (ThreadTask* task)
+{
+	ASSERT (task);
+	pthread_mutex_lock (&mLock);
+
+	// If every queued task has been taken, the queue can be reused
+	// from the start, so that a pool that is never waited for does
+	// not grow without bound
+	if (mNext == mQueued)
+		mQueued = mNext = 0;
+
+	if (mQueued == mQueue.size())
+		mQueue.resize (mQueued>0? mQueued*2 : 16);
+	mQueue[mQueued++] = task;
+	pthread_cond_signal (&mWorkReady);
+	pthread_mutex_unlock (&mLock);
+}
+
+void ThreadPool::wait ()
+{
+	pthread_mutex_lock (&mLock);
+	while (mNext<mQueued || mRunning>0)
+		pthread_cond_wait (&mWorkDone, &mLock);
+
+	// Everything is done, so the queue can be reused from the start
+	mQueued = mNext = 0;
+	pthread_mutex_unlock (&mLock);
+}
+
+/*static*/ int ThreadPool::processors ()
+{
+	long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+	return (cpus>0)? int(cpus) : 1;
+}
+
+void ThreadPool::stopWorkers (int count)
+{
+	// Order the workers to quit and wait until they do
+	pthread_mutex_lock (&mLock);
+	mShutdown = true;
+	pthread_cond_broadcast (&mWorkReady);
+	pthread_mutex_unlock (&mLock);
+	for (int i=0; i<count; i++)
+		pthread_join (mThreads[i], NULL);
+}
+
+/*static*/ void* ThreadPool::workerMain (void* pool)
+{
+	static_cast<ThreadPool*>(pool)->work ();
+	return NULL;
+}
+
+void ThreadPool::work ()
+{
+	pthread_mutex_lock (&mLock);
+	while (true) {
+		while (mNext==mQueued && !mShutdown)
+			pthread_cond_wait (&mWorkReady, &mLock);
+		if (mNext==mQueued)
+			break; // Shut down and nothing left to do
+
+		ThreadTask* task = mQueue[mNext++];
+		mRunning++;
+		pthread_mutex_unlock (&mLock);
+
+		// Exceptions must not escape from the thread, so store the
+		// message in the task for the submitter to inspect.
+		task->mError = "";
+		try {
+			task->run ();
+		} catch (Exception& e) {
+			task->mError = e.what ();
+			if (task->mError.isEmpty())
+				task->mError = i18n("Unknown error");
+		} catch (...) {
+			task->mError = i18n("Unknown error");
+		}
+
+		pthread_mutex_lock (&mLock);
+		mRunning--;
+		pthread_cond_broadcast (&mWorkDone);
+	}
+	pthread_mutex_unlock (&mLock);
+}
@@ -22,9 +22,123 @@
  *                                                                         *
  ***************************************************************************/
 
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <magic/mclass.h>
 #include "inanna/trainer.h"
 #include "inanna/termination.h"
 #include "inanna/patternset.h"
+#include "inanna/threadpool.h"
+#include "inanna/publisher.h"
+
+impl_abstract (Trainer, {Object});
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//   ___  |                |              o            ___                   //
+//  /   \ | _   ___   ___  |     --           _    |  |  \   ___   |   ___   //
+//  |     |/ | /   ) |   \ | /  |  )  __  | |/ \  -+- |   |  ___| -+-  ___|  //
+//  |     |  | |---  |     |/   |--  /  \ | |   |  |  |   | (   |  |  (   |  //
+//  \___/ |  |  \__   \__/ | \  |    \__/ | |   |   \ |__/   \__|   \  \__|  //
+///////////////////////////////////////////////////////////////////////////////
+
+/** Header of a checkpoint file. */
+struct CheckpointHeader {
+	char	magic[8];	/**< CHECKPOINT_MAGIC */
+	int		byteOrder;	/**< CHECKPOINT_BYTEORDER */
+	int		values;		/**< Number of doubles after the header. */
+};
+
+#define CHECKPOINT_MAGIC		"INNCKPT1"
+#define CHECKPOINT_BYTEORDER	0x01020304
+
+void CheckpointData::put (double value)
+{
+	if (mSize == mValues.size())
+		mValues.resize ((mSize>0)? 2*mSize : 1024);
+	mValues[mSize++] = value;
+}
+
+void CheckpointData::put (const Vector& values)
+{
+	put (values.size());
+	for (int i=0; i<values.size(); i++)
+		put (values[i]);
+}
+
+double CheckpointData::get ()
+{
+	if (mReadPos >= mSize)
+		throw invalid_format (i18n("Checkpoint data ended unexpectedly"));
+	return mValues[mReadPos++];
+}
+
+void CheckpointData::get (Vector& values)
+{
+	int size = int (get ());
+	if (size < 0 || size > mSize-mReadPos)
+		throw invalid_format (i18n("Invalid vector size in checkpoint data"));
+	values.make (size);
+	for (int i=0; i<size; i++)
+		values[i] = mValues[mReadPos++];
+}
+
+void CheckpointData::writeFile (const String& filename) const
+{
+	CheckpointHeader header;
+	memset (&header, 0, sizeof (header));
+	memcpy (header.magic, CHECKPOINT_MAGIC, sizeof (header.magic));
+	header.byteOrder = CHECKPOINT_BYTEORDER;
+	header.values    = mSize;
+
+	String tmpname = filename + format (".%d.tmp", int (getpid ()));
+	FILE* out = fopen (tmpname, "wb");
+	bool ok = out &&
+		fwrite (&header, sizeof (header), 1, out) == 1 &&
+		(mSize == 0 || fwrite (&mValues[0], sizeof (double), mSize, out) == size_t (mSize)) &&
+		!fflush (out) && !fsync (fileno (out));
+	if (out && fclose (out))
+		ok = false;
+	if (!ok || rename (tmpname, filename)) {
+		unlink (tmpname);
+		throw open_failure (format (i18n("Checkpoint file '%s' couldn't be written"), (CONSTR) filename));
+	}
+}
+
+void CheckpointData::readFile (const String& filename)
+{
+	FILE* in = fopen (filename, "rb");
+	if (!in)
+		throw open_failure (format (i18n("Checkpoint file '%s' couldn't be opened"), (CONSTR) filename));
+
+	CheckpointHeader header;
+	bool ok = fread (&header, sizeof (header), 1, in) == 1 &&
+		!memcmp (header.magic, CHECKPOINT_MAGIC, sizeof (header.magic)) &&
+		header.byteOrder == CHECKPOINT_BYTEORDER && header.values >= 0;
+	if (ok) {
+		mValues.resize (header.values);
+		ok = header.values == 0 ||
+			fread (&mValues[0], sizeof (double), header.values, in) == size_t (header.values);
+	}
+	fclose (in);
+	if (!ok)
+		throw invalid_format (format (i18n("File '%s' is not a valid checkpoint file"), (CONSTR) filename));
+
+	mSize    = header.values;
+	mReadPos = 0;
+}
+
+/** Writes a checkpoint in a background thread. */
+class CheckpointWriteTask : public ThreadTask {
+  public:
+	String			mFilename;
+	CheckpointData	mData;
+
+	virtual void	run		() {mData.writeFile (mFilename);}
+};
 
 ///////////////////////////////////////////////////////////////////////////////
 //                     -----           o                                     //
@@ -40,6 +154,20 @@ Trainer::Trainer () {
 	mTrained            = 0;
 	mTotalTrained       = 0;
 	pTrainingObserver   = NULL;
+	mValidations        = 0;
+	mpTerminator        = NULL;
+	mpResumeState       = NULL;
+	mpPublisher         = NULL;
+	mPublishInterval    = 1;
+	mWarmStart          = false;
+	mValidationSample   = 0;
+	mFullValidationInterval = 10;
+	mValidationAbort    = false;
+	mStopReason         = BUDGET_USED;
+}
+
+Trainer::~Trainer () {
+	delete mpResumeState;
 }
 
 /*virtual*/ void Trainer::init (const StringMap& params) {
@@ -49,8 +177,12 @@ Trainer::Trainer () {
 
 /*virtual*/ void Trainer::initTrain (ANNetwork& network) const
 {
-	// Initialize weights
-	network.init (0.5);
+	// Initialize weights, unless continuing from the current ones.
+	// The trainer may run in a worker thread.
+	if (!mWarmStart) {
+		RandomLock lock;
+		network.init (0.5);
+	}
 }
 
 double Trainer::train (ANNetwork&           network,
@@ -58,24 +190,77 @@ double Trainer::train (ANNetwork&           network,
 					   int                  cycles,
 					   const PatternSource* validationSet,
 					   int                  validationInterval)
+{
+	return runTraining (network, trainset, cycles, validationSet, validationInterval,
+						String (), 0, false);
+}
+
+double Trainer::train (ANNetwork&           network,
+					   const PatternSource& trainset,
+					   int                  cycles,
+					   const PatternSource* validationSet,
+					   int                  validationInterval,
+					   const String&        checkpointFile,
+					   int                  checkpointInterval)
+{
+	// Resume a checkpoint loaded earlier, or one left by an earlier run
+	bool resume = mpResumeState != NULL;
+	if (!resume && !access (checkpointFile, F_OK)) {
+		loadCheckpoint (checkpointFile, network);
+		resume = true;
+	}
+
+	return runTraining (network, trainset, cycles, validationSet, validationInterval,
+						checkpointFile, checkpointInterval, resume);
+}
+
+/*******************************************************************************
+ * The training loop. If resuming, the state has already been
+ * restored by loadCheckpoint().
+ ******************************************************************************/
+double Trainer::runTraining (ANNetwork&           network,
+							 const PatternSource& trainset,
+							 int                  cycles,
+							 const PatternSource* validationSet,
+							 int                  validationInterval,
+							 const String&        checkpointFile,
+							 int                  checkpointInterval,
+							 bool                 resume)
 {
 	ASSERT (trainset.patterns>0);
 	ASSERT (cycles>0);
 
-	// Initialize training method
-	initTrain (network);
+	int previousCycles = 0;
+	if (resume) {
+		// Continue the recording; the number of cycles may have changed
+		previousCycles = (mTotalTrained<cycles)? mTotalTrained : cycles;
+		mTrainingProfile.resize (cycles);
+	} else {
+		// Initialize training method
+		initTrain (network);
 
-	// Initialize recording
-	mTrainingProfile.make (cycles);
-	for (int i=0; i<mTrainingProfile.size(); i++)
+		// Initialize recording
+		mTrainingProfile.make (cycles);
+		mTotalTrained = 0;
+		mValidations  = 0;
+		mGeneralizationLoss = 0.0;
+	}
+	for (int i=previousCycles; i<mTrainingProfile.size(); i++)
 		mTrainingProfile[i] = 0.0;
 
 	// If validation set is present, build a terminator that monitors it.
 	Terminator* arnold=NULL;
 	bool ensureValidGTTrain = true;
 	if (validationSet) {
-		mValidationProfile.make (cycles/validationInterval+1);
-		for (int i=0; i<mValidationProfile.size(); i++)
+		int previousValidations = 0;
+		if (resume && mValidations <= cycles/validationInterval+1) {
+			previousValidations = mValidations;
+			mValidationProfile.resize (cycles/validationInterval+1);
+		} else {
+			mValidationProfile.make (cycles/validationInterval+1);
+			mValidations = 0;
+		}
+		for (int i=previousValidations; i<mValidationProfile.size(); i++)
 			mValidationProfile[i]=0.0;
 
 		////////////////////////////////////////
@@ -95,16 +280,38 @@ double Trainer::train (ANNetwork&           network,
 		
 		// Order a terminator from the factory
 		arnold = buildTerminator (terminator, *validationSet, validationInterval);
+		if (arnold) {
+			arnold->setSampling (mValidationSample, mFullValidationInterval);
+			arnold->setEarlyAbort (mValidationAbort);
+			arnold->setTrainingBound (ensureValidGTTrain);
+		}
+	}
+
+	// Continue the terminator from the checkpoint, if it had one
+	if (mpResumeState) {
+		if (resume && mpResumeState->get () != 0.0 && arnold)
+			arnold->loadState (*mpResumeState);
+		delete mpResumeState;
+		mpResumeState = NULL;
+	}
+	mpTerminator = arnold;
+
+	// Checkpoints are written by a background thread
+	ThreadPool* checkpointWriter = NULL;
+	CheckpointWriteTask checkpoint;
+	if (checkpointInterval > 0) {
+		checkpointWriter = new ThreadPool (1);
+		checkpoint.mFilename = checkpointFile;
 	}
 
 	////////////////////////////////////////
 	// Train and validate
 	
-	double	trainMSE;
-	double	GL			= 0;
-	int		validations	= 0;
+	double	trainMSE	= (mTotalTrained>0)? mTrainingProfile[previousCycles-1] : 0.0;
+	double	GL			= mGeneralizationLoss;
 	bool	terminate	= false;
-	for (mTotalTrained=0; mTotalTrained<cycles;) {
+	mStopReason = BUDGET_USED;
+	for (; mTotalTrained<cycles;) {
 		// Train all patterns once
 		trainMSE = mTrainingProfile[mTotalTrained] = trainOnce (network, trainset);
 		mTotalTrained++;
@@ -119,18 +326,43 @@ double Trainer::train (ANNetwork&           network,
 			// Calculate the validation error for the current network
 			// state
 			terminate = arnold->validate (network, *this, mTotalTrained);
-			mValidationProfile[validations++] = arnold->validationError ();
+			mValidationProfile[mValidations++] = arnold->validationError ();
 
 			// Let the terminator calculate the GL value. Some
 			// terminators use this value to determine termination.
-			GL = arnold->generalizationLoss ();
+			GL = mGeneralizationLoss = arnold->generalizationLoss ();
 
 			// Do not terminate if the validation error is lower than
 			// the training error
-			if (ensureValidGTTrain && arnold->validationError() < trainMSE)
+			if (ensureValidGTTrain && arnold->validationError() < trainMSE) {
+				mStopReason = VALIDATION_BELOW_TRAINING;
+				break;
+			}
+
+			// Early stopping
+			if (terminate) {
+				mStopReason = TERMINATED;
+				break;
+			}
+		}
+
+		// Take a snapshot of the state for the checkpoint writer,
+		// after it has finished with the previous one
+		if (checkpointWriter && !(mTotalTrained%checkpointInterval)) {
+			checkpointWriter->wait ();
+			if (checkpoint.failed ()) {
+				mStopReason = CHECKPOINT_FAILED;
 				break;
+			}
+			checkpoint.mData.clear ();
+			captureState (checkpoint.mData, network);
+			checkpointWriter->submit (&checkpoint);
 		}
 
+		// Let the readers see the new weights
+		if (mpPublisher && mPublishInterval>0 && !(mTotalTrained%mPublishInterval))
+			mpPublisher->publish (network);
+
 		// Report the cycle to the training observer, if present
 		if (pTrainingObserver) {
 			pTrainingObserver->cycleTrained (*this, mTotalTrained);
@@ -138,12 +370,20 @@ double Trainer::train (ANNetwork&           network,
 			// The observer has the power to stop training. This is
 			// typically a cancel command given interactively by a
 			// user.
-			if (pTrainingObserver->wantsToStop())
+			if (pTrainingObserver->wantsToStop()) {
+				mStopReason = OBSERVER_STOPPED;
 				break;
+			}
 		}
 
 	}
 
+	// Let the last checkpoint finish
+	if (checkpointWriter) {
+		checkpointWriter->wait ();
+		delete checkpointWriter;
+	}
+
 	// Restore the state with the lowest error on validation set. Do
 	// not restore if the validation error is smaller than the training error
 	if (arnold && (!ensureValidGTTrain || arnold->minimumError() > trainMSE)) {
@@ -153,6 +393,10 @@ double Trainer::train (ANNetwork&           network,
 		// No validation, keep the latest state
 		mTrained = mTotalTrained;
 
+	// Publish the final weights
+	if (mpPublisher)
+		mpPublisher->publish (network);
+
 	//////////////////////////////////////////////////////////
 	// Record and clean up some statistics (truncate vectors)
 	
@@ -162,15 +406,102 @@ double Trainer::train (ANNetwork&           network,
 	else
 		mTrainingProfile.make (0);
 	if (arnold)
-		mValidationProfile.resize (validations);
+		mValidationProfile.resize (mValidations);
 	else
 		mValidationProfile.make (0);
 
 	
 	// You will now be terminated
+	mpTerminator = NULL;
 	delete arnold;
-	
+
+	if (checkpoint.failed ())
+		throw open_failure (checkpoint.error ());
+
 	return trainMSE; // Return final training MSE
 }
 
+/*******************************************************************************
+ * Writes the network weights and the complete training state to the
+ * checkpoint data.
+ ******************************************************************************/
+void Trainer::captureState (CheckpointData& data, const ANNetwork& network) const
+{
+	// Network weights and biases, in the same order as the trainers use
+	int connections=0;
+	for (int i=0; i<network.size(); i++)
+		connections += network[i].incomings();
+	data.put (network.size());
+	data.put (connections);
+	for (int j=network.size()-1; j>=0; j--) {
+		data.put (network[j].bias());
+		for (int i=0; i<network[j].incomings(); i++)
+			data.put (network[j].incoming(i).weight());
+	}
+
+	// Progress of the training
+	data.put (mTotalTrained);
+	data.put (mValidations);
+	data.put (mGeneralizationLoss);
+	data.put (mTrainingProfile);
+	data.put (mValidationProfile);
+
+	// Training algorithm
+	saveState (data);
+
+	// Terminator
+	data.put (mpTerminator? 1.0 : 0.0);
+	if (mpTerminator)
+		mpTerminator->saveState (data);
+}
+
+void Trainer::saveCheckpoint (const String& filename, const ANNetwork& network) const
+{
+	CheckpointData data;
+	captureState (data, network);
+	data.writeFile (filename);
+}
+
+void Trainer::loadCheckpoint (const String& filename, ANNetwork& network)
+{
+	CheckpointData* data = new CheckpointData ();
+	try {
+		data->readFile (filename);
+
+		int units = int (data->get ());
+		int connections = int (data->get ());
+		int netConnections=0;
+		for (int i=0; i<network.size(); i++)
+			netConnections += network[i].incomings();
+		if (units != network.size() || connections != netConnections)
+			throw invalid_format (format (i18n("Checkpoint '%s' is for a different network"), (CONSTR) filename));
+
+		// Let the training algorithm allocate its state
+		initTrain (network);
+
+		for (int j=network.size()-1; j>=0; j--) {
+			network[j].setBias (data->get ());
+			for (int i=0; i<network[j].incomings(); i++)
+				network[j].incoming(i).setWeight (data->get ());
+		}
 
+		mTotalTrained       = int (data->get ());
+		mValidations        = int (data->get ());
+		mGeneralizationLoss = data->get ();
+		data->get (mTrainingProfile);
+		data->get (mValidationProfile);
+		if (mTotalTrained < 0 || mTotalTrained > mTrainingProfile.size() ||
+			mValidations < 0 || mValidations > mValidationProfile.size())
+			throw invalid_format (format (i18n("Checkpoint '%s' is corrupted"), (CONSTR) filename));
+		mTrained = mTotalTrained;
+
+		loadState (*data);
+	} catch (...) {
+		delete data;
+		throw;
+	}
+
+	// The rest belongs to the terminator of the resumed training
+	delete mpResumeState;
+	mpResumeState = data;
+}
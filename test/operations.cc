@@ -13,12 +13,30 @@
 *******************************************************************************/
 
 #include <fstream.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <math.h>
 
 #include <magic/mobject.h>
 #include <magic/mapplic.h>
 #include "inanna/annetwork.h"
 #include "inanna/annfilef.h"
 #include "inanna/equalization.h"
+#include "inanna/patternset.h"
+#include "inanna/dataformat.h"
+#include "inanna/crossvalidation.h"
+#include "inanna/termination.h"
+#include "inanna/rprop.h"
+#include "inanna/levmar.h"
+#include "inanna/scg.h"
+#include "inanna/adaptive.h"
+#include "inanna/paramsearch.h"
+#include "inanna/sampler.h"
+#include "inanna/publisher.h"
+#include "inanna/netstructure.h"
+#include "inanna/prediction.h"
+#include "inanna/backtest.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -192,6 +210,1147 @@ bool networkEqualizerSaveLoad (void) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Creates a random pattern set with a simple target function
+PatternSet* createPatternSet (int patterns) {
+	PatternSet* set = new PatternSet (patterns, 4, 1);
+	for (int p=0; p<patterns; p++) {
+		double sum = 0.0;
+		for (int i=0; i<4; i++) {
+			set->set_input (p, i, frnd ());
+			sum += set->input (p, i);
+		}
+		set->set_output (p, 0, (sum>2.0)? 1.0 : 0.0);
+	}
+	return set;
+}
+
+// Runs a small parallel cross-validation
+bool crossValidation (void) {
+	ANNetwork prototype ("4-3-1");
+	prototype.connectFullFfw (false);
+
+	StringMap params;
+	params.set ("RPropTrainer.delta0", "0.1");
+	params.set ("RPropTrainer.deltamax", "50");
+	params.set ("BackpropTrainer.decay", "1.0");
+	params.set ("BackpropTrainer.batchLearning", "1");
+	params.set ("maxCycles", "20");
+	params.set ("validationInterval", "5");
+	params.set ("terminator", "-GL5");
+
+	PatternSet* set = createPatternSet (40);
+	CrossValidator cv (prototype, "RPropTrainer", params);
+	cv.setFolds (4);
+	cv.setThreads (2);
+	cv.setValidationRatio (0.25);
+	cv.setClassification ();
+	CrossValidationResults* results = cv.validate (*set);
+
+	bool ok = results->size()==4 && results->failedFolds()==0;
+	for (int f=0; f<results->size(); f++)
+		if (results->folds[f].testPatterns != 10 || !results->folds[f].classification ||
+			results->folds[f].weights.size() != prototype.parameters() ||
+			!results->folds[f].weights.sameStructure (results->folds[0].weights))
+			ok = false;
+
+	// The trained fold network can be rebuilt from its weights
+	ANNetwork rebuilt;
+	results->folds[3].weights.build (rebuilt);
+	PatternSet fold (10, 4, 1);
+	for (int p=0; p<10; p++) {
+		for (int i=0; i<4; i++)
+			fold.set_input (p, i, set->input (30+p, i));
+		fold.set_output (p, 0, set->output (30+p, 0));
+	}
+	ok = ok && fabs (rebuilt.test (fold) - results->folds[3].testMSE) < 1E-12;
+
+	delete results;
+	delete set;
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Loads a raw pattern file with caching, checks that a second load comes
+// from the cache and that a same-second change of the source invalidates it
+bool patternCache (void) {
+	PatternSet* orig = createPatternSet (20);
+	orig->save ("/tmp/testcache.raw", PatternSet::FT_RAW);
+	unlink ("/tmp/testcache.raw.cache");
+
+	DataFormatLib::setCaching ();
+	PatternSet parsed ("/tmp/testcache.raw", 4, 1);
+	struct stat st;
+	bool ok = !stat ("/tmp/testcache.raw.cache", &st);
+
+	// Change one decimal of the source without changing its size or
+	// times, so that only a load from the cache gives the old values
+	stat ("/tmp/testcache.raw", &st);
+	FILE* source = fopen ("/tmp/testcache.raw", "r+");
+	int c, prev=0;
+	while ((c = fgetc (source)) != EOF && !(prev=='.' && c>='0' && c<='9'))
+		prev = c;
+	fseek (source, -1, SEEK_CUR);
+	fputc ((c=='9')? '8' : c+1, source);
+	fclose (source);
+	struct timespec times[2] = {st.st_atim, st.st_mtim};
+	utimensat (AT_FDCWD, "/tmp/testcache.raw", times, 0);
+	PatternSet cached ("/tmp/testcache.raw", 4, 1);
+
+	// A change within the same second must invalidate the cache
+	times[1].tv_nsec = (times[1].tv_nsec + 1) % 1000000000;
+	utimensat (AT_FDCWD, "/tmp/testcache.raw", times, 0);
+	PatternSet reparsed ("/tmp/testcache.raw", 4, 1);
+	DataFormatLib::setCaching (false);
+
+	ok = ok && cached.patterns==parsed.patterns && cached.inputs==4 && cached.outputs==1;
+	bool changed = false;
+	for (int p=0; ok && p<cached.patterns; p++) {
+		for (int i=0; i<cached.inputs; i++) {
+			ok = ok && cached.input (p,i) == parsed.input (p,i);
+			changed = changed || reparsed.input (p,i) != parsed.input (p,i);
+		}
+		ok = ok && cached.output (p,0) == parsed.output (p,0);
+		changed = changed || reparsed.output (p,0) != parsed.output (p,0);
+	}
+
+	delete orig;
+	return ok && changed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Equalizes with two merged streaming histogram equalizers
+bool streamingHistogramEq (void) {
+	HistogramEq a (0, 0.0, 1.0, 100);
+	HistogramEq b (0, 0.0, 1.0, 100);
+	Vector data (1000);
+	for (int i=0; i<1000; i++)
+		data[i] = i;
+	a.analyze (data);
+	for (int i=0; i<1000; i++)
+		data[i] = 1000+i;
+	b.analyze (data);
+	a.merge (b);
+
+	Vector vec (3);
+	vec[0] = 0.0;
+	vec[1] = 1000.0;
+	vec[2] = 1999.0;
+	a.equalize (vec);
+	bool ok = vec[0]==0.0 && fabs (vec[1]-0.5) < 0.01 && vec[2]==1.0;
+	a.unequalize (vec);
+	return ok && fabs (vec[1]-1000.0) < 1.0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Checks that histogram unequalization reverses the equalization
+bool histogramInverse (void) {
+	HistogramEq eq (1000);
+	Vector data (5000);
+	for (int i=0; i<data.size(); i++)
+		data[i] = sqr (frnd ()) * 100.0;
+	eq.analyze (data);
+
+	Vector vec (3);
+	vec[0] = 10.0;
+	vec[1] = 50.0;
+	vec[2] = 90.0;
+	eq.equalize (vec);
+	eq.unequalize (vec);
+	return fabs (vec[0]-10.0) < 0.5 && fabs (vec[1]-50.0) < 0.5 && fabs (vec[2]-90.0) < 0.5;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Equalizes and unequalizes the columns of a matrix in parallel
+bool parallelMatrixEqualizer (void) {
+	Matrix orig (200, 30);
+	for (int i=0; i<orig.rows; i++)
+		for (int j=0; j<orig.cols; j++)
+			orig.get (i,j) = frnd () * (j+1);
+
+	Matrix mat = orig;
+	MatrixEqualizer eq (new GaussianEq ());
+	eq.setThreads (4);
+	eq.analyze (mat);
+	eq.equalize (mat);
+	eq.unequalize (mat);
+
+	bool ok = eq.planes() == orig.cols;
+	for (int i=0; i<orig.rows; i++)
+		for (int j=0; j<orig.cols; j++)
+			ok = ok && fabs (mat.get (i,j) - orig.get (i,j)) < 1E-9;
+
+	// A global streaming histogram equalizer is shared by all the
+	// columns and finalizes its analysis on the first equalization
+	MatrixEqualizer global (new HistogramEq (1000, 0.0, 1.0, 100));
+	global.analyze (orig, true);
+	Matrix serial = orig;
+	global.equalize (serial);
+
+	MatrixEqualizer shared (new HistogramEq (1000, 0.0, 1.0, 100));
+	shared.setThreads (4);
+	shared.analyze (orig, true);
+	Matrix parallel = orig;
+	shared.equalize (parallel);
+
+	ok = ok && shared.planes() == 1;
+	for (int i=0; i<orig.rows; i++)
+		for (int j=0; j<orig.cols; j++)
+			ok = ok && fabs (parallel.get (i,j) - serial.get (i,j)) < 1E-12;
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Compares lazily equalized patterns with an eagerly equalized matrix
+bool equalizedPatternSource (void) {
+	Matrix data (150, 5);
+	for (int i=0; i<data.rows; i++)
+		for (int j=0; j<data.cols; j++)
+			data.get (i,j) = frnd () * (j+1);
+
+	MatrixEqualizer eq (new MinmaxEq ());
+	eq.analyze (data);
+	PatternSet raw (data, 4, 1);
+
+	Matrix equalized = data;
+	eq.equalize (equalized);
+
+	// Small blocks and cache to exercise the block replacement
+	EqualizedPatternSource lazy (raw, eq, 16, 2);
+	bool ok = lazy.patterns==150 && lazy.inputs==4 && lazy.outputs==1;
+	for (int p=lazy.patterns-1; ok && p>=0; p--) {
+		for (int i=0; i<lazy.inputs; i++)
+			ok = ok && fabs (lazy.input (p,i) - equalized.get (p,i)) < 1E-9;
+		ok = ok && fabs (lazy.output (p,0) - equalized.get (p,4)) < 1E-9;
+	}
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Saves a network in binary format and evaluates it both loaded and mapped
+bool binarySaveLoad (void) {
+	ANNetwork* net = createNetwork ();
+	net->setEqualizer (createEqualizer ());
+	ANNFileFormatLib::save ("/tmp/testsave.bnet", *net, "binary");
+
+	ANNetwork loadnet;
+	ANNFileFormatLib::load ("/tmp/testsave.bnet", loadnet);
+	MappedANNetwork mapped ("/tmp/testsave.bnet");
+
+	PatternSet set (1, 10, 5);
+	for (int i=0; i<10; i++)
+		set.set_input (0, i, frnd ());
+
+	Vector orig = net->testPattern (set, 0);
+	Vector loaded = loadnet.testPattern (set, 0);
+	Vector input (10);
+	for (int i=0; i<10; i++)
+		input[i] = set.input (0, i);
+	Vector evaluated = mapped.evaluate (input);
+
+	bool ok = loadnet.size() == net->size() && mapped.outputs() == 5 &&
+		dynamic_cast<MatrixEqualizer*>(loadnet.getEqualizer())->planes() == 10;
+	for (int j=0; ok && j<5; j++)
+		ok = fabs (loaded[j] - orig[j]) < 1E-12 && fabs (evaluated[j] - orig[j]) < 1E-12;
+
+	delete net;
+	return ok;
+}
+
+// Corrupts the section offsets of a binary network file, which must
+// then be rejected instead of mapped
+bool binaryCorruptHeader (void) {
+	ANNetwork* net = createNetwork ();
+	ANNFileFormatLib::save ("/tmp/testsave.bnet", *net, "binary");
+	delete net;
+
+	FILE* in = fopen ("/tmp/testsave.bnet", "rb");
+	if (!in)
+		return false;
+	fseek (in, 0, SEEK_END);
+	long size = ftell (in);
+	fseek (in, 0, SEEK_SET);
+	char* data = new char [size];
+	bool ok = fread (data, 1, size, in) == size_t (size);
+	fclose (in);
+
+	// The offsets follow the magic and six counts in the header
+	const int offsets[] = {8 + 6*sizeof(int), 8 + 8*sizeof(int), 8 + 10*sizeof(int)};
+	const int corrupt[] = {-64, 0, 4};
+	for (int o=0; ok && o<3; o++)
+		for (int c=0; ok && c<3; c++) {
+			int orig;
+			memcpy (&orig, data + offsets[o], sizeof (int));
+			memcpy (data + offsets[o], &corrupt[c], sizeof (int));
+			FILE* out = fopen ("/tmp/testcorrupt.bnet", "wb");
+			ok = out && fwrite (data, 1, size, out) == size_t (size);
+			if (out)
+				fclose (out);
+			memcpy (data + offsets[o], &orig, sizeof (int));
+
+			bool rejected = false;
+			try {
+				MappedANNetwork mapped ("/tmp/testcorrupt.bnet");
+			} catch (invalid_format& e) {
+				rejected = true;
+			}
+			ok = ok && rejected;
+		}
+
+	delete [] data;
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Stops a training after the given number of cycles, like a preempted process
+class StoppingObserver : public TrainingObserver {
+  public:
+					StoppingObserver	(int cycles) : mCycles (cycles) {}
+	virtual	void	cycleTrained		(const Trainer& trainer, int totalCycles) {
+		if (totalCycles >= mCycles)
+			stopTraining ();
+	}
+  private:
+	int	mCycles;
+};
+
+// Trains a network with checkpoints, optionally stopping it at the given cycle
+double trainCheckpointed (ANNetwork& net, const PatternSet& set, const PatternSet& vset,
+						  const char* checkpoint, int stopAt) {
+	StringMap params;
+	params.set ("RPropTrainer.delta0", "0.1");
+	params.set ("RPropTrainer.deltamax", "50");
+	params.set ("BackpropTrainer.decay", "1.0");
+	params.set ("BackpropTrainer.batchLearning", "1");
+
+	net.make ("4-3-1");
+	net.connectFullFfw (false);
+
+	RPropTrainer trainer;
+	trainer.init (params);
+	trainer.setTerminator ("-GL1000");
+	StoppingObserver stop (stopAt);
+	if (stopAt > 0)
+		trainer.setObserver (&stop);
+	return trainer.train (net, set, 40, &vset, 5, checkpoint, 10);
+}
+
+// Interrupts a checkpointed training and checks that resuming it
+// gives the same result as continuing without interruption
+bool trainingCheckpoint (void) {
+	PatternSet* set = createPatternSet (40);
+	PatternSet* vset = createPatternSet (10);
+	unlink ("/tmp/testcheckpoint.ckp");
+	unlink ("/tmp/testcheckpoint2.ckp");
+
+	// Common starting point at cycle 10
+	ANNetwork start;
+	trainCheckpointed (start, *set, *vset, "/tmp/testcheckpoint.ckp", 10);
+	system ("cp /tmp/testcheckpoint.ckp /tmp/testcheckpoint2.ckp");
+
+	// Continue without interruption
+	ANNetwork net1;
+	double mse1 = trainCheckpointed (net1, *set, *vset, "/tmp/testcheckpoint2.ckp", 0);
+
+	// Stop after the checkpoint of cycle 20, then resume
+	ANNetwork net2, net3;
+	trainCheckpointed (net2, *set, *vset, "/tmp/testcheckpoint.ckp", 27);
+	double mse3 = trainCheckpointed (net3, *set, *vset, "/tmp/testcheckpoint.ckp", 0);
+
+	bool ok = fabs (mse1 - mse3) < 1E-12;
+	for (int j=0; ok && j<net1.size(); j++) {
+		ok = fabs (net1[j].bias() - net3[j].bias()) < 1E-12;
+		for (int i=0; ok && i<net1[j].incomings(); i++)
+			ok = fabs (net1[j].incoming(i).weight() - net3[j].incoming(i).weight()) < 1E-12;
+	}
+
+	delete set;
+	delete vset;
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Evaluates published snapshots until told to stop
+struct PublishedReaderJob {
+	NetworkPublisher*	publisher;
+	volatile bool		stop;
+	int					evaluations;
+	bool				ok;
+};
+
+void* readPublished (void* arg) {
+	PublishedReaderJob& job = *(PublishedReaderJob*) arg;
+	NetworkReader reader (*job.publisher);
+	double input[4] = {0.1, 0.2, 0.3, 0.4};
+	double output[1];
+	while (!job.stop) {
+		reader.evaluate (input, output);
+		if (!(output[0] >= 0.0 && output[0] <= 1.0))
+			job.ok = false;
+		job.evaluations++;
+	}
+	return NULL;
+}
+
+// Trains a network while other threads evaluate its published weights
+bool publishedTraining (void) {
+	PatternSet* set = createPatternSet (40);
+	ANNetwork net ("4-3-1");
+	net.connectFullFfw (false);
+	net.init (0.5);
+
+	NetworkPublisher publisher;
+	publisher.publish (net);
+
+	PublishedReaderJob jobs[4];
+	pthread_t threads[4];
+	for (int i=0; i<4; i++) {
+		jobs[i].publisher   = &publisher;
+		jobs[i].stop        = false;
+		jobs[i].evaluations = 0;
+		jobs[i].ok          = true;
+		pthread_create (&threads[i], NULL, readPublished, &jobs[i]);
+	}
+
+	StringMap params;
+	params.set ("RPropTrainer.delta0", "0.1");
+	params.set ("RPropTrainer.deltamax", "50");
+	params.set ("BackpropTrainer.decay", "1.0");
+	params.set ("BackpropTrainer.batchLearning", "1");
+	RPropTrainer trainer;
+	trainer.init (params);
+	trainer.setPublisher (&publisher, 2);
+	trainer.train (net, *set, 100);
+
+	bool ok = publisher.version() == 1 + 50 + 1;
+	for (int i=0; i<4; i++) {
+		jobs[i].stop = true;
+		pthread_join (threads[i], NULL);
+		ok = ok && jobs[i].ok;
+	}
+
+	// The last snapshot has the final weights
+	NetworkReader reader (publisher);
+	Vector input (4);
+	for (int i=0; i<4; i++)
+		input[i] = set->input (0, i);
+	Vector result = reader.evaluate (input);
+	Vector orig = net.testPattern (*set, 0);
+	ok = ok && fabs (result[0] - orig[0]) < 1E-12;
+
+	delete set;
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Stores network replicas as weights sharing one structure
+bool sharedStructure (void) {
+	ANNetwork* net = createNetwork ();
+	NetworkWeights weights (*net);
+
+	// A replica with different weights
+	NetworkWeights replica (weights);
+	for (int i=0; i<replica.size(); i++)
+		replica[i] = weights[i] + 0.5;
+
+	ANNetwork built;
+	replica.build (built);
+	NetworkWeights rebuilt (weights, built);
+
+	bool ok = replica.sameStructure (weights) && rebuilt.sameStructure (weights) &&
+		weights.size() == net->parameters() && built.size() == net->size();
+	for (int i=0; ok && i<weights.size(); i++)
+		ok = rebuilt[i] == replica[i] && weights[i] + 0.5 == replica[i];
+
+	// Back to the original weights
+	weights.set (built);
+	PatternSet set (1, 10, 5);
+	for (int i=0; i<10; i++)
+		set.set_input (0, i, frnd ());
+	Vector orig = net->testPattern (set, 0);
+	Vector result = built.testPattern (set, 0);
+	for (int j=0; ok && j<5; j++)
+		ok = fabs (result[j] - orig[j]) < 1E-12;
+
+	delete net;
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Evaluates a batch of vectors at once and one by one
+bool batchedEvaluation (void) {
+	ANNetwork* net = createNetwork ();
+	MappedANNetwork mapped (*net);
+
+	const int count = 13;
+	double input[count*10], output[count*5], single[5];
+	double* work = new double [count*mapped.units()];
+	for (int i=0; i<count*10; i++)
+		input[i] = frnd ();
+	mapped.evaluateBatch (input, output, count, work);
+
+	bool ok = true;
+	for (int p=0; ok && p<count; p++) {
+		mapped.evaluate (input+p*10, single, work);
+		for (int j=0; ok && j<5; j++)
+			ok = fabs (output[p*5+j] - single[j]) < 1E-12;
+	}
+
+	delete [] work;
+	delete net;
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Fills monthly series of the variables around 100, 200, ... with a
+// seasonal wave and some noise
+void seasonalSeries (Matrix& data) {
+	for (int r=0; r<data.rows; r++)
+		for (int c=0; c<data.cols; c++)
+			data.get (r, c) = 100.0*(c+1) + 10.0*sin (r*0.5+c) + frnd ();
+}
+
+// Parameters for the network per variable strategy
+StringMap singleNeuralParams () {
+	StringMap params;
+	params.set ("inputMonths", "1");
+	params.set ("maxCycles", "20");
+	params.set ("validationInterval", "10");
+	params.set ("terminator", "none");
+	params.set ("AbsoluteNeuralPrediction.useAllInputs", "1");
+	params.set ("AbsoluteNeuralPrediction.useAllOutputs", "0");
+	params.set ("AbsoluteNeuralPrediction.hidden", "-4-");
+	params.set ("RPropTrainer.delta0", "0.1");
+	params.set ("RPropTrainer.deltamax", "50");
+	return params;
+}
+
+// Trains and predicts with a network per variable, with one thread and
+// with several
+Ref<Matrix> singleNeuralPredict (const MatrixView& train, const MatrixView& test, int threads) {
+	srand (1);
+	SingleNeuralPrediction strategy;
+	strategy.make (singleNeuralParams ());
+	strategy.setThreads (threads);
+	strategy.train (train, 199001);
+	return strategy.predict (test, 199201);
+}
+
+bool parallelPrediction (void) {
+	Matrix data (48, 3);
+	seasonalSeries (data);
+	MatrixView train (data, 0, 35, 0, Matrix::end), test (data, 35, 47, 0, Matrix::end);
+
+	Ref<Matrix> serial = singleNeuralPredict (train, test, 1);
+	Ref<Matrix> parallel = singleNeuralPredict (train, test, 3);
+
+	bool ok = serial->rows == 12 && serial->cols == 3 &&
+		parallel->rows == serial->rows && parallel->cols == serial->cols;
+	for (int r=0; ok && r<serial->rows; r++)
+		for (int c=0; ok && c<serial->cols; c++)
+			ok = fabs (serial->get (r, c) - parallel->get (r, c)) < 1E-9 &&
+				fabs (serial->get (r, c) - 100.0*(c+1)) < 50.0;
+	return ok;
+}
+
+// Saves the networks of the variables in binary files and predicts
+// with them loaded to another strategy
+bool binaryPredictionNetworks (void) {
+	Matrix data (48, 3);
+	seasonalSeries (data);
+	MatrixView train (data, 0, 35, 0, Matrix::end), test (data, 35, 47, 0, Matrix::end);
+
+	SingleNeuralPrediction trained;
+	trained.make (singleNeuralParams ());
+	trained.train (train, 199001);
+	trained.saveNetworks ("/tmp/testpred");
+
+	SingleNeuralPrediction loaded;
+	loaded.make (singleNeuralParams ());
+	loaded.loadNetworks ("/tmp/testpred", 3);
+
+	Ref<Matrix> orig = trained.predict (test, 199201);
+	Ref<Matrix> result = loaded.predict (test, 199201);
+
+	bool ok = BinaryANNFormat::isBinary ("/tmp/testpred.2") &&
+		result->rows == orig->rows && result->cols == orig->cols;
+	for (int r=0; ok && r<orig->rows; r++)
+		for (int c=0; ok && c<orig->cols; c++)
+			ok = fabs (result->get (r, c) - orig->get (r, c)) < 1E-9;
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Compares the virtual lagged patterns with ones built explicitly
+bool laggedWindowSource (void) {
+	Matrix data (30, 3);
+	for (int r=0; r<data.rows; r++)
+		for (int c=0; c<data.cols; c++)
+			data.get (r, c) = 100.0*c + r;
+
+	bool ok = true;
+	for (int all=0; all<2; all++) {
+		int lags = 3, month0 = 10, variable = all? -1 : 2;
+		LaggedWindowPatternSource source (data, lags, month0, variable, variable);
+		int vars = all? data.cols : 1;
+		ok = ok && source.patterns == data.rows-lags &&
+			source.inputs == 12+lags*vars && source.outputs == vars;
+
+		for (int p=0; ok && p<source.patterns; p++) {
+			for (int m=0; m<12; m++) {
+				bool flag = false;
+				for (int im=0; im<lags; im++)
+					flag = flag || (month0+p+im)%12 == m;
+				ok = ok && source.input (p, m) == (flag? 1.0 : 0.0);
+			}
+			for (int prm=0; prm<lags; prm++)
+				for (int j=0; j<vars; j++)
+					ok = ok && source.input (p, 12+vars*prm+j) == data.get (p+prm, all? j : 2);
+			for (int j=0; j<vars; j++)
+				ok = ok && source.output (p, j) == data.get (p+lags, all? j : 2);
+		}
+	}
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Trains and predicts with the combined method, with the component methods
+// in one thread and in several
+bool parallelCombined (void) {
+	Matrix data (48, 3);
+	seasonalSeries (data);
+	MatrixView train (data, 0, 35, 0, Matrix::end), test (data, 35, 47, 0, Matrix::end);
+
+	StringMap params;
+	Ref<Matrix> results[2];
+	for (int t=0; t<2; t++) {
+		CombinedPrediction strategy (params);
+		strategy.setThreads (t? 4 : 1);
+		strategy.train (train, 199001);
+		results[t] = strategy.predict (test, 199212);
+	}
+
+	bool ok = results[0]->rows == 12 && results[0]->cols == 3 &&
+		results[1]->rows == 12 && results[1]->cols == 3;
+	for (int r=0; ok && r<12; r++)
+		for (int c=0; ok && c<3; c++)
+			ok = results[0]->get (r, c) == results[1]->get (r, c) &&
+				fabs (results[0]->get (r, c) - 100.0*(c+1)) < 50.0;
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Walks the forecast origin forward in one warm-started chain and in
+// independent chains
+bool walkForwardBacktest (void) {
+	Matrix data (48, 2);
+	seasonalSeries (data);
+
+	StringMap params;
+	params.set ("inputMonths", "1");
+	params.set ("maxCycles", "20");
+	params.set ("validationInterval", "10");
+	params.set ("terminator", "none");
+	params.set ("AbsoluteNeuralPrediction.useAllInputs", "1");
+	params.set ("AbsoluteNeuralPrediction.useAllOutputs", "1");
+	params.set ("AbsoluteNeuralPrediction.hidden", "-4-");
+	params.set ("AbsoluteNeuralPrediction.updateCycles", "5");
+	params.set ("RPropTrainer.delta0", "0.1");
+	params.set ("RPropTrainer.deltamax", "50");
+
+	WalkForwardBacktest backtest ("AbsoluteNeuralPrediction", params);
+	backtest.setCutoffs (24, -1, 6);
+	backtest.setThreads (1);
+	backtest.setChains (1);
+	BacktestResults* chained = backtest.run (data, 199001);
+
+	backtest.setThreads (3);
+	backtest.setChains (0);
+	BacktestResults* parallel = backtest.run (data, 199001);
+
+	bool ok = chained->size()==3 && parallel->size()==3 &&
+		chained->failedSteps()==0 && parallel->failedSteps()==0 &&
+		chained->retrainedSteps()==1 && parallel->retrainedSteps()==3 &&
+		chained->steps[1].cutoff==30 && chained->steps[1].month==199207 &&
+		chained->steps[2].cutoff==36 && !chained->steps[2].retrained &&
+		chained->meanError() < 50.0 && parallel->meanError() < 50.0;
+
+	delete chained;
+	delete parallel;
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Compares matrix views and lazy row deltas with copied submatrices
+bool matrixViews (void) {
+	Matrix data (30, 3);
+	for (int r=0; r<data.rows; r++)
+		for (int c=0; c<data.cols; c++)
+			data.get (r, c) = 100.0*c + r*r;
+
+	Matrix part = data.sub (5, Matrix::end, 1, 2);
+	MatrixView view (data, 5, Matrix::end, 1, 2);
+	MatrixView yearly = MatrixView(data).sub (2, Matrix::end, 0, Matrix::end, 12);
+	RowDeltaView deltas (data);
+
+	bool ok = view.rows == part.rows && view.cols == part.cols &&
+		yearly.rows == 3 && deltas.rows == data.rows-1;
+	for (int r=0; ok && r<view.rows; r++)
+		for (int c=0; c<view.cols; c++)
+			ok = ok && view.get (r, c) == part.get (r, c);
+	for (int r=0; ok && r<yearly.rows; r++)
+		for (int c=0; c<yearly.cols; c++)
+			ok = ok && yearly.get (r, c) == data.get (2+12*r, c);
+	for (int r=0; ok && r<deltas.rows; r++)
+		for (int c=0; c<deltas.cols; c++)
+			ok = ok && deltas.get (r, c) == data.get (r+1, c) - data.get (r, c);
+
+	// Patterns from a view must equal those from a copy
+	LaggedWindowPatternSource fromCopy (part, 2, 3), fromView (view, 2, 3);
+	ok = ok && fromView.patterns == fromCopy.patterns && fromView.inputs == fromCopy.inputs;
+	for (int p=0; ok && p<fromView.patterns; p++) {
+		for (int i=0; i<fromView.inputs; i++)
+			ok = ok && fromView.input (p, i) == fromCopy.input (p, i);
+		for (int j=0; j<fromView.outputs; j++)
+			ok = ok && fromView.output (p, j) == fromCopy.output (p, j);
+	}
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Basic parameters for the trainers
+StringMap trainerParams () {
+	StringMap params;
+	params.set ("RPropTrainer.delta0", "0.1");
+	params.set ("RPropTrainer.deltamax", "50");
+	params.set ("BackpropTrainer.decay", "1.0");
+	return params;
+}
+
+// Trains a 4-3-1 network from given initial weights, or random weights
+// if the vector is empty, and returns the final MSE
+double trainFrom (Trainer& trainer, Vector& weights, const PatternSet& set, int cycles,
+				  const StringMap& params = trainerParams ()) {
+	ANNetwork net;
+	net.make ("4-3-1");
+	net.connectFullFfw (false);
+	if (weights.size() == 0) {
+		net.init (0.5);
+		net.getWeights (weights);
+	} else
+		net.setWeights (weights);
+
+	trainer.init (params);
+	trainer.setWarmStart ();
+	return trainer.train (net, set, cycles);
+}
+
+// Checks that a training record never increases
+bool decreasing (const Vector& record) {
+	for (int i=1; i<record.size(); i++)
+		if (record[i] > record[i-1])
+			return false;
+	return true;
+}
+
+// Trains the same network with Levenberg-Marquardt and RProp for a few
+// cycles; LM must never increase the error and must get lower
+bool levenbergMarquardt (void) {
+	PatternSet* set = createPatternSet (40);
+	Vector weights;
+	RPropTrainer rprop;
+	double rpmse = trainFrom (rprop, weights, *set, 15);
+	LevenbergMarquardtTrainer lm;
+	double lmmse = trainFrom (lm, weights, *set, 15);
+
+	bool ok = lm.trainingRecord().size() == 15 && lmmse < rpmse &&
+		decreasing (lm.trainingRecord ());
+
+	delete set;
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Same as above for scaled conjugate gradient
+bool scaledConjugateGradient (void) {
+	PatternSet* set = createPatternSet (40);
+	Vector weights;
+	RPropTrainer rprop;
+	double rpmse = trainFrom (rprop, weights, *set, 30);
+	SCGTrainer scg;
+	double scgmse = trainFrom (scg, weights, *set, 30);
+
+	bool ok = scg.trainingRecord().size() == 30 && scgmse < rpmse &&
+		decreasing (scg.trainingRecord ());
+
+	delete set;
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Trains with the default and explicitly given Rprop step factors, and
+// with the iRprop+ variant
+bool rpropVariants (void) {
+	PatternSet* set = createPatternSet (40);
+	Vector weights;
+	RPropTrainer defaults;
+	double mse = trainFrom (defaults, weights, *set, 30);
+
+	StringMap params = trainerParams ();
+	params.set ("RPropTrainer.etaPlus", "1.2");
+	params.set ("RPropTrainer.etaMinus", "0.5");
+	params.set ("RPropTrainer.deltamin", "1E-6");
+	RPropTrainer explicitly;
+	double explicitMse = trainFrom (explicitly, weights, *set, 30, params);
+
+	params.set ("RPropTrainer.etaPlus", "1.5");
+	RPropTrainer faster;
+	double fasterMse = trainFrom (faster, weights, *set, 30, params);
+
+	params.set ("RPropTrainer.etaPlus", "1.2");
+	params.set ("RPropTrainer.backtracking", "1");
+	RPropTrainer backtracking;
+	double backtrackMse = trainFrom (backtracking, weights, *set, 30, params);
+
+	bool ok = explicitMse == mse && fasterMse != mse &&
+		backtrackMse < backtracking.trainingRecord()[0];
+
+	// With large steps the error soon rises. Until then, iRprop+ must
+	// train exactly as iRprop-, and after it, revert the weights.
+	params.set ("RPropTrainer.delta0", "2.0");
+	params.set ("RPropTrainer.backtracking", "0");
+	RPropTrainer plainLarge;
+	trainFrom (plainLarge, weights, *set, 30, params);
+	params.set ("RPropTrainer.backtracking", "1");
+	RPropTrainer backtrackLarge;
+	trainFrom (backtrackLarge, weights, *set, 30, params);
+
+	const Vector& plain = plainLarge.trainingRecord ();
+	const Vector& reverted = backtrackLarge.trainingRecord ();
+	int rise = 1;
+	while (rise < plain.size()-1 && plain[rise] <= plain[rise-1])
+		rise++;
+	ok = ok && rise < plain.size()-1;
+	for (int c=0; ok && c<=rise; c++)
+		ok = reverted[c] == plain[c];
+	ok = ok && reverted[rise+1] != plain[rise+1];
+
+	// The limits of the ranges are used as given, and values outside
+	// them are rejected
+	params.set ("RPropTrainer.backtracking", "0");
+	params.set ("RPropTrainer.deltamin", "0");
+	params.set ("RPropTrainer.etaPlus", "1.0");
+	RPropTrainer limits;
+	trainFrom (limits, weights, *set, 5, params);
+	ok = ok && limits.trainingRecord().size() == 5;
+	params.set ("RPropTrainer.deltamin", "-1");
+	RPropTrainer invalid;
+	try {
+		invalid.init (params);
+		ok = false;
+	} catch (invalid_format& e) {
+	}
+
+	delete set;
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Trains with the adaptive mini-batch methods, which must all reduce
+// the error clearly
+bool adaptiveOptimizers (void) {
+	PatternSet* set = createPatternSet (80);
+	StringMap params = trainerParams ();
+	params.set ("MiniBatchTrainer.batchSize", "8");
+
+	Vector weights;
+	AdamTrainer adam;
+	AdaGradTrainer adagrad;
+	RMSPropTrainer rmsprop;
+	MiniBatchTrainer* trainers[3] = {&adam, &adagrad, &rmsprop};
+	const char* etas[3] = {"0.02", "0.2", "0.02"}; // AdaGrad slows down with time
+	bool ok = true;
+	for (int t=0; t<3; t++) {
+		params.set ("MiniBatchTrainer.eta", etas[t]);
+		double mse = trainFrom (*trainers[t], weights, *set, 60, params);
+		ok = ok && trainers[t]->trainingRecord().size() == 60 &&
+			mse < 0.5*trainers[t]->trainingRecord()[0];
+	}
+
+	delete set;
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Searches Rprop step sizes and hidden layers with successive halving;
+// the ranking must be ordered and the halving must save cycles
+bool parameterSearch (void) {
+	PatternSet* train = createPatternSet (40);
+	PatternSet* valid = createPatternSet (20);
+	StringMap params = trainerParams ();
+	params.set ("maxCycles", "27");
+	params.set ("validationInterval", "1");
+
+	ParameterSearch search ("RPropTrainer", params);
+	search.addRange ("RPropTrainer.delta0", 0.01, 1.0, true);
+	search.addChoices ("hidden", "-2- -4-");
+	search.setCandidates (9);
+	search.setThreads (3);
+	SearchResults* results = search.search (*train, *valid);
+
+	// The best candidate was trained through the last round or stopped
+	int lastRound = 0;
+	for (int c=0; c<results->size(); c++)
+		if (results->candidates[c].rounds > lastRound)
+			lastRound = results->candidates[c].rounds;
+	bool ok = results->size() == 9 && results->failedCandidates() == 0 &&
+		results->totalCycles() < 9*27 &&
+		(results->best().rounds == lastRound || results->best().stopped);
+	for (int r=1; r<results->size(); r++)
+		if (results->ranked(r).validationMSE < results->ranked(r-1).validationMSE)
+			ok = false;
+
+	// The candidates with the same hidden layer share the structure
+	for (int c=1; c<results->size(); c++) {
+		const SearchCandidate& candidate = results->candidates[c];
+		for (int o=0; o<c; o++)
+			if (results->candidates[o].weights.sameStructure (candidate.weights) !=
+				(results->candidates[o].params["hidden"] == candidate.params["hidden"]))
+				ok = false;
+	}
+
+	// Validated with the training set, the validation error soon falls
+	// below the training error. That ends a training early, but does
+	// not stop the candidate, so the best ones reach the next round.
+	SearchResults* same = search.search (*train, *train);
+	bool promoted = false;
+	for (int c=0; c<same->size(); c++) {
+		promoted = promoted || same->candidates[c].rounds > 0;
+		ok = ok && !same->candidates[c].stopped;
+	}
+	ok = ok && promoted;
+
+	delete same;
+	delete results;
+	delete valid;
+	delete train;
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Trains the same network with full, early-aborted and subsampled
+// validation. The training is the same, and an aborted or subsampled
+// validation can only report an error above the true minimum.
+bool validationShortcuts (void) {
+	PatternSet* train = createPatternSet (40);
+	PatternSet* valid = createPatternSet (200);
+	ANNetwork net;
+	net.make ("4-3-1");
+	net.connectFullFfw (false);
+	net.init (0.5);
+	Vector weights;
+	net.getWeights (weights);
+
+	RPropTrainer trainers[3];
+	double mse[3];
+	for (int t=0; t<3; t++) {
+		net.setWeights (weights);
+		trainers[t].init (trainerParams ());
+		trainers[t].setWarmStart ();
+		// The abort limit of UP is the minimum, so its rises are cut
+		// short, while GL stops on its first rise above the limit
+		trainers[t].setTerminator ((t<2)? "-UP5" : "-GL5");
+		if (t==1)
+			trainers[t].setValidationAbort ();
+		if (t==2)
+			trainers[t].setValidationSampling (50, 5);
+		mse[t] = trainers[t].train (net, *train, 60, valid, 1);
+	}
+
+	const Vector& full = trainers[0].validationRecord ();
+	const Vector& aborted = trainers[1].validationRecord ();
+	const Vector& sampled = trainers[2].validationRecord ();
+	bool ok = full.size()==aborted.size() && sampled.size()>0 &&
+		mse[1]==mse[0] && trainers[1].cyclesTrained()==trainers[0].cyclesTrained();
+
+	bool shortcut=false, exactMin=false;
+	for (int i=0; ok && i<full.size(); i++) {
+		if (aborted[i] > full[i])
+			ok = false;
+		if (aborted[i] < full[i])
+			shortcut = true;
+	}
+
+	// Compare only the validations both trainings made
+	int common = (full.size()<sampled.size())? full.size() : sampled.size();
+	double fullMin=full[0], sampledMin=sampled[0];
+	for (int i=0; i<common; i++) {
+		fullMin = (full[i]<fullMin)? full[i] : fullMin;
+		sampledMin = (sampled[i]<sampledMin)? sampled[i] : sampledMin;
+	}
+	for (int i=0; i<common; i++)
+		if (sampled[i]==sampledMin && sampled[i]==full[i])
+			exactMin = true;
+
+	delete valid;
+	delete train;
+	return ok && shortcut && exactMin && sampledMin >= fullMin;
+}
+
+// A terminator with a fixed minimum and abort limit, which never
+// terminates
+class LimitTerminator : public Terminator {
+  public:
+					LimitTerminator	(const PatternSource& set, double minimum, double limit)
+							: Terminator (set, 1), mLimit (limit) {mMinValidError = minimum;}
+  protected:
+	virtual bool	check			(const ANNetwork& net, int cyclesTrained) {return false;}
+	virtual double	abortLimit		() const {return mLimit;}
+  private:
+	double	mLimit;
+};
+
+// Validates with patterns that all have the same error, so the
+// subsample error is known exactly. Only an estimate strictly below
+// the abort limit is accepted without measuring all the patterns,
+// and UP never uses the subsample.
+bool subsampleLimit (void) {
+	PatternSet set (40, 4, 1);
+	for (int p=0; p<40; p++) {
+		for (int i=0; i<4; i++)
+			set.set_input (p, i, 0.5);
+		set.set_output (p, 0, 1.0);
+	}
+	ANNetwork net;
+	net.make ("4-3-1");
+	net.connectFullFfw (false);
+	net.init (0.5);
+
+	// The error of any 10 patterns, summed as the terminator does
+	Vector res = net.testPattern (set, 0);
+	double sum = 0.0;
+	for (int n=0; n<10; n++)
+		sum += sqr (res[0] - 1.0);
+	double estimate = sum / 10;
+
+	RPropTrainer trainer;
+	LimitTerminator atLimit (set, estimate/2, estimate);
+	atLimit.setSampling (10, 0);
+	atLimit.validate (net, trainer, 0);
+	LimitTerminator belowLimit (set, estimate/2, estimate*2);
+	belowLimit.setSampling (10, 0);
+	belowLimit.validate (net, trainer, 0);
+	Terminator* up = buildTerminator ("UP5", set, 1);
+	up->setSampling (10, 0);
+	up->validate (net, trainer, 0);
+	up->validate (net, trainer, 0);
+
+	bool ok = atLimit.evaluatedPatterns () == 10+40 &&
+		belowLimit.evaluatedPatterns () == 10 &&
+		belowLimit.validationError () == estimate &&
+		up->evaluatedPatterns () == 2*40;
+
+	delete up;
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Draws patterns with a few high-error ones, which must be drawn most
+// often but with weights that keep the sums unbiased. Then trains
+// with importance sampling, which must reduce the error clearly.
+bool importanceSampling (void) {
+	ImportanceSampler sampler;
+	PackArray<int> order;
+	sampler.draw (100, order);
+	PackArray<int> seen (100);
+	for (int p=0; p<100; p++)
+		seen[p] = 0;
+	for (int n=0; n<100; n++)
+		seen[order[n]]++;
+	bool ok = true;
+	for (int p=0; p<100; p++) {
+		ok = ok && seen[p] == 1;
+		sampler.update (p, (p<10)? 1.0 : 0.01);
+	}
+
+	int hard=0, draws=0;
+	double weights=0.0;
+	for (int cycle=0; cycle<20; cycle++) {
+		sampler.draw (100, order);
+		for (int n=0; n<100; n++, draws++) {
+			hard += order[n] < 10;
+			weights += sampler.weight (order[n]);
+		}
+	}
+	ok = ok && hard > draws/2 && fabs (weights/draws - 1.0) < 0.2;
+
+	PatternSet* set = createPatternSet (80);
+	StringMap params = trainerParams ();
+	params.set ("MiniBatchTrainer.batchSize", "8");
+	params.set ("MiniBatchTrainer.eta", "0.02");
+	params.set ("BackpropTrainer.importanceSampling", "1");
+	params.set ("BackpropTrainer.samplingFloor", "0.2");
+	ANNetwork net;
+	net.make ("4-3-1");
+	net.connectFullFfw (false);
+	net.init (0.5);
+	double initial = net.test (*set);
+	AdamTrainer adam;
+	adam.init (params);
+	adam.setWarmStart ();
+	adam.train (net, *set, 60);
+	ok = ok && adam.trainingRecord().size() == 60 && net.test (*set) < 0.5*initial;
+
+	// The plain backpropagation learns the drawn patterns online
+	params.set ("BackpropTrainer.eta", "0.5");
+	params.set ("BackpropTrainer.onlineLearning", "1");
+	net.init (0.5);
+	initial = net.test (*set);
+	BackpropTrainer backprop;
+	backprop.init (params);
+	backprop.setWarmStart ();
+	backprop.train (net, *set, 60);
+	ok = ok && backprop.trainingRecord().size() == 60 && net.test (*set) < 0.5*initial;
+
+	// Sampling purely by error is allowed, a share above 1 is not
+	params.set ("BackpropTrainer.samplingFloor", "0");
+	BackpropTrainer pure;
+	pure.init (params);
+	params.set ("BackpropTrainer.samplingFloor", "1.5");
+	BackpropTrainer invalid;
+	try {
+		invalid.init (params);
+		ok = false;
+	} catch (invalid_format& e) {
+	}
+
+	delete set;
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 int printout=true;
 
 void testf (CONSTR funcname, bool (* func) ()) {
@@ -218,6 +1377,32 @@ Main () {
 		test (testSaveLoad);
 		test (equalizerSaveLoad);
 		test (networkEqualizerSaveLoad);
+		test (crossValidation);
+		test (patternCache);
+		test (streamingHistogramEq);
+		test (histogramInverse);
+		test (parallelMatrixEqualizer);
+		test (equalizedPatternSource);
+		test (binarySaveLoad);
+		test (binaryCorruptHeader);
+		test (trainingCheckpoint);
+		test (publishedTraining);
+		test (sharedStructure);
+		test (batchedEvaluation);
+		test (parallelPrediction);
+		test (binaryPredictionNetworks);
+		test (walkForwardBacktest);
+		test (laggedWindowSource);
+		test (parallelCombined);
+		test (matrixViews);
+		test (levenbergMarquardt);
+		test (scaledConjugateGradient);
+		test (rpropVariants);
+		test (adaptiveOptimizers);
+		test (parameterSearch);
+		test (validationShortcuts);
+		test (subsampleLimit);
+		test (importanceSampling);
 		printout=false;
 	}
 